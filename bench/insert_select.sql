@@ -0,0 +1,3 @@
+-- Rewrites the same keys each time; CQL INSERT is an upsert
+INSERT INTO bench_sink
+    SELECT g, md5(g::text) FROM generate_series(1, :insert_rows) g;
@@ -0,0 +1,5 @@
+-- Nested loop with a parameterized foreign scan on the inner side; run.sh
+-- disables hash and merge joins
+\set b random(0, 999)
+SELECT count(r.v) FROM bench_keys l JOIN bench_kv r ON r.k = l.k
+WHERE l.batch = :b;
@@ -0,0 +1,2 @@
+\set k random(1, :rows)
+SELECT v FROM bench_kv WHERE k = :k;
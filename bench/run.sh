@@ -0,0 +1,134 @@
+#!/bin/sh
+#
+# bench/run.sh
+#        Performance suite for scylla_fdw, run by "make bench"
+#
+# Loads bench/schema.cql into ScyllaDB and bench/setup.sql into a
+# PostgreSQL database of its own, $BENCH_DB, which it (re)creates; then
+# runs the pgbench scripts in this directory and the driver-level
+# microbenchmark.  Every result is
+# one JSON object per line, written to stdout and appended to $BENCH_OUT,
+# so runs can be compared by a script.
+#
+# Settings, from the environment:
+#     SCYLLA_HOST     ScyllaDB contact point (127.0.0.1)
+#     BENCH_ROWS      rows loaded into each table (100000)
+#     BENCH_TIME      seconds per pgbench run (30)
+#     BENCH_CLIENTS   pgbench clients (4)
+#     BENCH_BATCH_SIZES   batch_size values for INSERT ... SELECT ("1 10 100")
+#     BENCH_INSERT_ROWS   rows per INSERT ... SELECT (10000)
+#     BENCH_OUT       results file (bench/results.jsonl)
+#     BENCH_DB        database created for the run (scylla_fdw_bench); it
+#                     is dropped first, so don't point it at one you need
+#     BENCH_ADMIN_DB  database to connect to when creating it (postgres)
+#     BENCH_SKIP_LOAD set to skip loading the schemas and data, reusing
+#                     $BENCH_DB as left by an earlier run
+#     CQLSH, PSQL, PGBENCH    programs to use
+#
+# The usual PG* variables, other than PGDATABASE, select the server.
+#
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+
+SCYLLA_HOST=${SCYLLA_HOST:-127.0.0.1}
+BENCH_ROWS=${BENCH_ROWS:-100000}
+BENCH_TIME=${BENCH_TIME:-30}
+BENCH_CLIENTS=${BENCH_CLIENTS:-4}
+BENCH_BATCH_SIZES=${BENCH_BATCH_SIZES:-"1 10 100"}
+BENCH_INSERT_ROWS=${BENCH_INSERT_ROWS:-10000}
+BENCH_OUT=${BENCH_OUT:-$BENCH_DIR/results.jsonl}
+BENCH_DB=${BENCH_DB:-scylla_fdw_bench}
+BENCH_ADMIN_DB=${BENCH_ADMIN_DB:-postgres}
+CQLSH=${CQLSH:-cqlsh}
+PSQL=${PSQL:-psql}
+PGBENCH=${PGBENCH:-pgbench}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+RUN_ID=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+# emit JSON: print a result line and append it to $BENCH_OUT
+emit()
+{
+    echo "$1"
+    echo "$1" >> "$BENCH_OUT"
+}
+
+# run_pgbench NAME SCRIPT ROWS_PER_XACT [pgbench options...]
+#     Runs one pgbench script and reports throughput and latency
+#     percentiles, computed from pgbench's per-transaction log
+run_pgbench()
+{
+    name=$1
+    script=$2
+    rows_per_xact=$3
+    shift 3
+
+    rm -f "$TMP"/log*
+    "$PGBENCH" -n -T "$BENCH_TIME" -c "$BENCH_CLIENTS" -j "$BENCH_CLIENTS" \
+        -l --log-prefix="$TMP/log" -D rows="$BENCH_ROWS" "$@" \
+        -f "$BENCH_DIR/$script" > "$TMP/out" 2>&1 || {
+        cat "$TMP/out" >&2
+        exit 1
+    }
+
+    tps=$(sed -n 's/^tps = \([0-9.]*\).*/\1/p' "$TMP/out" | head -n 1)
+    cat "$TMP"/log* | awk '{ print $3 }' | sort -n > "$TMP/latencies"
+    count=$(wc -l < "$TMP/latencies")
+    p50=$(awk -v n="$count" 'NR == int(n * 0.50) + 1 { printf "%.3f", $1 / 1000 }' "$TMP/latencies")
+    p99=$(awk -v n="$count" 'NR == int(n * 0.99) + 1 { printf "%.3f", $1 / 1000 }' "$TMP/latencies")
+    rows_per_sec=$(awk -v t="$tps" -v r="$rows_per_xact" 'BEGIN { printf "%.1f", t * r }')
+
+    emit "{\"run\":\"$RUN_ID\",\"bench\":\"$name\",\"clients\":$BENCH_CLIENTS,\"transactions\":$count,\"tps\":${tps:-0},\"rows_per_sec\":$rows_per_sec,\"p50_ms\":${p50:-0},\"p99_ms\":${p99:-0}}"
+}
+
+if [ -z "$BENCH_SKIP_LOAD" ]; then
+    "$PSQL" -X -q -v ON_ERROR_STOP=1 -d "$BENCH_ADMIN_DB" \
+        -c "DROP DATABASE IF EXISTS \"$BENCH_DB\"" \
+        -c "CREATE DATABASE \"$BENCH_DB\""
+fi
+
+# Everything below runs in the benchmark's own database
+PGDATABASE=$BENCH_DB
+export PGDATABASE
+
+if [ -z "$BENCH_SKIP_LOAD" ]; then
+    "$CQLSH" "$SCYLLA_HOST" -f "$BENCH_DIR/schema.cql"
+    "$PSQL" -X -q -v ON_ERROR_STOP=1 -v scylla_host="$SCYLLA_HOST" \
+        -v rows="$BENCH_ROWS" -f "$BENCH_DIR/setup.sql"
+fi
+
+# Full scans, by column type mix
+run_pgbench scan_mixed scan.sql "$BENCH_ROWS" -D cols='*'
+for col in c_int c_bigint c_double c_boolean c_text c_uuid c_timestamp \
+           c_decimal c_blob; do
+    run_pgbench "scan_$col" scan.sql "$BENCH_ROWS" -D cols="$col"
+done
+
+# Point lookups
+run_pgbench lookup lookup.sql 1
+
+# Nested loop joins driving parameterized foreign scans
+PGOPTIONS="$PGOPTIONS -c enable_hashjoin=off -c enable_mergejoin=off" \
+    run_pgbench join_nestloop join.sql 100
+
+# INSERT ... SELECT, by batch size
+for size in $BENCH_BATCH_SIZES; do
+    "$PSQL" -X -q -v ON_ERROR_STOP=1 \
+        -c "ALTER FOREIGN TABLE bench_sink OPTIONS (ADD batch_size '$size')" 2>/dev/null ||
+    "$PSQL" -X -q -v ON_ERROR_STOP=1 \
+        -c "ALTER FOREIGN TABLE bench_sink OPTIONS (SET batch_size '$size')"
+    run_pgbench "insert_select_batch_$size" insert_select.sql \
+        "$BENCH_INSERT_ROWS" -D insert_rows="$BENCH_INSERT_ROWS"
+done
+
+# Driver-level decode and lookup cost, without PostgreSQL
+if [ -x "$BENCH_DIR/scylla_microbench" ]; then
+    "$BENCH_DIR/scylla_microbench" "$SCYLLA_HOST" "$BENCH_ROWS" "$RUN_ID" > "$TMP/micro"
+    while read -r line; do
+        emit "$line"
+    done < "$TMP/micro"
+fi
@@ -0,0 +1,3 @@
+-- Full scan; OFFSET makes every row be fetched and decoded, but returned
+-- to nobody.  :cols is "*" or a single column.
+SELECT :cols FROM bench_mixed OFFSET 1000000000;
@@ -0,0 +1,363 @@
+/*-------------------------------------------------------------------------
+ *
+ * scylla_microbench.cpp
+ *        Driver-level microbenchmark for scylla_fdw
+ *
+ * Links against scylla_connection.o only, and so measures what the FDW's
+ * driver wrapper costs without PostgreSQL around it: fetching pages of
+ * the bench tables, extracting each column type from them, and prepared
+ * point lookups.  Comparing it with the pgbench results of bench/run.sh
+ * separates driver time from the FDW's own decode and executor work.
+ *
+ * Usage: scylla_microbench host rows [run-id]
+ *
+ * Prints one JSON object per result line.
+ *
+ * Copyright (c) 2024, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *        scylla_fdw/bench/scylla_microbench.cpp
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/*
+ * The wrapper's interface, as declared in scylla_fdw.h; that header can't
+ * be used here because it needs the PostgreSQL server headers.
+ */
+extern "C" {
+void       *scylla_connect(const char *host, int port, const char *username,
+                           const char *password, int connect_timeout,
+                           bool use_ssl, const char *ssl_cert,
+                           const char *ssl_key, const char *ssl_ca,
+                           const char *local_dc, bool token_aware,
+                           bool latency_aware, int core_connections,
+                           int num_io_threads, int speculative_delay_ms,
+                           int speculative_max, int retry_policy,
+                           bool log_retries,
+                           char **error_msg);
+void        scylla_disconnect(void *conn, void *cluster);
+void       *scylla_prepare_query(void *conn, const char *query, char **error_msg);
+void       *scylla_create_query_statement(const char *query, int num_params);
+void       *scylla_create_statement(void *prepared);
+void       *scylla_execute_statement(void *conn, void *statement,
+                                     int consistency, char **error_msg);
+void        scylla_free_statement(void *statement);
+void        scylla_free_result(void *result);
+void        scylla_free_prepared(void *prepared);
+void        scylla_statement_set_paging_size(void *statement, int page_size);
+bool        scylla_statement_set_paging_state(void *statement, void *result);
+bool        scylla_result_has_more_pages(void *result);
+void       *scylla_result_iterator(void *result);
+bool        scylla_iterator_next(void *iterator);
+void        scylla_free_iterator(void *iterator);
+void       *scylla_iterator_get_row(void *iterator);
+void       *scylla_row_get_column(void *row, int col);
+bool        scylla_bind_int32(void *statement, int index, int32_t value);
+bool        scylla_value_get_bool(void *value, bool *out);
+bool        scylla_value_get_int32(void *value, int32_t *out);
+bool        scylla_value_get_int64(void *value, int64_t *out);
+bool        scylla_value_get_double(void *value, double *out);
+const char *scylla_value_get_string(void *value, size_t *len);
+const char *scylla_value_get_bytes(void *value, size_t *len);
+bool        scylla_value_get_uuid(void *value, unsigned char *out);
+bool        scylla_value_get_decimal(void *value, const unsigned char **varint,
+                                     size_t *len, int32_t *scale);
+}
+
+/* CQL consistency ONE */
+#define BENCH_CONSISTENCY   1
+
+/* Page size of the scans, the FDW's default fetch_size */
+#define BENCH_PAGE_SIZE     1000
+
+/* Number of point lookups timed */
+#define BENCH_LOOKUPS       10000
+
+typedef std::chrono::steady_clock Clock;
+
+enum ExtractKind
+{
+    EXTRACT_INT32,
+    EXTRACT_INT64,
+    EXTRACT_DOUBLE,
+    EXTRACT_BOOL,
+    EXTRACT_STRING,
+    EXTRACT_UUID,
+    EXTRACT_DECIMAL,
+    EXTRACT_BYTES
+};
+
+struct BenchColumn
+{
+    const char *name;
+    ExtractKind kind;
+};
+
+/* The columns of scylla_fdw_bench.mixed, see bench/schema.cql */
+static const BenchColumn bench_columns[] = {
+    {"c_int", EXTRACT_INT32},
+    {"c_bigint", EXTRACT_INT64},
+    {"c_double", EXTRACT_DOUBLE},
+    {"c_boolean", EXTRACT_BOOL},
+    {"c_text", EXTRACT_STRING},
+    {"c_uuid", EXTRACT_UUID},
+    {"c_timestamp", EXTRACT_INT64},
+    {"c_decimal", EXTRACT_DECIMAL},
+    {"c_blob", EXTRACT_BYTES},
+};
+
+static double
+elapsed_ms(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/*
+ * Extract one value, the way the FDW's decoders do; returns a byte of it
+ * so the compiler can't drop the work
+ */
+static unsigned
+extract_value(void *value, ExtractKind kind)
+{
+    switch (kind)
+    {
+        case EXTRACT_INT32:
+        {
+            int32_t     v = 0;
+
+            scylla_value_get_int32(value, &v);
+            return (unsigned) v;
+        }
+        case EXTRACT_INT64:
+        {
+            int64_t     v = 0;
+
+            scylla_value_get_int64(value, &v);
+            return (unsigned) v;
+        }
+        case EXTRACT_DOUBLE:
+        {
+            double      v = 0;
+
+            scylla_value_get_double(value, &v);
+            return (unsigned) v;
+        }
+        case EXTRACT_BOOL:
+        {
+            bool        v = false;
+
+            scylla_value_get_bool(value, &v);
+            return v;
+        }
+        case EXTRACT_STRING:
+        {
+            size_t      len = 0;
+            const char *v = scylla_value_get_string(value, &len);
+
+            return v != NULL && len > 0 ? (unsigned char) v[0] : 0;
+        }
+        case EXTRACT_UUID:
+        {
+            unsigned char v[16] = {0};
+
+            scylla_value_get_uuid(value, v);
+            return v[0];
+        }
+        case EXTRACT_DECIMAL:
+        {
+            const unsigned char *varint = NULL;
+            size_t      len = 0;
+            int32_t     scale = 0;
+
+            scylla_value_get_decimal(value, &varint, &len, &scale);
+            return (unsigned) len + (unsigned) scale;
+        }
+        case EXTRACT_BYTES:
+        {
+            size_t      len = 0;
+            const char *v = scylla_value_get_bytes(value, &len);
+
+            return v != NULL && len > 0 ? (unsigned char) v[0] : 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Scan one column of the mixed table, timing page fetches and value
+ * extraction separately
+ */
+static bool
+bench_scan(void *conn, const BenchColumn &column, const char *run_id)
+{
+    char        query[256];
+    void       *statement;
+    char       *error_msg = NULL;
+    double      fetch_ms = 0;
+    double      extract_ms = 0;
+    int64_t     rows = 0;
+    unsigned    sink = 0;
+    bool        more = true;
+
+    snprintf(query, sizeof(query),
+             "SELECT %s FROM scylla_fdw_bench.mixed", column.name);
+    statement = scylla_create_query_statement(query, 0);
+    scylla_statement_set_paging_size(statement, BENCH_PAGE_SIZE);
+
+    while (more)
+    {
+        Clock::time_point start = Clock::now();
+        void       *result = scylla_execute_statement(conn, statement,
+                                                      BENCH_CONSISTENCY,
+                                                      &error_msg);
+        Clock::time_point fetched = Clock::now();
+        void       *iterator;
+
+        if (result == NULL)
+        {
+            fprintf(stderr, "scan of %s failed: %s\n", column.name,
+                    error_msg ? error_msg : "unknown error");
+            free(error_msg);
+            scylla_free_statement(statement);
+            return false;
+        }
+
+        iterator = scylla_result_iterator(result);
+        while (scylla_iterator_next(iterator))
+        {
+            void       *row = scylla_iterator_get_row(iterator);
+
+            sink += extract_value(scylla_row_get_column(row, 0), column.kind);
+            rows++;
+        }
+        scylla_free_iterator(iterator);
+
+        fetch_ms += elapsed_ms(start, fetched);
+        extract_ms += elapsed_ms(fetched, Clock::now());
+
+        more = scylla_result_has_more_pages(result) &&
+            scylla_statement_set_paging_state(statement, result);
+        scylla_free_result(result);
+    }
+    scylla_free_statement(statement);
+
+    printf("{\"run\":\"%s\",\"bench\":\"micro_scan_%s\",\"rows\":%lld,"
+           "\"fetch_ms\":%.3f,\"extract_ms\":%.3f,"
+           "\"rows_per_sec\":%.1f,\"extract_ns_per_value\":%.1f,"
+           "\"checksum\":%u}\n",
+           run_id, column.name, (long long) rows, fetch_ms, extract_ms,
+           rows > 0 ? rows * 1000.0 / (fetch_ms + extract_ms) : 0.0,
+           rows > 0 ? extract_ms * 1e6 / rows : 0.0, sink % 256);
+
+    return true;
+}
+
+/*
+ * Time prepared point lookups on the kv table
+ */
+static bool
+bench_lookup(void *conn, int64_t nrows, const char *run_id)
+{
+    char       *error_msg = NULL;
+    void       *prepared;
+    std::vector<double> latencies;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int32_t> keys(1, (int32_t) nrows);
+    double      total = 0;
+
+    prepared = scylla_prepare_query(conn,
+                                    "SELECT v FROM scylla_fdw_bench.kv WHERE k = ?",
+                                    &error_msg);
+    if (prepared == NULL)
+    {
+        fprintf(stderr, "prepare failed: %s\n",
+                error_msg ? error_msg : "unknown error");
+        free(error_msg);
+        return false;
+    }
+
+    latencies.reserve(BENCH_LOOKUPS);
+    for (int i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        void       *statement = scylla_create_statement(prepared);
+        Clock::time_point start;
+        void       *result;
+
+        scylla_bind_int32(statement, 0, keys(rng));
+        start = Clock::now();
+        result = scylla_execute_statement(conn, statement, BENCH_CONSISTENCY,
+                                          &error_msg);
+        latencies.push_back(elapsed_ms(start, Clock::now()));
+        scylla_free_statement(statement);
+
+        if (result == NULL)
+        {
+            fprintf(stderr, "lookup failed: %s\n",
+                    error_msg ? error_msg : "unknown error");
+            free(error_msg);
+            scylla_free_prepared(prepared);
+            return false;
+        }
+        scylla_free_result(result);
+    }
+    scylla_free_prepared(prepared);
+
+    for (double ms : latencies)
+        total += ms;
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("{\"run\":\"%s\",\"bench\":\"micro_lookup\",\"transactions\":%d,"
+           "\"tps\":%.1f,\"p50_ms\":%.3f,\"p99_ms\":%.3f}\n",
+           run_id, BENCH_LOOKUPS, BENCH_LOOKUPS * 1000.0 / total,
+           latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100]);
+
+    return true;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *host;
+    int64_t     nrows;
+    const char *run_id;
+    char       *error_msg = NULL;
+    void       *conn;
+    bool        ok = true;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s host rows [run-id]\n", argv[0]);
+        return 2;
+    }
+    host = argv[1];
+    nrows = atoll(argv[2]);
+    run_id = argc > 3 ? argv[3] : "";
+
+    conn = scylla_connect(host, 9042, NULL, NULL, 10000, false,
+                          NULL, NULL, NULL, NULL, true, false,
+                          0, 0, -1, 0, 0, false, &error_msg);
+    if (conn == NULL)
+    {
+        fprintf(stderr, "could not connect to %s: %s\n", host,
+                error_msg ? error_msg : "unknown error");
+        return 1;
+    }
+
+    for (const BenchColumn &column : bench_columns)
+        ok = bench_scan(conn, column, run_id) && ok;
+    ok = bench_lookup(conn, nrows, run_id) && ok;
+
+    scylla_disconnect(conn, NULL);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+-- bench/setup.sql
+--
+-- Creates the foreign tables for "make bench" and loads the ScyllaDB
+-- tables through them.  Expects the psql variables scylla_host and rows.
+-- bench/run.sh runs it in a database of its own, created just before.
+
+CREATE EXTENSION scylla_fdw;
+
+CREATE SERVER bench_server
+    FOREIGN DATA WRAPPER scylla_fdw
+    OPTIONS (host :'scylla_host', consistency 'local_one');
+
+CREATE USER MAPPING FOR current_user SERVER bench_server;
+
+CREATE FOREIGN TABLE bench_mixed (
+    id integer,
+    c_int integer,
+    c_bigint bigint,
+    c_double double precision,
+    c_boolean boolean,
+    c_text text,
+    c_uuid uuid,
+    c_timestamp timestamp with time zone,
+    c_decimal numeric,
+    c_blob bytea
+)
+SERVER bench_server
+OPTIONS (keyspace 'scylla_fdw_bench', table 'mixed', primary_key 'id');
+
+CREATE FOREIGN TABLE bench_kv (
+    k integer,
+    v text
+)
+SERVER bench_server
+OPTIONS (keyspace 'scylla_fdw_bench', table 'kv', primary_key 'k');
+
+CREATE FOREIGN TABLE bench_sink (
+    id integer,
+    v text
+)
+SERVER bench_server
+OPTIONS (keyspace 'scylla_fdw_bench', table 'sink', primary_key 'id');
+
+INSERT INTO bench_mixed
+    SELECT g, g, g * 1000, g * 0.5, g % 2 = 0, md5(g::text),
+           md5(g::text)::uuid,
+           timestamptz '2024-01-01 00:00:00+00' + g * interval '1 second',
+           g / 100.0, decode(md5(g::text), 'hex')
+    FROM generate_series(1, :rows) g;
+
+INSERT INTO bench_kv
+    SELECT g, md5(g::text) FROM generate_series(1, :rows) g;
+
+-- Local outer side of the parameterized join, 100 keys per batch
+CREATE TABLE bench_keys (batch integer, k integer);
+INSERT INTO bench_keys
+    SELECT g / 100, (g * 7919) % :rows + 1 FROM generate_series(0, 99999) g;
+CREATE INDEX ON bench_keys (batch);
+ANALYZE bench_keys;
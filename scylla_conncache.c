@@ -0,0 +1,667 @@
+/*-------------------------------------------------------------------------
+ *
+ * scylla_conncache.c
+ *        Per-backend connection cache for ScyllaDB Foreign Data Wrapper
+ *
+ * Establishing a CassSession is expensive: the driver performs the
+ * handshake, discovers the cluster topology and (optionally) negotiates
+ * TLS before the first request can be sent.  To avoid paying that price
+ * for every scan or modification, sessions are cached per backend and
+ * shared across all plan nodes that use the same foreign server and user
+ * mapping.
+ *
+ * Each cached session also keeps the statements prepared on it, keyed by
+ * CQL text, so a query is only prepared once per backend no matter how
+ * often it runs.
+ *
+ * Copyright (c) 2024, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *        scylla_fdw/scylla_conncache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "scylla_fdw.h"
+
+#include "access/xact.h"
+#include "common/hashfn.h"
+#include "storage/ipc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+
+/*
+ * Connection cache hash table key
+ *
+ * Sessions are identified by the foreign server and the user mapping used
+ * to connect, so two foreign tables on the same server accessed as the
+ * same user share a single CassSession.
+ */
+typedef struct ScyllaConnCacheKey
+{
+    Oid         serverid;       /* OID of foreign server */
+    Oid         umid;           /* OID of user mapping */
+} ScyllaConnCacheKey;
+
+/*
+ * Connection cache hash table entry
+ */
+typedef struct ScyllaConnCacheEntry
+{
+    ScyllaConnCacheKey key;     /* hash key (must be first) */
+    void       *conn;           /* ScyllaConnection*, or NULL if not connected */
+    int         refcount;       /* number of active scans/modifies using conn */
+    bool        invalidated;    /* true if options changed; reconnect needed */
+    uint32      server_hashvalue;   /* hash value of foreign server OID */
+    uint32      mapping_hashvalue;  /* hash value of user mapping OID */
+    HTAB       *prepared;       /* ScyllaPreparedEntry hash, or NULL */
+    bool        prepared_stale; /* some prepared entries must be dropped */
+    List       *retired;        /* replaced CassPrepared*, freed when idle */
+    ScyllaSessionMetrics published; /* driver metrics in shared statistics */
+} ScyllaConnCacheEntry;
+
+/*
+ * Prepared statement cache entry
+ *
+ * The key is a pointer to the CQL text, hashed and compared by content;
+ * the text itself is copied into CacheMemoryContext on insertion.
+ */
+typedef struct ScyllaPreparedEntry
+{
+    char       *query;          /* hash key: CQL text (must be first) */
+    void       *prepared;       /* CassPrepared* */
+    Oid         relid;          /* foreign table the query was built for */
+    bool        stale;          /* drop once no scan or modify is running */
+} ScyllaPreparedEntry;
+
+/*
+ * Upper bound on prepared statements kept per session.  Queries with bind
+ * markers rarely get anywhere near it; it only guards against unbounded
+ * growth from queries that differ in inlined constants.
+ */
+#define SCYLLA_MAX_PREPARED     1024
+
+/* Connection cache (initialized on first use) */
+static HTAB *ConnectionHash = NULL;
+
+/* Local function prototypes */
+static void *connect_scylla_server(ForeignServer *server, UserMapping *user);
+static void disconnect_cache_entry(ScyllaConnCacheEntry *entry);
+static ScyllaConnCacheEntry *find_cache_entry(void *conn);
+static void drop_stale_prepared(ScyllaConnCacheEntry *entry, bool all);
+static uint32 prepared_query_hash(const void *key, Size keysize);
+static int prepared_query_match(const void *key1, const void *key2,
+                                Size keysize);
+static void *prepared_query_keycopy(void *dest, const void *src,
+                                    Size keysize);
+static void scylla_conncache_inval_callback(Datum arg, int cacheid,
+                                            uint32 hashvalue);
+static void scylla_conncache_relcache_callback(Datum arg, Oid relid);
+static void scylla_conncache_xact_callback(XactEvent event, void *arg);
+static void scylla_conncache_shutdown(int code, Datum arg);
+
+/*
+ * scylla_get_connection
+ *        Get a ScyllaDB session for the given server and user mapping
+ *
+ * A cached session is returned if one exists and its options are still
+ * current; otherwise a new session is established.  Every successful call
+ * must be paired with scylla_release_connection().
+ *
+ * will_prep_stmt is accepted for API parity with the other FDWs; CQL
+ * sessions carry no per-transaction state, so it does not affect which
+ * session is handed out.
+ */
+void *
+scylla_get_connection(ForeignServer *server, UserMapping *user,
+                      bool will_prep_stmt)
+{
+    ScyllaConnCacheKey key;
+    ScyllaConnCacheEntry *entry;
+    bool        found;
+
+    (void) will_prep_stmt;
+
+    /* First time through, initialize connection cache hashtable */
+    if (ConnectionHash == NULL)
+    {
+        HASHCTL     ctl;
+
+        ctl.keysize = sizeof(ScyllaConnCacheKey);
+        ctl.entrysize = sizeof(ScyllaConnCacheEntry);
+        ctl.hcxt = CacheMemoryContext;
+        ConnectionHash = hash_create("scylla_fdw connections", 8,
+                                     &ctl,
+                                     HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+        /*
+         * Register callbacks for connection cleanup.  These are registered
+         * only once per backend.
+         */
+        CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+                                      scylla_conncache_inval_callback,
+                                      (Datum) 0);
+        CacheRegisterSyscacheCallback(USERMAPPINGOID,
+                                      scylla_conncache_inval_callback,
+                                      (Datum) 0);
+        CacheRegisterRelcacheCallback(scylla_conncache_relcache_callback,
+                                      (Datum) 0);
+        RegisterXactCallback(scylla_conncache_xact_callback, NULL);
+        on_proc_exit(scylla_conncache_shutdown, (Datum) 0);
+    }
+
+    /* Create hash key */
+    memset(&key, 0, sizeof(key));
+    key.serverid = server->serverid;
+    key.umid = user->umid;
+
+    entry = (ScyllaConnCacheEntry *) hash_search(ConnectionHash, &key,
+                                                 HASH_ENTER, &found);
+    if (!found)
+    {
+        entry->conn = NULL;
+        entry->refcount = 0;
+        entry->invalidated = false;
+        entry->prepared = NULL;
+        entry->prepared_stale = false;
+        entry->retired = NIL;
+    }
+
+    /*
+     * If the server or user mapping options changed since the session was
+     * opened, drop it now -- unless some other plan node is still using it,
+     * in which case we keep sharing the old session until it is released.
+     */
+    if (entry->conn != NULL && entry->invalidated && entry->refcount == 0)
+    {
+        elog(DEBUG1, "scylla_fdw: closing stale connection for server %u",
+             server->serverid);
+        disconnect_cache_entry(entry);
+    }
+
+    if (entry->conn == NULL)
+    {
+        entry->conn = connect_scylla_server(server, user);
+        entry->invalidated = false;
+        memset(&entry->published, 0, sizeof(ScyllaSessionMetrics));
+        scylla_shared_stats_count(server->serverid, SCYLLA_STATS_CONNECT);
+        entry->server_hashvalue =
+            GetSysCacheHashValue1(FOREIGNSERVEROID,
+                                  ObjectIdGetDatum(server->serverid));
+        entry->mapping_hashvalue =
+            GetSysCacheHashValue1(USERMAPPINGOID,
+                                  ObjectIdGetDatum(user->umid));
+    }
+    else
+        elog(DEBUG1, "scylla_fdw: reusing cached connection for server %u",
+             server->serverid);
+
+    /* Nobody holds prepared statements while the session is unused */
+    if (entry->prepared_stale && entry->refcount == 0)
+        drop_stale_prepared(entry, false);
+
+    entry->refcount++;
+
+    return entry->conn;
+}
+
+/*
+ * scylla_release_connection
+ *        Release a session obtained from scylla_get_connection
+ *
+ * The session normally stays open for reuse by later queries.  It is only
+ * closed here if it was invalidated while in use.
+ */
+void
+scylla_release_connection(void *conn)
+{
+    ScyllaConnCacheEntry *entry = find_cache_entry(conn);
+
+    if (entry == NULL)
+        return;
+
+    if (entry->refcount > 0)
+        entry->refcount--;
+
+    if (entry->invalidated && entry->refcount == 0)
+    {
+        elog(DEBUG1, "scylla_fdw: closing invalidated connection for server %u",
+             entry->key.serverid);
+        disconnect_cache_entry(entry);
+        return;
+    }
+    else if (entry->prepared_stale && entry->refcount == 0)
+        drop_stale_prepared(entry, false);
+
+    scylla_shared_stats_session(entry->key.serverid, entry->conn,
+                                &entry->published);
+}
+
+/*
+ * scylla_get_prepared
+ *        Get a prepared statement for query on a cached session
+ *
+ * The statement is prepared on first use and kept with the session, so
+ * this only costs a server round trip once per distinct CQL text.  relid
+ * is the foreign table the query was built for; a relcache invalidation
+ * of that table drops the entry.  The result belongs to the cache and must
+ * not be freed; it stays valid until the session is released.
+ */
+void *
+scylla_get_prepared(void *conn, Oid relid, const char *query)
+{
+    ScyllaConnCacheEntry *entry = find_cache_entry(conn);
+    ScyllaPreparedEntry *pentry;
+    char       *error_msg = NULL;
+    void       *prepared;
+    bool        found;
+
+    if (entry == NULL)
+        elog(ERROR, "scylla_fdw: connection is not in the connection cache");
+
+    if (entry->prepared == NULL)
+    {
+        HASHCTL     ctl;
+
+        ctl.keysize = sizeof(char *);
+        ctl.entrysize = sizeof(ScyllaPreparedEntry);
+        ctl.hash = prepared_query_hash;
+        ctl.match = prepared_query_match;
+        ctl.keycopy = prepared_query_keycopy;
+        ctl.hcxt = CacheMemoryContext;
+        entry->prepared = hash_create("scylla_fdw prepared statements", 64,
+                                      &ctl,
+                                      HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+                                      HASH_KEYCOPY | HASH_CONTEXT);
+    }
+
+    pentry = (ScyllaPreparedEntry *) hash_search(entry->prepared, &query,
+                                                 HASH_FIND, NULL);
+    if (pentry != NULL && !pentry->stale)
+    {
+        elog(DEBUG2, "scylla_fdw: reusing prepared statement: %s", query);
+        scylla_shared_stats_count(entry->key.serverid,
+                                  SCYLLA_STATS_PREPARED_HIT);
+        return pentry->prepared;
+    }
+
+    /*
+     * If the cache is full, flush it the next time the session is idle;
+     * entries can't be evicted now, since other plan nodes may use them.
+     */
+    if (pentry == NULL &&
+        hash_get_num_entries(entry->prepared) >= SCYLLA_MAX_PREPARED)
+    {
+        HASH_SEQ_STATUS scan;
+        ScyllaPreparedEntry *other;
+
+        hash_seq_init(&scan, entry->prepared);
+        while ((other = (ScyllaPreparedEntry *) hash_seq_search(&scan)) != NULL)
+            other->stale = true;
+        entry->prepared_stale = true;
+    }
+
+    elog(DEBUG1, "scylla_fdw: preparing statement: %s", query);
+    scylla_shared_stats_count(entry->key.serverid, SCYLLA_STATS_PREPARED_MISS);
+    prepared = scylla_prepare_query(conn, query, &error_msg);
+    if (prepared == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not prepare ScyllaDB statement: %s",
+                        error_msg ? error_msg : "unknown error")));
+
+    pentry = (ScyllaPreparedEntry *) hash_search(entry->prepared, &query,
+                                                 HASH_ENTER, &found);
+    if (found)
+    {
+        MemoryContext oldcontext;
+
+        /* The stale statement may still be in use; free it later */
+        oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
+        entry->retired = lappend(entry->retired, pentry->prepared);
+        MemoryContextSwitchTo(oldcontext);
+    }
+    pentry->prepared = prepared;
+    pentry->relid = relid;
+    pentry->stale = false;
+
+    return prepared;
+}
+
+/*
+ * find_cache_entry
+ *        Look up the cache entry holding a session
+ */
+static ScyllaConnCacheEntry *
+find_cache_entry(void *conn)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaConnCacheEntry *entry;
+
+    if (conn == NULL || ConnectionHash == NULL)
+        return NULL;
+
+    hash_seq_init(&scan, ConnectionHash);
+    while ((entry = (ScyllaConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+    {
+        if (entry->conn == conn)
+        {
+            hash_seq_term(&scan);
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * drop_stale_prepared
+ *        Free the stale prepared statements of a session, or all of them
+ *
+ * Must only be called while no scan or modify is using the session.
+ */
+static void
+drop_stale_prepared(ScyllaConnCacheEntry *entry, bool all)
+{
+    ListCell   *lc;
+
+    if (entry->prepared != NULL)
+    {
+        HASH_SEQ_STATUS scan;
+        ScyllaPreparedEntry *pentry;
+
+        hash_seq_init(&scan, entry->prepared);
+        while ((pentry = (ScyllaPreparedEntry *) hash_seq_search(&scan)) != NULL)
+        {
+            char       *query = pentry->query;
+
+            if (!all && !pentry->stale)
+                continue;
+
+            scylla_free_prepared(pentry->prepared);
+            hash_search(entry->prepared, &query, HASH_REMOVE, NULL);
+            pfree(query);
+        }
+
+        if (all)
+        {
+            hash_destroy(entry->prepared);
+            entry->prepared = NULL;
+        }
+    }
+
+    foreach(lc, entry->retired)
+        scylla_free_prepared(lfirst(lc));
+    list_free(entry->retired);
+    entry->retired = NIL;
+
+    entry->prepared_stale = false;
+}
+
+/*
+ * Hash support for the prepared statement cache, whose keys are pointers
+ * to CQL text
+ */
+static uint32
+prepared_query_hash(const void *key, Size keysize)
+{
+    const char *query = *(const char *const *) key;
+
+    return hash_bytes((const unsigned char *) query, strlen(query));
+}
+
+static int
+prepared_query_match(const void *key1, const void *key2, Size keysize)
+{
+    return strcmp(*(const char *const *) key1, *(const char *const *) key2);
+}
+
+static void *
+prepared_query_keycopy(void *dest, const void *src, Size keysize)
+{
+    *(char **) dest = MemoryContextStrdup(CacheMemoryContext,
+                                          *(const char *const *) src);
+    return dest;
+}
+
+/*
+ * connect_scylla_server
+ *        Open a new ScyllaDB session using the server and user mapping options
+ */
+static void *
+connect_scylla_server(ForeignServer *server, UserMapping *user)
+{
+    void       *conn;
+    ListCell   *lc;
+    char       *host = DEFAULT_HOST;
+    int         port = DEFAULT_PORT;
+    char       *username = NULL;
+    char       *password = NULL;
+    int         connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    bool        use_ssl = false;
+    char       *ssl_cert = NULL;
+    char       *ssl_key = NULL;
+    char       *ssl_ca = NULL;
+    char       *local_dc = NULL;
+    bool        token_aware = true;
+    bool        latency_aware = false;
+    int         core_connections = 0;
+    int         num_io_threads = 0;
+    int         speculative_delay_ms = -1;
+    int         speculative_max = DEFAULT_SPECULATIVE_MAX;
+    int         retry_policy = 0;
+    bool        log_retries = false;
+    char       *error_msg = NULL;
+
+    /* Get server options */
+    foreach(lc, server->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+        if (strcmp(def->defname, OPT_HOST) == 0)
+            host = defGetString(def);
+        else if (strcmp(def->defname, OPT_PORT) == 0)
+            port = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_CONNECT_TIMEOUT) == 0)
+            connect_timeout = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_SSL) == 0)
+            use_ssl = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_SSL_CERT) == 0)
+            ssl_cert = defGetString(def);
+        else if (strcmp(def->defname, OPT_SSL_KEY) == 0)
+            ssl_key = defGetString(def);
+        else if (strcmp(def->defname, OPT_SSL_CA) == 0)
+            ssl_ca = defGetString(def);
+        else if (strcmp(def->defname, OPT_LOCAL_DC) == 0)
+            local_dc = defGetString(def);
+        else if (strcmp(def->defname, OPT_TOKEN_AWARE) == 0)
+            token_aware = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_LATENCY_AWARE_ROUTING) == 0)
+            latency_aware = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_CORE_CONNECTIONS_PER_HOST) == 0)
+            core_connections = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_NUM_IO_THREADS) == 0)
+            num_io_threads = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_SPECULATIVE_DELAY_MS) == 0)
+            speculative_delay_ms = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_SPECULATIVE_MAX) == 0)
+            speculative_max = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_RETRY_POLICY) == 0)
+            retry_policy = scylla_string_to_retry_policy(defGetString(def));
+        else if (strcmp(def->defname, OPT_LOG_RETRIES) == 0)
+            log_retries = defGetBoolean(def);
+    }
+
+    /* Get user mapping options */
+    foreach(lc, user->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+        if (strcmp(def->defname, OPT_USERNAME) == 0)
+            username = defGetString(def);
+        else if (strcmp(def->defname, OPT_PASSWORD) == 0)
+            password = defGetString(def);
+    }
+
+    /* Connect to ScyllaDB */
+    elog(DEBUG1, "scylla_fdw: connecting to ScyllaDB at %s:%d", host, port);
+    conn = scylla_connect(host, port, username, password,
+                          connect_timeout, use_ssl,
+                          ssl_cert, ssl_key, ssl_ca,
+                          local_dc, token_aware, latency_aware,
+                          core_connections, num_io_threads,
+                          speculative_delay_ms, speculative_max,
+                          retry_policy, log_retries,
+                          &error_msg);
+    if (conn == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
+                 errmsg("could not connect to ScyllaDB: %s",
+                        error_msg ? error_msg : "unknown error")));
+    elog(DEBUG1, "scylla_fdw: successfully connected to ScyllaDB");
+
+    return conn;
+}
+
+/*
+ * disconnect_cache_entry
+ *        Close the session held by a cache entry, if any
+ */
+static void
+disconnect_cache_entry(ScyllaConnCacheEntry *entry)
+{
+    drop_stale_prepared(entry, true);
+
+    if (entry->conn != NULL)
+    {
+        scylla_shared_stats_disconnect(entry->key.serverid, entry->conn,
+                                       &entry->published);
+        scylla_disconnect(entry->conn, NULL);
+        entry->conn = NULL;
+    }
+    entry->refcount = 0;
+    entry->invalidated = false;
+}
+
+/*
+ * scylla_conncache_inval_callback
+ *        Mark sessions stale when server or user mapping options change
+ *
+ * We don't close sessions here: the callback can fire while a scan is in
+ * progress, and talking to the driver from inside a cache invalidation is
+ * best avoided.  Stale sessions are closed the next time they are looked
+ * up or released.
+ */
+static void
+scylla_conncache_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaConnCacheEntry *entry;
+
+    Assert(cacheid == FOREIGNSERVEROID || cacheid == USERMAPPINGOID);
+
+    /* ConnectionHash must exist already, if we're registered */
+    hash_seq_init(&scan, ConnectionHash);
+    while ((entry = (ScyllaConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+    {
+        /* Ignore invalid entries */
+        if (entry->conn == NULL)
+            continue;
+
+        /* hashvalue == 0 means a cache reset, must clear all state */
+        if (hashvalue == 0 ||
+            (cacheid == FOREIGNSERVEROID &&
+             entry->server_hashvalue == hashvalue) ||
+            (cacheid == USERMAPPINGOID &&
+             entry->mapping_hashvalue == hashvalue))
+            entry->invalidated = true;
+    }
+}
+
+/*
+ * scylla_conncache_xact_callback
+ *        Reset reference counts at the end of each top-level transaction
+ *
+ * All scans and modifications are finished (or aborted) by the time the
+ * transaction ends, so any remaining references were leaked by an error.
+ * This is also the point where invalidated sessions are finally closed.
+ */
+static void
+scylla_conncache_xact_callback(XactEvent event, void *arg)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaConnCacheEntry *entry;
+
+    switch (event)
+    {
+        case XACT_EVENT_COMMIT:
+        case XACT_EVENT_PARALLEL_COMMIT:
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PARALLEL_ABORT:
+        case XACT_EVENT_PREPARE:
+            break;
+        default:
+            return;
+    }
+
+    hash_seq_init(&scan, ConnectionHash);
+    while ((entry = (ScyllaConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+    {
+        entry->refcount = 0;
+        if (entry->invalidated)
+            disconnect_cache_entry(entry);
+        else if (entry->prepared_stale)
+            drop_stale_prepared(entry, false);
+    }
+}
+
+/*
+ * scylla_conncache_relcache_callback
+ *        Mark prepared statements stale when their foreign table changes
+ *
+ * ALTER FOREIGN TABLE may rename columns or change the remote table, after
+ * which the cached statements no longer match.  As with sessions, they are
+ * only freed once nothing is using them.
+ */
+static void
+scylla_conncache_relcache_callback(Datum arg, Oid relid)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaConnCacheEntry *entry;
+
+    hash_seq_init(&scan, ConnectionHash);
+    while ((entry = (ScyllaConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+    {
+        HASH_SEQ_STATUS pscan;
+        ScyllaPreparedEntry *pentry;
+
+        if (entry->prepared == NULL)
+            continue;
+
+        /* relid == InvalidOid means a cache reset */
+        hash_seq_init(&pscan, entry->prepared);
+        while ((pentry = (ScyllaPreparedEntry *) hash_seq_search(&pscan)) != NULL)
+        {
+            if (!OidIsValid(relid) || pentry->relid == relid)
+            {
+                pentry->stale = true;
+                entry->prepared_stale = true;
+            }
+        }
+    }
+}
+
+/*
+ * scylla_conncache_shutdown
+ *        Close all cached sessions at backend exit
+ */
+static void
+scylla_conncache_shutdown(int code, Datum arg)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaConnCacheEntry *entry;
+
+    if (ConnectionHash == NULL)
+        return;
+
+    hash_seq_init(&scan, ConnectionHash);
+    while ((entry = (ScyllaConnCacheEntry *) hash_seq_search(&scan)) != NULL)
+        disconnect_cache_entry(entry);
+}
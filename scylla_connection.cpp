@@ -15,10 +15,18 @@
  */
 
 #include <cassandra.h>
+#include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 extern "C" {
 
@@ -31,11 +39,106 @@ typedef struct ScyllaConnection {
     CassSession* session;
 } ScyllaConnection;
 
+/* Values of the retry_policy option, see scylla_string_to_retry_policy */
+enum {
+    SCYLLA_RETRY_DEFAULT = 0,
+    SCYLLA_RETRY_FALLTHROUGH = 1,
+    SCYLLA_RETRY_DOWNGRADING = 2
+};
+
+/*
+ * Configure request routing.  With local_dc set, only nodes of that DC
+ * coordinate requests; token-aware routing then picks a replica among
+ * them, and the driver sends the request to the shard owning the token.
+ * Zero counts leave the driver defaults in place.
+ */
+static CassError
+set_load_balancing(CassCluster* cluster, const char *local_dc,
+                   bool token_aware, bool latency_aware,
+                   int core_connections, int num_io_threads)
+{
+    CassError rc;
+
+    if (local_dc != NULL) {
+        rc = cass_cluster_set_load_balance_dc_aware(cluster, local_dc, 0, cass_false);
+        if (rc != CASS_OK)
+            return rc;
+    }
+
+    cass_cluster_set_token_aware_routing(cluster, token_aware ? cass_true : cass_false);
+    cass_cluster_set_latency_aware_routing(cluster, latency_aware ? cass_true : cass_false);
+
+    if (core_connections > 0) {
+        rc = cass_cluster_set_core_connections_per_host(cluster, (unsigned) core_connections);
+        if (rc != CASS_OK)
+            return rc;
+    }
+
+    if (num_io_threads > 0) {
+        rc = cass_cluster_set_num_threads_io(cluster, (unsigned) num_io_threads);
+        if (rc != CASS_OK)
+            return rc;
+    }
+
+    return CASS_OK;
+}
+
+/*
+ * Configure what happens when a node is slow or fails.  Speculative
+ * executions (disabled if speculative_delay_ms is negative) send another
+ * copy of an idempotent request to the next node whenever the delay
+ * passes without a response, up to speculative_max extra copies.
+ */
+static CassError
+set_request_policies(CassCluster* cluster, int speculative_delay_ms,
+                     int speculative_max, int retry_policy, bool log_retries)
+{
+    CassRetryPolicy* policy;
+
+    if (speculative_delay_ms >= 0) {
+        CassError rc;
+
+        rc = cass_cluster_set_constant_speculative_execution_policy(cluster,
+                                                                    speculative_delay_ms,
+                                                                    speculative_max);
+        if (rc != CASS_OK)
+            return rc;
+    }
+
+    switch (retry_policy) {
+        case SCYLLA_RETRY_FALLTHROUGH:
+            policy = cass_retry_policy_fallthrough_new();
+            break;
+        case SCYLLA_RETRY_DOWNGRADING:
+            policy = cass_retry_policy_downgrading_consistency_new();
+            break;
+        default:
+            policy = cass_retry_policy_default_new();
+            break;
+    }
+
+    if (log_retries) {
+        CassRetryPolicy* logging = cass_retry_policy_logging_new(policy);
+
+        cass_retry_policy_free(policy);
+        policy = logging;
+    }
+
+    cass_cluster_set_retry_policy(cluster, policy);
+    cass_retry_policy_free(policy);  /* Cluster keeps its own reference */
+
+    return CASS_OK;
+}
+
 void *
 scylla_connect(const char *host, int port, const char *username,
                const char *password, int connect_timeout,
                bool use_ssl, const char *ssl_cert, 
                const char *ssl_key, const char *ssl_ca,
+               const char *local_dc, bool token_aware,
+               bool latency_aware, int core_connections,
+               int num_io_threads, int speculative_delay_ms,
+               int speculative_max, int retry_policy, bool log_retries,
                char **error_msg)
 {
     CassCluster* cluster = cass_cluster_new();
@@ -53,6 +156,19 @@ scylla_connect(const char *host, int port, const char *username,
     /* Set connection timeout */
     cass_cluster_set_connect_timeout(cluster, connect_timeout);
 
+    /* Set up request routing */
+    rc = set_load_balancing(cluster, local_dc, token_aware, latency_aware,
+                            core_connections, num_io_threads);
+    if (rc == CASS_OK)
+        rc = set_request_policies(cluster, speculative_delay_ms, speculative_max,
+                                  retry_policy, log_retries);
+    if (rc != CASS_OK) {
+        *error_msg = strdup(cass_error_desc(rc));
+        cass_session_free(session);
+        cass_cluster_free(cluster);
+        return NULL;
+    }
+
     /* Set authentication if provided */
     if (username != NULL && password != NULL) {
         cass_cluster_set_credentials(cluster, username, password);
@@ -154,21 +270,15 @@ scylla_disconnect(void *conn_ptr, void *cluster_ptr)
  * Query execution
  */
 
-void *
-scylla_execute_query(void *conn_ptr, const char *query, 
-                     int consistency, char **error_msg)
+/*
+ * Wait for a request future and return its result, or NULL with
+ * *error_msg set if the request failed.  The future is freed either way.
+ */
+static const CassResult *
+wait_for_result(CassFuture* result_future, char **error_msg)
 {
-    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
-    CassStatement* statement;
-    CassFuture* result_future;
     CassError rc;
 
-    *error_msg = NULL;
-
-    statement = cass_statement_new(query, 0);
-    cass_statement_set_consistency(statement, (CassConsistency) consistency);
-
-    result_future = cass_session_execute(conn->session, statement);
     cass_future_wait(result_future);
 
     rc = cass_future_error_code(result_future);
@@ -178,12 +288,358 @@ scylla_execute_query(void *conn_ptr, const char *query,
         cass_future_error_message(result_future, &message, &message_length);
         *error_msg = strndup(message, message_length);
         cass_future_free(result_future);
-        cass_statement_free(statement);
         return NULL;
     }
 
     const CassResult* result = cass_future_get_result(result_future);
     cass_future_free(result_future);
+
+    return result;
+}
+
+void *
+scylla_create_query_statement(const char *query, int num_params)
+{
+    return cass_statement_new(query, (size_t) num_params);
+}
+
+void
+scylla_statement_set_paging_size(void *statement_ptr, int page_size)
+{
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    cass_statement_set_paging_size(statement, page_size);
+}
+
+/*
+ * Only idempotent statements are retried after a timeout or executed
+ * speculatively; the driver treats all others as unsafe to send twice.
+ */
+void
+scylla_statement_set_idempotent(void *statement_ptr, bool idempotent)
+{
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    cass_statement_set_is_idempotent(statement, idempotent ? cass_true : cass_false);
+}
+
+void
+scylla_statement_set_serial_consistency(void *statement_ptr, int serial_consistency)
+{
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    cass_statement_set_serial_consistency(statement, (CassConsistency) serial_consistency);
+}
+
+bool
+scylla_statement_set_paging_state(void *statement_ptr, void *result_ptr)
+{
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    const CassResult* result = (const CassResult*) result_ptr;
+
+    return cass_statement_set_paging_state(statement, result) == CASS_OK;
+}
+
+bool
+scylla_result_has_more_pages(void *result_ptr)
+{
+    const CassResult* result = (const CassResult*) result_ptr;
+    return cass_result_has_more_pages(result) == cass_true;
+}
+
+void *
+scylla_execute_statement(void *conn_ptr, void *statement_ptr,
+                         int consistency, char **error_msg)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    CassFuture* result_future;
+
+    *error_msg = NULL;
+
+    cass_statement_set_consistency(statement, (CassConsistency) consistency);
+
+    result_future = cass_session_execute(conn->session, statement);
+
+    return (void*) wait_for_result(result_future, error_msg);
+}
+
+void *
+scylla_execute_statement_async(void *conn_ptr, void *statement_ptr,
+                               int consistency)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    CassStatement* statement = (CassStatement*) statement_ptr;
+
+    /*
+     * The request holds a shared reference to the statement, not a copy:
+     * freeing the statement right away is fine, but changing it (setting
+     * the next paging state, say) must wait until the future is ready.
+     */
+    cass_statement_set_consistency(statement, (CassConsistency) consistency);
+
+    return (void*) cass_session_execute(conn->session, statement);
+}
+
+bool
+scylla_future_ready(void *future_ptr)
+{
+    return cass_future_ready((CassFuture*) future_ptr) == cass_true;
+}
+
+void
+scylla_future_wait(void *future_ptr)
+{
+    cass_future_wait((CassFuture*) future_ptr);
+}
+
+void *
+scylla_future_get_result(void *future_ptr, char **error_msg)
+{
+    *error_msg = NULL;
+
+    return (void*) wait_for_result((CassFuture*) future_ptr, error_msg);
+}
+
+void
+scylla_free_future(void *future_ptr)
+{
+    if (future_ptr != NULL)
+        cass_future_free((CassFuture*) future_ptr);
+}
+
+/*
+ * Completion signals
+ *
+ * A signal is a file descriptor that becomes readable once a future it is
+ * armed on completes, so that the executor can wait for requests together
+ * with its other events.  The driver invokes the callback from one of its
+ * own threads, which only writes to the descriptor.  Callbacks of abandoned
+ * futures may still run after the scan is gone, so the signal holds a
+ * reference for each armed future and is freed when the last one drops.
+ */
+
+typedef struct ScyllaAsyncSignal {
+    int read_fd;
+    int write_fd;               /* same as read_fd for an eventfd */
+    std::atomic<int> refs;
+} ScyllaAsyncSignal;
+
+static void
+async_signal_unref(ScyllaAsyncSignal* sig)
+{
+    if (sig->refs.fetch_sub(1) != 1)
+        return;
+
+    close(sig->read_fd);
+    if (sig->write_fd != sig->read_fd)
+        close(sig->write_fd);
+    delete sig;
+}
+
+static void
+async_signal_callback(CassFuture* future, void* data)
+{
+    ScyllaAsyncSignal* sig = (ScyllaAsyncSignal*) data;
+#ifdef __linux__
+    uint64_t one = 1;
+#else
+    char one = 1;
+#endif
+    ssize_t rc;
+
+    /* A full pipe is readable already, so EAGAIN needs no retry */
+    do {
+        rc = write(sig->write_fd, &one, sizeof(one));
+    } while (rc < 0 && errno == EINTR);
+
+    async_signal_unref(sig);
+}
+
+void *
+scylla_async_signal_create(char **error_msg)
+{
+    ScyllaAsyncSignal* sig = new ScyllaAsyncSignal;
+
+    *error_msg = NULL;
+
+#ifdef __linux__
+    sig->read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sig->write_fd = sig->read_fd;
+    if (sig->read_fd < 0) {
+        *error_msg = strdup(strerror(errno));
+        delete sig;
+        return NULL;
+    }
+#else
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        *error_msg = strdup(strerror(errno));
+        delete sig;
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    sig->read_fd = fds[0];
+    sig->write_fd = fds[1];
+#endif
+    sig->refs.store(1);
+
+    return (void*) sig;
+}
+
+int
+scylla_async_signal_fd(void *signal_ptr)
+{
+    return ((ScyllaAsyncSignal*) signal_ptr)->read_fd;
+}
+
+/*
+ * Make the signal readable when the future completes, or right away if it
+ * has already.  Returns false if the future already has a callback; the
+ * FDW sets no other, so it is armed already.
+ */
+bool
+scylla_async_signal_arm(void *signal_ptr, void *future_ptr)
+{
+    ScyllaAsyncSignal* sig = (ScyllaAsyncSignal*) signal_ptr;
+
+    sig->refs.fetch_add(1);
+    if (cass_future_set_callback((CassFuture*) future_ptr,
+                                 async_signal_callback, sig) != CASS_OK) {
+        async_signal_unref(sig);
+        return false;
+    }
+    return true;
+}
+
+/* Consume the pending notifications, so the descriptor is no longer readable */
+void
+scylla_async_signal_clear(void *signal_ptr)
+{
+    ScyllaAsyncSignal* sig = (ScyllaAsyncSignal*) signal_ptr;
+    char buf[64];
+    ssize_t rc;
+
+    do {
+        rc = read(sig->read_fd, buf, sizeof(buf));
+    } while (rc > 0 || (rc < 0 && errno == EINTR));
+}
+
+void
+scylla_async_signal_release(void *signal_ptr)
+{
+    if (signal_ptr != NULL)
+        async_signal_unref((ScyllaAsyncSignal*) signal_ptr);
+}
+
+/*
+ * Instrumentation
+ */
+
+/*
+ * Find the address of the node that coordinated a request, by asking it
+ * for its own address.  Waits for the future, which stays owned by the
+ * caller.
+ */
+bool
+scylla_future_coordinator(void *conn_ptr, void *future_ptr,
+                          char *buf, size_t buflen)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    const CassNode* node;
+    CassStatement* statement;
+    const CassResult* result;
+    const CassRow* row;
+    CassInet inet;
+    char address[CASS_INET_STRING_LENGTH];
+    char* error_msg = NULL;
+
+    node = cass_future_coordinator((CassFuture*) future_ptr);
+    if (node == NULL)
+        return false;
+
+    statement = cass_statement_new("SELECT rpc_address FROM system.local", 0);
+    cass_statement_set_node(statement, node);
+    result = wait_for_result(cass_session_execute(conn->session, statement),
+                             &error_msg);
+    cass_statement_free(statement);
+    if (result == NULL) {
+        free(error_msg);
+        return false;
+    }
+
+    row = cass_result_first_row(result);
+    if (row == NULL ||
+        cass_value_get_inet(cass_row_get_column(row, 0), &inet) != CASS_OK) {
+        cass_result_free(result);
+        return false;
+    }
+    cass_result_free(result);
+
+    cass_inet_string(inet, address);
+    strncpy(buf, address, buflen - 1);
+    buf[buflen - 1] = '\0';
+    return true;
+}
+
+/*
+ * Session-wide counters of the driver: speculative executions sent and
+ * requests that timed out
+ */
+void
+scylla_session_counters(void *conn_ptr, int64_t *speculative,
+                        int64_t *timeouts)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    CassMetrics metrics;
+    CassSpeculativeExecutionMetrics spec_metrics;
+
+    cass_session_get_metrics(conn->session, &metrics);
+    cass_session_get_speculative_execution_metrics(conn->session, &spec_metrics);
+
+    *speculative = (int64_t) spec_metrics.count;
+    *timeouts = (int64_t) metrics.errors.request_timeouts;
+}
+
+/*
+ * Driver metrics of a session for shared statistics: open connections and
+ * the three kinds of timeouts
+ */
+void
+scylla_session_metrics(void *conn_ptr, int64_t *connections,
+                       int64_t *request_timeouts,
+                       int64_t *connection_timeouts,
+                       int64_t *pending_request_timeouts)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    CassMetrics metrics;
+
+    cass_session_get_metrics(conn->session, &metrics);
+
+    *connections = (int64_t) metrics.stats.total_connections;
+    *request_timeouts = (int64_t) metrics.errors.request_timeouts;
+    *connection_timeouts = (int64_t) metrics.errors.connection_timeouts;
+    *pending_request_timeouts = (int64_t) metrics.errors.pending_request_timeouts;
+}
+
+void *
+scylla_execute_query(void *conn_ptr, const char *query, 
+                     int consistency, bool idempotent, char **error_msg)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    CassStatement* statement;
+    CassFuture* result_future;
+    const CassResult* result;
+
+    *error_msg = NULL;
+
+    statement = cass_statement_new(query, 0);
+    cass_statement_set_consistency(statement, (CassConsistency) consistency);
+    cass_statement_set_is_idempotent(statement, idempotent ? cass_true : cass_false);
+
+    result_future = cass_session_execute(conn->session, statement);
+    result = wait_for_result(result_future, error_msg);
     cass_statement_free(statement);
 
     return (void*) result;
@@ -225,7 +681,6 @@ scylla_execute_prepared(void *conn_ptr, void *prepared_ptr,
     ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
     CassStatement* statement = (CassStatement*) params[0];  /* Statement is passed as first param */
     CassFuture* result_future;
-    CassError rc;
 
     /* prepared_ptr and num_params not used directly - statement already bound */
     (void) prepared_ptr;
@@ -236,22 +691,8 @@ scylla_execute_prepared(void *conn_ptr, void *prepared_ptr,
     cass_statement_set_consistency(statement, (CassConsistency) consistency);
 
     result_future = cass_session_execute(conn->session, statement);
-    cass_future_wait(result_future);
-
-    rc = cass_future_error_code(result_future);
-    if (rc != CASS_OK) {
-        const char* message;
-        size_t message_length;
-        cass_future_error_message(result_future, &message, &message_length);
-        *error_msg = strndup(message, message_length);
-        cass_future_free(result_future);
-        return NULL;
-    }
 
-    const CassResult* result = cass_future_get_result(result_future);
-    cass_future_free(result_future);
-
-    return (void*) result;
+    return (void*) wait_for_result(result_future, error_msg);
 }
 
 void
@@ -501,82 +942,190 @@ scylla_get_time(void *iterator_ptr, int col, bool *is_null)
     return result;
 }
 
+/*
+ * Row-level value access
+ *
+ * A scan fetches the row once per tuple and hands each retrieved column's
+ * value straight to the getter for its type.  Rows and values are only
+ * valid until the iterator moves on to the next row.  Scalar getters
+ * return false and pointer getters NULL when the value is NULL; the caller
+ * has already checked the column's CQL type, so no other error can occur.
+ */
+
+void *
+scylla_iterator_get_row(void *iterator_ptr)
+{
+    return (void *) cass_iterator_get_row((CassIterator*) iterator_ptr);
+}
+
+void *
+scylla_row_get_column(void *row_ptr, int col)
+{
+    return (void *) cass_row_get_column((const CassRow*) row_ptr, col);
+}
+
+/*
+ * Bytes of a column value as received, 0 for NULL
+ */
+int64_t
+scylla_value_size(void *value_ptr)
+{
+    const CassValue* value = (const CassValue*) value_ptr;
+    const cass_byte_t* data;
+    size_t size;
+
+    if (value == NULL || cass_value_is_null(value) ||
+        cass_value_get_bytes(value, &data, &size) != CASS_OK)
+        return 0;
+    return (int64_t) size;
+}
+
+bool
+scylla_value_get_bool(void *value_ptr, bool *out)
+{
+    cass_bool_t result;
+
+    if (cass_value_get_bool((const CassValue*) value_ptr, &result) != CASS_OK)
+        return false;
+    *out = (result == cass_true);
+    return true;
+}
+
+bool
+scylla_value_get_int8(void *value_ptr, int8_t *out)
+{
+    return cass_value_get_int8((const CassValue*) value_ptr, out) == CASS_OK;
+}
+
+bool
+scylla_value_get_int16(void *value_ptr, int16_t *out)
+{
+    return cass_value_get_int16((const CassValue*) value_ptr, out) == CASS_OK;
+}
+
+bool
+scylla_value_get_int32(void *value_ptr, int32_t *out)
+{
+    return cass_value_get_int32((const CassValue*) value_ptr, out) == CASS_OK;
+}
+
+bool
+scylla_value_get_uint32(void *value_ptr, uint32_t *out)
+{
+    return cass_value_get_uint32((const CassValue*) value_ptr, out) == CASS_OK;
+}
+
+bool
+scylla_value_get_int64(void *value_ptr, int64_t *out)
+{
+    cass_int64_t result;
+
+    if (cass_value_get_int64((const CassValue*) value_ptr, &result) != CASS_OK)
+        return false;
+    *out = result;
+    return true;
+}
+
+bool
+scylla_value_get_float(void *value_ptr, float *out)
+{
+    return cass_value_get_float((const CassValue*) value_ptr, out) == CASS_OK;
+}
+
+bool
+scylla_value_get_double(void *value_ptr, double *out)
+{
+    return cass_value_get_double((const CassValue*) value_ptr, out) == CASS_OK;
+}
+
 const char *
-scylla_get_decimal(void *iterator_ptr, int col, bool *is_null)
+scylla_value_get_string(void *value_ptr, size_t *len)
 {
-    /* Decimal type returns varint + scale - convert to string */
-    CassIterator* iterator = (CassIterator*) iterator_ptr;
-    const CassRow* row = cass_iterator_get_row(iterator);
-    const CassValue* value = cass_row_get_column(row, col);
-    const cass_byte_t* varint;
-    size_t varint_size;
-    cass_int32_t scale;
+    const char* result;
 
-    *is_null = (cass_value_is_null(value) == cass_true);
-    if (*is_null)
+    if (cass_value_get_string((const CassValue*) value_ptr,
+                              &result, len) != CASS_OK)
         return NULL;
+    return result;
+}
 
-    cass_value_get_decimal(value, &varint, &varint_size, &scale);
-    
-    /* Decode varint to int64 (simplified for reasonable range) */
-    static char decimal_str[64];
-    
-    if (varint_size == 0) {
-        snprintf(decimal_str, sizeof(decimal_str), "0");
-        return decimal_str;
-    }
-    
-    /* Check if negative (high bit set) */
-    bool is_negative = (varint[0] & 0x80) != 0;
-    
-    /* Decode bytes as big-endian integer */
-    int64_t unscaled_value = 0;
-    
-    if (is_negative) {
-        /* Two's complement decoding */
-        for (size_t i = 0; i < varint_size && i < 8; i++) {
-            unscaled_value = (unscaled_value << 8) | (~varint[i] & 0xFF);
-        }
-        unscaled_value = -(unscaled_value + 1);
-    } else {
-        /* Positive number */
-        for (size_t i = 0; i < varint_size && i < 8; i++) {
-            unscaled_value = (unscaled_value << 8) | varint[i];
-        }
-    }
-    
-    /* Format with decimal point at the right place */
-    if (scale == 0) {
-        snprintf(decimal_str, sizeof(decimal_str), "%lld", (long long)unscaled_value);
-    } else {
-        /* Insert decimal point */
-        char temp[64];
-        snprintf(temp, sizeof(temp), "%lld", (long long)(unscaled_value < 0 ? -unscaled_value : unscaled_value));
-        int len = strlen(temp);
-        
-        if (scale >= len) {
-            /* Need leading zeros: 0.00123 */
-            char *p = decimal_str;
-            if (unscaled_value < 0) *p++ = '-';
-            *p++ = '0';
-            *p++ = '.';
-            for (int i = 0; i < scale - len; i++) {
-                *p++ = '0';
-            }
-            strcpy(p, temp);
-        } else {
-            /* Insert decimal point in the middle: 123.45 */
-            int int_digits = len - scale;
-            char *p = decimal_str;
-            if (unscaled_value < 0) *p++ = '-';
-            strncpy(p, temp, int_digits);
-            p += int_digits;
-            *p++ = '.';
-            strcpy(p, temp + int_digits);
-        }
-    }
-    
-    return decimal_str;
+const char *
+scylla_value_get_bytes(void *value_ptr, size_t *len)
+{
+    const cass_byte_t* result;
+
+    if (cass_value_get_bytes((const CassValue*) value_ptr,
+                             &result, len) != CASS_OK)
+        return NULL;
+    return (const char*) result;
+}
+
+bool
+scylla_value_get_uuid(void *value_ptr, unsigned char *out)
+{
+    CassUuid uuid;
+    uint64_t tv;
+    uint64_t csn;
+
+    if (cass_value_get_uuid((const CassValue*) value_ptr, &uuid) != CASS_OK)
+        return false;
+
+    /*
+     * Lay the two halves out in RFC 4122 byte order: time_and_version holds
+     * time_hi_and_version:time_mid:time_low, clock_seq_and_node the rest.
+     */
+    tv = uuid.time_and_version;
+    csn = uuid.clock_seq_and_node;
+    out[0] = (unsigned char) (tv >> 24);
+    out[1] = (unsigned char) (tv >> 16);
+    out[2] = (unsigned char) (tv >> 8);
+    out[3] = (unsigned char) tv;
+    out[4] = (unsigned char) (tv >> 40);
+    out[5] = (unsigned char) (tv >> 32);
+    out[6] = (unsigned char) (tv >> 56);
+    out[7] = (unsigned char) (tv >> 48);
+    for (int i = 0; i < 8; i++)
+        out[8 + i] = (unsigned char) (csn >> (56 - 8 * i));
+    return true;
+}
+
+bool
+scylla_value_get_inet(void *value_ptr, unsigned char *addr, int *len)
+{
+    CassInet inet;
+
+    if (cass_value_get_inet((const CassValue*) value_ptr, &inet) != CASS_OK)
+        return false;
+    memcpy(addr, inet.address, inet.address_length);
+    *len = inet.address_length;
+    return true;
+}
+
+bool
+scylla_value_get_decimal(void *value_ptr, const unsigned char **varint,
+                         size_t *len, int32_t *scale)
+{
+    const cass_byte_t* bytes;
+
+    if (cass_value_get_decimal((const CassValue*) value_ptr,
+                               &bytes, len, scale) != CASS_OK)
+        return false;
+    *varint = bytes;
+    return true;
+}
+
+bool
+scylla_value_get_varint(void *value_ptr, const unsigned char **varint,
+                        size_t *len)
+{
+    const cass_byte_t* bytes;
+
+    /* The driver has no varint accessor; the raw value is the varint */
+    if (cass_value_get_bytes((const CassValue*) value_ptr,
+                             &bytes, len) != CASS_OK)
+        return false;
+    *varint = bytes;
+    return true;
 }
 
 /*
@@ -623,167 +1172,224 @@ scylla_create_statement(void *prepared_ptr)
     return cass_prepared_bind(prepared);
 }
 
-void
+/*
+ * Encode an unsigned string of decimal digits, negated if negative, as a
+ * CQL varint: big-endian two's complement in as few bytes as possible
+ */
+static void
+encode_varint(const std::string& digits, bool negative,
+              std::vector<cass_byte_t>& out)
+{
+    std::vector<cass_byte_t> mag;   /* little-endian */
+
+    for (char c : digits) {
+        unsigned carry = c - '0';
+
+        for (cass_byte_t& b : mag) {
+            unsigned v = b * 10 + carry;
+
+            b = v & 0xFF;
+            carry = v >> 8;
+        }
+        for (; carry != 0; carry >>= 8)
+            mag.push_back(carry & 0xFF);
+    }
+
+    /* A zero byte on top leaves room for the sign bit */
+    mag.push_back(0);
+    if (negative) {
+        unsigned carry = 1;
+
+        for (cass_byte_t& b : mag) {
+            unsigned v = (cass_byte_t) ~b + carry;
+
+            b = v & 0xFF;
+            carry = v >> 8;
+        }
+    }
+
+    /* Drop the sign bytes the next byte's top bit makes redundant */
+    while (mag.size() > 1) {
+        cass_byte_t top = mag[mag.size() - 1];
+        cass_byte_t next = mag[mag.size() - 2];
+
+        if ((top == 0x00 && !(next & 0x80)) || (top == 0xFF && (next & 0x80)))
+            mag.pop_back();
+        else
+            break;
+    }
+
+    out.assign(mag.rbegin(), mag.rend());
+}
+
+bool
 scylla_bind_null(void *statement_ptr, int index)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_null(statement, index);
+    return cass_statement_bind_null(statement, index) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_bool(void *statement_ptr, int index, bool value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_bool(statement, index, value ? cass_true : cass_false);
+    return cass_statement_bind_bool(statement, index, value ? cass_true : cass_false) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_int32(void *statement_ptr, int index, int32_t value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_int32(statement, index, value);
+    return cass_statement_bind_int32(statement, index, value) == CASS_OK;
 }
 
-void
+/*
+ * smallint columns are imported from both CQL smallint and tinyint, so a
+ * value the driver won't take for the one is tried as the other.
+ */
+bool
+scylla_bind_int16(void *statement_ptr, int index, int16_t value)
+{
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    CassError rc = cass_statement_bind_int16(statement, index, value);
+
+    if (rc == CASS_ERROR_LIB_INVALID_VALUE_TYPE && value >= INT8_MIN &&
+        value <= INT8_MAX)
+        rc = cass_statement_bind_int8(statement, index, (cass_int8_t) value);
+    return rc == CASS_OK;
+}
+
+bool
 scylla_bind_uint32(void *statement_ptr, int index, uint32_t value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_uint32(statement, index, value);
+    return cass_statement_bind_uint32(statement, index, value) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_int64(void *statement_ptr, int index, int64_t value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_int64(statement, index, value);
+    return cass_statement_bind_int64(statement, index, value) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_float(void *statement_ptr, int index, float value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_float(statement, index, value);
+    return cass_statement_bind_float(statement, index, value) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_double(void *statement_ptr, int index, double value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_double(statement, index, value);
+    return cass_statement_bind_double(statement, index, value) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_string(void *statement_ptr, int index, const char *value, size_t len)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_string_n(statement, index, value, len);
+    return cass_statement_bind_string_n(statement, index, value, len) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_bytes(void *statement_ptr, int index, const char *value, size_t len)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_bytes(statement, index, (const cass_byte_t*) value, len);
+    return cass_statement_bind_bytes(statement, index, (const cass_byte_t*) value, len) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_uuid(void *statement_ptr, int index, const char *value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
     CassUuid uuid;
-    cass_uuid_from_string(value, &uuid);
-    cass_statement_bind_uuid(statement, index, uuid);
+
+    if (cass_uuid_from_string(value, &uuid) != CASS_OK)
+        return false;
+    return cass_statement_bind_uuid(statement, index, uuid) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_timestamp(void *statement_ptr, int index, int64_t value)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    cass_statement_bind_int64(statement, index, value);
+    return cass_statement_bind_int64(statement, index, value) == CASS_OK;
 }
 
-void
+bool
 scylla_bind_decimal(void *statement_ptr, int index, const char *decimal_str)
 {
     CassStatement* statement = (CassStatement*) statement_ptr;
-    
-    /* Parse decimal string to extract scale and unscaled value */
-    /* For example: "195.00" -> scale=2, unscaled=19500 */
-    const char *dot = strchr(decimal_str, '.');
+    std::vector<cass_byte_t> varint;
+    std::string digits;
     cass_int32_t scale = 0;
-    std::string unscaled_str = decimal_str;
-    
-    if (dot != NULL) {
-        /* Calculate scale (number of digits after decimal point) */
-        scale = strlen(dot + 1);
-        /* Remove the decimal point to get unscaled value */
-        std::string before_dot(decimal_str, dot - decimal_str);
-        std::string after_dot(dot + 1);
-        unscaled_str = before_dot + after_dot;
-    }
-    
-    /* Handle negative numbers */
-    bool is_negative = false;
-    if (unscaled_str[0] == '-') {
-        is_negative = true;
-        unscaled_str = unscaled_str.substr(1);
-    }
-    
-    /* Convert unscaled value string to int64 */
-    int64_t unscaled_value = strtoll(unscaled_str.c_str(), NULL, 10);
-    if (is_negative) {
-        unscaled_value = -unscaled_value;
+    bool negative = false;
+    bool seen_dot = false;
+    bool integral = true;
+    const char *p = decimal_str;
+    CassError rc;
+
+    /*
+     * numeric_out gives [-]digits[.digits]: the unscaled value is all the
+     * digits, the scale the number of them after the point.  NaN and the
+     * infinities have no CQL decimal form.
+     */
+    if (*p == '-') {
+        negative = true;
+        p++;
     }
-    
-    /* Encode as varint bytes (simple implementation for int64 range) */
-    /* This is a simplified big-endian encoding */
-    cass_byte_t varint[9];  /* Max 9 bytes for int64 */
-    int varint_size = 0;
-    
-    if (unscaled_value == 0) {
-        varint[0] = 0;
-        varint_size = 1;
-    } else {
-        uint64_t abs_val = (unscaled_value < 0) ? -unscaled_value : unscaled_value;
-        bool is_neg = (unscaled_value < 0);
-        
-        /* Encode in big-endian */
-        varint_size = 8;
-        for (int i = 7; i >= 0; i--) {
-            varint[7 - i] = (abs_val >> (i * 8)) & 0xFF;
-        }
-        
-        /* Remove leading zeros */
-        int start = 0;
-        while (start < 7 && varint[start] == 0) {
-            start++;
-        }
-        varint_size = 8 - start;
-        
-        /* Shift bytes to start */
-        if (start > 0) {
-            for (int i = 0; i < varint_size; i++) {
-                varint[i] = varint[start + i];
-            }
-        }
-        
-        /* Handle two's complement for negative numbers */
-        if (is_neg) {
-            /* Two's complement: invert bits and add 1 */
-            for (int i = 0; i < varint_size; i++) {
-                varint[i] = ~varint[i];
-            }
-            /* Add 1 */
-            int carry = 1;
-            for (int i = varint_size - 1; i >= 0 && carry; i--) {
-                int sum = varint[i] + carry;
-                varint[i] = sum & 0xFF;
-                carry = sum >> 8;
+    for (; *p; p++) {
+        if (*p >= '0' && *p <= '9') {
+            if (seen_dot) {
+                scale++;
+                integral = integral && *p == '0';
             }
+            digits += *p;
+        } else if (*p == '.' && !seen_dot) {
+            seen_dot = true;
+        } else {
+            return false;
         }
     }
-    
-    cass_statement_bind_decimal(statement, index, varint, varint_size, scale);
+    if (digits.empty())
+        return false;
+
+    encode_varint(digits, negative, varint);
+    rc = cass_statement_bind_decimal(statement, index, varint.data(),
+                                     varint.size(), scale);
+
+    /*
+     * numeric columns are also imported from CQL varint, which cassandra.h
+     * binds as bytes.  Only whole numbers fit.
+     */
+    if (rc == CASS_ERROR_LIB_INVALID_VALUE_TYPE && integral) {
+        digits.resize(digits.size() - scale);
+        if (digits.empty())
+            digits = "0";
+        encode_varint(digits, negative, varint);
+        rc = cass_statement_bind_bytes(statement, index, varint.data(),
+                                       varint.size());
+    }
+    return rc == CASS_OK;
+}
+
+bool
+scylla_bind_inet(void *statement_ptr, int index, const unsigned char *addr,
+                 int len)
+{
+    CassStatement* statement = (CassStatement*) statement_ptr;
+    CassInet inet;
+
+    if (len == 4)
+        inet = cass_inet_init_v4(addr);
+    else if (len == 16)
+        inet = cass_inet_init_v6(addr);
+    else
+        return false;
+    return cass_statement_bind_inet(statement, index, inet) == CASS_OK;
 }
 
 void
@@ -793,6 +1399,59 @@ scylla_free_statement(void *statement_ptr)
         cass_statement_free((CassStatement*) statement_ptr);
 }
 
+/*
+ * Batches
+ */
+
+void *
+scylla_create_batch(bool logged)
+{
+    return cass_batch_new(logged ? CASS_BATCH_TYPE_LOGGED
+                                 : CASS_BATCH_TYPE_UNLOGGED);
+}
+
+bool
+scylla_batch_add_statement(void *batch_ptr, void *statement_ptr)
+{
+    CassBatch* batch = (CassBatch*) batch_ptr;
+    CassStatement* statement = (CassStatement*) statement_ptr;
+
+    /* The batch keeps its own reference; the statement may be freed after */
+    return cass_batch_add_statement(batch, statement) == CASS_OK;
+}
+
+void
+scylla_batch_set_idempotent(void *batch_ptr, bool idempotent)
+{
+    CassBatch* batch = (CassBatch*) batch_ptr;
+    cass_batch_set_is_idempotent(batch, idempotent ? cass_true : cass_false);
+}
+
+void
+scylla_batch_set_serial_consistency(void *batch_ptr, int serial_consistency)
+{
+    CassBatch* batch = (CassBatch*) batch_ptr;
+    cass_batch_set_serial_consistency(batch, (CassConsistency) serial_consistency);
+}
+
+void *
+scylla_execute_batch_async(void *conn_ptr, void *batch_ptr, int consistency)
+{
+    ScyllaConnection* conn = (ScyllaConnection*) conn_ptr;
+    CassBatch* batch = (CassBatch*) batch_ptr;
+
+    cass_batch_set_consistency(batch, (CassConsistency) consistency);
+
+    return (void*) cass_session_execute_batch(conn->session, batch);
+}
+
+void
+scylla_free_batch(void *batch_ptr)
+{
+    if (batch_ptr != NULL)
+        cass_batch_free((CassBatch*) batch_ptr);
+}
+
 /*
  * Utility functions
  */
@@ -833,6 +1492,15 @@ scylla_string_to_consistency(const char *str)
     return -1;
 }
 
+int
+scylla_string_to_retry_policy(const char *str)
+{
+    if (strcasecmp(str, "default") == 0)      return SCYLLA_RETRY_DEFAULT;
+    if (strcasecmp(str, "fallthrough") == 0)  return SCYLLA_RETRY_FALLTHROUGH;
+    if (strcasecmp(str, "downgrading") == 0)  return SCYLLA_RETRY_DOWNGRADING;
+    return -1;
+}
+
 int64_t
 scylla_result_row_count(void *result_ptr)
 {
@@ -15,17 +15,24 @@
 #include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "access/table.h"
+#include "catalog/dependency.h"
+#include "catalog/pg_aggregate.h"
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "commands/extension.h"
+#include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/primnodes.h"
 #include "optimizer/optimizer.h"
 #include "parser/parsetree.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
 #include "utils/date.h"
 #include "utils/datetime.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/numeric.h"
 #include "utils/syscache.h"
@@ -41,7 +48,7 @@ typedef struct DeparseContext
     PlannerInfo *root;          /* Planner info */
     RelOptInfo  *foreignrel;    /* Foreign relation */
     RelOptInfo  *scanrel;       /* Scan relation */
-    List       *params_list;    /* List of param references */
+    List      **params_list;    /* exprs sent as bind markers, or NULL */
     bool        can_pushdown;   /* Can this expr be pushed down? */
 } DeparseContext;
 
@@ -53,13 +60,46 @@ static void deparseBoolExpr(BoolExpr *node, DeparseContext *context);
 static void deparseOpExpr(OpExpr *node, DeparseContext *context);
 static void deparseNullTest(NullTest *node, DeparseContext *context);
 static void deparseRelabelType(RelabelType *node, DeparseContext *context);
+static void deparseFuncExpr(FuncExpr *node, DeparseContext *context);
+static void deparseRowCompareExpr(RowCompareExpr *node,
+                                  DeparseContext *context);
+static void deparseCollectionOpExpr(OpExpr *node, const char *cql_op,
+                                    DeparseContext *context);
+static void deparseScalarArrayOpExpr(ScalarArrayOpExpr *node,
+                                     DeparseContext *context);
+static void deparseOperand(Expr *node, Expr *column, DeparseContext *context);
+static bool is_scanrel_column(Expr *node, DeparseContext *context);
+static bool is_foreign_column(PlannerInfo *root, RelOptInfo *baserel,
+                              Expr *node);
+static bool is_foreign_param(Expr *node);
+static bool is_foreign_value(PlannerInfo *root, RelOptInfo *baserel,
+                             Expr *node, Expr *column);
+static bool is_foreign_row_compare(PlannerInfo *root, RelOptInfo *baserel,
+                                   RowCompareExpr *rc);
+static bool is_token_call(Expr *node, RelOptInfo *baserel);
+static bool is_token_restriction(Expr *clause, RelOptInfo *baserel);
+static bool clause_references_columns(Expr *clause, RelOptInfo *baserel,
+                                      List *attnums);
+static const char *get_cql_collection_operator(OpExpr *op,
+                                               RelOptInfo *baserel);
+static bool contain_param_walker(Node *node, void *context);
 static bool is_pushdown_safe_type(Oid typeid);
+static bool is_pushdown_safe_array(Const *node);
 static const char *get_cql_operator(Oid opno);
 static char *cql_quote_literal(const char *str);
 static char *cql_quote_identifier(const char *ident);
+static void deparse_where_conds(StringInfo buf, PlannerInfo *root,
+                                RelOptInfo *baserel, List *conds,
+                                List **params_list);
+static void deparse_lwt_conds(StringInfo buf, PlannerInfo *root,
+                              ScyllaFdwRelationInfo *fpinfo,
+                              RelOptInfo *baserel, List *if_conds);
 static bool needs_allow_filtering(PlannerInfo *root, RelOptInfo *baserel,
                                    ScyllaFdwRelationInfo *fpinfo,
-                                   List *remote_conds, Relation rel);
+                                   List *remote_conds);
+static bool aggregate_cql_form(RelOptInfo *scanrel, Aggref *agg,
+                               const char **fname, const char **cast,
+                               Var **arg);
 
 /*
  * We don't use a hardcoded operator table because operator OIDs can vary.
@@ -120,6 +160,15 @@ scylla_extract_options(List *server_opts, List *table_opts,
     fpinfo->primary_key = NULL;
     fpinfo->clustering_key = NULL;
     fpinfo->consistency = DEFAULT_CONSISTENCY;
+    fpinfo->fetch_size = DEFAULT_FETCH_SIZE;
+    fpinfo->prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    fpinfo->lookup_concurrency = DEFAULT_LOOKUP_CONCURRENCY;
+    fpinfo->rescan_cache_size = DEFAULT_RESCAN_CACHE_SIZE;
+    fpinfo->use_remote_estimate = false;
+    fpinfo->async_capable = false;
+    fpinfo->direct_modify_if_exists = false;
+    fpinfo->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
+    fpinfo->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
 
     /* Process server options */
     foreach(lc, server_opts)
@@ -132,9 +181,27 @@ scylla_extract_options(List *server_opts, List *table_opts,
             fpinfo->port = atoi(defGetString(def));
         else if (strcmp(def->defname, OPT_CONSISTENCY) == 0)
             fpinfo->consistency = defGetString(def);
+        else if (strcmp(def->defname, OPT_FETCH_SIZE) == 0)
+            fpinfo->fetch_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_PREFETCH_DEPTH) == 0)
+            fpinfo->prefetch_depth = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_LOOKUP_CONCURRENCY) == 0)
+            fpinfo->lookup_concurrency = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_RESCAN_CACHE_SIZE) == 0)
+            fpinfo->rescan_cache_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_USE_REMOTE_ESTIMATE) == 0)
+            fpinfo->use_remote_estimate = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_ASYNC_CAPABLE) == 0)
+            fpinfo->async_capable = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_DIRECT_MODIFY_IF_EXISTS) == 0)
+            fpinfo->direct_modify_if_exists = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_FDW_STARTUP_COST) == 0)
+            fpinfo->fdw_startup_cost = strtod(defGetString(def), NULL);
+        else if (strcmp(def->defname, OPT_FDW_TUPLE_COST) == 0)
+            fpinfo->fdw_tuple_cost = strtod(defGetString(def), NULL);
     }
 
-    /* Process table options */
+    /* Process table options (these override server options) */
     foreach(lc, table_opts)
     {
         DefElem *def = (DefElem *) lfirst(lc);
@@ -147,6 +214,20 @@ scylla_extract_options(List *server_opts, List *table_opts,
             fpinfo->primary_key = defGetString(def);
         else if (strcmp(def->defname, OPT_CLUSTERING_KEY) == 0)
             fpinfo->clustering_key = defGetString(def);
+        else if (strcmp(def->defname, OPT_FETCH_SIZE) == 0)
+            fpinfo->fetch_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_PREFETCH_DEPTH) == 0)
+            fpinfo->prefetch_depth = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_LOOKUP_CONCURRENCY) == 0)
+            fpinfo->lookup_concurrency = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_RESCAN_CACHE_SIZE) == 0)
+            fpinfo->rescan_cache_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_USE_REMOTE_ESTIMATE) == 0)
+            fpinfo->use_remote_estimate = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_ASYNC_CAPABLE) == 0)
+            fpinfo->async_capable = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_DIRECT_MODIFY_IF_EXISTS) == 0)
+            fpinfo->direct_modify_if_exists = defGetBoolean(def);
     }
 
     /* Process user options */
@@ -164,12 +245,23 @@ scylla_extract_options(List *server_opts, List *table_opts,
 /*
  * scylla_classify_conditions
  *        Classify restriction clauses into pushdown and local categories
+ *
+ * Each clause is checked on its own first.  CQL then refuses some
+ * combinations of restrictions that are fine individually: a token()
+ * restriction can't be mixed with a regular one on the partition key, nor
+ * a multi-column restriction on the clustering key with single-column
+ * ones.  The partition key and single clustering column conditions give
+ * way in these cases and are checked locally instead.
  */
 void
 scylla_classify_conditions(PlannerInfo *root, RelOptInfo *baserel,
                            List *input_conds, List **remote_conds,
                            List **local_conds)
 {
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    bool        has_token = false;
+    bool        has_row_compare = false;
+    List       *candidates = NIL;
     ListCell   *lc;
 
     *remote_conds = NIL;
@@ -180,6 +272,30 @@ scylla_classify_conditions(PlannerInfo *root, RelOptInfo *baserel,
         RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
 
         if (scylla_is_foreign_expr(root, baserel, ri->clause))
+        {
+            candidates = lappend(candidates, ri);
+            if (is_token_restriction(ri->clause, baserel))
+                has_token = true;
+            else if (IsA(ri->clause, RowCompareExpr))
+                has_row_compare = true;
+        }
+        else
+            *local_conds = lappend(*local_conds, ri);
+    }
+
+    foreach(lc, candidates)
+    {
+        RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+        bool        remote = true;
+
+        if (has_token && !is_token_restriction(ri->clause, baserel) &&
+            clause_references_columns(ri->clause, baserel, fpinfo->pk_attrs))
+            remote = false;
+        if (has_row_compare && !IsA(ri->clause, RowCompareExpr) &&
+            clause_references_columns(ri->clause, baserel, fpinfo->ck_attrs))
+            remote = false;
+
+        if (remote)
             *remote_conds = lappend(*remote_conds, ri);
         else
             *local_conds = lappend(*local_conds, ri);
@@ -196,8 +312,12 @@ scylla_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr)
     /*
      * ScyllaDB has limited WHERE clause support compared to PostgreSQL.
      * We can push down:
-     *  - Equality conditions on partition key columns (required)
-     *  - Range conditions on clustering key columns
+     *  - Comparisons of a column with a constant or a parameter
+     *  - Comparisons of scylla_token() of the partition key, as token()
+     *  - IN lists on partition key and clustering key columns
+     *  - Row comparisons on a prefix of the clustering key
+     *  - Array containment (@>) as CONTAINS, jsonb key existence (?) as
+     *    CONTAINS KEY
      *  - Simple boolean expressions combining the above
      *
      * We cannot push down:
@@ -231,19 +351,41 @@ scylla_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr)
         case T_OpExpr:
             {
                 OpExpr *op = (OpExpr *) expr;
-                ListCell *lc;
+                const char *cql_op;
+                Expr       *column;
+                Expr       *value;
+
+                if (list_length(op->args) != 2)
+                    return false;
+
+                if (get_cql_collection_operator(op, baserel) != NULL)
+                    return true;
 
                 /* Check if operator is supported */
-                if (get_cql_operator(op->opno) == NULL)
+                cql_op = get_cql_operator(op->opno);
+                if (cql_op == NULL)
                     return false;
 
-                /* Check all arguments */
-                foreach(lc, op->args)
+                /*
+                 * CQL compares a column (or the partition key token) with a
+                 * value; the deparser puts the column first if need be.
+                 */
+                column = linitial(op->args);
+                value = lsecond(op->args);
+                if (!is_foreign_column(root, baserel, column) &&
+                    !is_token_call(column, baserel))
                 {
-                    if (!scylla_is_foreign_expr(root, baserel, lfirst(lc)))
+                    column = lsecond(op->args);
+                    value = linitial(op->args);
+                    if (!is_foreign_column(root, baserel, column) &&
+                        !is_token_call(column, baserel))
                         return false;
                 }
-                return true;
+
+                if (is_token_call(column, baserel) && strcmp(cql_op, "!=") == 0)
+                    return false;
+
+                return is_foreign_value(root, baserel, value, column);
             }
 
         case T_BoolExpr:
@@ -263,6 +405,84 @@ scylla_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr)
                 return true;
             }
 
+        case T_ScalarArrayOpExpr:
+            {
+                ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) expr;
+                ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+                const char *cql_op;
+                Expr       *left;
+                Expr       *values;
+                AttrNumber  attnum;
+
+                /*
+                 * "col = ANY(array)" becomes "col IN (...)".  CQL accepts
+                 * IN on primary key columns only.
+                 */
+                if (!saop->useOr || list_length(saop->args) != 2)
+                    return false;
+
+                cql_op = get_cql_operator(saop->opno);
+                if (cql_op == NULL || strcmp(cql_op, "=") != 0)
+                    return false;
+
+                left = linitial(saop->args);
+                if (!is_foreign_column(root, baserel, left))
+                    return false;
+
+                if (fpinfo == NULL)
+                    return false;
+                if (IsA(left, RelabelType))
+                    left = ((RelabelType *) left)->arg;
+                attnum = ((Var *) left)->varattno;
+                if (!list_member_int(fpinfo->pk_attrs, attnum) &&
+                    !list_member_int(fpinfo->ck_attrs, attnum))
+                    return false;
+
+                /*
+                 * The values are either a constant array, a list of
+                 * constants and parameters (as in "col IN ($1, $2)"), which
+                 * are bound as one marker each, or an array parameter,
+                 * bound as one marker per element.
+                 */
+                values = lsecond(saop->args);
+                if (IsA(values, Const))
+                    return is_pushdown_safe_array((Const *) values);
+                if (IsA(values, Param))
+                {
+                    Param      *param = (Param *) values;
+                    Oid         elemtype = get_element_type(param->paramtype);
+
+                    return (param->paramkind == PARAM_EXTERN ||
+                            param->paramkind == PARAM_EXEC) &&
+                        elemtype == exprType((Node *) linitial(saop->args)) &&
+                        is_pushdown_safe_type(elemtype) &&
+                        scylla_is_bindable_type(elemtype);
+                }
+                if (IsA(values, ArrayExpr))
+                {
+                    ArrayExpr  *arr = (ArrayExpr *) values;
+                    ListCell   *lc;
+
+                    if (arr->multidims || arr->elements == NIL ||
+                        arr->element_typeid != exprType((Node *) linitial(saop->args)) ||
+                        !scylla_is_bindable_type(arr->element_typeid))
+                        return false;
+
+                    foreach(lc, arr->elements)
+                    {
+                        Expr       *elem = (Expr *) lfirst(lc);
+
+                        if (!(IsA(elem, Const) || is_foreign_param(elem)))
+                            return false;
+                    }
+                    return true;
+                }
+                return false;
+            }
+
+        case T_RowCompareExpr:
+            return is_foreign_row_compare(root, baserel, (RowCompareExpr *) expr);
+
         case T_NullTest:
             /* ScyllaDB doesn't support IS NULL / IS NOT NULL in WHERE */
             return false;
@@ -278,15 +498,319 @@ scylla_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr)
     }
 }
 
+/*
+ * is_foreign_column
+ *        Check if an expression is a pushdown-safe column of baserel
+ */
+static bool
+is_foreign_column(PlannerInfo *root, RelOptInfo *baserel, Expr *node)
+{
+    if (node != NULL && IsA(node, RelabelType))
+        node = ((RelabelType *) node)->arg;
+
+    return node != NULL && IsA(node, Var) &&
+        ((Var *) node)->varlevelsup == 0 &&
+        scylla_is_foreign_expr(root, baserel, node);
+}
+
+/*
+ * is_foreign_param
+ *        Check if an expression is a Param whose value can be bound
+ *
+ * Parameters of a prepared statement, and those set by an initplan or the
+ * outer side of a nested loop, are known when the scan starts.
+ */
+static bool
+is_foreign_param(Expr *node)
+{
+    Param      *param;
+
+    if (node == NULL || !IsA(node, Param))
+        return false;
+
+    param = (Param *) node;
+    return (param->paramkind == PARAM_EXTERN ||
+            param->paramkind == PARAM_EXEC) &&
+        is_pushdown_safe_type(param->paramtype) &&
+        scylla_is_bindable_type(param->paramtype);
+}
+
+/*
+ * is_foreign_value
+ *        Check if an expression can be compared with column in CQL
+ *
+ * Constants may be of another type, as they can be inlined as literals.
+ * Parameters are sent as bind markers, bound using the conversion for
+ * their own type, which must therefore be the column's.
+ */
+static bool
+is_foreign_value(PlannerInfo *root, RelOptInfo *baserel, Expr *node,
+                 Expr *column)
+{
+    if (node != NULL && IsA(node, RelabelType))
+        node = ((RelabelType *) node)->arg;
+    if (node == NULL)
+        return false;
+
+    if (IsA(node, Const))
+        return scylla_is_foreign_expr(root, baserel, node);
+
+    return is_foreign_param(node) &&
+        exprType((Node *) node) == exprType((Node *) column);
+}
+
+/*
+ * is_token_call
+ *        Check if an expression is scylla_token() of baserel's partition key
+ *
+ * The arguments must be the partition key columns, in primary_key order,
+ * for it to be sent as CQL's token().
+ */
+static bool
+is_token_call(Expr *node, RelOptInfo *baserel)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    FuncExpr   *func;
+    char       *fname;
+    Oid         extoid;
+    ListCell   *lc;
+    ListCell   *lc2;
+
+    if (node == NULL || !IsA(node, FuncExpr) ||
+        fpinfo == NULL || fpinfo->pk_attrs == NIL)
+        return false;
+
+    func = (FuncExpr *) node;
+    if (list_length(func->args) != list_length(fpinfo->pk_attrs))
+        return false;
+
+    fname = get_func_name(func->funcid);
+    if (fname == NULL || strcmp(fname, "scylla_token") != 0)
+        return false;
+    extoid = get_extension_oid("scylla_fdw", true);
+    if (!OidIsValid(extoid) ||
+        getExtensionOfObject(ProcedureRelationId, func->funcid) != extoid)
+        return false;
+
+    forboth(lc, func->args, lc2, fpinfo->pk_attrs)
+    {
+        Expr       *arg = (Expr *) lfirst(lc);
+
+        if (IsA(arg, RelabelType))
+            arg = ((RelabelType *) arg)->arg;
+        if (!IsA(arg, Var) || ((Var *) arg)->varlevelsup != 0 ||
+            !bms_is_member(((Var *) arg)->varno, baserel->relids) ||
+            ((Var *) arg)->varattno != lfirst_int(lc2))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * is_token_restriction
+ *        Check if a clause compares the partition key token
+ */
+static bool
+is_token_restriction(Expr *clause, RelOptInfo *baserel)
+{
+    OpExpr     *op;
+
+    if (clause == NULL || !IsA(clause, OpExpr))
+        return false;
+
+    op = (OpExpr *) clause;
+    return list_length(op->args) == 2 &&
+        (is_token_call(linitial(op->args), baserel) ||
+         is_token_call(lsecond(op->args), baserel));
+}
+
+/*
+ * scylla_conds_restrict_token
+ *        Check if conds include a restriction on the partition key token
+ *
+ * conds may contain bare clauses or RestrictInfos.
+ */
+bool
+scylla_conds_restrict_token(RelOptInfo *baserel, List *conds)
+{
+    ListCell   *lc;
+
+    foreach(lc, conds)
+    {
+        Expr       *expr = (Expr *) lfirst(lc);
+
+        if (expr != NULL && IsA(expr, RestrictInfo))
+            expr = ((RestrictInfo *) expr)->clause;
+        if (is_token_restriction(expr, baserel))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * is_foreign_row_compare
+ *        Check if a row comparison is a CQL multi-column slice
+ *
+ * CQL accepts "(c1, c2, ...) > (v1, v2, ...)" when c1, c2, ... are the
+ * leading clustering key columns, in order.  It compares them in
+ * clustering order, which only matches PostgreSQL's for types that sort
+ * the same way in both.
+ */
+static bool
+is_foreign_row_compare(PlannerInfo *root, RelOptInfo *baserel,
+                       RowCompareExpr *rc)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    const char *cql_op = NULL;
+    ListCell   *ck;
+    ListCell   *lc;
+    ListCell   *lc2;
+    ListCell   *lc3;
+    ListCell   *lc4;
+
+    if (fpinfo == NULL ||
+        list_length(rc->largs) > list_length(fpinfo->ck_attrs))
+        return false;
+
+    ck = list_head(fpinfo->ck_attrs);
+    forfour(lc, rc->largs, lc2, rc->rargs, lc3, rc->opnos, lc4, rc->inputcollids)
+    {
+        Expr       *column = (Expr *) lfirst(lc);
+        Expr       *var = column;
+        const char *op = get_cql_operator(lfirst_oid(lc3));
+
+        if (op == NULL || strcmp(op, "=") == 0 || strcmp(op, "!=") == 0 ||
+            (cql_op != NULL && strcmp(op, cql_op) != 0))
+            return false;
+        cql_op = op;
+
+        if (!is_foreign_column(root, baserel, column))
+            return false;
+        if (IsA(var, RelabelType))
+            var = ((RelabelType *) var)->arg;
+        if (((Var *) var)->varattno != lfirst_int(ck))
+            return false;
+        if (!is_cql_sort_compatible(((Var *) var)->vartype, lfirst_oid(lc4)))
+            return false;
+
+        if (IsA(lfirst(lc2), Const) && ((Const *) lfirst(lc2))->constisnull)
+            return false;
+        if (!is_foreign_value(root, baserel, (Expr *) lfirst(lc2), column))
+            return false;
+
+        ck = lnext(fpinfo->ck_attrs, ck);
+    }
+
+    return true;
+}
+
+/*
+ * get_cql_collection_operator
+ *        Get the CQL collection operator an OpExpr maps to, or NULL
+ *
+ * "col @> ARRAY[v, ...]" on an array column becomes "col CONTAINS v AND
+ * ...", and "col ? 'k'" on a jsonb column, holding a map, becomes "col
+ * CONTAINS KEY 'k'".  The values are inlined as literals.
+ */
+static const char *
+get_cql_collection_operator(OpExpr *op, RelOptInfo *baserel)
+{
+    HeapTuple   tuple;
+    Form_pg_operator oprform;
+    char        opname[NAMEDATALEN];
+    Expr       *column;
+    Expr       *value;
+    Oid         coltype;
+
+    if (list_length(op->args) != 2)
+        return NULL;
+
+    column = linitial(op->args);
+    value = lsecond(op->args);
+    if (IsA(column, RelabelType))
+        column = ((RelabelType *) column)->arg;
+    if (!IsA(column, Var) || ((Var *) column)->varlevelsup != 0 ||
+        ((Var *) column)->varattno <= 0 ||
+        !bms_is_member(((Var *) column)->varno, baserel->relids))
+        return NULL;
+    if (IsA(value, RelabelType))
+        value = ((RelabelType *) value)->arg;
+    if (!IsA(value, Const) || ((Const *) value)->constisnull)
+        return NULL;
+
+    tuple = SearchSysCache1(OPEROID, ObjectIdGetDatum(op->opno));
+    if (!HeapTupleIsValid(tuple))
+        return NULL;
+    oprform = (Form_pg_operator) GETSTRUCT(tuple);
+    if (oprform->oprnamespace != PG_CATALOG_NAMESPACE)
+    {
+        ReleaseSysCache(tuple);
+        return NULL;
+    }
+    strlcpy(opname, NameStr(oprform->oprname), NAMEDATALEN);
+    ReleaseSysCache(tuple);
+
+    coltype = ((Var *) column)->vartype;
+    if (strcmp(opname, "@>") == 0 &&
+        is_pushdown_safe_type(get_element_type(coltype)) &&
+        ((Const *) value)->consttype == coltype &&
+        is_pushdown_safe_array((Const *) value))
+        return "CONTAINS";
+    if (strcmp(opname, "?") == 0 && coltype == JSONBOID &&
+        ((Const *) value)->consttype == TEXTOID)
+        return "CONTAINS KEY";
+
+    return NULL;
+}
+
+/*
+ * clause_references_columns
+ *        Check if a clause references any of the given columns of baserel
+ */
+static bool
+clause_references_columns(Expr *clause, RelOptInfo *baserel, List *attnums)
+{
+    Bitmapset  *attrs = NULL;
+    ListCell   *lc;
+
+    pull_varattnos((Node *) clause, baserel->relid, &attrs);
+    foreach(lc, attnums)
+    {
+        if (bms_is_member(lfirst_int(lc) - FirstLowInvalidHeapAttributeNumber,
+                          attrs))
+            return true;
+    }
+
+    return false;
+}
+
 /*
  * scylla_build_select_query
  *        Build CQL SELECT query for a foreign table scan
+ *
+ * If token_range is true, the query is restricted to a range of partition
+ * key tokens with "token(pk) > ? AND token(pk) <= ?".  These are always the
+ * first two bind markers of the query; parallel scans bind a different
+ * range for each chunk of the ring.
+ *
+ * Values that are not known until execution, such as the outer side of a
+ * join clause in a parameterized scan, are also sent as bind markers.  The
+ * corresponding expressions are returned in *params_list, in marker order
+ * (after the token range markers, if any).
+ *
+ * pathkeys, if not NIL, must have been accepted by scylla_clustering_order;
+ * limit, if positive, is sent as a CQL LIMIT.
  */
 char *
 scylla_build_select_query(PlannerInfo *root, RelOptInfo *baserel,
                           ScyllaFdwRelationInfo *fpinfo,
                           List *tlist, List *remote_conds,
-                          List **retrieved_attrs)
+                          bool token_range,
+                          List *pathkeys, int limit,
+                          List **retrieved_attrs,
+                          List **params_list)
 {
     StringInfoData buf;
     RangeTblEntry *rte;
@@ -296,6 +820,7 @@ scylla_build_select_query(PlannerInfo *root, RelOptInfo *baserel,
     int         i;
 
     *retrieved_attrs = NIL;
+    *params_list = NIL;
 
     rte = planner_rt_fetch(baserel->relid, root);
     rel = table_open(rte->relid, NoLock);
@@ -347,33 +872,68 @@ scylla_build_select_query(PlannerInfo *root, RelOptInfo *baserel,
                      cql_quote_identifier(fpinfo->table));
 
     /* WHERE */
-    if (remote_conds != NIL)
+    first = true;
+    if (token_range)
     {
-        appendStringInfoString(&buf, " WHERE ");
-        first = true;
+        StringInfoData tokbuf;
 
-        foreach(lc, remote_conds)
+        initStringInfo(&tokbuf);
+        foreach(lc, fpinfo->pk_attrs)
         {
-            Expr *expr = (Expr *) lfirst(lc);
-            DeparseContext context;
+            Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel),
+                                                   lfirst_int(lc) - 1);
 
-            if (!first)
-                appendStringInfoString(&buf, " AND ");
+            if (tokbuf.len > 0)
+                appendStringInfoString(&tokbuf, ", ");
+            appendStringInfoString(&tokbuf,
+                                   cql_quote_identifier(NameStr(attr->attname)));
+        }
+
+        appendStringInfo(&buf, " WHERE token(%s) > ? AND token(%s) <= ?",
+                         tokbuf.data, tokbuf.data);
+        pfree(tokbuf.data);
+        first = false;
+    }
+
+    if (remote_conds != NIL)
+    {
+        appendStringInfoString(&buf, first ? " WHERE " : " AND ");
+        deparse_where_conds(&buf, root, baserel, remote_conds, params_list);
+    }
+
+    /* ORDER BY */
+    if (pathkeys != NIL)
+    {
+        bool        reversed;
+        List       *order_attrs;
+        ListCell   *lc2;
 
-            context.buf = &buf;
-            context.root = root;
-            context.foreignrel = baserel;
-            context.scanrel = baserel;
-            context.params_list = NIL;
-            context.can_pushdown = true;
+        order_attrs = scylla_clustering_order(root, baserel, pathkeys,
+                                              &reversed);
+        Assert(order_attrs != NIL);
 
-            deparseExpr(expr, &context);
+        /* The order attributes are the leading clustering columns */
+        first = true;
+        forboth(lc, order_attrs, lc2, fpinfo->ck_desc)
+        {
+            Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel),
+                                                   lfirst_int(lc) - 1);
+            bool        desc = (lfirst_int(lc2) != 0) != reversed;
+
+            appendStringInfoString(&buf, first ? " ORDER BY " : ", ");
+            appendStringInfo(&buf, "%s %s",
+                             cql_quote_identifier(NameStr(attr->attname)),
+                             desc ? "DESC" : "ASC");
             first = false;
         }
     }
 
+    /* LIMIT */
+    if (limit > 0)
+        appendStringInfo(&buf, " LIMIT %d", limit);
+
     /* Check if we need ALLOW FILTERING */
-    if (needs_allow_filtering(root, baserel, fpinfo, remote_conds, rel))
+    if (needs_allow_filtering(root, baserel, fpinfo, remote_conds))
     {
         appendStringInfoString(&buf, " ALLOW FILTERING");
     }
@@ -384,82 +944,569 @@ scylla_build_select_query(PlannerInfo *root, RelOptInfo *baserel,
 }
 
 /*
- * scylla_build_insert_query
- *        Build CQL INSERT query
+ * scylla_build_direct_update_query
+ *        Build a CQL UPDATE for a directly modified foreign table
+ *
+ * targetAttrs and targetlist come from get_translated_update_targetlist;
+ * every new value must be pushdown-safe and every pinned key condition
+ * must be in key_conds (see scylla_conds_pin_primary_key).  if_conds are
+ * sent as the IF clause of a lightweight transaction (see
+ * scylla_split_lwt_conds).  Without any, the command is a plain UPDATE,
+ * unless direct_modify_if_exists asks for IF EXISTS (see
+ * deparse_lwt_conds).
  */
 char *
-scylla_build_insert_query(Relation rel, List *target_attrs)
+scylla_build_direct_update_query(PlannerInfo *root, RelOptInfo *baserel,
+                                 ScyllaFdwRelationInfo *fpinfo,
+                                 List *targetAttrs, List *targetlist,
+                                 List *key_conds, List *if_conds)
 {
     StringInfoData buf;
-    TupleDesc   tupdesc = RelationGetDescr(rel);
-    bool        first;
-    int         attnum;
-    int         i;
-    ForeignTable *table;
-    char       *keyspace = NULL;
-    char       *tablename = NULL;
+    RangeTblEntry *rte = planner_rt_fetch(baserel->relid, root);
     ListCell   *lc;
-    int         num_attrs;
-    Form_pg_attribute attr;
-
-    table = GetForeignTable(RelationGetRelid(rel));
-    foreach(lc, table->options)
-    {
-        DefElem *def = (DefElem *) lfirst(lc);
-        if (strcmp(def->defname, OPT_KEYSPACE) == 0)
-            keyspace = defGetString(def);
-        else if (strcmp(def->defname, OPT_TABLE) == 0)
-            tablename = defGetString(def);
-    }
+    ListCell   *lc2;
+    bool        first = true;
 
     initStringInfo(&buf);
+    appendStringInfo(&buf, "UPDATE %s.%s SET ",
+                     cql_quote_identifier(fpinfo->keyspace),
+                     cql_quote_identifier(fpinfo->table));
 
-    appendStringInfo(&buf, "INSERT INTO %s.%s (",
-                     cql_quote_identifier(keyspace),
-                     cql_quote_identifier(tablename));
-
-    /* Column names */
-    first = true;
-    foreach(lc, target_attrs)
+    forboth(lc, targetAttrs, lc2, targetlist)
     {
-        attnum = lfirst_int(lc);
-        attr = TupleDescAttr(tupdesc, attnum - 1);
-
-        if (!first)
-            appendStringInfoString(&buf, ", ");
-        appendStringInfoString(&buf, cql_quote_identifier(NameStr(attr->attname)));
-        first = false;
-    }
-
-    appendStringInfoString(&buf, ") VALUES (");
+        int         attnum = lfirst_int(lc);
+        TargetEntry *tle = lfirst_node(TargetEntry, lc2);
+        DeparseContext context;
 
-    /* Placeholders - just need count, not the values */
-    num_attrs = list_length(target_attrs);
-    first = true;
-    for (i = 0; i < num_attrs; i++)
-    {
         if (!first)
             appendStringInfoString(&buf, ", ");
-        appendStringInfoString(&buf, "?");
+        appendStringInfo(&buf, "%s = ",
+                         cql_quote_identifier(get_attname(rte->relid, attnum, false)));
+
+        context.buf = &buf;
+        context.root = root;
+        context.foreignrel = baserel;
+        context.scanrel = baserel;
+        context.params_list = NULL;
+        context.can_pushdown = true;
+        deparseExpr(tle->expr, &context);
         first = false;
     }
 
-    appendStringInfoString(&buf, ")");
+    appendStringInfoString(&buf, " WHERE ");
+    deparse_where_conds(&buf, root, baserel, key_conds, NULL);
+    deparse_lwt_conds(&buf, root, fpinfo, baserel, if_conds);
 
     return buf.data;
 }
 
 /*
- * scylla_build_update_query
- *        Build CQL UPDATE query
+ * scylla_build_direct_delete_query
+ *        Build a CQL DELETE for a directly modified foreign table
+ *
+ * key_conds and if_conds are as for scylla_build_direct_update_query.
  */
 char *
-scylla_build_update_query(Relation rel, List *target_attrs,
-                          int *pk_attrs, int num_pk_attrs)
+scylla_build_direct_delete_query(PlannerInfo *root, RelOptInfo *baserel,
+                                 ScyllaFdwRelationInfo *fpinfo,
+                                 List *key_conds, List *if_conds)
 {
     StringInfoData buf;
-    TupleDesc   tupdesc = RelationGetDescr(rel);
-    bool        first;
+
+    initStringInfo(&buf);
+    appendStringInfo(&buf, "DELETE FROM %s.%s WHERE ",
+                     cql_quote_identifier(fpinfo->keyspace),
+                     cql_quote_identifier(fpinfo->table));
+    deparse_where_conds(&buf, root, baserel, key_conds, NULL);
+    deparse_lwt_conds(&buf, root, fpinfo, baserel, if_conds);
+
+    return buf.data;
+}
+
+/*
+ * deparse_lwt_conds
+ *        Append the IF clause of a direct modification, if any
+ *
+ * A plain CQL UPDATE or DELETE is a single write, but does not tell
+ * whether the row existed: the row is counted as modified either way, and
+ * an UPDATE creates it if it was missing.  With direct_modify_if_exists,
+ * the command is a lightweight transaction with IF EXISTS instead, whose
+ * [applied] column gives the exact count, at the price of a Paxos round.
+ */
+static void
+deparse_lwt_conds(StringInfo buf, PlannerInfo *root,
+                  ScyllaFdwRelationInfo *fpinfo, RelOptInfo *baserel,
+                  List *if_conds)
+{
+    if (if_conds == NIL)
+    {
+        if (fpinfo->direct_modify_if_exists)
+            appendStringInfoString(buf, " IF EXISTS");
+        return;
+    }
+
+    appendStringInfoString(buf, " IF ");
+    deparse_where_conds(buf, root, baserel, if_conds, NULL);
+}
+
+/*
+ * scylla_build_analyze_query
+ *        Build the CQL SELECT used to sample rows for ANALYZE
+ *
+ * Every column is fetched, followed by the partition key token so the
+ * sampler can tell where one partition ends and the next begins.  Like a
+ * parallel scan, the query covers one token range given by the first two
+ * bind markers.
+ */
+char *
+scylla_build_analyze_query(Relation rel, ScyllaFdwRelationInfo *fpinfo,
+                           List **retrieved_attrs)
+{
+    StringInfoData buf;
+    StringInfoData tokbuf;
+    TupleDesc   tupdesc = RelationGetDescr(rel);
+    ListCell   *lc;
+    int         i;
+
+    *retrieved_attrs = NIL;
+
+    initStringInfo(&tokbuf);
+    foreach(lc, fpinfo->pk_attrs)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, lfirst_int(lc) - 1);
+
+        if (tokbuf.len > 0)
+            appendStringInfoString(&tokbuf, ", ");
+        appendStringInfoString(&tokbuf,
+                               cql_quote_identifier(NameStr(attr->attname)));
+    }
+
+    initStringInfo(&buf);
+    appendStringInfoString(&buf, "SELECT ");
+    for (i = 1; i <= tupdesc->natts; i++)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i - 1);
+
+        if (attr->attisdropped)
+            continue;
+
+        appendStringInfoString(&buf, cql_quote_identifier(NameStr(attr->attname)));
+        appendStringInfoString(&buf, ", ");
+        *retrieved_attrs = lappend_int(*retrieved_attrs, i);
+    }
+
+    appendStringInfo(&buf, "token(%s) FROM %s.%s"
+                     " WHERE token(%s) > ? AND token(%s) <= ?",
+                     tokbuf.data,
+                     cql_quote_identifier(fpinfo->keyspace),
+                     cql_quote_identifier(fpinfo->table),
+                     tokbuf.data, tokbuf.data);
+    pfree(tokbuf.data);
+
+    return buf.data;
+}
+
+/*
+ * scylla_build_aggregate_query
+ *        Build CQL SELECT query computing the aggregates of a grouped rel
+ *
+ * tlist holds the grouping columns and the aggregates to compute, which
+ * must have been accepted by scylla_is_foreign_aggregate; they are
+ * retrieved in tlist order.  The scanned relation and its conditions come
+ * from fpinfo->outerrel, and params_list is filled in as for
+ * scylla_build_select_query.
+ */
+char *
+scylla_build_aggregate_query(PlannerInfo *root, RelOptInfo *grouped_rel,
+                             List *tlist, List *remote_conds,
+                             List **retrieved_attrs,
+                             List **params_list)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) grouped_rel->fdw_private;
+    RelOptInfo *scanrel = fpinfo->outerrel;
+    ScyllaFdwRelationInfo *ifpinfo = (ScyllaFdwRelationInfo *) scanrel->fdw_private;
+    StringInfoData buf;
+    RangeTblEntry *rte;
+    bool        first;
+    ListCell   *lc;
+
+    *retrieved_attrs = NIL;
+    *params_list = NIL;
+
+    rte = planner_rt_fetch(scanrel->relid, root);
+
+    initStringInfo(&buf);
+    appendStringInfoString(&buf, "SELECT ");
+
+    first = true;
+    foreach(lc, tlist)
+    {
+        TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+        if (!first)
+            appendStringInfoString(&buf, ", ");
+
+        if (IsA(tle->expr, Var))
+        {
+            Var        *var = (Var *) tle->expr;
+
+            appendStringInfoString(&buf,
+                                   cql_quote_identifier(get_attname(rte->relid,
+                                                                    var->varattno,
+                                                                    false)));
+        }
+        else
+        {
+            const char *fname;
+            const char *cast;
+            Var        *arg;
+
+            if (!aggregate_cql_form(scanrel, (Aggref *) tle->expr,
+                                    &fname, &cast, &arg))
+                elog(ERROR, "scylla_fdw: aggregate cannot be deparsed");
+
+            if (arg == NULL)
+                appendStringInfo(&buf, "%s(*)", fname);
+            else
+            {
+                char       *colname = cql_quote_identifier(get_attname(rte->relid,
+                                                                       arg->varattno,
+                                                                       false));
+
+                if (cast != NULL)
+                    appendStringInfo(&buf, "%s(cast(%s as %s))", fname, colname, cast);
+                else
+                    appendStringInfo(&buf, "%s(%s)", fname, colname);
+            }
+        }
+
+        *retrieved_attrs = lappend_int(*retrieved_attrs, tle->resno);
+        first = false;
+    }
+
+    appendStringInfo(&buf, " FROM %s.%s",
+                     cql_quote_identifier(ifpinfo->keyspace),
+                     cql_quote_identifier(ifpinfo->table));
+
+    if (remote_conds != NIL)
+    {
+        appendStringInfoString(&buf, " WHERE ");
+        deparse_where_conds(&buf, root, scanrel, remote_conds, params_list);
+    }
+
+    /* GROUP BY, in primary key order */
+    first = true;
+    foreach(lc, fpinfo->group_attrs)
+    {
+        appendStringInfoString(&buf, first ? " GROUP BY " : ", ");
+        appendStringInfoString(&buf,
+                               cql_quote_identifier(get_attname(rte->relid,
+                                                                lfirst_int(lc),
+                                                                false)));
+        first = false;
+    }
+
+    if (needs_allow_filtering(root, scanrel, ifpinfo, remote_conds))
+        appendStringInfoString(&buf, " ALLOW FILTERING");
+
+    return buf.data;
+}
+
+/*
+ * scylla_is_foreign_aggregate
+ *        Check if ScyllaDB can compute an aggregate over a scan of scanrel
+ *
+ * CQL has count, min, max, sum and avg of a single column.  sum and avg
+ * return the type of their argument, so an int sum would overflow where
+ * PostgreSQL's doesn't and an int avg would be rounded; their argument is
+ * cast to the CQL type matching PostgreSQL's result instead, and avg of
+ * integers or numerics, which PostgreSQL returns as numeric, stays local.
+ *
+ * Over no rows, CQL's sum and avg return 0 rather than NULL; their results
+ * must be paired with a count of the argument (see scylla_make_count_aggregate).
+ */
+bool
+scylla_is_foreign_aggregate(RelOptInfo *scanrel, Aggref *agg)
+{
+    const char *fname;
+    const char *cast;
+    Var        *arg;
+
+    return aggregate_cql_form(scanrel, agg, &fname, &cast, &arg);
+}
+
+/*
+ * scylla_aggregate_needs_count
+ *        Check if an aggregate's CQL result must be set to NULL when no
+ *        non-NULL input values were seen
+ */
+bool
+scylla_aggregate_needs_count(Aggref *agg)
+{
+    char       *fname;
+
+    if (agg->aggstar)
+        return false;
+    fname = get_func_name(agg->aggfnoid);
+    return strcmp(fname, "sum") == 0 || strcmp(fname, "avg") == 0;
+}
+
+/*
+ * scylla_make_count_aggregate
+ *        Build count(arg) for the argument of a pushed-down aggregate
+ *
+ * The result is only ever deparsed and used for its type, never executed.
+ */
+Aggref *
+scylla_make_count_aggregate(Aggref *agg)
+{
+    Aggref     *count = makeNode(Aggref);
+    Expr       *arg = linitial_node(TargetEntry, agg->args)->expr;
+
+    count->aggfnoid = F_COUNT_ANY;
+    count->aggtype = INT8OID;
+    count->aggtranstype = INT8OID;
+    count->aggargtypes = list_make1_oid(exprType((Node *) arg));
+    count->args = list_make1(makeTargetEntry(arg, 1, NULL, false));
+    count->aggkind = AGGKIND_NORMAL;
+    count->aggsplit = AGGSPLIT_SIMPLE;
+    count->location = -1;
+
+    return count;
+}
+
+/*
+ * aggregate_cql_form
+ *        Work out how to write an aggregate in CQL
+ *
+ * Sets *fname to the CQL function, *cast to the type to cast its argument
+ * to (or NULL), and *arg to the column aggregated (NULL for count(*)).
+ */
+static bool
+aggregate_cql_form(RelOptInfo *scanrel, Aggref *agg, const char **fname,
+                   const char **cast, Var **arg)
+{
+    char       *name;
+    Expr       *expr;
+    Oid         argtype;
+
+    *cast = NULL;
+    *arg = NULL;
+
+    if (agg->aggorder != NIL || agg->aggdistinct != NIL ||
+        agg->aggfilter != NULL || agg->aggvariadic ||
+        agg->aggkind != AGGKIND_NORMAL || agg->aggsplit != AGGSPLIT_SIMPLE ||
+        agg->agglevelsup != 0)
+        return false;
+
+    if (get_func_namespace(agg->aggfnoid) != PG_CATALOG_NAMESPACE)
+        return false;
+    name = get_func_name(agg->aggfnoid);
+
+    if (agg->aggstar)
+    {
+        *fname = "count";
+        return strcmp(name, "count") == 0;
+    }
+
+    if (list_length(agg->args) != 1)
+        return false;
+    expr = linitial_node(TargetEntry, agg->args)->expr;
+    if (IsA(expr, RelabelType))
+        expr = ((RelabelType *) expr)->arg;
+    if (!IsA(expr, Var) || ((Var *) expr)->varno != scanrel->relid ||
+        ((Var *) expr)->varlevelsup != 0 || ((Var *) expr)->varattno <= 0)
+        return false;
+    *arg = (Var *) expr;
+    argtype = (*arg)->vartype;
+
+    if (strcmp(name, "count") == 0)
+        *fname = "count";
+    else if (strcmp(name, "min") == 0 || strcmp(name, "max") == 0)
+    {
+        if (!is_cql_sort_compatible(argtype, agg->inputcollid))
+            return false;
+        *fname = strcmp(name, "min") == 0 ? "min" : "max";
+    }
+    else if (strcmp(name, "sum") == 0)
+    {
+        *fname = "sum";
+        switch (argtype)
+        {
+            case INT2OID:
+            case INT4OID:
+                *cast = "bigint";
+                break;
+            case INT8OID:
+                *cast = "varint";
+                break;
+            case FLOAT4OID:
+                *cast = "float";
+                break;
+            case FLOAT8OID:
+                *cast = "double";
+                break;
+            case NUMERICOID:
+                *cast = "decimal";
+                break;
+            default:
+                return false;
+        }
+    }
+    else if (strcmp(name, "avg") == 0)
+    {
+        if (argtype != FLOAT4OID && argtype != FLOAT8OID)
+            return false;
+        *fname = "avg";
+        *cast = "double";
+    }
+    else
+        return false;
+
+    return true;
+}
+
+/*
+ * deparse_where_conds
+ *        Append a list of conditions, joined by AND
+ *
+ * If params_list is not NULL, operands computed outside the scanned
+ * relation are deparsed as bind markers and appended to *params_list.
+ */
+static void
+deparse_where_conds(StringInfo buf, PlannerInfo *root, RelOptInfo *baserel,
+                    List *conds, List **params_list)
+{
+    bool        first = true;
+    ListCell   *lc;
+
+    foreach(lc, conds)
+    {
+        Expr *expr = (Expr *) lfirst(lc);
+        DeparseContext context;
+
+        if (!first)
+            appendStringInfoString(buf, " AND ");
+
+        context.buf = buf;
+        context.root = root;
+        context.foreignrel = baserel;
+        context.scanrel = baserel;
+        context.params_list = params_list;
+        context.can_pushdown = true;
+
+        deparseExpr(expr, &context);
+        first = false;
+    }
+}
+
+/*
+ * scylla_build_insert_query
+ *        Build CQL INSERT query
+ *
+ * If if_not_exists is set, the INSERT is a lightweight transaction that
+ * only writes rows whose primary key is not taken yet; that is how
+ * INSERT ... ON CONFLICT DO NOTHING is sent.
+ */
+char *
+scylla_build_insert_query(Relation rel, List *target_attrs, bool if_not_exists)
+{
+    StringInfoData buf;
+    TupleDesc   tupdesc = RelationGetDescr(rel);
+    bool        first;
+    int         attnum;
+    int         i;
+    ForeignTable *table;
+    char       *keyspace = NULL;
+    char       *tablename = NULL;
+    char       *ttl = NULL;
+    char       *write_timestamp = NULL;
+    ListCell   *lc;
+    int         num_attrs;
+    Form_pg_attribute attr;
+
+    table = GetForeignTable(RelationGetRelid(rel));
+    foreach(lc, table->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+        if (strcmp(def->defname, OPT_KEYSPACE) == 0)
+            keyspace = defGetString(def);
+        else if (strcmp(def->defname, OPT_TABLE) == 0)
+            tablename = defGetString(def);
+        else if (strcmp(def->defname, OPT_TTL) == 0)
+            ttl = defGetString(def);
+        else if (strcmp(def->defname, OPT_WRITE_TIMESTAMP) == 0)
+            write_timestamp = defGetString(def);
+    }
+
+    initStringInfo(&buf);
+
+    appendStringInfo(&buf, "INSERT INTO %s.%s (",
+                     cql_quote_identifier(keyspace),
+                     cql_quote_identifier(tablename));
+
+    /* Column names */
+    first = true;
+    foreach(lc, target_attrs)
+    {
+        attnum = lfirst_int(lc);
+        attr = TupleDescAttr(tupdesc, attnum - 1);
+
+        if (!first)
+            appendStringInfoString(&buf, ", ");
+        appendStringInfoString(&buf, cql_quote_identifier(NameStr(attr->attname)));
+        first = false;
+    }
+
+    appendStringInfoString(&buf, ") VALUES (");
+
+    /* Placeholders - just need count, not the values */
+    num_attrs = list_length(target_attrs);
+    first = true;
+    for (i = 0; i < num_attrs; i++)
+    {
+        if (!first)
+            appendStringInfoString(&buf, ", ");
+        appendStringInfoString(&buf, "?");
+        first = false;
+    }
+
+    appendStringInfoString(&buf, ")");
+
+    if (if_not_exists)
+    {
+        /* Paxos picks the timestamp of a conditional write itself */
+        if (write_timestamp != NULL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("ON CONFLICT is not supported on foreign table \"%s\" with option \"%s\"",
+                            RelationGetRelationName(rel), OPT_WRITE_TIMESTAMP)));
+        appendStringInfoString(&buf, " IF NOT EXISTS");
+    }
+
+    /* The validator checked that these are integers */
+    if (ttl != NULL && write_timestamp != NULL)
+        appendStringInfo(&buf, " USING TTL %s AND TIMESTAMP %s",
+                         ttl, write_timestamp);
+    else if (ttl != NULL)
+        appendStringInfo(&buf, " USING TTL %s", ttl);
+    else if (write_timestamp != NULL)
+        appendStringInfo(&buf, " USING TIMESTAMP %s", write_timestamp);
+
+    return buf.data;
+}
+
+/*
+ * scylla_build_update_query
+ *        Build CQL UPDATE query
+ */
+char *
+scylla_build_update_query(Relation rel, List *target_attrs,
+                          int *pk_attrs, int num_pk_attrs)
+{
+    StringInfoData buf;
+    TupleDesc   tupdesc = RelationGetDescr(rel);
+    bool        first;
     bool        is_pk;
     int         i;
     int         attnum;
@@ -607,6 +1654,15 @@ deparseExpr(Expr *node, DeparseContext *context)
         case T_RelabelType:
             deparseRelabelType((RelabelType *) node, context);
             break;
+        case T_ScalarArrayOpExpr:
+            deparseScalarArrayOpExpr((ScalarArrayOpExpr *) node, context);
+            break;
+        case T_FuncExpr:
+            deparseFuncExpr((FuncExpr *) node, context);
+            break;
+        case T_RowCompareExpr:
+            deparseRowCompareExpr((RowCompareExpr *) node, context);
+            break;
         default:
             elog(ERROR, "unsupported expression type for CQL deparse: %d",
                  (int) nodeTag(node));
@@ -695,115 +1751,429 @@ deparseConst(Const *node, DeparseContext *context)
             appendStringInfoString(context->buf, cql_quote_literal(extval));
             break;
 
-        case DATEOID:
-            appendStringInfoString(context->buf, cql_quote_literal(extval));
-            break;
+        case DATEOID:
+            appendStringInfoString(context->buf, cql_quote_literal(extval));
+            break;
+
+        case BYTEAOID:
+            /* Blob in hex format */
+            appendStringInfo(context->buf, "0x%s", extval + 2);  /* Skip \x prefix */
+            break;
+
+        default:
+            appendStringInfoString(context->buf, cql_quote_literal(extval));
+            break;
+    }
+
+    pfree(extval);
+}
+
+/*
+ * deparseOpExpr
+ *        Deparse an OpExpr node
+ */
+static void
+deparseOpExpr(OpExpr *node, DeparseContext *context)
+{
+    const char *cql_op;
+    Expr       *left;
+    Expr       *right;
+
+    if (list_length(node->args) != 2)
+    {
+        context->can_pushdown = false;
+        return;
+    }
+
+    cql_op = get_cql_collection_operator(node, context->scanrel);
+    if (cql_op != NULL)
+    {
+        deparseCollectionOpExpr(node, cql_op, context);
+        return;
+    }
+
+    cql_op = get_cql_operator(node->opno);
+    if (cql_op == NULL)
+    {
+        context->can_pushdown = false;
+        return;
+    }
+
+    left = linitial(node->args);
+    right = lsecond(node->args);
+
+    /*
+     * CQL only accepts the column, or token(), on the left.  Join clauses
+     * used by a parameterized scan and comparisons written the other way
+     * round may have it on the right; flip those around using the
+     * commutator.
+     */
+    if (!is_scanrel_column(left, context) &&
+        !is_token_call(left, context->scanrel) &&
+        (is_scanrel_column(right, context) ||
+         is_token_call(right, context->scanrel)))
+    {
+        Oid         commutator = get_commutator(node->opno);
+        Expr       *tmp;
+
+        cql_op = OidIsValid(commutator) ? get_cql_operator(commutator) : NULL;
+        if (cql_op == NULL)
+        {
+            context->can_pushdown = false;
+            return;
+        }
+
+        tmp = left;
+        left = right;
+        right = tmp;
+    }
+
+    deparseExpr(left, context);
+    appendStringInfo(context->buf, " %s ", cql_op);
+    deparseOperand(right, left, context);
+}
+
+/*
+ * deparseOperand
+ *        Deparse the value side of a comparison against column
+ *
+ * An operand that does not reference the scanned relation is evaluated by
+ * the executor instead, and sent as a bind marker.  That includes plain
+ * constants, so that queries differing only in their constants share one
+ * prepared statement -- but only those of the column's own type, since
+ * values are bound using the conversion for their type, and only if that
+ * type has a binary bind (scylla_is_bindable_type); others are inlined as
+ * CQL literals, which ScyllaDB coerces.
+ */
+static void
+deparseOperand(Expr *node, Expr *column, DeparseContext *context)
+{
+    Relids      varnos;
+
+    if (context->params_list == NULL)
+    {
+        deparseExpr(node, context);
+        return;
+    }
+
+    if (IsA(node, Const))
+    {
+        Const      *c = (Const *) node;
+
+        if (c->constisnull || c->consttype != exprType((Node *) column) ||
+            !scylla_is_bindable_type(c->consttype))
+        {
+            deparseExpr(node, context);
+            return;
+        }
+
+        appendStringInfoChar(context->buf, '?');
+        *context->params_list = lappend(*context->params_list, node);
+        return;
+    }
+
+#if PG_VERSION_NUM >= 140000
+    varnos = pull_varnos(context->root, (Node *) node);
+#else
+    varnos = pull_varnos((Node *) node);
+#endif
+    if (bms_overlap(varnos, context->scanrel->relids))
+    {
+        deparseExpr(node, context);
+        return;
+    }
+
+    appendStringInfoChar(context->buf, '?');
+    *context->params_list = lappend(*context->params_list, node);
+}
+
+/*
+ * is_scanrel_column
+ *        Check if an expression is a plain column of the scanned relation
+ */
+static bool
+is_scanrel_column(Expr *node, DeparseContext *context)
+{
+    if (node != NULL && IsA(node, RelabelType))
+        node = ((RelabelType *) node)->arg;
+
+    return node != NULL && IsA(node, Var) &&
+        ((Var *) node)->varlevelsup == 0 &&
+        bms_is_member(((Var *) node)->varno, context->scanrel->relids);
+}
+
+/*
+ * deparseBoolExpr
+ *        Deparse a BoolExpr node
+ */
+static void
+deparseBoolExpr(BoolExpr *node, DeparseContext *context)
+{
+    const char *op;
+    bool        first;
+    ListCell   *lc;
+
+    switch (node->boolop)
+    {
+        case AND_EXPR:
+            op = " AND ";
+            break;
+        case OR_EXPR:
+            /* ScyllaDB doesn't support OR in WHERE */
+            context->can_pushdown = false;
+            return;
+        case NOT_EXPR:
+            /* NOT is only partially supported */
+            context->can_pushdown = false;
+            return;
+        default:
+            context->can_pushdown = false;
+            return;
+    }
+
+    appendStringInfoChar(context->buf, '(');
+    first = true;
+    foreach(lc, node->args)
+    {
+        if (!first)
+            appendStringInfoString(context->buf, op);
+        deparseExpr((Expr *) lfirst(lc), context);
+        first = false;
+    }
+    appendStringInfoChar(context->buf, ')');
+}
+
+/*
+ * deparseNullTest
+ *        Deparse a NullTest node
+ */
+static void
+deparseNullTest(NullTest *node, DeparseContext *context)
+{
+    /* ScyllaDB doesn't support IS NULL / IS NOT NULL in WHERE */
+    context->can_pushdown = false;
+}
+
+/*
+ * deparseRelabelType
+ *        Deparse a RelabelType node
+ */
+static void
+deparseRelabelType(RelabelType *node, DeparseContext *context)
+{
+    deparseExpr(node->arg, context);
+}
+
+/*
+ * deparseFuncExpr
+ *        Deparse scylla_token() of the partition key as CQL's token()
+ */
+static void
+deparseFuncExpr(FuncExpr *node, DeparseContext *context)
+{
+    bool        first = true;
+    ListCell   *lc;
+
+    if (!is_token_call((Expr *) node, context->scanrel))
+    {
+        context->can_pushdown = false;
+        return;
+    }
+
+    appendStringInfoString(context->buf, "token(");
+    foreach(lc, node->args)
+    {
+        if (!first)
+            appendStringInfoString(context->buf, ", ");
+        deparseExpr((Expr *) lfirst(lc), context);
+        first = false;
+    }
+    appendStringInfoChar(context->buf, ')');
+}
+
+/*
+ * deparseRowCompareExpr
+ *        Deparse a multi-column slice "(c1, c2) > (v1, v2)"
+ */
+static void
+deparseRowCompareExpr(RowCompareExpr *node, DeparseContext *context)
+{
+    ListCell   *lc;
+    ListCell   *lc2;
+    bool        first = true;
+
+    appendStringInfoChar(context->buf, '(');
+    foreach(lc, node->largs)
+    {
+        if (!first)
+            appendStringInfoString(context->buf, ", ");
+        deparseExpr((Expr *) lfirst(lc), context);
+        first = false;
+    }
+    appendStringInfo(context->buf, ") %s (",
+                     get_cql_operator(linitial_oid(node->opnos)));
+    first = true;
+    forboth(lc, node->largs, lc2, node->rargs)
+    {
+        if (!first)
+            appendStringInfoString(context->buf, ", ");
+        deparseOperand((Expr *) lfirst(lc2), (Expr *) lfirst(lc), context);
+        first = false;
+    }
+    appendStringInfoChar(context->buf, ')');
+}
+
+/*
+ * deparseCollectionOpExpr
+ *        Deparse "col @> ARRAY[...]" or "col ? 'k'" as CONTAINS (KEY)
+ *
+ * An array of several values needs a CONTAINS for each of them.
+ */
+static void
+deparseCollectionOpExpr(OpExpr *node, const char *cql_op,
+                        DeparseContext *context)
+{
+    Expr       *column = linitial(node->args);
+    Expr       *value = lsecond(node->args);
+    List       *values;
+    bool        first = true;
+    ListCell   *lc;
+
+    if (IsA(value, RelabelType))
+        value = ((RelabelType *) value)->arg;
 
-        case BYTEAOID:
-            /* Blob in hex format */
-            appendStringInfo(context->buf, "0x%s", extval + 2);  /* Skip \x prefix */
-            break;
+    if (strcmp(cql_op, "CONTAINS") == 0)
+        values = scylla_const_array_elements((Const *) value);
+    else
+        values = list_make1(value);
 
-        default:
-            appendStringInfoString(context->buf, cql_quote_literal(extval));
-            break;
+    foreach(lc, values)
+    {
+        if (!first)
+            appendStringInfoString(context->buf, " AND ");
+        deparseExpr(column, context);
+        appendStringInfo(context->buf, " %s ", cql_op);
+        deparseConst((Const *) lfirst(lc), context);
+        first = false;
     }
-
-    pfree(extval);
 }
 
 /*
- * deparseOpExpr
- *        Deparse an OpExpr node
+ * deparseScalarArrayOpExpr
+ *        Deparse "col = ANY(array)" as "col IN (...)"
+ *
+ * A constant array is inlined.  A list of values including parameters is
+ * sent as one bind marker per element, all bound from the expression
+ * evaluating to the whole array (see bind_scan_params).  So is an array
+ * parameter, though its length is only known when the scan starts; until
+ * then, its markers are written as SCYLLA_ARRAY_PARAM_MARKER.
  */
 static void
-deparseOpExpr(OpExpr *node, DeparseContext *context)
+deparseScalarArrayOpExpr(ScalarArrayOpExpr *node, DeparseContext *context)
 {
-    const char *cql_op;
-    Expr       *left;
-    Expr       *right;
+    bool        first = true;
+    ListCell   *lc;
 
-    cql_op = get_cql_operator(node->opno);
-    if (cql_op == NULL)
+    if (!node->useOr || list_length(node->args) != 2)
     {
         context->can_pushdown = false;
         return;
     }
 
-    if (list_length(node->args) != 2)
+    if (IsA(lsecond(node->args), ArrayExpr) && context->params_list != NULL)
     {
-        context->can_pushdown = false;
+        ArrayExpr  *arr = (ArrayExpr *) lsecond(node->args);
+
+        deparseExpr(linitial(node->args), context);
+        appendStringInfoString(context->buf, " IN (");
+        foreach(lc, arr->elements)
+        {
+            if (!first)
+                appendStringInfoString(context->buf, ", ");
+            appendStringInfoChar(context->buf, '?');
+            first = false;
+        }
+        appendStringInfoChar(context->buf, ')');
+        *context->params_list = lappend(*context->params_list, arr);
         return;
     }
 
-    left = linitial(node->args);
-    right = lsecond(node->args);
-
-    deparseExpr(left, context);
-    appendStringInfo(context->buf, " %s ", cql_op);
-    deparseExpr(right, context);
-}
-
-/*
- * deparseBoolExpr
- *        Deparse a BoolExpr node
- */
-static void
-deparseBoolExpr(BoolExpr *node, DeparseContext *context)
-{
-    const char *op;
-    bool        first;
-    ListCell   *lc;
+    if (IsA(lsecond(node->args), Param) && context->params_list != NULL)
+    {
+        deparseExpr(linitial(node->args), context);
+        appendStringInfoString(context->buf, " IN (" SCYLLA_ARRAY_PARAM_MARKER ")");
+        *context->params_list = lappend(*context->params_list,
+                                        lsecond(node->args));
+        return;
+    }
 
-    switch (node->boolop)
+    if (!IsA(lsecond(node->args), Const))
     {
-        case AND_EXPR:
-            op = " AND ";
-            break;
-        case OR_EXPR:
-            /* ScyllaDB doesn't support OR in WHERE */
-            context->can_pushdown = false;
-            return;
-        case NOT_EXPR:
-            /* NOT is only partially supported */
-            context->can_pushdown = false;
-            return;
-        default:
-            context->can_pushdown = false;
-            return;
+        context->can_pushdown = false;
+        return;
     }
 
-    appendStringInfoChar(context->buf, '(');
-    first = true;
-    foreach(lc, node->args)
+    deparseExpr(linitial(node->args), context);
+    appendStringInfoString(context->buf, " IN (");
+    foreach(lc, scylla_const_array_elements((Const *) lsecond(node->args)))
     {
         if (!first)
-            appendStringInfoString(context->buf, op);
-        deparseExpr((Expr *) lfirst(lc), context);
+            appendStringInfoString(context->buf, ", ");
+        deparseConst((Const *) lfirst(lc), context);
         first = false;
     }
     appendStringInfoChar(context->buf, ')');
 }
 
 /*
- * deparseNullTest
- *        Deparse a NullTest node
+ * scylla_const_array_elements
+ *        Split a constant array into a list of Consts, one per distinct
+ *        element
+ *
+ * Repeated elements are dropped: a partition key IN list split into
+ * single-key lookups would otherwise return the rows of a repeated key
+ * once per copy, where "= ANY" returns them once.  Elements are compared
+ * by their binary image, in the order they first appear.
  */
-static void
-deparseNullTest(NullTest *node, DeparseContext *context)
+List *
+scylla_const_array_elements(Const *node)
 {
-    /* ScyllaDB doesn't support IS NULL / IS NOT NULL in WHERE */
-    context->can_pushdown = false;
-}
+    ArrayType  *arr = DatumGetArrayTypeP(node->constvalue);
+    Oid         elemtype = ARR_ELEMTYPE(arr);
+    int16       typlen;
+    bool        typbyval;
+    char        typalign;
+    Datum      *elems;
+    bool       *nulls;
+    int         nelems;
+    List       *result = NIL;
+    int         i;
 
-/*
- * deparseRelabelType
- *        Deparse a RelabelType node
- */
-static void
-deparseRelabelType(RelabelType *node, DeparseContext *context)
-{
-    deparseExpr(node->arg, context);
+    get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+    deconstruct_array(arr, elemtype, typlen, typbyval, typalign,
+                      &elems, &nulls, &nelems);
+
+    for (i = 0; i < nelems; i++)
+    {
+        bool        duplicate = false;
+        int         j;
+
+        for (j = 0; j < i && !duplicate; j++)
+        {
+            if (nulls[i] || nulls[j])
+                duplicate = nulls[i] && nulls[j];
+            else
+                duplicate = datum_image_eq(elems[i], elems[j],
+                                           typbyval, typlen);
+        }
+        if (duplicate)
+            continue;
+
+        result = lappend(result, makeConst(elemtype, -1, InvalidOid, typlen,
+                                           elems[i], nulls[i], typbyval));
+    }
+
+    return result;
 }
 
 /*
@@ -881,6 +2251,28 @@ is_pushdown_safe_type(Oid typeid)
     }
 }
 
+/*
+ * is_pushdown_safe_array
+ *        Check if a constant array can be sent as the values of an IN list
+ *
+ * CQL can't express NULLs in an IN list, and an empty list is pointless.
+ */
+static bool
+is_pushdown_safe_array(Const *node)
+{
+    ArrayType  *arr;
+
+    if (node->constisnull)
+        return false;
+
+    arr = DatumGetArrayTypeP(node->constvalue);
+    if (!is_pushdown_safe_type(ARR_ELEMTYPE(arr)) ||
+        ARR_NDIM(arr) != 1 || array_contains_nulls(arr))
+        return false;
+
+    return ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr)) > 0;
+}
+
 /*
  * cql_quote_literal
  *        Quote a string literal for CQL
@@ -967,133 +2359,318 @@ scylla_quote_identifier(const char *ident)
  * 1. No WHERE clause at all
  * 2. Partition key columns are not all specified with = or IN operators
  * 3. Partition key columns use non-equality operators (<, >, <=, >=, !=)
+ * 4. Columns outside the primary key are restricted, e.g. with CONTAINS
+ *    (with a secondary index, ALLOW FILTERING is harmless)
  */
 static bool
 needs_allow_filtering(PlannerInfo *root, RelOptInfo *baserel,
                       ScyllaFdwRelationInfo *fpinfo,
-                      List *remote_conds, Relation rel)
+                      List *remote_conds)
 {
-    TupleDesc   tupdesc = RelationGetDescr(rel);
-    char       *pk_str = fpinfo->primary_key;
-    char       *str;
-    char       *token;
-    char       *saveptr;
-    char       *end;
+    List       *pk_cols;
     ListCell   *lc;
-    bool        all_pk_have_equality = true;
-    
+
     /* If no WHERE clause, we need ALLOW FILTERING */
     if (remote_conds == NIL)
         return true;
-    
+
     /* If no primary key defined, be conservative and add ALLOW FILTERING */
-    if (pk_str == NULL || pk_str[0] == '\0')
+    if (fpinfo->primary_key == NULL || fpinfo->primary_key[0] == '\0')
         return true;
-    
-    /* Parse each partition key column and check if it has equality condition */
-    str = pstrdup(pk_str);
-    for (token = strtok_r(str, ",", &saveptr);
-         token != NULL;
-         token = strtok_r(NULL, ",", &saveptr))
-    {
-        bool        found_equality = false;
-        int         pk_attnum = 0;
-        int         i;
-        
-        /* Trim whitespace */
-        while (*token == ' ') token++;
-        end = token + strlen(token) - 1;
-        while (end > token && *end == ' ') *end-- = '\0';
-        
-        /* Find attribute number for this PK column */
-        for (i = 0; i < tupdesc->natts; i++)
+
+    /* Check that each partition key column has an equality condition */
+    pk_cols = fpinfo->pk_attrs;
+    foreach(lc, pk_cols)
+    {
+        if (!scylla_column_has_equality(baserel, remote_conds, lfirst_int(lc), true))
+            return true;
+    }
+
+    /* Check that only primary key columns are restricted */
+    foreach(lc, remote_conds)
+    {
+        Bitmapset  *attrs = NULL;
+        int         attidx = -1;
+
+        pull_varattnos((Node *) lfirst(lc), baserel->relid, &attrs);
+        while ((attidx = bms_next_member(attrs, attidx)) >= 0)
         {
-            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-            if (strcmp(NameStr(attr->attname), token) == 0)
-            {
-                pk_attnum = i + 1;
-                break;
-            }
+            AttrNumber  attnum = attidx + FirstLowInvalidHeapAttributeNumber;
+
+            if (!list_member_int(pk_cols, attnum) &&
+                !is_clustering_key_column(fpinfo, attnum))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * scylla_column_has_equality
+ *        Check if conds pin a column with = (or IN, if allow_in)
+ *
+ * conds may contain bare clauses or RestrictInfos.  The column may be on
+ * either side of an =, since the deparser flips such clauses.
+ */
+bool
+scylla_column_has_equality(RelOptInfo *baserel, List *conds,
+                           AttrNumber attnum, bool allow_in)
+{
+    ListCell   *lc;
+
+    foreach(lc, conds)
+    {
+        Expr       *expr = (Expr *) lfirst(lc);
+        List       *operands = NIL;
+        ListCell   *lc2;
+
+        if (expr != NULL && IsA(expr, RestrictInfo))
+            expr = ((RestrictInfo *) expr)->clause;
+        if (expr == NULL)
+            continue;
+
+        /* Check if this is an OpExpr (= operator) */
+        if (IsA(expr, OpExpr))
+        {
+            OpExpr     *opexpr = (OpExpr *) expr;
+            const char *op_str = get_cql_operator(opexpr->opno);
+
+            if (op_str != NULL && strcmp(op_str, "=") == 0)
+                operands = opexpr->args;
         }
-        
-        if (pk_attnum == 0)
-            continue;  /* Column not found, skip */
-        
-        /* Check if this PK column appears in remote_conds with = or IN operator */
-        foreach(lc, remote_conds)
+        /* ScalarArrayOpExpr with useOr=true represents IN() */
+        else if (allow_in && IsA(expr, ScalarArrayOpExpr))
         {
-            Expr *expr = (Expr *) lfirst(lc);
-            
-            if (expr == NULL)
-                continue;
-            
-            /* Check if this is an OpExpr (= operator) */
-            if (IsA(expr, OpExpr))
-            {
-                OpExpr *opexpr = (OpExpr *) expr;
-                Expr *left;
-                Oid  opno = opexpr->opno;
-                const char *op_str = get_cql_operator(opno);
-                
-                /* Check if operator is = */
-                if (op_str != NULL && strcmp(op_str, "=") == 0)
-                {
-                    /* Check if left side is our PK column */
-                    if (list_length(opexpr->args) >= 1)
-                    {
-                        left = linitial(opexpr->args);
-                        
-                        if (IsA(left, Var))
-                        {
-                            Var *var = (Var *) left;
-                            if (var->varattno == pk_attnum &&
-                                bms_is_member(var->varno, baserel->relids))
-                            {
-                                found_equality = true;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
-            /* Check if this is a ScalarArrayOpExpr (IN operator) */
-            else if (IsA(expr, ScalarArrayOpExpr))
+            ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) expr;
+
+            if (saop->useOr && list_length(saop->args) >= 1)
+                operands = list_make1(linitial(saop->args));
+        }
+
+        /* Check if either operand is our column */
+        foreach(lc2, operands)
+        {
+            Expr       *operand = (Expr *) lfirst(lc2);
+
+            if (IsA(operand, RelabelType))
+                operand = ((RelabelType *) operand)->arg;
+            if (IsA(operand, Var))
             {
-                ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) expr;
-                Expr *left;
-                
-                /* ScalarArrayOpExpr with useOr=true represents IN() */
-                if (saop->useOr)
-                {
-                    /* Check if left side is our PK column */
-                    if (list_length(saop->args) >= 1)
-                    {
-                        left = linitial(saop->args);
-                        
-                        if (IsA(left, Var))
-                        {
-                            Var *var = (Var *) left;
-                            if (var->varattno == pk_attnum &&
-                                bms_is_member(var->varno, baserel->relids))
-                            {
-                                found_equality = true;
-                                break;
-                            }
-                        }
-                    }
-                }
+                Var        *var = (Var *) operand;
+
+                if (var->varattno == attnum && var->varlevelsup == 0 &&
+                    bms_is_member(var->varno, baserel->relids))
+                    return true;
             }
         }
-        
-        /* If this PK column doesn't have equality condition, we need ALLOW FILTERING */
-        if (!found_equality)
+    }
+
+    return false;
+}
+
+/*
+ * scylla_is_foreign_param_clause
+ *        Check if a join clause can drive a parameterized scan
+ *
+ * That is the case for "col = expr", in either order, where col is a column
+ * of baserel and expr can be computed before the scan starts (it does not
+ * reference baserel) and bound as a value of the column's type.  On
+ * success, the column's attribute number is returned in *attnum.
+ */
+bool
+scylla_is_foreign_param_clause(PlannerInfo *root, RelOptInfo *baserel,
+                               Expr *clause, AttrNumber *attnum)
+{
+    OpExpr     *op;
+    const char *cql_op;
+    Expr       *colarg;
+    Expr       *other;
+    Var        *var;
+    Relids      varnos;
+
+    if (clause == NULL || !IsA(clause, OpExpr))
+        return false;
+
+    op = (OpExpr *) clause;
+    if (list_length(op->args) != 2)
+        return false;
+
+    cql_op = get_cql_operator(op->opno);
+    if (cql_op == NULL || strcmp(cql_op, "=") != 0)
+        return false;
+
+    /* Find the side that is a column of baserel */
+    colarg = linitial(op->args);
+    other = lsecond(op->args);
+    var = (Var *) (IsA(colarg, RelabelType) ? ((RelabelType *) colarg)->arg : colarg);
+    if (!IsA(var, Var) || !bms_is_member(var->varno, baserel->relids))
+    {
+        colarg = lsecond(op->args);
+        other = linitial(op->args);
+        var = (Var *) (IsA(colarg, RelabelType) ? ((RelabelType *) colarg)->arg : colarg);
+        if (!IsA(var, Var) || !bms_is_member(var->varno, baserel->relids))
+            return false;
+    }
+
+    if (var->varattno <= 0 || var->varlevelsup != 0 ||
+        !is_pushdown_safe_type(var->vartype))
+        return false;
+
+    /* The value side must not depend on the scanned rows */
+#if PG_VERSION_NUM >= 140000
+    varnos = pull_varnos(root, (Node *) other);
+#else
+    varnos = pull_varnos((Node *) other);
+#endif
+    if (bms_overlap(varnos, baserel->relids))
+        return false;
+    if (contain_volatile_functions((Node *) other))
+        return false;
+
+    /* It is bound using the conversion for the column's type */
+    if (exprType((Node *) other) != exprType((Node *) colarg) ||
+        !scylla_is_bindable_type(exprType((Node *) other)))
+        return false;
+
+    *attnum = var->varattno;
+    return true;
+}
+
+/*
+ * scylla_conds_pin_primary_key
+ *        Check if remote_conds identify exactly one row
+ *
+ * That is the case when every partition key and clustering key column is
+ * compared with = and there are no other conditions, which is what a CQL
+ * UPDATE or DELETE accepts as its WHERE clause.  Those statements are not
+ * prepared, so the values must be constants.
+ */
+bool
+scylla_conds_pin_primary_key(PlannerInfo *root, RelOptInfo *baserel,
+                             ScyllaFdwRelationInfo *fpinfo,
+                             List *remote_conds)
+{
+    List       *key_cols;
+    ListCell   *lc;
+
+    if (fpinfo->pk_attrs == NIL)
+        return false;
+    key_cols = list_concat_copy(fpinfo->pk_attrs, fpinfo->ck_attrs);
+
+    /* Every key column must be pinned ... */
+    foreach(lc, key_cols)
+    {
+        if (!scylla_column_has_equality(baserel, remote_conds, lfirst_int(lc), false))
+            return false;
+    }
+
+    /* ... and nothing else may be restricted */
+    if (list_length(remote_conds) != list_length(key_cols))
+        return false;
+
+    if (contain_param_walker((Node *) remote_conds, NULL))
+        return false;
+
+    return true;
+}
+
+/*
+ * scylla_split_lwt_conds
+ *        Split the conditions of a direct modification into key conditions
+ *        and the IF conditions of a lightweight transaction
+ *
+ * The WHERE clause of a CQL UPDATE or DELETE can only restrict the primary
+ * key, but comparisons of regular columns with constants can be sent as
+ * "IF col = value ...": the statement then runs as a Paxos round, and only
+ * writes if the row matches.  Conditions that reference a key column go
+ * to *key_conds, such comparisons to *if_conds.  Returns false if some
+ * other condition is left, which rules out a direct modification.
+ */
+bool
+scylla_split_lwt_conds(RelOptInfo *baserel, ScyllaFdwRelationInfo *fpinfo,
+                       List *remote_conds,
+                       List **key_conds, List **if_conds)
+{
+    List       *key_cols;
+    ListCell   *lc;
+
+    *key_conds = NIL;
+    *if_conds = NIL;
+
+    key_cols = list_concat_copy(fpinfo->pk_attrs, fpinfo->ck_attrs);
+
+    foreach(lc, remote_conds)
+    {
+        Expr       *clause = (Expr *) lfirst(lc);
+        OpExpr     *op;
+        const char *cqlop;
+        Expr       *colarg;
+        Expr       *other;
+
+        if (clause_references_columns(clause, baserel, key_cols))
+        {
+            *key_conds = lappend(*key_conds, clause);
+            continue;
+        }
+
+        /* Otherwise it must be "col op constant", in either order */
+        if (!IsA(clause, OpExpr))
+            return false;
+        op = (OpExpr *) clause;
+        if (list_length(op->args) != 2)
+            return false;
+
+        /*
+         * "IF col != value" holds when col is null, where "col <> value"
+         * doesn't, so only the operators that are false for null are used.
+         */
+        cqlop = get_cql_operator(op->opno);
+        if (cqlop == NULL || strcmp(cqlop, "!=") == 0)
+            return false;
+
+        colarg = linitial(op->args);
+        other = lsecond(op->args);
+        if (IsA(colarg, RelabelType))
+            colarg = ((RelabelType *) colarg)->arg;
+        if (IsA(other, RelabelType))
+            other = ((RelabelType *) other)->arg;
+        if (IsA(colarg, Const))
         {
-            all_pk_have_equality = false;
-            break;
+            Expr       *tmp = colarg;
+
+            colarg = other;
+            other = tmp;
         }
+
+        if (!IsA(colarg, Var) || !IsA(other, Const) ||
+            ((Var *) colarg)->varno != baserel->relid ||
+            ((Var *) colarg)->varattno <= 0 ||
+            !is_pushdown_safe_type(((Var *) colarg)->vartype) ||
+            ((Const *) other)->constisnull)
+            return false;
+
+        /* Ranges only where ScyllaDB orders values as PostgreSQL does */
+        if (strcmp(cqlop, "=") != 0 &&
+            !is_cql_sort_compatible(((Var *) colarg)->vartype, op->inputcollid))
+            return false;
+
+        *if_conds = lappend(*if_conds, clause);
     }
-    
-    pfree(str);
-    
-    return !all_pk_have_equality;
+
+    return true;
+}
+
+/*
+ * contain_param_walker
+ *        Check if an expression tree contains a Param
+ */
+static bool
+contain_param_walker(Node *node, void *context)
+{
+    if (node == NULL)
+        return false;
+    if (IsA(node, Param))
+        return true;
+    return expression_tree_walker(node, contain_param_walker, context);
 }
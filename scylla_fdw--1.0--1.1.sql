@@ -0,0 +1,47 @@
+/* scylla_fdw/scylla_fdw--1.0--1.1.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION scylla_fdw UPDATE TO '1.1'" to load this file. \quit
+
+-- Stand-in for CQL's token(), only usable in pushed-down WHERE clauses
+CREATE FUNCTION scylla_token(VARIADIC "any")
+RETURNS bigint
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT STABLE PARALLEL SAFE;
+
+-- Cluster-wide statistics, kept when preloaded via shared_preload_libraries
+CREATE FUNCTION scylla_fdw_stats(
+    OUT dbid oid,
+    OUT serverid oid,
+    OUT since timestamptz,
+    OUT sessions bigint,
+    OUT connections bigint,
+    OUT connects bigint,
+    OUT prepared_hits bigint,
+    OUT prepared_misses bigint,
+    OUT requests bigint,
+    OUT errors bigint,
+    OUT requests_per_second float8,
+    OUT latency_mean_ms float8,
+    OUT latency_p50_ms float8,
+    OUT latency_p95_ms float8,
+    OUT latency_p99_ms float8,
+    OUT latency_p999_ms float8,
+    OUT request_timeouts bigint,
+    OUT connection_timeouts bigint,
+    OUT pending_request_timeouts bigint,
+    OUT rows bigint,
+    OUT bytes bigint,
+    OUT total_time_ms float8
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW scylla_fdw_stats AS
+    SELECT srv.srvname AS server_name, s.*
+    FROM scylla_fdw_stats() s
+    LEFT JOIN pg_foreign_server srv
+        ON srv.oid = s.serverid
+        AND s.dbid = (SELECT oid FROM pg_database
+                      WHERE datname = current_database());
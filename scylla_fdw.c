@@ -12,9 +12,13 @@
  */
 #include "scylla_fdw.h"
 
+#include <math.h>
+
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/sysattr.h"
 #include "access/table.h"
+#include "common/hashfn.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
@@ -24,26 +28,46 @@
 #include "nodes/nodeFuncs.h"
 #include "optimizer/cost.h"
 #include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
 #include "optimizer/tlist.h"
+#include "executor/execAsync.h"
 #include "parser/parsetree.h"
+#include "storage/latch.h"
 #include "utils/array.h"
 #include "utils/date.h"
 #include "utils/datetime.h"
 #include "utils/float.h"
 #include "utils/formatting.h"
+#include "utils/guc.h"
 #include "utils/inet.h"
 #include "utils/numeric.h"
+#include "utils/selfuncs.h"
 #include "utils/timestamp.h"
 #include "utils/uuid.h"
 
 PG_MODULE_MAGIC;
 
+/*
+ * Settings overriding the consistency options of every foreign table; an
+ * empty string leaves the options in effect
+ */
+char       *scylla_read_consistency = NULL;
+char       *scylla_write_consistency = NULL;
+char       *scylla_serial_consistency = NULL;
+
+void        _PG_init(void);
+
+static bool check_consistency(char **newval, void **extra, GucSource source);
+static bool check_serial_consistency(char **newval, void **extra,
+                                     GucSource source);
+
 /*
  * SQL functions
  */
 PG_FUNCTION_INFO_V1(scylla_fdw_handler);
 PG_FUNCTION_INFO_V1(scylla_fdw_validator);
 PG_FUNCTION_INFO_V1(scylla_fdw_version);
+PG_FUNCTION_INFO_V1(scylla_token);
 
 /*
  * FDW callback functions
@@ -61,10 +85,33 @@ static ForeignScan *scyllaGetForeignPlan(PlannerInfo *root,
                                          List *tlist,
                                          List *scan_clauses,
                                          Plan *outer_plan);
+static void scyllaGetForeignUpperPaths(PlannerInfo *root,
+                                       UpperRelationKind stage,
+                                       RelOptInfo *input_rel,
+                                       RelOptInfo *output_rel,
+                                       void *extra);
 static void scyllaBeginForeignScan(ForeignScanState *node, int eflags);
 static TupleTableSlot *scyllaIterateForeignScan(ForeignScanState *node);
 static void scyllaReScanForeignScan(ForeignScanState *node);
 static void scyllaEndForeignScan(ForeignScanState *node);
+static bool scyllaIsForeignScanParallelSafe(PlannerInfo *root,
+                                            RelOptInfo *rel,
+                                            RangeTblEntry *rte);
+static Size scyllaEstimateDSMForeignScan(ForeignScanState *node,
+                                         ParallelContext *pcxt);
+static void scyllaInitializeDSMForeignScan(ForeignScanState *node,
+                                           ParallelContext *pcxt,
+                                           void *coordinate);
+static void scyllaReInitializeDSMForeignScan(ForeignScanState *node,
+                                             ParallelContext *pcxt,
+                                             void *coordinate);
+static bool scyllaIsForeignPathAsyncCapable(ForeignPath *path);
+static void scyllaForeignAsyncRequest(AsyncRequest *areq);
+static void scyllaForeignAsyncConfigureWait(AsyncRequest *areq);
+static void scyllaForeignAsyncNotify(AsyncRequest *areq);
+static void scyllaInitializeWorkerForeignScan(ForeignScanState *node,
+                                              shm_toc *toc,
+                                              void *coordinate);
 
 /* Modification support - implemented in scylla_fdw_modify.c */
 extern void scyllaAddForeignUpdateTargets(PlannerInfo *root,
@@ -94,6 +141,23 @@ extern TupleTableSlot *scyllaExecForeignDelete(EState *estate,
                                                TupleTableSlot *planSlot);
 extern void scyllaEndForeignModify(EState *estate,
                                    ResultRelInfo *resultRelInfo);
+extern void scyllaBeginForeignInsert(ModifyTableState *mtstate,
+                                     ResultRelInfo *resultRelInfo);
+extern void scyllaEndForeignInsert(EState *estate,
+                                   ResultRelInfo *resultRelInfo);
+extern bool scyllaPlanDirectModify(PlannerInfo *root,
+                                   ModifyTable *plan,
+                                   Index resultRelation,
+                                   int subplan_index);
+extern void scyllaBeginDirectModify(ForeignScanState *node, int eflags);
+extern TupleTableSlot *scyllaIterateDirectModify(ForeignScanState *node);
+extern void scyllaEndDirectModify(ForeignScanState *node);
+extern int scyllaGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo);
+extern TupleTableSlot **scyllaExecForeignBatchInsert(EState *estate,
+                                                     ResultRelInfo *resultRelInfo,
+                                                     TupleTableSlot **slots,
+                                                     TupleTableSlot **planSlots,
+                                                     int *numSlots);
 
 /* Join and upper path support - implemented in scylla_fdw_modify.c */
 extern void scyllaGetForeignJoinPaths(PlannerInfo *root,
@@ -104,14 +168,14 @@ extern void scyllaGetForeignJoinPaths(PlannerInfo *root,
                                       JoinPathExtraData *extra);
 
 /* Explain support - implemented in scylla_fdw_modify.c */
-#if PG_VERSION_NUM < 180000
 extern void scyllaExplainForeignScan(ForeignScanState *node, ExplainState *es);
 extern void scyllaExplainForeignModify(ModifyTableState *mtstate,
                                        ResultRelInfo *rinfo,
                                        List *fdw_private,
                                        int subplan_index,
                                        ExplainState *es);
-#endif
+extern void scyllaExplainDirectModify(ForeignScanState *node,
+                                      ExplainState *es);
 
 /* Analyze support - implemented in scylla_fdw_modify.c */
 extern bool scyllaAnalyzeForeignTable(Relation relation,
@@ -123,8 +187,90 @@ extern List *scyllaImportForeignSchema(ImportForeignSchemaStmt *stmt,
                                        Oid serverOid);
 
 /*
- * Helper functions - currently none needed
+ * Indexes of FDW-private information stored in fdw_private lists.
+ *
+ * These items are indexed with the enum FdwScanPrivateIndex, so an item
+ * can be fetched with list_nth().  For example, to get the CQL query:
+ *      sql = strVal(list_nth(fdw_private, FdwScanPrivateSelectSql));
+ */
+enum FdwScanPrivateIndex
+{
+    /* CQL statement to execute remotely (as a String node) */
+    FdwScanPrivateSelectSql,
+    /* Integer list of attribute numbers retrieved by the SELECT */
+    FdwScanPrivateRetrievedAttrs,
+    /* Remote conditions enforced by the SELECT */
+    FdwScanPrivateRemoteConds,
+    /* Paging size (as an Integer node) */
+    FdwScanPrivateFetchSize,
+    /* Number of pages to fetch ahead (as an Integer node) */
+    FdwScanPrivatePrefetchDepth,
+    /* Number of token ranges for a parallel scan, or 0 (as an Integer node) */
+    FdwScanPrivateTokenRanges,
+    /* Const list of partition keys to look up one at a time, or NIL */
+    FdwScanPrivateLookupKeys,
+    /* Max single-key lookups in flight (as an Integer node) */
+    FdwScanPrivateLookupConcurrency,
+    /* Integer list of (sum/avg, count) attnum pairs of an aggregate scan */
+    FdwScanPrivateEmptyAggs,
+    /* Rescan cache size in kB, or 0 (as an Integer node) */
+    FdwScanPrivateRescanCacheSize
+};
+
+/*
+ * Helper functions
  */
+static ForeignPath *create_scylla_scan_path(PlannerInfo *root,
+                                            RelOptInfo *baserel,
+                                            double rows,
+                                            Cost startup_cost,
+                                            Cost total_cost,
+                                            List *pathkeys,
+                                            Relids required_outer);
+static bool token_range_scan_ok(PlannerInfo *root, RelOptInfo *baserel,
+                                Oid foreigntableid);
+static void add_parallel_scan_path(PlannerInfo *root, RelOptInfo *baserel,
+                                   Oid foreigntableid);
+static void add_parameterized_paths(PlannerInfo *root, RelOptInfo *baserel,
+                                    Oid foreigntableid);
+static void add_foreign_grouping_path(PlannerInfo *root, RelOptInfo *input_rel,
+                                      RelOptInfo *grouped_rel,
+                                      GroupPathExtraData *extra);
+static bool foreign_grouping_ok(PlannerInfo *root, RelOptInfo *grouped_rel,
+                                Node *havingQual);
+static ForeignScan *get_foreign_grouping_plan(PlannerInfo *root,
+                                              RelOptInfo *grouped_rel,
+                                              List *tlist, Plan *outer_plan);
+static bool ec_member_matches_column(PlannerInfo *root, RelOptInfo *rel,
+                                     EquivalenceClass *ec,
+                                     EquivalenceMember *em,
+                                     void *arg);
+static void *get_scan_prepared(ScyllaFdwScanState *fsstate);
+static bool bind_scan_params(ScyllaFdwScanState *fsstate, void *statement,
+                             int first_index);
+static bool fetch_next_lookup_page(ScyllaFdwScanState *fsstate);
+static void issue_lookups(ScyllaFdwScanState *fsstate);
+static void discard_lookups(ScyllaFdwScanState *fsstate);
+static bool create_scan_statement(ScyllaFdwScanState *fsstate);
+static bool fetch_next_page(ScyllaFdwScanState *fsstate);
+static void *execute_scan_statement(ScyllaFdwScanState *fsstate,
+                                    char **error_msg);
+static void check_decoders(ScyllaFdwScanState *fsstate);
+static void decode_page(ScyllaFdwScanState *fsstate);
+static void issue_prefetch(ScyllaFdwScanState *fsstate);
+static bool async_fetch_ready(ScyllaFdwScanState *fsstate);
+static void produce_tuple_async(AsyncRequest *areq);
+static void collect_prefetched_page(ScyllaFdwScanState *fsstate, bool wait);
+static void release_scan_results(ScyllaFdwScanState *fsstate);
+static void discard_prefetch(ScyllaFdwScanState *fsstate);
+static ScyllaRescanCache *rescan_cache_create(ScyllaFdwScanState *fsstate,
+                                              int size_kb);
+static void rescan_cache_lookup(ScyllaFdwScanState *fsstate);
+static void rescan_cache_add_row(ScyllaFdwScanState *fsstate,
+                                 TupleTableSlot *slot);
+static void rescan_cache_resume(ScyllaRescanCache *cache);
+static void rescan_cache_store(ScyllaRescanCache *cache, bool complete);
+static void rescan_cache_reset(ScyllaRescanCache *cache);
 
 /*
  * Valid options for scylla_fdw.
@@ -146,6 +292,29 @@ static struct ScyllaFdwOption
     {OPT_CONNECT_TIMEOUT, ForeignServerRelationId},
     {OPT_REQUEST_TIMEOUT, ForeignServerRelationId},
     {OPT_CONSISTENCY, ForeignServerRelationId},
+    {OPT_READ_CONSISTENCY, ForeignServerRelationId},
+    {OPT_WRITE_CONSISTENCY, ForeignServerRelationId},
+    {OPT_SERIAL_CONSISTENCY, ForeignServerRelationId},
+    {OPT_FETCH_SIZE, ForeignServerRelationId},
+    {OPT_PREFETCH_DEPTH, ForeignServerRelationId},
+    {OPT_BATCH_SIZE, ForeignServerRelationId},
+    {OPT_MAX_INFLIGHT, ForeignServerRelationId},
+    {OPT_LOOKUP_CONCURRENCY, ForeignServerRelationId},
+    {OPT_RESCAN_CACHE_SIZE, ForeignServerRelationId},
+    {OPT_USE_REMOTE_ESTIMATE, ForeignServerRelationId},
+    {OPT_ASYNC_CAPABLE, ForeignServerRelationId},
+    {OPT_DIRECT_MODIFY_IF_EXISTS, ForeignServerRelationId},
+    {OPT_FDW_STARTUP_COST, ForeignServerRelationId},
+    {OPT_FDW_TUPLE_COST, ForeignServerRelationId},
+    {OPT_LOCAL_DC, ForeignServerRelationId},
+    {OPT_TOKEN_AWARE, ForeignServerRelationId},
+    {OPT_LATENCY_AWARE_ROUTING, ForeignServerRelationId},
+    {OPT_CORE_CONNECTIONS_PER_HOST, ForeignServerRelationId},
+    {OPT_NUM_IO_THREADS, ForeignServerRelationId},
+    {OPT_SPECULATIVE_DELAY_MS, ForeignServerRelationId},
+    {OPT_SPECULATIVE_MAX, ForeignServerRelationId},
+    {OPT_RETRY_POLICY, ForeignServerRelationId},
+    {OPT_LOG_RETRIES, ForeignServerRelationId},
 
     /* User mapping options */
     {OPT_USERNAME, UserMappingRelationId},
@@ -156,11 +325,110 @@ static struct ScyllaFdwOption
     {OPT_TABLE, ForeignTableRelationId},
     {OPT_PRIMARY_KEY, ForeignTableRelationId},
     {OPT_CLUSTERING_KEY, ForeignTableRelationId},
+    {OPT_TTL, ForeignTableRelationId},
+    {OPT_WRITE_TIMESTAMP, ForeignTableRelationId},
+    {OPT_READ_CONSISTENCY, ForeignTableRelationId},
+    {OPT_WRITE_CONSISTENCY, ForeignTableRelationId},
+    {OPT_SERIAL_CONSISTENCY, ForeignTableRelationId},
+    {OPT_FETCH_SIZE, ForeignTableRelationId},
+    {OPT_PREFETCH_DEPTH, ForeignTableRelationId},
+    {OPT_BATCH_SIZE, ForeignTableRelationId},
+    {OPT_MAX_INFLIGHT, ForeignTableRelationId},
+    {OPT_LOOKUP_CONCURRENCY, ForeignTableRelationId},
+    {OPT_RESCAN_CACHE_SIZE, ForeignTableRelationId},
+    {OPT_USE_REMOTE_ESTIMATE, ForeignTableRelationId},
+    {OPT_ASYNC_CAPABLE, ForeignTableRelationId},
+    {OPT_DIRECT_MODIFY_IF_EXISTS, ForeignTableRelationId},
 
     /* Sentinel */
     {NULL, InvalidOid}
 };
 
+/*
+ * _PG_init
+ *        Module load callback
+ */
+void
+_PG_init(void)
+{
+    DefineCustomStringVariable("scylla_fdw.read_consistency",
+                               "Consistency level for reads from ScyllaDB.",
+                               "Overrides the read_consistency and consistency options when set.",
+                               &scylla_read_consistency,
+                               "",
+                               PGC_USERSET,
+                               0,
+                               check_consistency,
+                               NULL,
+                               NULL);
+
+    DefineCustomStringVariable("scylla_fdw.write_consistency",
+                               "Consistency level for writes to ScyllaDB.",
+                               "Overrides the write_consistency and consistency options when set.",
+                               &scylla_write_consistency,
+                               "",
+                               PGC_USERSET,
+                               0,
+                               check_consistency,
+                               NULL,
+                               NULL);
+
+    DefineCustomStringVariable("scylla_fdw.serial_consistency",
+                               "Serial consistency level for conditional writes to ScyllaDB.",
+                               "Overrides the serial_consistency option when set.",
+                               &scylla_serial_consistency,
+                               "",
+                               PGC_USERSET,
+                               0,
+                               check_serial_consistency,
+                               NULL,
+                               NULL);
+
+    scylla_shared_stats_install();
+
+#if PG_VERSION_NUM >= 150000
+    MarkGUCPrefixReserved("scylla_fdw");
+#else
+    EmitWarningsOnPlaceholders("scylla_fdw");
+#endif
+}
+
+/*
+ * check_consistency
+ *        GUC check hook for the read and write consistency settings
+ */
+static bool
+check_consistency(char **newval, void **extra, GucSource source)
+{
+    if (**newval == '\0' || scylla_string_to_consistency(*newval) >= 0)
+        return true;
+
+    GUC_check_errdetail("Valid values are: any, one, two, three, quorum, all, "
+                        "local_quorum, each_quorum, serial, local_serial, local_one.");
+    return false;
+}
+
+/*
+ * check_serial_consistency
+ *        GUC check hook for the serial consistency setting
+ */
+static bool
+check_serial_consistency(char **newval, void **extra, GucSource source)
+{
+    int         level;
+
+    if (**newval == '\0')
+        return true;
+
+    level = scylla_string_to_consistency(*newval);
+    if (level == SCYLLA_CONSISTENCY_SERIAL ||
+        level == SCYLLA_CONSISTENCY_LOCAL_SERIAL)
+        return true;
+
+    GUC_check_errdetail("Valid values are: serial, local_serial.");
+    return false;
+}
+
 /*
  * scylla_fdw_handler
  *        Return the FdwRoutine struct containing the FDW function pointers
@@ -179,6 +447,19 @@ scylla_fdw_handler(PG_FUNCTION_ARGS)
     routine->ReScanForeignScan = scyllaReScanForeignScan;
     routine->EndForeignScan = scyllaEndForeignScan;
 
+    /* Parallel scan support */
+    routine->IsForeignScanParallelSafe = scyllaIsForeignScanParallelSafe;
+    routine->EstimateDSMForeignScan = scyllaEstimateDSMForeignScan;
+    routine->InitializeDSMForeignScan = scyllaInitializeDSMForeignScan;
+    routine->ReInitializeDSMForeignScan = scyllaReInitializeDSMForeignScan;
+    routine->InitializeWorkerForeignScan = scyllaInitializeWorkerForeignScan;
+
+    /* Asynchronous execution support */
+    routine->IsForeignPathAsyncCapable = scyllaIsForeignPathAsyncCapable;
+    routine->ForeignAsyncRequest = scyllaForeignAsyncRequest;
+    routine->ForeignAsyncConfigureWait = scyllaForeignAsyncConfigureWait;
+    routine->ForeignAsyncNotify = scyllaForeignAsyncNotify;
+
     /* Modification support */
     routine->AddForeignUpdateTargets = scyllaAddForeignUpdateTargets;
     routine->PlanForeignModify = scyllaPlanForeignModify;
@@ -187,15 +468,23 @@ scylla_fdw_handler(PG_FUNCTION_ARGS)
     routine->ExecForeignUpdate = scyllaExecForeignUpdate;
     routine->ExecForeignDelete = scyllaExecForeignDelete;
     routine->EndForeignModify = scyllaEndForeignModify;
-
-    /* Join pushdown support */
+    routine->BeginForeignInsert = scyllaBeginForeignInsert;
+    routine->EndForeignInsert = scyllaEndForeignInsert;
+    routine->GetForeignModifyBatchSize = scyllaGetForeignModifyBatchSize;
+    routine->ExecForeignBatchInsert = scyllaExecForeignBatchInsert;
+    routine->PlanDirectModify = scyllaPlanDirectModify;
+    routine->BeginDirectModify = scyllaBeginDirectModify;
+    routine->IterateDirectModify = scyllaIterateDirectModify;
+    routine->EndDirectModify = scyllaEndDirectModify;
+
+    /* Join and aggregate pushdown support */
     routine->GetForeignJoinPaths = scyllaGetForeignJoinPaths;
+    routine->GetForeignUpperPaths = scyllaGetForeignUpperPaths;
 
     /* Explain support */
-#if PG_VERSION_NUM < 180000
     routine->ExplainForeignScan = scyllaExplainForeignScan;
     routine->ExplainForeignModify = scyllaExplainForeignModify;
-#endif
+    routine->ExplainDirectModify = scyllaExplainDirectModify;
 
     /* Analyze support */
     routine->AnalyzeForeignTable = scyllaAnalyzeForeignTable;
@@ -221,25 +510,30 @@ scylla_fdw_validator(PG_FUNCTION_ARGS)
     {
         DefElem    *def = (DefElem *) lfirst(cell);
         bool        found = false;
+        bool        known = false;
         struct ScyllaFdwOption *opt;
 
+        /* An option may be listed once for each object type it applies to */
         for (opt = scylla_fdw_options; opt->keyword; opt++)
         {
             if (strcmp(opt->keyword, def->defname) == 0)
             {
-                if (catalog != opt->context)
+                known = true;
+                if (catalog == opt->context)
                 {
-                    ereport(ERROR,
-                            (errcode(ERRCODE_SYNTAX_ERROR),
-                             errmsg("invalid option \"%s\"", def->defname),
-                             errhint("Option \"%s\" is not valid for this object type.",
-                                     def->defname)));
+                    found = true;
+                    break;
                 }
-                found = true;
-                break;
             }
         }
 
+        if (!found && known)
+            ereport(ERROR,
+                    (errcode(ERRCODE_SYNTAX_ERROR),
+                     errmsg("invalid option \"%s\"", def->defname),
+                     errhint("Option \"%s\" is not valid for this object type.",
+                             def->defname)));
+
         if (!found)
         {
             StringInfoData buf;
@@ -270,7 +564,87 @@ scylla_fdw_validator(PG_FUNCTION_ARGS)
                          errmsg("invalid port number: %s", defGetString(def))));
         }
 
-        if (strcmp(def->defname, OPT_CONSISTENCY) == 0)
+        if (strcmp(def->defname, OPT_FETCH_SIZE) == 0 ||
+            strcmp(def->defname, OPT_BATCH_SIZE) == 0 ||
+            strcmp(def->defname, OPT_MAX_INFLIGHT) == 0 ||
+            strcmp(def->defname, OPT_CORE_CONNECTIONS_PER_HOST) == 0 ||
+            strcmp(def->defname, OPT_NUM_IO_THREADS) == 0 ||
+            strcmp(def->defname, OPT_SPECULATIVE_MAX) == 0)
+        {
+            char *endptr;
+            long size = strtol(defGetString(def), &endptr, 10);
+            if (*endptr != '\0' || size < 1 || size > INT_MAX)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid value for %s: %s",
+                                def->defname, defGetString(def)),
+                         errhint("Value must be a positive integer.")));
+        }
+
+        if (strcmp(def->defname, OPT_PREFETCH_DEPTH) == 0 ||
+            strcmp(def->defname, OPT_LOOKUP_CONCURRENCY) == 0 ||
+            strcmp(def->defname, OPT_RESCAN_CACHE_SIZE) == 0 ||
+            strcmp(def->defname, OPT_TTL) == 0 ||
+            strcmp(def->defname, OPT_SPECULATIVE_DELAY_MS) == 0)
+        {
+            char *endptr;
+            long depth = strtol(defGetString(def), &endptr, 10);
+            if (*endptr != '\0' || depth < 0 || depth > INT_MAX)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid value for %s: %s",
+                                def->defname, defGetString(def)),
+                         errhint("Value must be a non-negative integer.")));
+        }
+
+        if (strcmp(def->defname, OPT_WRITE_TIMESTAMP) == 0)
+        {
+            char *endptr;
+
+            errno = 0;
+            (void) strtoll(defGetString(def), &endptr, 10);
+            if (*endptr != '\0' || errno != 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid value for %s: %s",
+                                def->defname, defGetString(def)),
+                         errhint("Value must be microseconds since the epoch.")));
+        }
+
+        if (strcmp(def->defname, OPT_FDW_STARTUP_COST) == 0 ||
+            strcmp(def->defname, OPT_FDW_TUPLE_COST) == 0)
+        {
+            char *endptr;
+            double cost = strtod(defGetString(def), &endptr);
+            if (*endptr != '\0' || cost < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid value for %s: %s",
+                                def->defname, defGetString(def)),
+                         errhint("Value must be a non-negative number.")));
+        }
+
+        if (strcmp(def->defname, OPT_USE_REMOTE_ESTIMATE) == 0 ||
+            strcmp(def->defname, OPT_ASYNC_CAPABLE) == 0 ||
+            strcmp(def->defname, OPT_DIRECT_MODIFY_IF_EXISTS) == 0 ||
+            strcmp(def->defname, OPT_TOKEN_AWARE) == 0 ||
+            strcmp(def->defname, OPT_LATENCY_AWARE_ROUTING) == 0 ||
+            strcmp(def->defname, OPT_LOG_RETRIES) == 0)
+            (void) defGetBoolean(def);
+
+        if (strcmp(def->defname, OPT_RETRY_POLICY) == 0)
+        {
+            const char *val = defGetString(def);
+            if (scylla_string_to_retry_policy(val) < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid retry policy: %s", val),
+                         errhint("Valid values are: default, fallthrough, downgrading")));
+        }
+
+        if (strcmp(def->defname, OPT_CONSISTENCY) == 0 ||
+            strcmp(def->defname, OPT_READ_CONSISTENCY) == 0 ||
+            strcmp(def->defname, OPT_WRITE_CONSISTENCY) == 0)
         {
             const char *val = defGetString(def);
             if (scylla_string_to_consistency(val) < 0)
@@ -280,6 +654,19 @@ scylla_fdw_validator(PG_FUNCTION_ARGS)
                          errhint("Valid values are: any, one, two, three, quorum, all, "
                                  "local_quorum, each_quorum, serial, local_serial, local_one")));
         }
+
+        if (strcmp(def->defname, OPT_SERIAL_CONSISTENCY) == 0)
+        {
+            const char *val = defGetString(def);
+            int         level = scylla_string_to_consistency(val);
+
+            if (level != SCYLLA_CONSISTENCY_SERIAL &&
+                level != SCYLLA_CONSISTENCY_LOCAL_SERIAL)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("invalid serial consistency level: %s", val),
+                         errhint("Valid values are: serial, local_serial")));
+        }
     }
 
     PG_RETURN_VOID();
@@ -295,6 +682,25 @@ scylla_fdw_version(PG_FUNCTION_ARGS)
     PG_RETURN_TEXT_P(cstring_to_text(SCYLLA_FDW_VERSION));
 }
 
+/*
+ * scylla_token
+ *        Stand-in for CQL's token() in WHERE clauses
+ *
+ * Comparisons of scylla_token() of a foreign table's partition key columns
+ * are sent to ScyllaDB as token() restrictions.  The token can't be
+ * computed locally, so any other use is an error.
+ */
+Datum
+scylla_token(PG_FUNCTION_ARGS)
+{
+    ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("scylla_token() can only be evaluated by ScyllaDB"),
+             errhint("Compare scylla_token() of all partition key columns of a scylla_fdw foreign table, in primary_key order, with a bigint.")));
+
+    PG_RETURN_NULL();
+}
+
 /*
  * scyllaGetForeignRelSize
  *        Obtain relation size estimates for a foreign table
@@ -313,17 +719,23 @@ scyllaGetForeignRelSize(PlannerInfo *root,
     fpinfo = (ScyllaFdwRelationInfo *) palloc0(sizeof(ScyllaFdwRelationInfo));
     baserel->fdw_private = (void *) fpinfo;
 
-    /* Look up foreign server and table options */
+    /* Server, table and user options, and the key columns they name */
+    scylla_init_rel_info(foreigntableid, fpinfo);
+
     fpinfo->rel = table_open(foreigntableid, NoLock);
 
-    /* Get server, table, and user options */
+    /* Ask the server how many partitions the table has, if so configured */
+    fpinfo->remote_partitions = -1;
+    if (fpinfo->use_remote_estimate && fpinfo->keyspace != NULL &&
+        fpinfo->table != NULL)
     {
-        List *server_opts = NIL;
-        List *table_opts = NIL;
-        List *user_opts = NIL;
+        ForeignTable *table = GetForeignTable(foreigntableid);
+        ForeignServer *server = GetForeignServer(table->serverid);
+        UserMapping *user = GetUserMapping(GetUserId(), server->serverid);
+        void       *conn = scylla_get_connection(server, user, false);
 
-        scylla_get_options(foreigntableid, &server_opts, &table_opts, &user_opts);
-        scylla_extract_options(server_opts, table_opts, user_opts, fpinfo);
+        fpinfo->remote_partitions = scylla_estimate_partition_count(conn, fpinfo);
+        scylla_release_connection(conn);
     }
 
     /* Identify which baserestrictinfo clauses can be sent to the remote server */
@@ -356,9 +768,13 @@ scyllaGetForeignRelSize(PlannerInfo *root,
                             &fpinfo->rows, &fpinfo->width,
                             &fpinfo->startup_cost, &fpinfo->total_cost);
 
-    /* Set the relation size estimate */
+    /*
+     * Set the relation size estimate.  baserel->tuples keeps the remote
+     * table's size, which only falls back to the default before ANALYZE.
+     */
     baserel->rows = fpinfo->rows;
-    baserel->tuples = fpinfo->rows;
+    if (baserel->tuples < 0)
+        baserel->tuples = 1000;
 
     elog(DEBUG1, "scylla_fdw: estimated rows=%.0f, width=%d", fpinfo->rows, fpinfo->width);
 
@@ -376,63 +792,288 @@ scyllaGetForeignPaths(PlannerInfo *root,
 {
     ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
     ForeignPath *path;
+    List       *useful_pathkeys;
 
     elog(DEBUG1, "scylla_fdw: creating foreign paths for relation %u", foreigntableid);
 
     /* Create a basic foreign path */
-    /* Note: PG17 and PG18 changed the signature - check PG_VERSION_NUM */
-#if PG_VERSION_NUM >= 180000
-    /* PostgreSQL 18+ signature - added disabled_nodes parameter */
-    path = create_foreignscan_path(root, baserel,
-                                   NULL,                    /* default pathtarget */
-                                   fpinfo->rows,            /* rows */
-                                   0,                       /* disabled_nodes */
-                                   fpinfo->startup_cost,    /* startup_cost */
-                                   fpinfo->total_cost,      /* total_cost */
-                                   NIL,                     /* pathkeys */
-                                   NULL,                    /* required_outer */
-                                   NULL,                    /* fdw_outerpath */
-                                   NIL,                     /* fdw_restrictinfo */
-                                   NIL);                    /* fdw_private */
-#elif PG_VERSION_NUM >= 170000
-    /* PostgreSQL 17 signature */
-    path = create_foreignscan_path(root, baserel,
-                                   NULL,    /* default pathtarget */
-                                   fpinfo->rows,
-                                   fpinfo->startup_cost,
-                                   fpinfo->total_cost,
-                                   NIL,     /* no pathkeys */
-                                   baserel->lateral_relids,
-                                   NULL,    /* no extra plan */
-                                   NIL,     /* no fdw_restrictinfo */
-                                   NIL);    /* no fdw_private */
-#elif PG_VERSION_NUM >= 90600
-    /* PostgreSQL 9.6 to 16 signature */
-    path = create_foreignscan_path(root, baserel,
-                                   NULL,    /* default pathtarget */
+    path = create_scylla_scan_path(root, baserel,
                                    fpinfo->rows,
                                    fpinfo->startup_cost,
                                    fpinfo->total_cost,
-                                   NIL,     /* no pathkeys */
-                                   baserel->lateral_relids,
-                                   NULL,    /* no extra plan */
-                                   NIL);    /* no fdw_private */
+                                   NIL,
+                                   baserel->lateral_relids);
+    add_path(baserel, (Path *) path);
+
+    /* Consider a parallel scan split across token ranges */
+    if (baserel->consider_parallel && baserel->lateral_relids == NULL)
+        add_parallel_scan_path(root, baserel, foreigntableid);
+
+    /* Consider key lookups driven by the outer side of a nested loop */
+    add_parameterized_paths(root, baserel, foreigntableid);
+
+    /*
+     * Within a partition, rows come back in clustering order, so a query
+     * pinning the partition key can be sorted by ScyllaDB for free.
+     */
+    useful_pathkeys = scylla_get_useful_pathkeys(root, baserel);
+    if (useful_pathkeys != NIL)
+    {
+        path = create_scylla_scan_path(root, baserel,
+                                       fpinfo->rows,
+                                       fpinfo->startup_cost,
+                                       fpinfo->total_cost,
+                                       useful_pathkeys,
+                                       baserel->lateral_relids);
+        add_path(baserel, (Path *) path);
+    }
+}
+
+/*
+ * scyllaGetForeignUpperPaths
+ *        Add paths for post-join operations like aggregation
+ *
+ * Only aggregation of a single foreign table is pushed down; CQL has no
+ * way to sort or deduplicate except along the clustering order.
+ */
+static void
+scyllaGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                           RelOptInfo *input_rel, RelOptInfo *output_rel,
+                           void *extra)
+{
+    ScyllaFdwRelationInfo *ifpinfo = (ScyllaFdwRelationInfo *) input_rel->fdw_private;
+    ScyllaFdwRelationInfo *fpinfo;
+
+    if (stage != UPPERREL_GROUP_AGG || ifpinfo == NULL ||
+        input_rel->reloptkind != RELOPT_BASEREL ||
+        output_rel->fdw_private != NULL)
+        return;
+
+    fpinfo = (ScyllaFdwRelationInfo *) palloc0(sizeof(ScyllaFdwRelationInfo));
+    fpinfo->outerrel = input_rel;
+    output_rel->fdw_private = fpinfo;
+
+    add_foreign_grouping_path(root, input_rel, output_rel,
+                              (GroupPathExtraData *) extra);
+}
+
+/*
+ * add_foreign_grouping_path
+ *        Add a path computing the aggregates of grouped_rel in ScyllaDB
+ *
+ * The remote query still reads every row it aggregates, but sends back
+ * one row per group; the cost reflects only the transfer saved.
+ */
+static void
+add_foreign_grouping_path(PlannerInfo *root, RelOptInfo *input_rel,
+                          RelOptInfo *grouped_rel, GroupPathExtraData *extra)
+{
+    Query      *parse = root->parse;
+    ScyllaFdwRelationInfo *ifpinfo = (ScyllaFdwRelationInfo *) input_rel->fdw_private;
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) grouped_rel->fdw_private;
+    ForeignPath *path;
+    double      num_groups;
+    Cost        startup_cost;
+    Cost        total_cost;
+
+    if (extra->patype == PARTITIONWISE_AGGREGATE_PARTIAL ||
+        !foreign_grouping_ok(root, grouped_rel, extra->havingQual))
+        return;
+
+    if (parse->groupClause != NIL)
+        num_groups = estimate_num_groups(root,
+                                         get_sortgrouplist_exprs(parse->groupClause,
+                                                                 fpinfo->grouped_tlist),
+                                         ifpinfo->rows, NULL, NULL);
+    else
+        num_groups = 1;
+
+    startup_cost = Max(ifpinfo->startup_cost,
+                       ifpinfo->total_cost -
+                       ifpinfo->rows * (cpu_tuple_cost + ifpinfo->fdw_tuple_cost));
+    total_cost = startup_cost +
+        num_groups * (cpu_tuple_cost + ifpinfo->fdw_tuple_cost);
+
+    elog(DEBUG1, "scylla_fdw: adding aggregate path, estimated groups=%.0f",
+         num_groups);
+
+#if PG_VERSION_NUM >= 180000
+    path = create_foreign_upper_path(root, grouped_rel,
+                                     grouped_rel->reltarget,
+                                     num_groups,
+                                     0,         /* disabled_nodes */
+                                     startup_cost,
+                                     total_cost,
+                                     NIL,       /* no pathkeys */
+                                     NULL,      /* no extra plan */
+                                     NIL,       /* no fdw_restrictinfo */
+                                     NIL);      /* no fdw_private */
+#elif PG_VERSION_NUM >= 170000
+    path = create_foreign_upper_path(root, grouped_rel,
+                                     grouped_rel->reltarget,
+                                     num_groups,
+                                     startup_cost,
+                                     total_cost,
+                                     NIL,       /* no pathkeys */
+                                     NULL,      /* no extra plan */
+                                     NIL,       /* no fdw_restrictinfo */
+                                     NIL);      /* no fdw_private */
 #else
-    /* Pre-9.6 signature */
-    path = create_foreignscan_path(root, baserel,
-                                   fpinfo->rows,
-                                   fpinfo->startup_cost,
-                                   fpinfo->total_cost,
-                                   NIL,     /* no pathkeys */
-                                   baserel->lateral_relids,
-                                   NULL,    /* no extra plan */
-                                   NIL);    /* no fdw_private */
+    path = create_foreign_upper_path(root, grouped_rel,
+                                     grouped_rel->reltarget,
+                                     num_groups,
+                                     startup_cost,
+                                     total_cost,
+                                     NIL,       /* no pathkeys */
+                                     NULL,      /* no extra plan */
+                                     NIL);      /* no fdw_private */
 #endif
-    add_path(baserel, (Path *) path);
+    add_path(grouped_rel, (Path *) path);
+}
+
+/*
+ * foreign_grouping_ok
+ *        Check if the aggregation of grouped_rel can be done by ScyllaDB
+ *
+ * Every condition of the scan must be pushed down, every aggregate must
+ * be one CQL can compute, and the query may only group by plain key
+ * columns forming a primary key prefix, as CQL's GROUP BY requires.
+ * Leading key columns pinned with = can be left out of that prefix.
+ *
+ * On success, fills in the grouped_tlist, group_attrs and empty_aggs of
+ * grouped_rel's fpinfo.  Expressions over grouping columns and aggregates
+ * are computed locally from the fetched values.
+ */
+static bool
+foreign_grouping_ok(PlannerInfo *root, RelOptInfo *grouped_rel,
+                    Node *havingQual)
+{
+    Query      *parse = root->parse;
+    PathTarget *grouping_target = grouped_rel->reltarget;
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) grouped_rel->fdw_private;
+    RelOptInfo *scanrel = fpinfo->outerrel;
+    ScyllaFdwRelationInfo *ifpinfo = (ScyllaFdwRelationInfo *) scanrel->fdw_private;
+    Bitmapset  *grouped = NULL;
+    List       *tlist = NIL;
+    List       *aggs = NIL;
+    List       *keys;
+    ListCell   *lc;
+    int         i;
+
+    if (parse->groupingSets != NIL || havingQual != NULL ||
+        root->hasPseudoConstantQuals ||
+        ifpinfo->local_conds != NIL || scanrel->lateral_relids != NULL)
+        return false;
+
+    i = 0;
+    foreach(lc, grouping_target->exprs)
+    {
+        Expr       *expr = (Expr *) lfirst(lc);
+        Index       sgref = get_pathtarget_sortgroupref(grouping_target, i);
+        List       *vars;
+        ListCell   *lc2;
+
+        i++;
+
+        if (sgref != 0 && get_sortgroupref_clause_noerr(sgref, parse->groupClause))
+        {
+            Var        *var = (Var *) expr;
+
+            /* CQL can only group by plain columns, compared bytewise */
+            if (!IsA(expr, Var) || var->varno != scanrel->relid ||
+                var->varattno <= 0 ||
+                (OidIsValid(var->varcollid) &&
+                 !get_collation_isdeterministic(var->varcollid)))
+                return false;
+
+            grouped = bms_add_member(grouped, var->varattno);
+            tlist = add_to_flat_tlist(tlist, list_make1(expr));
+            continue;
+        }
+
+        /* Anything else must be built from aggregates and grouping columns */
+        vars = pull_var_clause((Node *) expr, PVC_INCLUDE_AGGREGATES);
+        foreach(lc2, vars)
+        {
+            Expr       *var = (Expr *) lfirst(lc2);
+
+            if (IsA(var, Aggref))
+            {
+                if (!scylla_is_foreign_aggregate(scanrel, (Aggref *) var))
+                    return false;
+                aggs = lappend(aggs, var);
+            }
+            else if (!IsA(var, Var) || ((Var *) var)->varno != scanrel->relid)
+                return false;
+            tlist = add_to_flat_tlist(tlist, list_make1(var));
+        }
+    }
+
+    /*
+     * Walk the primary key.  Each column must be grouped or pinned, until
+     * all grouped columns are used up; the whole partition key is needed.
+     */
+    keys = list_concat_copy(ifpinfo->pk_attrs, ifpinfo->ck_attrs);
+    fpinfo->group_attrs = NIL;
+    i = 0;
+    foreach(lc, keys)
+    {
+        AttrNumber  attnum = lfirst_int(lc);
+
+        if (bms_is_empty(grouped) && i >= list_length(ifpinfo->pk_attrs))
+            break;
+        if (bms_is_member(attnum, grouped))
+        {
+            fpinfo->group_attrs = lappend_int(fpinfo->group_attrs, attnum);
+            grouped = bms_del_member(grouped, attnum);
+        }
+        else if (!scylla_column_has_equality(scanrel, ifpinfo->remote_conds,
+                                             attnum, false))
+            break;
+        i++;
+    }
+    if (!bms_is_empty(grouped) ||
+        (fpinfo->group_attrs != NIL && i < list_length(ifpinfo->pk_attrs)))
+        return false;
+
+    /*
+     * CQL's sum and avg return 0 over no values, where PostgreSQL returns
+     * NULL, so each one is fetched with a count of its argument.
+     */
+    fpinfo->empty_aggs = NIL;
+    foreach(lc, aggs)
+    {
+        Aggref     *agg = (Aggref *) lfirst(lc);
+        Aggref     *count;
+        TargetEntry *tle;
+
+        if (!scylla_aggregate_needs_count(agg))
+            continue;
+
+        count = scylla_make_count_aggregate(agg);
+        tlist = add_to_flat_tlist(tlist, list_make1(count));
+        tle = tlist_member((Expr *) agg, tlist);
+        fpinfo->empty_aggs = lappend_int(fpinfo->empty_aggs, tle->resno);
+        tle = tlist_member((Expr *) count, tlist);
+        fpinfo->empty_aggs = lappend_int(fpinfo->empty_aggs, tle->resno);
+    }
+
+    /* Name the fetched columns, for error messages */
+    foreach(lc, tlist)
+    {
+        TargetEntry *tle = lfirst_node(TargetEntry, lc);
+
+        if (IsA(tle->expr, Var))
+            tle->resname = get_attname(planner_rt_fetch(scanrel->relid, root)->relid,
+                                       ((Var *) tle->expr)->varattno, false);
+        else
+            tle->resname = get_func_name(((Aggref *) tle->expr)->aggfnoid);
+    }
+
+    apply_pathtarget_labeling_to_tlist(tlist, grouping_target);
+    fpinfo->grouped_tlist = tlist;
 
-    /* If we have ORDER BY pushdown possibility, add sorted path */
-    /* ScyllaDB supports ORDER BY on clustering columns */
-    /* Future enhancement: add ordered paths for clustering key columns */
+    return true;
 }
 
 /*
@@ -457,25 +1098,148 @@ scyllaGetForeignPlan(PlannerInfo *root,
     List       *fdw_scan_tlist = NIL;
     List       *retrieved_attrs;
     StringInfoData sql;
+    int         token_ranges = 0;
+    Bitmapset  *param_attrs = NULL;
+    List       *deparse_exprs;
+    ScalarArrayOpExpr *lookup_saop = NULL;
+    Param      *lookup_marker = NULL;
+    List       *lookup_keys = NIL;
+    int         limit = 0;
     ListCell   *lc;
 
-    /* Separate scan_clauses into those pushed down and those not */
+    /* Aggregates computed by ScyllaDB have a plan of their own */
+    if (IS_UPPER_REL(baserel))
+        return get_foreign_grouping_plan(root, baserel, tlist, outer_plan);
+
+    /*
+     * A parallel-aware scan covers the token ring in chunks; each partial
+     * path was created with a fixed number of ranges in fdw_private.
+     */
+    if (best_path->path.parallel_aware)
+        token_ranges = intVal(linitial(best_path->fdw_private));
+
+    /*
+     * Separate scan_clauses into those pushed down and those not.  For a
+     * parameterized path, this includes the join clauses on partition key
+     * columns; CQL accepts a single equality per column, so any further
+     * clause on an already pinned column is checked locally, as are all
+     * of them when a token() restriction is sent.
+     */
     foreach(lc, scan_clauses)
     {
         RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        AttrNumber  attnum;
 
         if (list_member_ptr(fpinfo->remote_conds, rinfo))
             remote_exprs = lappend(remote_exprs, rinfo->clause);
+        else if (best_path->path.param_info != NULL &&
+                 scylla_is_foreign_param_clause(root, baserel, rinfo->clause,
+                                                &attnum) &&
+                 is_partition_key_column(fpinfo, attnum) &&
+                 !scylla_conds_restrict_token(baserel, fpinfo->remote_conds) &&
+                 !bms_is_member(attnum, param_attrs) &&
+                 !scylla_column_has_equality(baserel, fpinfo->remote_conds,
+                                             attnum, true))
+        {
+            remote_exprs = lappend(remote_exprs, rinfo->clause);
+            param_attrs = bms_add_member(param_attrs, attnum);
+        }
         else
             local_exprs = lappend(local_exprs, rinfo->clause);
     }
 
+    /*
+     * With lookup_concurrency set, a constant IN list on a partition key
+     * column is split up: the query is deparsed with "col = ?" in its place, and each
+     * key is sent as a separate request, which the driver routes straight
+     * to a replica owning it.  The marker for the key goes first.
+     */
+    deparse_exprs = remote_exprs;
+    if (fpinfo->lookup_concurrency > 0 && token_ranges == 0 &&
+        best_path->path.pathkeys == NIL)
+    {
+        foreach(lc, remote_exprs)
+        {
+            ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) lfirst(lc);
+            Expr       *keycol;
+            Oid         elemtype;
+
+            if (!IsA(saop, ScalarArrayOpExpr) ||
+                !IsA(lsecond(saop->args), Const))
+                continue;
+
+            /* The keys are bound, as values of the column's type */
+            elemtype = get_element_type(((Const *) lsecond(saop->args))->consttype);
+            if (elemtype != exprType(linitial(saop->args)) ||
+                !scylla_is_bindable_type(elemtype))
+                continue;
+
+            keycol = (Expr *) linitial(saop->args);
+            if (IsA(keycol, RelabelType))
+                keycol = ((RelabelType *) keycol)->arg;
+            if (list_member_int(fpinfo->pk_attrs, ((Var *) keycol)->varattno))
+            {
+                lookup_saop = saop;
+                break;
+            }
+        }
+    }
+    if (lookup_saop != NULL)
+    {
+        Expr       *keycol = (Expr *) linitial(lookup_saop->args);
+        Const      *keys = (Const *) lsecond(lookup_saop->args);
+
+        lookup_keys = scylla_const_array_elements(keys);
+
+        lookup_marker = makeNode(Param);
+        lookup_marker->paramkind = PARAM_EXTERN;
+        lookup_marker->paramid = 0;
+        lookup_marker->paramtype = linitial_node(Const, lookup_keys)->consttype;
+        lookup_marker->paramtypmod = -1;
+        lookup_marker->paramcollid = InvalidOid;
+        lookup_marker->location = -1;
+
+        deparse_exprs = list_delete_ptr(list_copy(remote_exprs), lookup_saop);
+        deparse_exprs = lcons(make_opclause(lookup_saop->opno, BOOLOID, false,
+                                            keycol, (Expr *) lookup_marker,
+                                            InvalidOid,
+                                            lookup_saop->inputcollid),
+                              deparse_exprs);
+    }
+
+    /*
+     * A LIMIT can be sent along when every row ScyllaDB returns reaches the
+     * Limit node above us: no local filtering, no join, no row locking, and
+     * results already in the order the query wants.  The Limit node still
+     * applies it; this only stops ScyllaDB from paging through rows that
+     * would be thrown away.
+     */
+    if (root->limit_tuples > 0 && root->limit_tuples <= PG_INT32_MAX &&
+        local_exprs == NIL && token_ranges == 0 &&
+        best_path->path.param_info == NULL &&
+        root->parse->rowMarks == NIL &&
+        bms_membership(root->all_baserels) == BMS_SINGLETON &&
+        pathkeys_contained_in(root->query_pathkeys, best_path->path.pathkeys))
+        limit = (int) root->limit_tuples;
+
     /* Build the CQL query */
     initStringInfo(&sql);
     {
         char *query = scylla_build_select_query(root, baserel, fpinfo,
-                                                tlist, remote_exprs,
-                                                &retrieved_attrs);
+                                                tlist, deparse_exprs,
+                                                token_ranges > 0,
+                                                best_path->path.pathkeys,
+                                                limit,
+                                                &retrieved_attrs,
+                                                &params_list);
+
+        /* The key marker is bound by the scan itself, not from fdw_exprs */
+        if (lookup_marker != NULL)
+        {
+            Assert(linitial(params_list) == lookup_marker);
+            params_list = list_delete_first(params_list);
+        }
+
         appendStringInfoString(&sql, query);
         elog(DEBUG1, "scylla_fdw: generated CQL query: %s", query);
         pfree(query);
@@ -483,14 +1247,18 @@ scyllaGetForeignPlan(PlannerInfo *root,
 
     /*
      * Build the fdw_private list that will be passed to BeginForeignScan.
-     * Items:
-     *  1) CQL query string
-     *  2) Integer list of retrieved attribute numbers
-     *  3) Remote conditions to be enforced
+     * Items in the list must match enum FdwScanPrivateIndex, above.
      */
-    fdw_private = list_make3(makeString(sql.data),
+    fdw_private = list_make5(makeString(sql.data),
                              retrieved_attrs,
-                             remote_exprs);
+                             remote_exprs,
+                             makeInteger(fpinfo->fetch_size),
+                             makeInteger(fpinfo->prefetch_depth));
+    fdw_private = lappend(fdw_private, makeInteger(token_ranges));
+    fdw_private = lappend(fdw_private, lookup_keys);
+    fdw_private = lappend(fdw_private, makeInteger(fpinfo->lookup_concurrency));
+    fdw_private = lappend(fdw_private, NIL);
+    fdw_private = lappend(fdw_private, makeInteger(fpinfo->rescan_cache_size));
 
     /* Create the ForeignScan node */
     return make_foreignscan(tlist,
@@ -503,6 +1271,52 @@ scyllaGetForeignPlan(PlannerInfo *root,
                             outer_plan);
 }
 
+/*
+ * get_foreign_grouping_plan
+ *        Create a ForeignScan plan node computing a grouped rel's aggregates
+ *
+ * The scan returns the rows of fpinfo->grouped_tlist; the plan's own tlist
+ * is computed from them.
+ */
+static ForeignScan *
+get_foreign_grouping_plan(PlannerInfo *root, RelOptInfo *grouped_rel,
+                          List *tlist, Plan *outer_plan)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) grouped_rel->fdw_private;
+    ScyllaFdwRelationInfo *ifpinfo = (ScyllaFdwRelationInfo *) fpinfo->outerrel->fdw_private;
+    List       *remote_exprs = extract_actual_clauses(ifpinfo->remote_conds, false);
+    List       *retrieved_attrs;
+    List       *params_list;
+    List       *fdw_private;
+    char       *query;
+
+    query = scylla_build_aggregate_query(root, grouped_rel,
+                                         fpinfo->grouped_tlist, remote_exprs,
+                                         &retrieved_attrs, &params_list);
+    elog(DEBUG1, "scylla_fdw: generated CQL query: %s", query);
+
+    /* Items in the list must match enum FdwScanPrivateIndex, above */
+    fdw_private = list_make5(makeString(query),
+                             retrieved_attrs,
+                             remote_exprs,
+                             makeInteger(ifpinfo->fetch_size),
+                             makeInteger(ifpinfo->prefetch_depth));
+    fdw_private = lappend(fdw_private, makeInteger(0));
+    fdw_private = lappend(fdw_private, NIL);
+    fdw_private = lappend(fdw_private, makeInteger(0));
+    fdw_private = lappend(fdw_private, fpinfo->empty_aggs);
+    fdw_private = lappend(fdw_private, makeInteger(0));
+
+    return make_foreignscan(tlist,
+                            NIL,            /* no local quals */
+                            0,              /* no scan relation */
+                            params_list,
+                            fdw_private,
+                            fpinfo->grouped_tlist,
+                            NIL,
+                            outer_plan);
+}
+
 /*
  * scyllaBeginForeignScan
  *        Begin executing a foreign scan
@@ -519,7 +1333,6 @@ scyllaBeginForeignScan(ForeignScanState *node, int eflags)
     ForeignServer *server;
     UserMapping *user;
     int         rtindex;
-    char       *error_msg = NULL;
 
     /* Do nothing for EXPLAIN without ANALYZE */
     if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
@@ -544,100 +1357,282 @@ scyllaBeginForeignScan(ForeignScanState *node, int eflags)
     server = GetForeignServer(table->serverid);
     user = GetUserMapping(userid, server->serverid);
 
-    /* Extract options */
-    {
-        ListCell *lc;
-        char *host = DEFAULT_HOST;
-        int port = DEFAULT_PORT;
-        char *username = NULL;
-        char *password = NULL;
-        int connect_timeout = DEFAULT_CONNECT_TIMEOUT;
-        bool use_ssl = false;
-        char *ssl_cert = NULL;
-        char *ssl_key = NULL;
-        char *ssl_ca = NULL;
-
-        /* Get server options */
-        foreach(lc, server->options)
-        {
-            DefElem *def = (DefElem *) lfirst(lc);
-            if (strcmp(def->defname, OPT_HOST) == 0)
-                host = defGetString(def);
-            else if (strcmp(def->defname, OPT_PORT) == 0)
-                port = atoi(defGetString(def));
-            else if (strcmp(def->defname, OPT_CONNECT_TIMEOUT) == 0)
-                connect_timeout = atoi(defGetString(def));
-            else if (strcmp(def->defname, OPT_SSL) == 0)
-                use_ssl = defGetBoolean(def);
-            else if (strcmp(def->defname, OPT_SSL_CERT) == 0)
-                ssl_cert = defGetString(def);
-            else if (strcmp(def->defname, OPT_SSL_KEY) == 0)
-                ssl_key = defGetString(def);
-            else if (strcmp(def->defname, OPT_SSL_CA) == 0)
-                ssl_ca = defGetString(def);
-        }
-
-        /* Get user mapping options */
-        foreach(lc, user->options)
-        {
-            DefElem *def = (DefElem *) lfirst(lc);
-            if (strcmp(def->defname, OPT_USERNAME) == 0)
-                username = defGetString(def);
-            else if (strcmp(def->defname, OPT_PASSWORD) == 0)
-                password = defGetString(def);
-        }
-
-        /* Connect to ScyllaDB */
-        elog(DEBUG1, "scylla_fdw: connecting to ScyllaDB at %s:%d", host, port);
-        fsstate->conn = scylla_connect(host, port, username, password,
-                                       connect_timeout, use_ssl,
-                                       ssl_cert, ssl_key, ssl_ca,
-                                       &error_msg);
-        if (fsstate->conn == NULL)
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-                     errmsg("could not connect to ScyllaDB: %s",
-                            error_msg ? error_msg : "unknown error")));
-        elog(DEBUG1, "scylla_fdw: successfully connected to ScyllaDB");
-    }
-
-    /* Get the CQL query from fdw_private */
-    fsstate->query = strVal(list_nth(fsplan->fdw_private, 0));
+    /* Get a (possibly cached) session for this server and user */
+    fsstate->conn = scylla_get_connection(server, user, false);
+    scylla_stats_init(&fsstate->stats, fsstate->conn, server->serverid,
+                      node->ss.ps.instrument != NULL);
+
+    /* Get the CQL query and paging parameters from fdw_private */
+    fsstate->query = strVal(list_nth(fsplan->fdw_private,
+                                     FdwScanPrivateSelectSql));
+    fsstate->fetch_size = intVal(list_nth(fsplan->fdw_private,
+                                          FdwScanPrivateFetchSize));
+    fsstate->prefetch_depth = intVal(list_nth(fsplan->fdw_private,
+                                              FdwScanPrivatePrefetchDepth));
+    fsstate->token_ranges = intVal(list_nth(fsplan->fdw_private,
+                                            FdwScanPrivateTokenRanges));
+    fsstate->lookup_keys = (List *) list_nth(fsplan->fdw_private,
+                                             FdwScanPrivateLookupKeys);
+    fsstate->lookup_concurrency = intVal(list_nth(fsplan->fdw_private,
+                                                  FdwScanPrivateLookupConcurrency));
+    fsstate->consistency = scylla_get_read_consistency(rte->relid);
     ereport(NOTICE,
             (errmsg("scylla_fdw: executing remote query"),
              errdetail("%s", fsstate->query)));
 
-    /* Initialize other fields */
+    /*
+     * Values not inlined into the query (parameters, constants and split IN
+     * list keys) are bound to a statement created from the prepared query
+     * on each (re)scan.  Prepared statements also let the driver route each
+     * request by its partition key.
+     */
+    if (fsplan->fdw_exprs != NIL)
+    {
+        ListCell   *lc;
+        ListCell   *lc2;
+
+        fsstate->param_exprs = ExecInitExprList(fsplan->fdw_exprs,
+                                                (PlanState *) node);
+        foreach(lc, fsplan->fdw_exprs)
+            fsstate->param_types = lappend_oid(fsstate->param_types,
+                                               exprType((Node *) lfirst(lc)));
+        fsstate->param_econtext = node->ss.ps.ps_ExprContext;
+
+        /* Array parameters whose markers are only written once bound */
+        forboth(lc, fsplan->fdw_exprs, lc2, fsstate->param_exprs)
+        {
+            Node       *expr = (Node *) lfirst(lc);
+
+            if (IsA(expr, Param) &&
+                OidIsValid(get_element_type(exprType(expr))))
+                fsstate->array_param_exprs =
+                    lappend(fsstate->array_param_exprs, lfirst(lc2));
+        }
+    }
+
+    /* With array parameters, the query to prepare depends on their values */
+    if (fsstate->array_param_exprs == NIL)
+        fsstate->prepared = scylla_get_prepared(fsstate->conn, rte->relid,
+                                                fsstate->query);
+
+    /*
+     * Initialize other fields.  An aggregate scan has no scan relation; its
+     * tuples are described by fdw_scan_tlist.
+     */
     fsstate->rel = node->ss.ss_currentRelation;
-    fsstate->tupdesc = RelationGetDescr(fsstate->rel);
+    fsstate->relid = rte->relid;
+    if (fsstate->rel != NULL)
+        fsstate->tupdesc = RelationGetDescr(fsstate->rel);
+    else
+        fsstate->tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+    fsstate->empty_aggs = (List *) list_nth(fsplan->fdw_private,
+                                            FdwScanPrivateEmptyAggs);
     fsstate->attinmeta = TupleDescGetAttInMetadata(fsstate->tupdesc);
+    fsstate->statement = NULL;
     fsstate->result = NULL;
-    fsstate->iterator = NULL;
+    fsstate->pending = NULL;
+    fsstate->prefetched = NULL;
+    fsstate->num_prefetched = 0;
+    fsstate->more_pages = false;
+    fsstate->pscan = NULL;
+
+    /*
+     * An asynchronous scan gets every page, the first one included, through
+     * the prefetch queue, so it needs room for at least one.
+     */
+    fsstate->async = node->ss.ps.async_capable;
+    fsstate->async_signal = NULL;
+    if (fsstate->async && fsstate->prefetch_depth < 1)
+        fsstate->prefetch_depth = 1;
+    if (fsstate->prefetch_depth > 0)
+        fsstate->prefetched = (void **) palloc(fsstate->prefetch_depth *
+                                               sizeof(void *));
+    if (fsstate->lookup_keys != NIL)
+    {
+        fsstate->lookup_stmts = (void **) palloc(fsstate->lookup_concurrency *
+                                                 sizeof(void *));
+        fsstate->lookup_futures = (void **) palloc(fsstate->lookup_concurrency *
+                                                   sizeof(void *));
+        fsstate->lookup_sent = (instr_time *) palloc(fsstate->lookup_concurrency *
+                                                     sizeof(instr_time));
+    }
     fsstate->eof_reached = false;
     fsstate->fetch_ct = 0;
 
-    /* Prepare column mapping */
+    /*
+     * A parameterized scan rescanned with parameter values it has already
+     * seen, as the inner side of a nested loop often is, can be answered
+     * from the rows it returned the first time.  A parallel scan returns
+     * only part of the rows, so its results aren't worth keeping.
+     */
+    {
+        int cache_size = intVal(list_nth(fsplan->fdw_private,
+                                         FdwScanPrivateRescanCacheSize));
+
+        if (cache_size > 0 && fsstate->param_exprs != NIL &&
+            fsstate->token_ranges == 0)
+            fsstate->rescan_cache = rescan_cache_create(fsstate, cache_size);
+    }
+
+    /*
+     * Prepare the decode plan: one entry per retrieved column, in result
+     * column order.  The decode functions are picked once the first result
+     * tells us the CQL type of each column.
+     */
     {
-        List *retrieved_attrs = (List *) list_nth(fsplan->fdw_private, 1);
+        List *retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
+                                                  FdwScanPrivateRetrievedAttrs);
         int natts = fsstate->tupdesc->natts;
-        int i;
+        int col = 0;
         ListCell *lc;
 
-        fsstate->num_cols = list_length(retrieved_attrs);
-        fsstate->col_mapping = (int *) palloc(natts * sizeof(int));
-        
-        for (i = 0; i < natts; i++)
-            fsstate->col_mapping[i] = -1;
+        fsstate->decoders = (ScyllaColumnDecoder *)
+            palloc0(Max(list_length(retrieved_attrs), 1) *
+                    sizeof(ScyllaColumnDecoder));
+        fsstate->num_decoders = 0;
+        fsstate->decoders_checked = false;
+        fsstate->pagecontext = AllocSetContextCreate(node->ss.ps.state->es_query_cxt,
+                                                     "scylla_fdw page data",
+                                                     ALLOCSET_DEFAULT_SIZES);
+        fsstate->page_rows = 0;
+        fsstate->page_row = 0;
 
-        i = 0;
         foreach(lc, retrieved_attrs)
         {
             int attnum = lfirst_int(lc);
-            if (attnum > 0 && attnum <= natts)
-                fsstate->col_mapping[attnum - 1] = i;
-            i++;
+
+            if (attnum > 0 && attnum <= natts &&
+                !TupleDescAttr(fsstate->tupdesc, attnum - 1)->attisdropped)
+            {
+                Form_pg_attribute attr = TupleDescAttr(fsstate->tupdesc,
+                                                       attnum - 1);
+                ScyllaColumnDecoder *d =
+                    &fsstate->decoders[fsstate->num_decoders++];
+
+                d->attidx = attnum - 1;
+                d->col = col;
+                d->pg_type = attr->atttypid;
+                d->typmod = attr->atttypmod;
+            }
+            col++;
+        }
+    }
+}
+
+/*
+ * check_decoders
+ *        Pick the decode function of each retrieved column from the CQL
+ *        types in the result metadata
+ *
+ * Every page of a scan carries the same metadata, so this runs once.
+ */
+static void
+check_decoders(ScyllaFdwScanState *fsstate)
+{
+    int i;
+
+    for (i = 0; i < fsstate->num_decoders; i++)
+    {
+        ScyllaColumnDecoder *d = &fsstate->decoders[i];
+        int cql_type = scylla_get_column_type(fsstate->result, d->col);
+
+        d->decode = scylla_get_decoder(d->pg_type, cql_type);
+        if (d->decode == NULL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+                     errmsg("column \"%s\" of foreign table \"%s\" has type %s, which cannot hold CQL type %s",
+                            NameStr(TupleDescAttr(fsstate->tupdesc,
+                                                  d->attidx)->attname),
+                            get_rel_name(fsstate->relid),
+                            format_type_be(d->pg_type),
+                            scylla_cql_type_name(cql_type))));
+    }
+
+    fsstate->decoders_checked = true;
+}
+
+/*
+ * decode_page
+ *        Convert all rows of the current page into the page buffers
+ *
+ * The driver's rows and values are only valid until its iterator moves
+ * on, so each row is converted while the iterator is on it; the results
+ * are stored column-major, as the tuples are built from.  The sizes of the
+ * values are added up along the way when statistics are collected.
+ */
+static void
+decode_page(ScyllaFdwScanState *fsstate)
+{
+    int         ncols = fsstate->num_decoders;
+    int         maxrows = (int) scylla_result_row_count(fsstate->result);
+    int         nrows = maxrows;
+    bool        count_bytes = fsstate->stats.enabled || fsstate->stats.shared;
+    int64       bytes = 0;
+    MemoryContext oldcontext;
+    instr_time  start;
+    int         i;
+
+    if (maxrows > 0 && !fsstate->decoders_checked)
+        check_decoders(fsstate);
+
+    MemoryContextReset(fsstate->pagecontext);
+    oldcontext = MemoryContextSwitchTo(fsstate->pagecontext);
+
+    if (fsstate->stats.enabled)
+        INSTR_TIME_SET_CURRENT(start);
+
+    fsstate->page_values = (Datum *) palloc(Max(ncols * maxrows, 1) *
+                                            sizeof(Datum));
+    fsstate->page_nulls = (bool *) palloc(Max(ncols * maxrows, 1) *
+                                          sizeof(bool));
+    if (ncols > 0)
+    {
+        void       *iterator = scylla_result_iterator(fsstate->result);
+
+        nrows = 0;
+        while (nrows < maxrows && scylla_iterator_next(iterator))
+        {
+            void       *row = scylla_iterator_get_row(iterator);
+
+            for (i = 0; i < ncols; i++)
+            {
+                ScyllaColumnDecoder *d = &fsstate->decoders[i];
+                void       *cell = scylla_row_get_column(row, d->col);
+                int         idx = i * maxrows + nrows;
+
+                fsstate->page_nulls[idx] =
+                    !d->decode(cell, d->typmod, &fsstate->page_values[idx]);
+                if (count_bytes)
+                    bytes += scylla_value_size(cell);
+            }
+            nrows++;
+        }
+        scylla_free_iterator(iterator);
+        fsstate->stats.bytes += bytes;
+
+        /* Close the gaps if the page had fewer rows than it announced */
+        for (i = 1; i < ncols && nrows < maxrows; i++)
+        {
+            memmove(fsstate->page_values + i * nrows,
+                    fsstate->page_values + i * maxrows, nrows * sizeof(Datum));
+            memmove(fsstate->page_nulls + i * nrows,
+                    fsstate->page_nulls + i * maxrows, nrows * sizeof(bool));
         }
     }
+
+    fsstate->page_rows = nrows;
+    fsstate->page_row = 0;
+
+    if (fsstate->stats.enabled)
+    {
+        instr_time elapsed;
+
+        INSTR_TIME_SET_CURRENT(elapsed);
+        INSTR_TIME_SUBTRACT(elapsed, start);
+        fsstate->stats.convert_time += INSTR_TIME_GET_MILLISEC(elapsed);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
 }
 
 /*
@@ -649,78 +1644,130 @@ scyllaIterateForeignScan(ForeignScanState *node)
 {
     ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
     TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-    char *error_msg = NULL;
 
-    /* Execute query if not already done */
-    if (fsstate->result == NULL && !fsstate->eof_reached)
+    /* Check if we've exhausted the result set */
+    if (fsstate->eof_reached)
+        return ExecClearTuple(slot);
+
+    /* Return the cached rows if this scan's parameters were seen before */
+    if (fsstate->rescan_cache != NULL)
     {
-        int consistency = SCYLLA_CONSISTENCY_LOCAL_QUORUM; /* Default */
+        ScyllaRescanCache *cache = fsstate->rescan_cache;
 
-        elog(DEBUG1, "scylla_fdw: executing query with consistency level %d", consistency);
+        if (!cache->checked)
+            rescan_cache_lookup(fsstate);
 
-        fsstate->result = scylla_execute_query(fsstate->conn, fsstate->query,
-                                               consistency, &error_msg);
-        if (fsstate->result == NULL)
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_ERROR),
-                     errmsg("ScyllaDB query failed: %s",
-                            error_msg ? error_msg : "unknown error")));
+        if (cache->reading != NULL)
+        {
+            if (cache->next_tuple < cache->reading->ntuples)
+            {
+                ExecStoreHeapTuple(cache->reading->tuples[cache->next_tuple++],
+                                   slot, false);
+                fsstate->fetch_ct++;
+                return slot;
+            }
+
+            if (cache->reading->complete)
+            {
+                fsstate->eof_reached = true;
+                return ExecClearTuple(slot);
+            }
+
+            /* Only a prefix was kept; query the server for the rest */
+            rescan_cache_resume(cache);
+        }
+    }
+
+    /*
+     * Fetch next row, moving on to the next page whenever the current one
+     * is used up.  A page may legitimately be empty (e.g. when the server
+     * filtered every row of it), so keep going until a row turns up or the
+     * server reports there are no more pages.
+     */
+    while (fsstate->page_row >= fsstate->page_rows)
+    {
+        /*
+         * Under an async Append, return an empty slot rather than wait; the
+         * Append waits for the page together with its other subplans.
+         */
+        if (fsstate->async && !async_fetch_ready(fsstate))
+            return ExecClearTuple(slot);
 
-        fsstate->iterator = scylla_result_iterator(fsstate->result);
-        if (fsstate->iterator == NULL)
+        if (!fetch_next_page(fsstate))
         {
+            /* In a parallel scan, move on to the next token range */
+            if (fsstate->pscan != NULL && fsstate->statement != NULL)
+            {
+                discard_prefetch(fsstate);
+                release_scan_results(fsstate);
+                scylla_free_statement(fsstate->statement);
+                fsstate->statement = NULL;
+                continue;
+            }
+
             fsstate->eof_reached = true;
+            if (fsstate->rescan_cache != NULL)
+                rescan_cache_store(fsstate->rescan_cache, true);
             return ExecClearTuple(slot);
         }
-    }
 
-    /* Check if we've exhausted the result set */
-    if (fsstate->eof_reached)
-        return ExecClearTuple(slot);
+        decode_page(fsstate);
 
-    /* Fetch next row */
-    if (!scylla_iterator_next(fsstate->iterator))
-    {
-        fsstate->eof_reached = true;
-        return ExecClearTuple(slot);
+        /* Pass over the rows already returned from a cached prefix */
+        if (fsstate->rescan_cache != NULL && fsstate->rescan_cache->skip > 0)
+        {
+            int skip = Min(fsstate->rescan_cache->skip,
+                           fsstate->page_rows - fsstate->page_row);
+
+            fsstate->page_row += skip;
+            fsstate->rescan_cache->skip -= skip;
+        }
     }
 
-    /* Build the tuple */
+    /*
+     * Build the tuple from the decoded page, touching only the retrieved
+     * columns.  Its data lives in the page context, which is reset when the
+     * next page is decoded.
+     */
     ExecClearTuple(slot);
     {
-        TupleDesc tupdesc = fsstate->tupdesc;
-        int natts = tupdesc->natts;
         Datum *values = slot->tts_values;
         bool *nulls = slot->tts_isnull;
+        int row = fsstate->page_row++;
         int i;
 
-        /* Initialize all values as NULL */
-        for (i = 0; i < natts; i++)
+        memset(nulls, true, fsstate->tupdesc->natts * sizeof(bool));
+
+        for (i = 0; i < fsstate->num_decoders; i++)
         {
-            values[i] = (Datum) 0;
-            nulls[i] = true;
+            int attidx = fsstate->decoders[i].attidx;
+            int idx = i * fsstate->page_rows + row;
+
+            values[attidx] = fsstate->page_values[idx];
+            nulls[attidx] = fsstate->page_nulls[idx];
         }
 
-        /* Convert each column */
-        for (i = 0; i < natts; i++)
+        /* A sum or avg over no values is NULL */
+        for (i = 0; i < list_length(fsstate->empty_aggs); i += 2)
         {
-            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-            int col_index = fsstate->col_mapping[i];
-            bool is_null = true;
-
-            if (col_index < 0 || attr->attisdropped)
-                continue;
+            int agg = list_nth_int(fsstate->empty_aggs, i) - 1;
+            int count = list_nth_int(fsstate->empty_aggs, i + 1) - 1;
 
-            values[i] = scylla_convert_to_pg(fsstate->iterator, col_index,
-                                            attr->atttypid, attr->atttypmod,
-                                            &is_null);
-            nulls[i] = is_null;
+            if (nulls[count] || DatumGetInt64(values[count]) == 0)
+                nulls[agg] = true;
         }
     }
 
     ExecStoreVirtualTuple(slot);
     fsstate->fetch_ct++;
 
+    if (fsstate->rescan_cache != NULL && fsstate->rescan_cache->filling)
+        rescan_cache_add_row(fsstate, slot);
+
+    /* Pick up the next page if it has arrived, and request another */
+    if (fsstate->pending != NULL)
+        collect_prefetched_page(fsstate, false);
+
     if (fsstate->fetch_ct % 100 == 0)
         elog(DEBUG1, "scylla_fdw: fetched %ld rows so far", fsstate->fetch_ct);
 
@@ -738,18 +1785,31 @@ scyllaReScanForeignScan(ForeignScanState *node)
 
     elog(DEBUG1, "scylla_fdw: rescanning foreign table");
 
-    /* Release previous results */
-    if (fsstate->iterator != NULL)
-    {
-        scylla_free_iterator(fsstate->iterator);
-        fsstate->iterator = NULL;
-    }
-    if (fsstate->result != NULL)
+    /*
+     * Release previous results.  Dropping the statement discards its paging
+     * state, so the next fetch starts again from the first page.
+     */
+    discard_prefetch(fsstate);
+    discard_lookups(fsstate);
+    release_scan_results(fsstate);
+    if (fsstate->statement != NULL)
     {
-        scylla_free_result(fsstate->result);
-        fsstate->result = NULL;
+        scylla_free_statement(fsstate->statement);
+        fsstate->statement = NULL;
     }
 
+    /*
+     * A scan without shared state starts over on its private range queue;
+     * the shared queue of a parallel scan is reset by
+     * scyllaReInitializeDSMForeignScan instead.
+     */
+    if (fsstate->pscan == &fsstate->local_pscan)
+        fsstate->pscan = NULL;
+
+    /* Keep the rows an unfinished scan returned, marked as a prefix */
+    if (fsstate->rescan_cache != NULL)
+        rescan_cache_reset(fsstate->rescan_cache);
+
     /* Reset state */
     fsstate->eof_reached = false;
     fsstate->fetch_ct = 0;
@@ -769,15 +1829,1444 @@ scyllaEndForeignScan(ForeignScanState *node)
 
     elog(DEBUG1, "scylla_fdw: ending foreign table scan, fetched %ld rows total", fsstate->fetch_ct);
 
-    /* Release iterator and result */
-    if (fsstate->iterator != NULL)
-        scylla_free_iterator(fsstate->iterator);
-    if (fsstate->result != NULL)
-        scylla_free_result(fsstate->result);
-    if (fsstate->prepared != NULL)
-        scylla_free_prepared(fsstate->prepared);
+    /* Release prefetched pages and lookups, result and statement */
+    discard_prefetch(fsstate);
+    discard_lookups(fsstate);
+    release_scan_results(fsstate);
+    if (fsstate->statement != NULL)
+        scylla_free_statement(fsstate->statement);
+
+    scylla_shared_stats_report(&fsstate->stats);
+
+    /* Free the cached rows now; only the counters are still needed */
+    if (fsstate->rescan_cache != NULL)
+    {
+        MemoryContextDelete(fsstate->rescan_cache->cxt);
+        fsstate->rescan_cache->hash = NULL;
+    }
+
+    /* Callbacks of abandoned requests may still hold on to the signal */
+    scylla_async_signal_release(fsstate->async_signal);
 
-    /* Disconnect from ScyllaDB */
+    /* Return the session, and with it the prepared statement, to the cache */
     if (fsstate->conn != NULL)
-        scylla_disconnect(fsstate->conn, fsstate->cluster);
+        scylla_release_connection(fsstate->conn);
+}
+
+/*
+ * scyllaIsForeignPathAsyncCapable
+ *        Report whether a path can run asynchronously under an Append
+ *
+ * With async_capable set, an Append over many foreign tables sends the
+ * first request of each at once and returns rows from whichever answers
+ * first, instead of scanning them one after another.
+ */
+static bool
+scyllaIsForeignPathAsyncCapable(ForeignPath *path)
+{
+    RelOptInfo *rel = ((Path *) path)->parent;
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) rel->fdw_private;
+
+    /* An aggregate scan has the options of the table it reads */
+    if (fpinfo->outerrel != NULL)
+        fpinfo = (ScyllaFdwRelationInfo *) fpinfo->outerrel->fdw_private;
+
+    return fpinfo->async_capable;
+}
+
+/*
+ * scyllaForeignAsyncRequest
+ *        Asynchronously request the next row of an async scan
+ */
+static void
+scyllaForeignAsyncRequest(AsyncRequest *areq)
+{
+    produce_tuple_async(areq);
+}
+
+/*
+ * scyllaForeignAsyncConfigureWait
+ *        Add the scan's completion signal to the Append's wait event set
+ *
+ * The request is pending, so the scan is waiting for a page (or lookup)
+ * that async_fetch_ready has sent.  The driver makes the signal readable
+ * from one of its threads once that request completes.
+ */
+static void
+scyllaForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
+    AppendState *requestor = (AppendState *) areq->requestor;
+    void       *future;
+
+    if (fsstate->lookup_keys != NIL)
+        future = fsstate->lookup_futures[fsstate->lookup_head];
+    else
+        future = fsstate->pending;
+    Assert(future != NULL);
+
+    if (fsstate->async_signal == NULL)
+    {
+        char       *error_msg = NULL;
+
+        fsstate->async_signal = scylla_async_signal_create(&error_msg);
+        if (fsstate->async_signal == NULL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("could not create ScyllaDB completion signal: %s",
+                            error_msg ? error_msg : "unknown error")));
+    }
+
+    /* A future waited for before is armed already */
+    (void) scylla_async_signal_arm(fsstate->async_signal, future);
+
+    AddWaitEventToSet(requestor->as_eventset, WL_SOCKET_READABLE,
+                      scylla_async_signal_fd(fsstate->async_signal),
+                      NULL, areq);
+}
+
+/*
+ * scyllaForeignAsyncNotify
+ *        Produce the next row of an async scan whose signal fired
+ *
+ * The signal is cleared before looking at the request, so a completion
+ * after that still wakes the Append.  Callbacks of earlier requests may
+ * cause a spurious wakeup, in which case the request stays pending.
+ */
+static void
+scyllaForeignAsyncNotify(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
+
+    scylla_async_signal_clear(fsstate->async_signal);
+
+    produce_tuple_async(areq);
+}
+
+/*
+ * produce_tuple_async
+ *        Run the scan node for one row without waiting on ScyllaDB
+ *
+ * An empty slot before the end of the scan means the next page hasn't
+ * arrived yet, and the request is left pending.
+ */
+static void
+produce_tuple_async(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
+    TupleTableSlot *result;
+
+    result = ExecProcNode((PlanState *) node);
+
+    if (!TupIsNull(result))
+        ExecAsyncRequestDone(areq, result);
+    else if (fsstate->eof_reached)
+        ExecAsyncRequestDone(areq, NULL);
+    else
+        ExecAsyncRequestPending(areq);
+}
+
+/*
+ * scyllaIsForeignScanParallelSafe
+ *        Report whether a scan can be run inside a parallel worker
+ *
+ * Each worker opens its own session through the connection cache, and
+ * nothing about a scan depends on backend-local state.  The planner only
+ * runs Appends that aren't parallel safe asynchronously, though, so tables
+ * with async_capable set stay out of parallel plans.
+ */
+static bool
+scyllaIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+                                RangeTblEntry *rte)
+{
+    return !scylla_get_table_meta(rte->relid)->options->async_capable;
+}
+
+/*
+ * scyllaEstimateDSMForeignScan
+ *        Report the shared memory needed for a parallel scan
+ */
+static Size
+scyllaEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+    return sizeof(ScyllaParallelScanState);
+}
+
+/*
+ * scyllaInitializeDSMForeignScan
+ *        Set up the shared token range queue in the leader
+ */
+static void
+scyllaInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+                               void *coordinate)
+{
+    ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
+    ScyllaParallelScanState *pscan = (ScyllaParallelScanState *) coordinate;
+
+    pg_atomic_init_u32(&pscan->next_range, 0);
+    pscan->num_ranges = fsstate->token_ranges;
+    fsstate->pscan = pscan;
+}
+
+/*
+ * scyllaReInitializeDSMForeignScan
+ *        Reset the shared token range queue before a rescan
+ */
+static void
+scyllaReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+                                 void *coordinate)
+{
+    ScyllaParallelScanState *pscan = (ScyllaParallelScanState *) coordinate;
+
+    pg_atomic_write_u32(&pscan->next_range, 0);
+}
+
+/*
+ * scyllaInitializeWorkerForeignScan
+ *        Attach a parallel worker to the shared token range queue
+ */
+static void
+scyllaInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+                                  void *coordinate)
+{
+    ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
+
+    fsstate->pscan = (ScyllaParallelScanState *) coordinate;
+}
+
+/*
+ * create_scylla_scan_path
+ *        Create a ForeignPath for a base relation
+ */
+static ForeignPath *
+create_scylla_scan_path(PlannerInfo *root, RelOptInfo *baserel,
+                        double rows, Cost startup_cost, Cost total_cost,
+                        List *pathkeys, Relids required_outer)
+{
+    /* Note: PG17 and PG18 changed the signature - check PG_VERSION_NUM */
+#if PG_VERSION_NUM >= 180000
+    /* PostgreSQL 18+ signature - added disabled_nodes parameter */
+    return create_foreignscan_path(root, baserel,
+                                   NULL,                    /* default pathtarget */
+                                   rows,                    /* rows */
+                                   0,                       /* disabled_nodes */
+                                   startup_cost,            /* startup_cost */
+                                   total_cost,              /* total_cost */
+                                   pathkeys,                /* pathkeys */
+                                   required_outer,          /* required_outer */
+                                   NULL,                    /* fdw_outerpath */
+                                   NIL,                     /* fdw_restrictinfo */
+                                   NIL);                    /* fdw_private */
+#elif PG_VERSION_NUM >= 170000
+    /* PostgreSQL 17 signature */
+    return create_foreignscan_path(root, baserel,
+                                   NULL,    /* default pathtarget */
+                                   rows,
+                                   startup_cost,
+                                   total_cost,
+                                   pathkeys,
+                                   required_outer,
+                                   NULL,    /* no extra plan */
+                                   NIL,     /* no fdw_restrictinfo */
+                                   NIL);    /* no fdw_private */
+#elif PG_VERSION_NUM >= 90600
+    /* PostgreSQL 9.6 to 16 signature */
+    return create_foreignscan_path(root, baserel,
+                                   NULL,    /* default pathtarget */
+                                   rows,
+                                   startup_cost,
+                                   total_cost,
+                                   pathkeys,
+                                   required_outer,
+                                   NULL,    /* no extra plan */
+                                   NIL);    /* no fdw_private */
+#else
+    /* Pre-9.6 signature */
+    return create_foreignscan_path(root, baserel,
+                                   rows,
+                                   startup_cost,
+                                   total_cost,
+                                   pathkeys,
+                                   required_outer,
+                                   NULL,    /* no extra plan */
+                                   NIL);    /* no fdw_private */
+#endif
+}
+
+/*
+ * token_range_scan_ok
+ *        Check whether the scan can be split into partition key token ranges
+ *
+ * That needs a known partition key, and none of the pushed-down conditions
+ * may reference partition key columns: CQL refuses to combine a token()
+ * restriction with a regular restriction on the same columns.
+ */
+static bool
+token_range_scan_ok(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    Bitmapset  *attrs = NULL;
+    bool        ok = true;
+    int         attidx = -1;
+    ListCell   *lc;
+
+    if (fpinfo->primary_key == NULL || fpinfo->primary_key[0] == '\0')
+        return false;
+
+    foreach(lc, fpinfo->remote_conds)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+        pull_varattnos((Node *) rinfo->clause, baserel->relid, &attrs);
+    }
+
+    if (fpinfo->pk_attrs == NIL)
+        ok = false;
+
+    while (ok && (attidx = bms_next_member(attrs, attidx)) >= 0)
+    {
+        AttrNumber  attnum = attidx + FirstLowInvalidHeapAttributeNumber;
+
+        if (is_partition_key_column(fpinfo, attnum))
+            ok = false;
+    }
+
+    return ok;
+}
+
+/*
+ * add_parallel_scan_path
+ *        Add a partial path that splits the scan across token ranges
+ *
+ * Every participant claims token ranges from a queue in shared memory until
+ * none are left, so a full scan is spread over all ScyllaDB shards instead
+ * of going through a single session and coordinator.
+ */
+static void
+add_parallel_scan_path(PlannerInfo *root, RelOptInfo *baserel,
+                       Oid foreigntableid)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    ForeignPath *path;
+    double      pages;
+    double      divisor;
+    int         parallel_workers;
+
+    if (!token_range_scan_ok(root, baserel, foreigntableid))
+        return;
+
+    /* Size the worker pool the same way heap scans do */
+    pages = ceil(fpinfo->rows * fpinfo->width / BLCKSZ);
+    parallel_workers = compute_parallel_worker(baserel, pages, -1,
+                                               max_parallel_workers_per_gather);
+    if (parallel_workers <= 0)
+        return;
+
+    /* Rows and run cost are shared among the participants (cf. costsize.c) */
+    divisor = parallel_workers;
+    if (parallel_leader_participation)
+    {
+        double      leader_contribution = 1.0 - (0.3 * parallel_workers);
+
+        if (leader_contribution > 0)
+            divisor += leader_contribution;
+    }
+
+    path = create_scylla_scan_path(root, baserel,
+                                   clamp_row_est(fpinfo->rows / divisor),
+                                   fpinfo->startup_cost,
+                                   fpinfo->startup_cost +
+                                   (fpinfo->total_cost - fpinfo->startup_cost) / divisor,
+                                   NIL, NULL);
+    path->path.parallel_aware = true;
+    path->path.parallel_safe = true;
+    path->path.parallel_workers = parallel_workers;
+    path->fdw_private = list_make1(makeInteger(SCYLLA_PARALLEL_TOKEN_RANGES));
+
+    add_partial_path(baserel, (Path *) path);
+}
+
+/*
+ * add_parameterized_paths
+ *        Add paths that look up the partition keys given by outer rows
+ *
+ * A nested loop can then send the outer key values to ScyllaDB as bind
+ * parameters, turning a full remote scan per join into one partition
+ * lookup per outer row.  A parameterization is only worth offering if
+ * it pins every partition key column not already pinned by the
+ * restriction clauses; anything less would still need ALLOW FILTERING.
+ * None is offered when the restriction clauses send a token() range,
+ * since CQL refuses to combine that with partition key restrictions.
+ */
+static void
+add_parameterized_paths(PlannerInfo *root, RelOptInfo *baserel,
+                        Oid foreigntableid)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    List       *pk_cols = fpinfo->pk_attrs;
+    List       *clauses = NIL;
+    List       *outer_sets = NIL;
+    Relids      all_outer = NULL;
+    ListCell   *lc;
+
+    if (pk_cols == NIL ||
+        scylla_conds_restrict_token(baserel, fpinfo->remote_conds))
+        return;
+
+    /* Join clauses on partition key columns that can be evaluated here */
+    foreach(lc, baserel->joininfo)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        AttrNumber  attnum;
+
+        if (!join_clause_is_movable_to(rinfo, baserel))
+            continue;
+        if (scylla_is_foreign_param_clause(root, baserel, rinfo->clause,
+                                           &attnum) &&
+            list_member_int(pk_cols, attnum))
+            clauses = lappend(clauses, rinfo);
+    }
+
+    /* Equivalence classes can supply more, which joininfo doesn't list */
+    if (baserel->has_eclass_joins)
+    {
+        foreach(lc, pk_cols)
+        {
+            AttrNumber  attnum = lfirst_int(lc);
+            List       *ec_clauses;
+            ListCell   *lc2;
+
+            ec_clauses = generate_implied_equalities_for_column(root, baserel,
+                                                                ec_member_matches_column,
+                                                                (void *) &attnum,
+                                                                baserel->lateral_referencers);
+            foreach(lc2, ec_clauses)
+            {
+                RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc2);
+                AttrNumber  clause_attnum;
+
+                if (scylla_is_foreign_param_clause(root, baserel, rinfo->clause,
+                                                   &clause_attnum) &&
+                    clause_attnum == attnum)
+                    clauses = lappend(clauses, rinfo);
+            }
+        }
+    }
+
+    /*
+     * Each clause suggests parameterizing by the rels it references.  A
+     * composite partition key may be pinned by clauses against different
+     * rels, so also try all of them together.
+     */
+    foreach(lc, clauses)
+    {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        Relids      required_outer;
+        ListCell   *lc2;
+        bool        found = false;
+
+        required_outer = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+        required_outer = bms_del_members(required_outer, baserel->relids);
+        if (bms_is_empty(required_outer))
+            continue;
+
+        all_outer = bms_add_members(all_outer, required_outer);
+        foreach(lc2, outer_sets)
+        {
+            if (bms_equal((Relids) lfirst(lc2), required_outer))
+            {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            outer_sets = lappend(outer_sets, required_outer);
+    }
+    if (list_length(outer_sets) > 1)
+        outer_sets = lappend(outer_sets, all_outer);
+
+    foreach(lc, outer_sets)
+    {
+        Relids      required_outer = (Relids) lfirst(lc);
+        List       *usable = NIL;
+        bool        pinned = true;
+        bool        useful = false;
+        ParamPathInfo *param_info;
+        ForeignPath *path;
+        double      rows;
+        int         width;
+        Cost        startup_cost;
+        Cost        total_cost;
+        ListCell   *lc2;
+
+        foreach(lc2, clauses)
+        {
+            RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc2);
+
+            if (bms_is_subset(bms_difference(rinfo->clause_relids,
+                                             baserel->relids),
+                              required_outer))
+                usable = lappend(usable, rinfo);
+        }
+
+        foreach(lc2, pk_cols)
+        {
+            AttrNumber  attnum = lfirst_int(lc2);
+
+            if (scylla_column_has_equality(baserel, fpinfo->remote_conds,
+                                           attnum, true))
+                continue;
+            if (!scylla_column_has_equality(baserel, usable, attnum, false))
+            {
+                pinned = false;
+                break;
+            }
+            useful = true;
+        }
+        if (!pinned || !useful)
+            continue;
+
+        /*
+         * Each rescan pays the round trip again, but only reads the
+         * looked-up partitions.  The row count must match the planner's
+         * for this parameterization.
+         */
+        param_info = get_baserel_parampathinfo(root, baserel, required_outer);
+        estimate_path_cost_size(root, baserel, usable, NIL,
+                                &rows, &width, &startup_cost, &total_cost);
+        rows = param_info->ppi_rows;
+
+        elog(DEBUG1, "scylla_fdw: adding parameterized path, estimated rows=%.0f",
+             rows);
+
+        path = create_scylla_scan_path(root, baserel, rows,
+                                       startup_cost, total_cost,
+                                       NIL, required_outer);
+        add_path(baserel, (Path *) path);
+    }
+}
+
+/*
+ * ec_member_matches_column
+ *        Callback for generate_implied_equalities_for_column
+ *
+ * arg points to the attribute number of the baserel column to match.
+ */
+static bool
+ec_member_matches_column(PlannerInfo *root, RelOptInfo *rel,
+                         EquivalenceClass *ec, EquivalenceMember *em,
+                         void *arg)
+{
+    AttrNumber  attnum = *(AttrNumber *) arg;
+    Expr       *expr = em->em_expr;
+
+    if (IsA(expr, RelabelType))
+        expr = ((RelabelType *) expr)->arg;
+
+    return IsA(expr, Var) &&
+        ((Var *) expr)->varno == rel->relid &&
+        ((Var *) expr)->varattno == attnum &&
+        ((Var *) expr)->varlevelsup == 0;
+}
+
+/*
+ * create_scan_statement
+ *        Build the statement that executes the scan query
+ *
+ * In a parallel scan, this claims the next unscanned token range from the
+ * shared queue and binds its bounds; false is returned once every range
+ * has been handed out.  A parameterized scan binds the current values of
+ * its parameters, and returns false if the scan cannot match any row.
+ */
+static bool
+create_scan_statement(ScyllaFdwScanState *fsstate)
+{
+    if (fsstate->token_ranges > 0)
+    {
+        uint32      range;
+        uint64      step;
+        int64       lower;
+        int64       upper;
+
+        /*
+         * A parallel-aware plan whose DSM was never set up (e.g. no workers
+         * could be launched) still covers every range, one after another.
+         */
+        if (fsstate->pscan == NULL)
+        {
+            fsstate->local_pscan.num_ranges = fsstate->token_ranges;
+            pg_atomic_init_u32(&fsstate->local_pscan.next_range, 0);
+            fsstate->pscan = &fsstate->local_pscan;
+        }
+
+        range = pg_atomic_fetch_add_u32(&fsstate->pscan->next_range, 1);
+        if (range >= (uint32) fsstate->pscan->num_ranges)
+            return false;
+
+        /*
+         * Murmur3 tokens run from PG_INT64_MIN (exclusive, never assigned
+         * to a key) to PG_INT64_MAX.  The last range absorbs the remainder.
+         */
+        step = PG_UINT64_MAX / (uint64) fsstate->pscan->num_ranges;
+        lower = (int64) ((uint64) PG_INT64_MIN + range * step);
+        if (range == (uint32) fsstate->pscan->num_ranges - 1)
+            upper = PG_INT64_MAX;
+        else
+            upper = (int64) ((uint64) PG_INT64_MIN + (range + 1) * step);
+
+        elog(DEBUG1, "scylla_fdw: scanning token range %u of %d: (" INT64_FORMAT ", " INT64_FORMAT "]",
+             range + 1, fsstate->pscan->num_ranges, lower, upper);
+
+        fsstate->statement = scylla_create_statement(get_scan_prepared(fsstate));
+        scylla_bind_int64(fsstate->statement, 0, lower);
+        scylla_bind_int64(fsstate->statement, 1, upper);
+    }
+    else
+        fsstate->statement = scylla_create_statement(get_scan_prepared(fsstate));
+
+    /* Reads can always be retried or sent speculatively */
+    scylla_statement_set_idempotent(fsstate->statement, true);
+
+    if (!bind_scan_params(fsstate, fsstate->statement,
+                          fsstate->token_ranges > 0 ? 2 : 0))
+    {
+        scylla_free_statement(fsstate->statement);
+        fsstate->statement = NULL;
+        return false;
+    }
+
+    scylla_statement_set_paging_size(fsstate->statement, fsstate->fetch_size);
+
+    return true;
+}
+
+/*
+ * get_scan_prepared
+ *        Get the prepared statement to create the scan's statements from
+ *
+ * Each SCYLLA_ARRAY_PARAM_MARKER in the query stands for the elements of
+ * an array parameter, in array_param_exprs order, and is replaced by one
+ * marker per element of its current value.  A NULL or empty array keeps
+ * one marker; bind_scan_params then finds that no row can match.  The
+ * session's statement cache prepares each distinct query once.
+ */
+static void *
+get_scan_prepared(ScyllaFdwScanState *fsstate)
+{
+    ExprContext *econtext = fsstate->param_econtext;
+    MemoryContext oldcontext;
+    StringInfoData query;
+    ListCell   *lc;
+    const char *p;
+    char        quote = '\0';
+    void       *prepared;
+
+    if (fsstate->array_param_exprs == NIL)
+        return fsstate->prepared;
+
+    oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+    initStringInfo(&query);
+    lc = list_head(fsstate->array_param_exprs);
+    for (p = fsstate->query; *p; p++)
+    {
+        /* Skip quoted identifiers and literals, which may contain anything */
+        if (quote != '\0')
+        {
+            if (*p == quote)
+                quote = '\0';
+        }
+        else if (*p == '\'' || *p == '"')
+            quote = *p;
+        else if (lc != NULL &&
+                 strncmp(p, SCYLLA_ARRAY_PARAM_MARKER,
+                         strlen(SCYLLA_ARRAY_PARAM_MARKER)) == 0)
+        {
+            Datum       value;
+            bool        isnull;
+            int         nelems = 0;
+            int         i;
+
+            value = ExecEvalExpr((ExprState *) lfirst(lc), econtext, &isnull);
+            if (!isnull)
+            {
+                ArrayType  *arr = DatumGetArrayTypeP(value);
+
+                nelems = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+            }
+            for (i = 0; i < Max(nelems, 1); i++)
+                appendStringInfoString(&query, i > 0 ? ", ?" : "?");
+
+            lc = lnext(fsstate->array_param_exprs, lc);
+            p += strlen(SCYLLA_ARRAY_PARAM_MARKER) - 1;
+            continue;
+        }
+        appendStringInfoChar(&query, *p);
+    }
+
+    prepared = scylla_get_prepared(fsstate->conn, fsstate->relid, query.data);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    return prepared;
+}
+
+/*
+ * bind_scan_params
+ *        Evaluate the parameters of a parameterized scan and bind them
+ *
+ * The values are bound to statement starting at marker first_index.
+ * Returns false if any of them is NULL: "col = NULL" can't be true, so
+ * there is no point in asking the server.
+ *
+ * An array is the value list of an IN, with a marker for each element.
+ * NULL elements can't match anything; each is replaced by a non-NULL
+ * element instead, and only an all-NULL list rules out every row.
+ */
+static bool
+bind_scan_params(ScyllaFdwScanState *fsstate, void *statement,
+                 int first_index)
+{
+    ExprContext *econtext = fsstate->param_econtext;
+    MemoryContext oldcontext;
+    ListCell   *lc;
+    ListCell   *lc2;
+    int         i = first_index;
+    bool        ok = true;
+
+    if (fsstate->param_exprs == NIL)
+        return true;
+
+    /* Values are copied into the statement, so a short-lived context will do */
+    oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+
+    forboth(lc, fsstate->param_exprs, lc2, fsstate->param_types)
+    {
+        ExprState  *expr_state = (ExprState *) lfirst(lc);
+        Oid         elemtype;
+        Datum       value;
+        bool        isnull;
+
+        value = ExecEvalExpr(expr_state, econtext, &isnull);
+        if (isnull)
+        {
+            ok = false;
+            break;
+        }
+
+        elemtype = get_element_type(lfirst_oid(lc2));
+        if (OidIsValid(elemtype))
+        {
+            int16       typlen;
+            bool        typbyval;
+            char        typalign;
+            Datum      *elems;
+            bool       *nulls;
+            int         nelems;
+            int         valid;
+            int         j;
+
+            get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+            deconstruct_array(DatumGetArrayTypeP(value), elemtype,
+                              typlen, typbyval, typalign,
+                              &elems, &nulls, &nelems);
+            for (valid = 0; valid < nelems && nulls[valid]; valid++)
+                ;
+            if (valid == nelems)
+            {
+                ok = false;
+                break;
+            }
+            for (j = 0; j < nelems; j++)
+                scylla_convert_from_pg(elems[nulls[j] ? valid : j], elemtype,
+                                       statement, i++, false);
+            continue;
+        }
+
+        scylla_convert_from_pg(value, lfirst_oid(lc2), statement,
+                               i++, false);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+
+    return ok;
+}
+
+/*
+ * rescan_key_hash, rescan_key_match
+ *        Hash support for the rescan cache, comparing parameter images
+ */
+static uint32
+rescan_key_hash(const void *key, Size keysize)
+{
+    const ScyllaRescanKey *k = (const ScyllaRescanKey *) key;
+
+    return hash_bytes((const unsigned char *) k->data, (int) k->len);
+}
+
+static int
+rescan_key_match(const void *key1, const void *key2, Size keysize)
+{
+    const ScyllaRescanKey *k1 = (const ScyllaRescanKey *) key1;
+    const ScyllaRescanKey *k2 = (const ScyllaRescanKey *) key2;
+
+    if (k1->len != k2->len)
+        return 1;
+    return memcmp(k1->data, k2->data, k1->len);
+}
+
+/*
+ * rescan_cache_create
+ *        Set up an empty rescan cache holding up to size_kb of rows
+ */
+static ScyllaRescanCache *
+rescan_cache_create(ScyllaFdwScanState *fsstate, int size_kb)
+{
+    ScyllaRescanCache *cache;
+    HASHCTL     ctl;
+    ListCell   *lc;
+    int         i = 0;
+
+    cache = (ScyllaRescanCache *) palloc0(sizeof(ScyllaRescanCache));
+    cache->cxt = AllocSetContextCreate(CurrentMemoryContext,
+                                       "scylla_fdw rescan cache",
+                                       ALLOCSET_DEFAULT_SIZES);
+    cache->mem_limit = (Size) size_kb * 1024;
+    dlist_init(&cache->lru);
+
+    ctl.keysize = sizeof(ScyllaRescanKey);
+    ctl.entrysize = sizeof(ScyllaRescanEntry);
+    ctl.hash = rescan_key_hash;
+    ctl.match = rescan_key_match;
+    ctl.hcxt = cache->cxt;
+    cache->hash = hash_create("scylla_fdw rescan cache", 64, &ctl,
+                              HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+                              HASH_CONTEXT);
+
+    cache->param_typlen = (int16 *)
+        MemoryContextAlloc(cache->cxt,
+                           list_length(fsstate->param_types) * sizeof(int16));
+    cache->param_typbyval = (bool *)
+        MemoryContextAlloc(cache->cxt,
+                           list_length(fsstate->param_types) * sizeof(bool));
+    foreach(lc, fsstate->param_types)
+    {
+        get_typlenbyval(lfirst_oid(lc), &cache->param_typlen[i],
+                        &cache->param_typbyval[i]);
+        i++;
+    }
+
+    return cache;
+}
+
+/*
+ * rescan_cache_lookup
+ *        Look up the rows of the current scan's parameter values
+ *
+ * The key is the binary image of each value, so values that are equal but
+ * stored differently (numeric 1.0 and 1.00, say) are cached separately;
+ * that only costs a miss.  On a hit the cached rows are returned instead
+ * of querying the server; on a miss the rows are collected as they are
+ * returned.
+ */
+static void
+rescan_cache_lookup(ScyllaFdwScanState *fsstate)
+{
+    ScyllaRescanCache *cache = fsstate->rescan_cache;
+    ExprContext *econtext = fsstate->param_econtext;
+    ScyllaRescanEntry *entry;
+    ScyllaRescanKey key;
+    StringInfoData buf;
+    MemoryContext oldcontext;
+    ListCell   *lc;
+    int         i = 0;
+
+    cache->checked = true;
+
+    oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+    initStringInfo(&buf);
+    foreach(lc, fsstate->param_exprs)
+    {
+        ExprState  *expr_state = (ExprState *) lfirst(lc);
+        int16       typlen = cache->param_typlen[i];
+        Datum       value;
+        bool        isnull;
+
+        value = ExecEvalExpr(expr_state, econtext, &isnull);
+        appendStringInfoChar(&buf, isnull ? 'n' : 'v');
+        if (isnull)
+            ;                   /* the marker is the whole image */
+        else if (cache->param_typbyval[i])
+            appendBinaryStringInfo(&buf, (char *) &value, sizeof(Datum));
+        else if (typlen == -1)
+        {
+            struct varlena *v = PG_DETOAST_DATUM_PACKED(value);
+            uint32      len = VARSIZE_ANY_EXHDR(v);
+
+            appendBinaryStringInfo(&buf, (char *) &len, sizeof(len));
+            appendBinaryStringInfo(&buf, VARDATA_ANY(v), len);
+        }
+        else if (typlen == -2)
+            appendBinaryStringInfo(&buf, DatumGetCString(value),
+                                   strlen(DatumGetCString(value)) + 1);
+        else
+            appendBinaryStringInfo(&buf, DatumGetPointer(value), typlen);
+        i++;
+    }
+    MemoryContextSwitchTo(oldcontext);
+
+    key.data = buf.data;
+    key.len = buf.len;
+    entry = (ScyllaRescanEntry *) hash_search(cache->hash, &key,
+                                              HASH_FIND, NULL);
+    if (entry != NULL)
+    {
+        cache->hits++;
+        dlist_move_head(&cache->lru, &entry->lru_node);
+        cache->reading = entry;
+        cache->next_tuple = 0;
+        return;
+    }
+
+    cache->misses++;
+    entry = &cache->fill;
+    entry->cxt = AllocSetContextCreate(cache->cxt,
+                                       "scylla_fdw rescan cache entry",
+                                       ALLOCSET_SMALL_SIZES);
+    entry->key.data = MemoryContextAlloc(entry->cxt, key.len);
+    memcpy(entry->key.data, key.data, key.len);
+    entry->key.len = key.len;
+    entry->maxtuples = 16;
+    entry->tuples = (HeapTuple *) MemoryContextAlloc(entry->cxt,
+                                                     entry->maxtuples *
+                                                     sizeof(HeapTuple));
+    entry->ntuples = 0;
+    entry->complete = false;
+    cache->filling = true;
+}
+
+/*
+ * rescan_cache_resume
+ *        Go on from the end of the cached prefix being read
+ *
+ * The scan is run again from the start, passing over as many rows as the
+ * prefix holds, since the paging state of the scan that collected them is
+ * gone.  The prefix is taken out of the cache and the rows that follow are
+ * collected onto it.
+ */
+static void
+rescan_cache_resume(ScyllaRescanCache *cache)
+{
+    ScyllaRescanEntry *entry = cache->reading;
+
+    cache->fill = *entry;
+    dlist_delete(&entry->lru_node);
+    cache->mem_used -= entry->mem;
+    hash_search(cache->hash, &cache->fill.key, HASH_REMOVE, NULL);
+
+    cache->skip = cache->fill.ntuples;
+    cache->reading = NULL;
+    cache->filling = true;
+}
+
+/*
+ * rescan_cache_add_row
+ *        Keep a copy of a row returned by a scan whose rows are collected
+ *
+ * A result too large for the whole cache is given up on.
+ */
+static void
+rescan_cache_add_row(ScyllaFdwScanState *fsstate, TupleTableSlot *slot)
+{
+    ScyllaRescanCache *cache = fsstate->rescan_cache;
+    ScyllaRescanEntry *entry = &cache->fill;
+    MemoryContext oldcontext;
+
+    oldcontext = MemoryContextSwitchTo(entry->cxt);
+    if (entry->ntuples == entry->maxtuples)
+    {
+        entry->maxtuples *= 2;
+        entry->tuples = (HeapTuple *) repalloc(entry->tuples,
+                                               entry->maxtuples *
+                                               sizeof(HeapTuple));
+    }
+    entry->tuples[entry->ntuples++] = heap_form_tuple(fsstate->tupdesc,
+                                                      slot->tts_values,
+                                                      slot->tts_isnull);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (MemoryContextMemAllocated(entry->cxt, false) > cache->mem_limit)
+    {
+        MemoryContextDelete(entry->cxt);
+        cache->filling = false;
+    }
+}
+
+/*
+ * rescan_cache_store
+ *        Add the rows collected by the current scan to the cache
+ *
+ * complete says whether the scan ran to the end; if not, the rows are kept
+ * as a prefix.  The least recently used entries are evicted to make room.
+ */
+static void
+rescan_cache_store(ScyllaRescanCache *cache, bool complete)
+{
+    ScyllaRescanEntry *entry;
+    bool        found;
+
+    if (!cache->filling)
+        return;
+    cache->filling = false;
+
+    /*
+     * Nothing is gained from an empty prefix, nor from one longer than the
+     * whole result the server has now returned.
+     */
+    if ((!complete && cache->fill.ntuples == 0) ||
+        (complete && cache->skip > 0))
+    {
+        MemoryContextDelete(cache->fill.cxt);
+        return;
+    }
+
+    cache->fill.complete = complete;
+
+    cache->fill.mem = MemoryContextMemAllocated(cache->fill.cxt, false);
+    while (cache->mem_used + cache->fill.mem > cache->mem_limit &&
+           !dlist_is_empty(&cache->lru))
+    {
+        ScyllaRescanEntry *oldest = dlist_tail_element(ScyllaRescanEntry,
+                                                       lru_node, &cache->lru);
+
+        dlist_delete(&oldest->lru_node);
+        cache->mem_used -= oldest->mem;
+        cache->evictions++;
+
+        /* The key data goes with the context, so remove the entry first */
+        hash_search(cache->hash, &oldest->key, HASH_REMOVE, NULL);
+        MemoryContextDelete(oldest->cxt);
+    }
+
+    entry = (ScyllaRescanEntry *) hash_search(cache->hash, &cache->fill.key,
+                                              HASH_ENTER, &found);
+    Assert(!found);
+    *entry = cache->fill;
+    dlist_push_head(&cache->lru, &entry->lru_node);
+    cache->mem_used += entry->mem;
+}
+
+/*
+ * rescan_cache_reset
+ *        Forget the current scan's cache state before a rescan
+ */
+static void
+rescan_cache_reset(ScyllaRescanCache *cache)
+{
+    rescan_cache_store(cache, false);
+    cache->reading = NULL;
+    cache->skip = 0;
+    cache->checked = false;
+}
+
+/*
+ * fetch_next_page
+ *        Make the next page of the scan's result the current one
+ *
+ * Returns false once the server has no more pages to offer.  With
+ * prefetching enabled, the request for the following page is sent as soon
+ * as a page arrives, so the network round trip overlaps with converting the
+ * rows of the current page.  At most prefetch_depth pages are held besides
+ * the current one, so memory use stays bounded by fetch_size no matter how
+ * large the remote table is.
+ */
+static bool
+fetch_next_page(ScyllaFdwScanState *fsstate)
+{
+    char       *error_msg = NULL;
+
+    if (fsstate->lookup_keys != NIL)
+        return fetch_next_lookup_page(fsstate);
+
+    if (fsstate->statement == NULL)
+    {
+        /* First page: build the statement and wait for the result */
+        if (!create_scan_statement(fsstate))
+            return false;
+
+        elog(DEBUG1, "scylla_fdw: fetching first page of %d rows with consistency level %d",
+             fsstate->fetch_size, fsstate->consistency);
+
+        fsstate->result = execute_scan_statement(fsstate, &error_msg);
+        if (fsstate->result == NULL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("ScyllaDB query failed: %s",
+                            error_msg ? error_msg : "unknown error")));
+        fsstate->more_pages = scylla_result_has_more_pages(fsstate->result);
+    }
+    else if (fsstate->prefetch_depth == 0)
+    {
+        /* No prefetching: continue from where the current page left off */
+        if (!fsstate->more_pages)
+            return false;
+
+        if (!scylla_statement_set_paging_state(fsstate->statement,
+                                               fsstate->result))
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("could not set ScyllaDB paging state")));
+
+        release_scan_results(fsstate);
+
+        fsstate->result = execute_scan_statement(fsstate, &error_msg);
+        if (fsstate->result == NULL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("ScyllaDB query failed: %s",
+                            error_msg ? error_msg : "unknown error")));
+        fsstate->more_pages = scylla_result_has_more_pages(fsstate->result);
+    }
+    else
+    {
+        release_scan_results(fsstate);
+
+        /* Only block if no page has arrived while we were busy */
+        if (fsstate->num_prefetched == 0)
+        {
+            if (fsstate->pending == NULL)
+                return false;
+            collect_prefetched_page(fsstate, true);
+        }
+
+        /* Pop the oldest prefetched page */
+        fsstate->result = fsstate->prefetched[0];
+        fsstate->num_prefetched--;
+        memmove(fsstate->prefetched, fsstate->prefetched + 1,
+                fsstate->num_prefetched * sizeof(void *));
+    }
+
+    /* Keep the pipeline full */
+    issue_prefetch(fsstate);
+
+    return true;
+}
+
+/*
+ * execute_scan_statement
+ *        Send the scan's statement and wait for the page it returns
+ */
+static void *
+execute_scan_statement(ScyllaFdwScanState *fsstate, char **error_msg)
+{
+    instr_time  sent;
+    void       *future;
+
+    INSTR_TIME_SET_CURRENT(sent);
+    future = scylla_execute_statement_async(fsstate->conn, fsstate->statement,
+                                            fsstate->consistency);
+
+    return scylla_stats_get_result(&fsstate->stats, fsstate->conn, future,
+                                   &sent, error_msg);
+}
+
+/*
+ * fetch_next_lookup_page
+ *        fetch_next_page for a scan split into single-key lookups
+ *
+ * Keys are looked up in list order, with up to lookup_concurrency requests
+ * in flight, so the round trips overlap instead of adding up.  A partition
+ * too large for one page is paged through before moving to the next key.
+ */
+static bool
+fetch_next_lookup_page(ScyllaFdwScanState *fsstate)
+{
+    char       *error_msg = NULL;
+
+    if (fsstate->result != NULL &&
+        scylla_result_has_more_pages(fsstate->result))
+    {
+        /* More of the current partition */
+        if (!scylla_statement_set_paging_state(fsstate->statement,
+                                               fsstate->result))
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("could not set ScyllaDB paging state")));
+
+        release_scan_results(fsstate);
+
+        fsstate->result = execute_scan_statement(fsstate, &error_msg);
+    }
+    else
+    {
+        void       *future;
+        instr_time  sent;
+
+        release_scan_results(fsstate);
+        if (fsstate->statement != NULL)
+        {
+            scylla_free_statement(fsstate->statement);
+            fsstate->statement = NULL;
+        }
+
+        issue_lookups(fsstate);
+        if (fsstate->num_lookups == 0)
+            return false;
+
+        /* Take the oldest lookup, and refill the window before waiting */
+        fsstate->statement = fsstate->lookup_stmts[fsstate->lookup_head];
+        future = fsstate->lookup_futures[fsstate->lookup_head];
+        sent = fsstate->lookup_sent[fsstate->lookup_head];
+        fsstate->lookup_head = (fsstate->lookup_head + 1) %
+            fsstate->lookup_concurrency;
+        fsstate->num_lookups--;
+        issue_lookups(fsstate);
+
+        /* This frees the future */
+        fsstate->result = scylla_stats_get_result(&fsstate->stats,
+                                                  fsstate->conn, future,
+                                                  &sent, &error_msg);
+    }
+
+    if (fsstate->result == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("ScyllaDB query failed: %s",
+                        error_msg ? error_msg : "unknown error")));
+
+    return true;
+}
+
+/*
+ * issue_lookups
+ *        Send single-key lookups until lookup_concurrency are in flight
+ */
+static void
+issue_lookups(ScyllaFdwScanState *fsstate)
+{
+    int         nkeys = list_length(fsstate->lookup_keys);
+
+    while (fsstate->num_lookups < fsstate->lookup_concurrency &&
+           fsstate->next_lookup < nkeys)
+    {
+        Const      *key = list_nth_node(Const, fsstate->lookup_keys,
+                                        fsstate->next_lookup);
+        void       *statement;
+        int         slot;
+
+        fsstate->next_lookup++;
+
+        statement = scylla_create_statement(get_scan_prepared(fsstate));
+        scylla_statement_set_idempotent(statement, true);
+        scylla_convert_from_pg(key->constvalue, key->consttype, statement,
+                               0, false);
+        if (!bind_scan_params(fsstate, statement, 1))
+        {
+            /* No key can match; the parameters are the same for all */
+            scylla_free_statement(statement);
+            fsstate->next_lookup = nkeys;
+            break;
+        }
+        scylla_statement_set_paging_size(statement, fsstate->fetch_size);
+
+        elog(DEBUG2, "scylla_fdw: sending lookup %d of %d",
+             fsstate->next_lookup, nkeys);
+
+        slot = (fsstate->lookup_head + fsstate->num_lookups) %
+            fsstate->lookup_concurrency;
+        fsstate->lookup_stmts[slot] = statement;
+        INSTR_TIME_SET_CURRENT(fsstate->lookup_sent[slot]);
+        fsstate->lookup_futures[slot] =
+            scylla_execute_statement_async(fsstate->conn, statement,
+                                           fsstate->consistency);
+        fsstate->num_lookups++;
+    }
+}
+
+/*
+ * discard_lookups
+ *        Drop the lookups in flight and start over from the first key
+ */
+static void
+discard_lookups(ScyllaFdwScanState *fsstate)
+{
+    while (fsstate->num_lookups > 0)
+    {
+        scylla_free_future(fsstate->lookup_futures[fsstate->lookup_head]);
+        scylla_free_statement(fsstate->lookup_stmts[fsstate->lookup_head]);
+        fsstate->lookup_head = (fsstate->lookup_head + 1) %
+            fsstate->lookup_concurrency;
+        fsstate->num_lookups--;
+    }
+    fsstate->lookup_head = 0;
+    fsstate->next_lookup = 0;
+}
+
+/*
+ * issue_prefetch
+ *        Send the request for the page after the most recently received one
+ *
+ * Only one request can be in flight at a time, since each page's paging
+ * state comes from the page before it.  Nothing is sent if prefetching is
+ * disabled, the queue of prefetched pages is full, or the server has no
+ * more pages.
+ */
+static void
+issue_prefetch(ScyllaFdwScanState *fsstate)
+{
+    void       *latest;
+
+    if (fsstate->prefetch_depth <= 0 ||
+        fsstate->pending != NULL ||
+        !fsstate->more_pages ||
+        fsstate->num_prefetched >= fsstate->prefetch_depth)
+        return;
+
+    /* Pages arrive in order, so the newest one is at the end of the queue */
+    if (fsstate->num_prefetched > 0)
+        latest = fsstate->prefetched[fsstate->num_prefetched - 1];
+    else
+        latest = fsstate->result;
+
+    if (!scylla_statement_set_paging_state(fsstate->statement, latest))
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not set ScyllaDB paging state")));
+
+    elog(DEBUG2, "scylla_fdw: prefetching next page (%d pages queued)",
+         fsstate->num_prefetched);
+
+    INSTR_TIME_SET_CURRENT(fsstate->pending_sent);
+    fsstate->pending = scylla_execute_statement_async(fsstate->conn,
+                                                      fsstate->statement,
+                                                      fsstate->consistency);
+
+    /* Not known until the page arrives */
+    fsstate->more_pages = false;
+}
+
+/*
+ * async_fetch_ready
+ *        Check whether fetch_next_page can return without waiting
+ *
+ * If it can't, the request it would wait for is sent, if it hasn't been
+ * yet, for ForeignAsyncConfigureWait to wait on.  The first page of a scan
+ * (or token range) is requested like a prefetched page, and is taken off
+ * the prefetch queue as one.  Further pages of an oversized partition of
+ * a split IN list are still fetched synchronously.
+ */
+static bool
+async_fetch_ready(ScyllaFdwScanState *fsstate)
+{
+    if (fsstate->lookup_keys != NIL)
+    {
+        if (fsstate->result != NULL &&
+            scylla_result_has_more_pages(fsstate->result))
+            return true;
+
+        issue_lookups(fsstate);
+        return fsstate->num_lookups == 0 ||
+            scylla_future_ready(fsstate->lookup_futures[fsstate->lookup_head]);
+    }
+
+    if (fsstate->statement == NULL)
+    {
+        /* Nothing (more) to scan; fetch_next_page finds that out too */
+        if (!create_scan_statement(fsstate))
+            return true;
+
+        elog(DEBUG1, "scylla_fdw: requesting first page of %d rows with consistency level %d",
+             fsstate->fetch_size, fsstate->consistency);
+
+        INSTR_TIME_SET_CURRENT(fsstate->pending_sent);
+        fsstate->pending = scylla_execute_statement_async(fsstate->conn,
+                                                          fsstate->statement,
+                                                          fsstate->consistency);
+        return false;
+    }
+
+    if (fsstate->num_prefetched > 0 || fsstate->pending == NULL)
+        return true;
+
+    return scylla_future_ready(fsstate->pending);
+}
+
+/*
+ * collect_prefetched_page
+ *        Move the in-flight page, if it has arrived, onto the prefetch queue
+ *
+ * If wait is true, block until the page arrives.  Otherwise this is a cheap
+ * poll, which lets a deeper prefetch queue fill up while rows of the
+ * current page are being converted.
+ */
+static void
+collect_prefetched_page(ScyllaFdwScanState *fsstate, bool wait)
+{
+    void       *page;
+    char       *error_msg = NULL;
+
+    if (fsstate->pending == NULL)
+        return;
+
+    if (!wait && !scylla_future_ready(fsstate->pending))
+        return;
+
+    /* This frees the future */
+    page = scylla_stats_get_result(&fsstate->stats, fsstate->conn,
+                                   fsstate->pending, &fsstate->pending_sent,
+                                   &error_msg);
+    fsstate->pending = NULL;
+
+    if (page == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("ScyllaDB query failed: %s",
+                        error_msg ? error_msg : "unknown error")));
+
+    fsstate->prefetched[fsstate->num_prefetched++] = page;
+    fsstate->more_pages = scylla_result_has_more_pages(page);
+
+    issue_prefetch(fsstate);
+}
+
+/*
+ * release_scan_results
+ *        Free the current page's result, if any, and forget its rows
+ */
+static void
+release_scan_results(ScyllaFdwScanState *fsstate)
+{
+    fsstate->page_rows = 0;
+    fsstate->page_row = 0;
+    if (fsstate->result != NULL)
+    {
+        scylla_free_result(fsstate->result);
+        fsstate->result = NULL;
+    }
+}
+
+/*
+ * discard_prefetch
+ *        Drop the in-flight request and any pages fetched ahead
+ *
+ * The driver still completes an abandoned request in the background, but
+ * its result is discarded.
+ */
+static void
+discard_prefetch(ScyllaFdwScanState *fsstate)
+{
+    int         i;
+
+    if (fsstate->pending != NULL)
+    {
+        scylla_free_future(fsstate->pending);
+        fsstate->pending = NULL;
+    }
+    for (i = 0; i < fsstate->num_prefetched; i++)
+        scylla_free_result(fsstate->prefetched[i]);
+    fsstate->num_prefetched = 0;
+    fsstate->more_pages = false;
 }
@@ -25,6 +25,10 @@
 #include "catalog/pg_user_mapping.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#if PG_VERSION_NUM >= 180000
+#include "commands/explain_format.h"
+#include "commands/explain_state.h"
+#endif
 #include "access/reloptions.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
@@ -33,14 +37,18 @@
 #include "optimizer/restrictinfo.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
 #include "funcapi.h"
+#include "lib/ilist.h"
 #include "miscadmin.h"
 #include "commands/copy.h"
+#include "port/atomics.h"
+#include "portability/instr_time.h"
 
 /* Version */
-#define SCYLLA_FDW_VERSION "1.0.0"
+#define SCYLLA_FDW_VERSION "1.1.0"
 
 /*
  * Options that can be set on the server, user mapping, or foreign table
@@ -57,6 +65,29 @@
 #define OPT_CONNECT_TIMEOUT     "connect_timeout"
 #define OPT_REQUEST_TIMEOUT     "request_timeout"
 #define OPT_CONSISTENCY         "consistency"
+#define OPT_READ_CONSISTENCY    "read_consistency"  /* also a table option */
+#define OPT_WRITE_CONSISTENCY   "write_consistency" /* also a table option */
+#define OPT_SERIAL_CONSISTENCY  "serial_consistency"    /* also a table option */
+#define OPT_FETCH_SIZE          "fetch_size"    /* also a table option */
+#define OPT_PREFETCH_DEPTH      "prefetch_depth"    /* also a table option */
+#define OPT_BATCH_SIZE          "batch_size"    /* also a table option */
+#define OPT_MAX_INFLIGHT        "max_inflight"  /* also a table option */
+#define OPT_LOOKUP_CONCURRENCY  "lookup_concurrency"    /* also a table option */
+#define OPT_RESCAN_CACHE_SIZE   "rescan_cache_size" /* also a table option */
+#define OPT_USE_REMOTE_ESTIMATE "use_remote_estimate"   /* also a table option */
+#define OPT_ASYNC_CAPABLE       "async_capable" /* also a table option */
+#define OPT_DIRECT_MODIFY_IF_EXISTS "direct_modify_if_exists" /* also a table option */
+#define OPT_FDW_STARTUP_COST    "fdw_startup_cost"
+#define OPT_FDW_TUPLE_COST      "fdw_tuple_cost"
+#define OPT_LOCAL_DC            "local_dc"
+#define OPT_TOKEN_AWARE         "token_aware"
+#define OPT_LATENCY_AWARE_ROUTING   "latency_aware_routing"
+#define OPT_CORE_CONNECTIONS_PER_HOST   "core_connections_per_host"
+#define OPT_NUM_IO_THREADS      "num_io_threads"
+#define OPT_SPECULATIVE_DELAY_MS    "speculative_delay_ms"
+#define OPT_SPECULATIVE_MAX     "speculative_max"
+#define OPT_RETRY_POLICY        "retry_policy"
+#define OPT_LOG_RETRIES         "log_retries"
 
 /* User mapping options */
 #define OPT_USERNAME            "username"
@@ -67,6 +98,8 @@
 #define OPT_TABLE               "table"
 #define OPT_PRIMARY_KEY         "primary_key"
 #define OPT_CLUSTERING_KEY      "clustering_key"
+#define OPT_TTL                 "ttl"
+#define OPT_WRITE_TIMESTAMP     "write_timestamp"
 
 /* Default values */
 #define DEFAULT_HOST            "127.0.0.1"
@@ -74,6 +107,26 @@
 #define DEFAULT_CONSISTENCY     "local_quorum"
 #define DEFAULT_CONNECT_TIMEOUT 5000
 #define DEFAULT_REQUEST_TIMEOUT 12000
+#define DEFAULT_FETCH_SIZE      5000
+#define DEFAULT_PREFETCH_DEPTH  1
+#define DEFAULT_BATCH_SIZE      1
+#define DEFAULT_MAX_INFLIGHT    1
+#define DEFAULT_COPY_BATCH_SIZE     100
+#define DEFAULT_COPY_MAX_INFLIGHT   64
+#define DEFAULT_LOOKUP_CONCURRENCY  0
+#define DEFAULT_RESCAN_CACHE_SIZE   0
+#define DEFAULT_SPECULATIVE_MAX     1
+#define DEFAULT_FDW_STARTUP_COST    100.0
+#define DEFAULT_FDW_TUPLE_COST      0.01
+
+/* Number of token ranges a parallel scan splits the ring into */
+#define SCYLLA_PARALLEL_TOKEN_RANGES    256
+
+/*
+ * Placeholder for the bind markers of an array parameter in "col IN (...)",
+ * replaced by one marker per element when the scan starts
+ */
+#define SCYLLA_ARRAY_PARAM_MARKER   "?..."
 
 /*
  * FDW-specific planner information kept in RelOptInfo.fdw_private
@@ -107,22 +160,208 @@ typedef struct ScyllaFdwRelationInfo
     char       *username;
     char       *password;
     char       *consistency;
-
-    /* Join pushdown info */
+    int         fetch_size;
+    int         prefetch_depth;
+    int         lookup_concurrency;
+    int         rescan_cache_size;  /* in kB, 0 = disabled */
+    bool        async_capable;  /* may run asynchronously under an Append */
+    bool        direct_modify_if_exists;    /* send direct writes as LWTs */
+
+    /* Cost model */
     bool        use_remote_estimate;
     Cost        fdw_startup_cost;
     Cost        fdw_tuple_cost;
+    double      remote_partitions;  /* from size_estimates, or -1 */
+    List       *pk_attrs;       /* attnums of the primary_key columns */
+    List       *ck_attrs;       /* attnums of the clustering_key columns */
+    List       *ck_desc;        /* 1 for each of them declared DESC, else 0 */
 
     /* Cached relation info */
     Relation    rel;
     
-    /* For join pushdown */
+    /* For join pushdown, and the scanned relation of a grouped rel */
     RelOptInfo *outerrel;
     RelOptInfo *innerrel;
     JoinType    jointype;
     List       *joinclauses;
+
+    /* For aggregate pushdown */
+    List       *grouped_tlist;  /* grouping columns and aggregates to fetch */
+    List       *group_attrs;    /* attnums to GROUP BY, in primary key order */
+    List       *empty_aggs;     /* sum/avg resnos paired with count resnos */
 } ScyllaFdwRelationInfo;
 
+/*
+ * Parsed metadata of a foreign table, cached per backend
+ *
+ * See scylla_metacache.c.  Entries are rebuilt after an invalidation of
+ * the table, its server or the user mapping, so callers must copy what
+ * they keep beyond the next catalog access.
+ */
+typedef struct ScyllaTableMetaKey
+{
+    Oid         relid;          /* foreign table */
+    Oid         userid;         /* user whose mapping supplied the options */
+} ScyllaTableMetaKey;
+
+typedef struct ScyllaTableMeta
+{
+    ScyllaTableMetaKey key;     /* hash key (must be first) */
+    bool        valid;          /* false once invalidated */
+    uint32      table_hashvalue;    /* hash of relid in FOREIGNTABLEREL */
+    MemoryContext cxt;          /* holds everything below */
+
+    /*
+     * Options as resolved by scylla_extract_options, plus pk_attrs,
+     * ck_attrs and ck_desc; the other fields are zero
+     */
+    ScyllaFdwRelationInfo *options;
+    bool        pk_complete;    /* every primary_key name is a column */
+
+    /* Consistency options of the table or its server, or NULL */
+    char       *read_consistency;
+    char       *write_consistency;
+    char       *serial_consistency;
+} ScyllaTableMeta;
+
+/*
+ * Shared state of a parallel scan, kept in the DSM segment
+ *
+ * The Murmur3 token ring is split into num_ranges equal ranges, and each
+ * participant claims the next unscanned one by bumping next_range.
+ */
+typedef struct ScyllaParallelScanState
+{
+    pg_atomic_uint32 next_range;    /* index of next range to hand out */
+    int         num_ranges;         /* total number of token ranges */
+} ScyllaParallelScanState;
+
+/*
+ * Remote activity of a scan or modification, shown by EXPLAIN ANALYZE
+ *
+ * Requests and rows are always counted.  Timings and sizes are collected
+ * when the node is instrumented or shared statistics are kept (see
+ * scylla_stats.c), the coordinator only in the first case.  The driver's
+ * speculative execution and timeout counters are per session, so they are
+ * sampled when the node starts and reported as a difference.
+ */
+#define SCYLLA_LATENCY_BUCKETS  32
+
+typedef struct ScyllaRemoteStats
+{
+    bool        enabled;        /* node is instrumented */
+    bool        shared;         /* report to shared statistics at the end */
+    Oid         serverid;       /* foreign server the session belongs to */
+    int64       requests;       /* requests answered */
+    int64       rows;           /* rows received */
+    int64       bytes;          /* bytes of column values decoded by scans */
+    double      total_time;     /* ms from sending requests to their results */
+    double      max_time;       /* ms, slowest request */
+    double      convert_time;   /* ms converting values to PostgreSQL */
+    char        coordinator[64];    /* address of a coordinator, or "" */
+    int64       speculative_base;   /* session counters when we started */
+    int64       timeouts_base;
+    int64       latency[SCYLLA_LATENCY_BUCKETS];   /* see scylla_latency_bucket */
+} ScyllaRemoteStats;
+
+/*
+ * Driver metrics of a session as last reported to shared statistics, so
+ * that only the change is added next time
+ */
+typedef struct ScyllaSessionMetrics
+{
+    int64       connections;
+    int64       request_timeouts;
+    int64       connection_timeouts;
+    int64       pending_request_timeouts;
+} ScyllaSessionMetrics;
+
+/*
+ * Events counted directly in shared statistics, as they happen
+ */
+typedef enum ScyllaStatsEvent
+{
+    SCYLLA_STATS_CONNECT,       /* a session was opened */
+    SCYLLA_STATS_PREPARED_HIT,  /* a prepared statement was reused */
+    SCYLLA_STATS_PREPARED_MISS, /* a statement had to be prepared */
+    SCYLLA_STATS_ERROR          /* a request failed */
+} ScyllaStatsEvent;
+
+/*
+ * Converts a non-NULL CQL value to a Datum of the column's type; returns
+ * false if the value is NULL
+ */
+typedef bool (*ScyllaDecodeFunc) (void *value, int32 typmod, Datum *result);
+
+/*
+ * One entry of a scan's decode plan, built for the retrieved columns only
+ */
+typedef struct ScyllaColumnDecoder
+{
+    int         attidx;         /* 0-based attribute index in the tuple */
+    int         col;            /* column index in the CQL result */
+    Oid         pg_type;
+    int32       typmod;
+    ScyllaDecodeFunc decode;    /* picked from the first result's metadata */
+} ScyllaColumnDecoder;
+
+/*
+ * Key of the rescan cache: the images of a parameterized scan's parameter
+ * values, in param_exprs order
+ */
+typedef struct ScyllaRescanKey
+{
+    char       *data;
+    Size        len;
+} ScyllaRescanKey;
+
+/*
+ * Rows returned by one parameterized scan, kept for rescans with the same
+ * parameter values
+ *
+ * A scan stopped before the end, as under a semi-join or a LIMIT, leaves just
+ * the rows it returned; a rescan that needs more fetches the rest.
+ */
+typedef struct ScyllaRescanEntry
+{
+    ScyllaRescanKey key;        /* hash key, must be first */
+    dlist_node  lru_node;       /* in ScyllaRescanCache.lru, newest first */
+    MemoryContext cxt;          /* holds the key data and the rows */
+    HeapTuple  *tuples;
+    int         ntuples;
+    int         maxtuples;      /* allocated length of tuples[] */
+    Size        mem;            /* memory allocated in cxt */
+    bool        complete;       /* holds every row of the scan? */
+} ScyllaRescanEntry;
+
+/*
+ * Statement-scoped LRU cache of parameterized scan results
+ *
+ * Everything but the counters lives in cxt, a child of the executor's
+ * per-query context, so the cache goes away with the statement.
+ */
+typedef struct ScyllaRescanCache
+{
+    MemoryContext cxt;          /* parent of the entry contexts */
+    HTAB       *hash;           /* ScyllaRescanKey -> ScyllaRescanEntry */
+    dlist_head  lru;
+    Size        mem_limit;      /* bytes */
+    Size        mem_used;       /* bytes allocated by cached entries */
+    int16      *param_typlen;   /* per param_exprs entry */
+    bool       *param_typbyval;
+    bool        checked;        /* looked up the current scan's key yet? */
+    ScyllaRescanEntry *reading; /* cached rows being returned, or NULL */
+    int         next_tuple;     /* index into reading->tuples */
+    bool        filling;        /* collecting the current scan's rows? */
+    ScyllaRescanEntry fill;     /* ... into this, not yet in hash */
+    int         skip;           /* remote rows already returned from cache */
+
+    /* For EXPLAIN ANALYZE */
+    int64       hits;
+    int64       misses;
+    int64       evictions;
+} ScyllaRescanCache;
+
 /*
  * Execution state of a foreign scan
  */
@@ -133,21 +372,53 @@ typedef struct ScyllaFdwScanState
     void       *cluster;        /* CassCluster* */
     
     /* Query execution state */
-    void       *result;         /* CassResult* */
-    void       *iterator;       /* CassIterator* */
+    void       *statement;      /* CassStatement*, carries the paging state */
+    void       *result;         /* CassResult* for the current page */
     void       *prepared;       /* CassPrepared* */
+    int         fetch_size;     /* rows requested per page */
+    int         consistency;    /* CassConsistency for scan requests */
+
+    /* Asynchronous prefetch state */
+    int         prefetch_depth; /* max pages fetched ahead, 0 = disabled */
+    void       *pending;        /* CassFuture* for the next page, or NULL */
+    instr_time  pending_sent;   /* when pending was sent */
+    void      **prefetched;     /* completed pages not yet read, oldest first */
+    int         num_prefetched; /* number of entries in prefetched[] */
+    bool        more_pages;     /* server has pages we have not requested */
+
+    /* Parallel scan state */
+    int         token_ranges;   /* ranges to split the ring into, 0 = no split */
+    ScyllaParallelScanState *pscan; /* shared range queue, or &local_pscan */
+    ScyllaParallelScanState local_pscan;    /* used when there is no DSM */
+
+    /* Partition key IN list split into single-key lookups */
+    List       *lookup_keys;    /* Const list of keys, or NIL if not split */
+    int         lookup_concurrency; /* max lookups in flight */
+    int         next_lookup;    /* index of the next key to send */
+    void      **lookup_stmts;   /* ring of in-flight CassStatement* ... */
+    void      **lookup_futures; /* ... and their CassFuture*, oldest first */
+    instr_time *lookup_sent;    /* ... and when they were sent */
+    int         lookup_head;    /* ring index of the oldest lookup */
+    int         num_lookups;    /* number of lookups in flight */
+
+    /* Asynchronous execution under an Append */
+    bool        async;          /* rows requested by ForeignAsyncRequest */
+    void       *async_signal;   /* ScyllaAsyncSignal*, or NULL until needed */
     
     /* Query string */
     char       *query;
     
     /* Relation info */
-    Relation    rel;
+    Relation    rel;            /* NULL for an aggregate scan */
+    Oid         relid;
     AttInMetadata *attinmeta;
     
-    /* Parameters for parameterized scans */
-    List       *param_exprs;
+    /* Parameters for parameterized scans, bound after any token range */
+    List       *param_exprs;    /* ExprState list, from fdw_exprs */
     FmgrInfo   *param_flinfo;
-    List       *param_types;
+    List       *param_types;    /* OID list, types of param_exprs */
+    ExprContext *param_econtext;    /* context to evaluate param_exprs in */
+    List       *array_param_exprs;  /* array Params sent as "IN (?...)" */
     
     /* For rescans */
     int         fetch_ct;
@@ -156,9 +427,32 @@ typedef struct ScyllaFdwScanState
     /* Tuple descriptor */
     TupleDesc   tupdesc;
     
-    /* Column mapping */
-    int        *col_mapping;
-    int         num_cols;
+    /* Decode plan for the retrieved columns, in result column order */
+    ScyllaColumnDecoder *decoders;
+    int         num_decoders;
+    bool        decoders_checked;   /* decode functions picked yet? */
+
+    /*
+     * The current page, decoded one column at a time: decoder i's value for
+     * row r is page_values[i * page_rows + r], and page_nulls likewise
+     */
+    MemoryContext pagecontext;  /* holds the current page's decoded data */
+    Datum      *page_values;
+    bool       *page_nulls;
+    int         page_rows;
+    int         page_row;       /* next row to return */
+
+    /*
+     * Pairs of attribute numbers (sum or avg, count of its argument) of an
+     * aggregate scan; the aggregate is NULL when the count is 0
+     */
+    List       *empty_aggs;
+
+    /* Rows of earlier parameterized scans, or NULL if not caching */
+    ScyllaRescanCache *rescan_cache;
+
+    /* Remote activity, for EXPLAIN ANALYZE */
+    ScyllaRemoteStats stats;
 } ScyllaFdwScanState;
 
 /*
@@ -185,18 +479,66 @@ typedef struct ScyllaFdwModifyState
     List       *target_attrs;
     Oid        *param_types;
     
-    /* Primary key info for UPDATE/DELETE */
+    /*
+     * Primary key info: WHERE clause columns for UPDATE/DELETE, partition
+     * key columns used to group rows into batches for INSERT
+     */
     AttrNumber *pk_attrs;
     int         num_pk_attrs;
     AttrNumber *junk_att_nums;  /* Junk attribute numbers in planSlot for PK columns */
+
+    /* Batch insert */
+    int         batch_size;     /* max rows per ExecForeignBatchInsert call */
+
+    /* Pipelined writes: ring buffer of outstanding CassFuture* */
+    int         max_inflight;   /* window size, 1 = wait for every write */
+    void      **inflight;
+    instr_time *inflight_sent;  /* when each write was sent */
+    int         inflight_head;  /* index of oldest outstanding write */
+    int         num_inflight;
+    MemoryContextCallback inflight_cb;  /* frees them if the query fails */
     
+    /* COPY: rows buffered by ExecForeignInsert until a batch is full */
+    bool        bulk;
+    TupleTableSlot **bulk_slots;
+    int         bulk_capacity;
+    int         num_bulk_slots;
+
+    /* COPY: failed pipelined writes, reported at the end */
+    int         num_failed;
+    char       *first_failure;
+
+    /* Consistency levels, resolved when the modify starts */
+    int         consistency;
+    int         serial_consistency;
+
+    /* INSERT ... IF NOT EXISTS: rows are written one at a time */
+    bool        conditional;
+
     /* Operation type */
     CmdType     operation;
     
     /* Tuple descriptor */
     TupleDesc   tupdesc;
+
+    /* Remote activity, for EXPLAIN ANALYZE */
+    ScyllaRemoteStats stats;
 } ScyllaFdwModifyState;
 
+/*
+ * Execution state of a direct UPDATE/DELETE
+ */
+typedef struct ScyllaFdwDirectModifyState
+{
+    void       *conn;           /* CassSession* */
+    char       *query;          /* CQL UPDATE/DELETE command */
+    int         consistency;    /* write consistency level */
+    int         serial_consistency;    /* for the Paxos round of an LWT */
+    bool        set_processed;  /* count the row in es_processed? */
+    bool        conditional;    /* an LWT, whose [applied] gives the count */
+    bool        executed;       /* have we sent the command yet? */
+} ScyllaFdwDirectModifyState;
+
 /*
  * CQL consistency level mapping
  */
@@ -227,19 +569,59 @@ void       *scylla_connect(const char *host, int port, const char *username,
                            const char *password, int connect_timeout,
                            bool use_ssl, const char *ssl_cert, 
                            const char *ssl_key, const char *ssl_ca,
+                           const char *local_dc, bool token_aware,
+                           bool latency_aware, int core_connections,
+                           int num_io_threads, int speculative_delay_ms,
+                           int speculative_max, int retry_policy,
+                           bool log_retries,
                            char **error_msg);
 void        scylla_disconnect(void *conn, void *cluster);
 
 /* Query execution */
 void       *scylla_execute_query(void *conn, const char *query, 
-                                 int consistency, char **error_msg);
+                                 int consistency, bool idempotent,
+                                 char **error_msg);
 void       *scylla_prepare_query(void *conn, const char *query, char **error_msg);
 void       *scylla_execute_prepared(void *conn, void *prepared, 
                                     void **params, int num_params,
                                     int consistency, char **error_msg);
+void       *scylla_create_query_statement(const char *query, int num_params);
+void       *scylla_execute_statement(void *conn, void *statement,
+                                     int consistency, char **error_msg);
 void        scylla_free_result(void *result);
 void        scylla_free_prepared(void *prepared);
 
+/* Paging */
+void        scylla_statement_set_paging_size(void *statement, int page_size);
+void        scylla_statement_set_idempotent(void *statement, bool idempotent);
+void        scylla_statement_set_serial_consistency(void *statement,
+                                                    int serial_consistency);
+bool        scylla_statement_set_paging_state(void *statement, void *result);
+bool        scylla_result_has_more_pages(void *result);
+
+/* Asynchronous execution */
+void       *scylla_execute_statement_async(void *conn, void *statement,
+                                           int consistency);
+bool        scylla_future_ready(void *future);
+void        scylla_future_wait(void *future);
+void       *scylla_future_get_result(void *future, char **error_msg);
+void        scylla_free_future(void *future);
+void       *scylla_async_signal_create(char **error_msg);
+int         scylla_async_signal_fd(void *signal);
+bool        scylla_async_signal_arm(void *signal, void *future);
+void        scylla_async_signal_clear(void *signal);
+void        scylla_async_signal_release(void *signal);
+
+/* Instrumentation */
+bool        scylla_future_coordinator(void *conn, void *future,
+                                      char *buf, size_t buflen);
+void        scylla_session_counters(void *conn, int64_t *speculative,
+                                    int64_t *timeouts);
+void        scylla_session_metrics(void *conn, int64_t *connections,
+                                   int64_t *request_timeouts,
+                                   int64_t *connection_timeouts,
+                                   int64_t *pending_request_timeouts);
+
 /* Result iteration */
 void       *scylla_result_iterator(void *result);
 bool        scylla_iterator_next(void *iterator);
@@ -258,32 +640,65 @@ const char *scylla_get_inet(void *iterator, int col, bool *is_null);
 int64_t     scylla_get_timestamp(void *iterator, int col, bool *is_null);
 int32_t     scylla_get_date(void *iterator, int col, bool *is_null);
 int64_t     scylla_get_time(void *iterator, int col, bool *is_null);
-const char *scylla_get_decimal(void *iterator, int col, bool *is_null);
+
+/* Row-level value access, used by the scan's decode plan */
+void       *scylla_iterator_get_row(void *iterator);
+void       *scylla_row_get_column(void *row, int col);
+int64_t     scylla_value_size(void *value);
+bool        scylla_value_get_bool(void *value, bool *out);
+bool        scylla_value_get_int8(void *value, int8_t *out);
+bool        scylla_value_get_int16(void *value, int16_t *out);
+bool        scylla_value_get_int32(void *value, int32_t *out);
+bool        scylla_value_get_uint32(void *value, uint32_t *out);
+bool        scylla_value_get_int64(void *value, int64_t *out);
+bool        scylla_value_get_float(void *value, float *out);
+bool        scylla_value_get_double(void *value, double *out);
+const char *scylla_value_get_string(void *value, size_t *len);
+const char *scylla_value_get_bytes(void *value, size_t *len);
+bool        scylla_value_get_uuid(void *value, unsigned char *out);
+bool        scylla_value_get_inet(void *value, unsigned char *addr, int *len);
+bool        scylla_value_get_decimal(void *value, const unsigned char **varint,
+                                     size_t *len, int32_t *scale);
+bool        scylla_value_get_varint(void *value, const unsigned char **varint,
+                                    size_t *len);
 
 /* Value type detection */
 int         scylla_get_column_type(void *result, int col);
 int         scylla_get_column_count(void *result);
 const char *scylla_get_column_name(void *result, int col, size_t *len);
 
-/* Statement binding */
+/* Statement binding; the binds return false if the driver rejects the value */
 void       *scylla_create_statement(void *prepared);
-void        scylla_bind_null(void *statement, int index);
-void        scylla_bind_bool(void *statement, int index, bool value);
-void        scylla_bind_int32(void *statement, int index, int32_t value);
-void        scylla_bind_uint32(void *statement, int index, uint32_t value);
-void        scylla_bind_int64(void *statement, int index, int64_t value);
-void        scylla_bind_float(void *statement, int index, float value);
-void        scylla_bind_double(void *statement, int index, double value);
-void        scylla_bind_string(void *statement, int index, const char *value, size_t len);
-void        scylla_bind_bytes(void *statement, int index, const char *value, size_t len);
-void        scylla_bind_uuid(void *statement, int index, const char *value);
-void        scylla_bind_timestamp(void *statement, int index, int64_t value);
-void        scylla_bind_decimal(void *statement, int index, const char *decimal_str);
+bool        scylla_bind_null(void *statement, int index);
+bool        scylla_bind_bool(void *statement, int index, bool value);
+bool        scylla_bind_int16(void *statement, int index, int16_t value);
+bool        scylla_bind_int32(void *statement, int index, int32_t value);
+bool        scylla_bind_uint32(void *statement, int index, uint32_t value);
+bool        scylla_bind_int64(void *statement, int index, int64_t value);
+bool        scylla_bind_float(void *statement, int index, float value);
+bool        scylla_bind_double(void *statement, int index, double value);
+bool        scylla_bind_string(void *statement, int index, const char *value, size_t len);
+bool        scylla_bind_bytes(void *statement, int index, const char *value, size_t len);
+bool        scylla_bind_uuid(void *statement, int index, const char *value);
+bool        scylla_bind_timestamp(void *statement, int index, int64_t value);
+bool        scylla_bind_decimal(void *statement, int index, const char *decimal_str);
+bool        scylla_bind_inet(void *statement, int index, const unsigned char *addr,
+                             int len);
 void        scylla_free_statement(void *statement);
 
+/* Batches */
+void       *scylla_create_batch(bool logged);
+bool        scylla_batch_add_statement(void *batch, void *statement);
+void        scylla_batch_set_idempotent(void *batch, bool idempotent);
+void        scylla_batch_set_serial_consistency(void *batch,
+                                                int serial_consistency);
+void       *scylla_execute_batch_async(void *conn, void *batch, int consistency);
+void        scylla_free_batch(void *batch);
+
 /* Utility functions */
 const char *scylla_consistency_to_string(int consistency);
 int         scylla_string_to_consistency(const char *str);
+int         scylla_string_to_retry_policy(const char *str);
 int64_t     scylla_result_row_count(void *result);
 
 #ifdef __cplusplus
@@ -304,30 +719,68 @@ void scylla_extract_options(List *server_opts, List *table_opts,
 char *scylla_build_select_query(PlannerInfo *root, RelOptInfo *baserel,
                                 ScyllaFdwRelationInfo *fpinfo,
                                 List *tlist, List *remote_conds,
-                                List **retrieved_attrs);
-char *scylla_build_insert_query(Relation rel, List *target_attrs);
+                                bool token_range,
+                                List *pathkeys, int limit,
+                                List **retrieved_attrs,
+                                List **params_list);
+char *scylla_build_aggregate_query(PlannerInfo *root, RelOptInfo *grouped_rel,
+                                   List *tlist, List *remote_conds,
+                                   List **retrieved_attrs,
+                                   List **params_list);
+char *scylla_build_analyze_query(Relation rel, ScyllaFdwRelationInfo *fpinfo,
+                                 List **retrieved_attrs);
+char *scylla_build_insert_query(Relation rel, List *target_attrs,
+                                bool if_not_exists);
 char *scylla_build_update_query(Relation rel, List *target_attrs,
                                 int *pk_attrs, int num_pk_attrs);
 char *scylla_build_delete_query(Relation rel, int *pk_attrs, int num_pk_attrs);
+char *scylla_build_direct_update_query(PlannerInfo *root, RelOptInfo *baserel,
+                                       ScyllaFdwRelationInfo *fpinfo,
+                                       List *targetAttrs, List *targetlist,
+                                       List *key_conds, List *if_conds);
+char *scylla_build_direct_delete_query(PlannerInfo *root, RelOptInfo *baserel,
+                                       ScyllaFdwRelationInfo *fpinfo,
+                                       List *key_conds, List *if_conds);
+bool scylla_conds_pin_primary_key(PlannerInfo *root, RelOptInfo *baserel,
+                                  ScyllaFdwRelationInfo *fpinfo,
+                                  List *remote_conds);
+bool scylla_split_lwt_conds(RelOptInfo *baserel, ScyllaFdwRelationInfo *fpinfo,
+                            List *remote_conds,
+                            List **key_conds, List **if_conds);
 
 /* WHERE clause deparsing */
 void scylla_deparse_expr(Expr *expr, StringInfo buf, PlannerInfo *root,
                         RelOptInfo *baserel, bool *can_pushdown);
 bool scylla_is_foreign_expr(PlannerInfo *root, RelOptInfo *baserel, Expr *expr);
+bool scylla_is_foreign_param_clause(PlannerInfo *root, RelOptInfo *baserel,
+                                    Expr *clause, AttrNumber *attnum);
+bool scylla_column_has_equality(RelOptInfo *baserel, List *conds,
+                                AttrNumber attnum, bool allow_in);
+bool scylla_conds_restrict_token(RelOptInfo *baserel, List *conds);
+List *scylla_const_array_elements(Const *node);
+bool scylla_is_foreign_aggregate(RelOptInfo *scanrel, Aggref *agg);
+bool scylla_aggregate_needs_count(Aggref *agg);
+Aggref *scylla_make_count_aggregate(Aggref *agg);
 void scylla_classify_conditions(PlannerInfo *root, RelOptInfo *baserel,
                                 List *input_conds, List **remote_conds,
                                 List **local_conds);
 
 /* Type conversion */
-Datum scylla_convert_to_pg(void *iterator, int col, Oid pg_type,
-                           int32 typmod, bool *is_null);
+ScyllaDecodeFunc scylla_get_decoder(Oid pg_type, int cql_type);
+const char *scylla_cql_type_name(int cql_type);
 void scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
                             int index, bool is_null);
+bool scylla_is_bindable_type(Oid pg_type);
 
 /* Connection caching */
 void *scylla_get_connection(ForeignServer *server, UserMapping *user,
                             bool will_prep_stmt);
 void scylla_release_connection(void *conn);
+void *scylla_get_prepared(void *conn, Oid relid, const char *query);
+
+/* Table metadata cache (scylla_metacache.c) */
+ScyllaTableMeta *scylla_get_table_meta(Oid relid);
+void scylla_init_rel_info(Oid relid, ScyllaFdwRelationInfo *fpinfo);
 
 /* Utility */
 char *scylla_quote_identifier(const char *ident);
@@ -338,9 +791,33 @@ void estimate_path_cost_size(PlannerInfo *root, RelOptInfo *baserel,
                              List *join_conds, List *pathkeys,
                              double *p_rows, int *p_width,
                              Cost *p_startup_cost, Cost *p_total_cost);
+double scylla_estimate_partition_count(void *conn,
+                                       ScyllaFdwRelationInfo *fpinfo);
 List *scylla_get_useful_pathkeys(PlannerInfo *root, RelOptInfo *baserel);
+List *scylla_clustering_order(PlannerInfo *root, RelOptInfo *baserel,
+                              List *pathkeys, bool *reversed);
 List *scylla_get_useful_ecs_for_relation(PlannerInfo *root, RelOptInfo *baserel);
 
+/* Remote activity statistics */
+void scylla_stats_init(ScyllaRemoteStats *stats, void *conn, Oid serverid,
+                       bool enabled);
+void *scylla_stats_get_result(ScyllaRemoteStats *stats, void *conn,
+                              void *future, instr_time *sent,
+                              char **error_msg);
+void scylla_stats_explain(ScyllaRemoteStats *stats, void *conn, bool scan,
+                          ExplainState *es);
+
+/* Shared statistics (scylla_stats.c) */
+void scylla_shared_stats_install(void);
+bool scylla_shared_stats_active(void);
+int scylla_latency_bucket(double ms);
+void scylla_shared_stats_report(ScyllaRemoteStats *stats);
+void scylla_shared_stats_count(Oid serverid, ScyllaStatsEvent event);
+void scylla_shared_stats_session(Oid serverid, void *conn,
+                                 ScyllaSessionMetrics *published);
+void scylla_shared_stats_disconnect(Oid serverid, void *conn,
+                                    ScyllaSessionMetrics *published);
+
 /* Option handling */
 void apply_server_options(ScyllaFdwRelationInfo *fpinfo, ForeignServer *server);
 void apply_table_options(ScyllaFdwRelationInfo *fpinfo, ForeignTable *table);
@@ -349,13 +826,25 @@ void merge_fdw_options(ScyllaFdwRelationInfo *fpinfo,
                        ForeignTable *table,
                        UserMapping *user);
 bool is_valid_option(const char *option, Oid context);
+const char *find_option_value(List *options, const char *optname);
+int scylla_get_read_consistency(Oid relid);
+int scylla_get_write_consistency(Oid relid);
+int scylla_get_serial_consistency(Oid relid);
+
+/* Settings (scylla_fdw.c) */
+extern char *scylla_read_consistency;
+extern char *scylla_write_consistency;
+extern char *scylla_serial_consistency;
 
 /* Column utilities */
 int get_relation_column_count(Relation rel);
 AttrNumber get_column_by_name(Relation rel, const char *colname);
 List *parse_column_list(Relation rel, const char *collist);
-bool is_partition_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum, Relation rel);
-bool is_clustering_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum, Relation rel);
+List *parse_clustering_key(Relation rel, const char *collist,
+                           List **descending);
+bool is_partition_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum);
+bool is_clustering_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum);
+bool is_cql_sort_compatible(Oid type, Oid collation);
 
 /*
  * FDW callback function prototypes (implemented in scylla_fdw_modify.c)
@@ -387,20 +876,37 @@ extern TupleTableSlot *scyllaExecForeignDelete(EState *estate,
                                                TupleTableSlot *planSlot);
 extern void scyllaEndForeignModify(EState *estate,
                                    ResultRelInfo *resultRelInfo);
+extern void scyllaBeginForeignInsert(ModifyTableState *mtstate,
+                                     ResultRelInfo *resultRelInfo);
+extern void scyllaEndForeignInsert(EState *estate,
+                                   ResultRelInfo *resultRelInfo);
+extern bool scyllaPlanDirectModify(PlannerInfo *root,
+                                   ModifyTable *plan,
+                                   Index resultRelation,
+                                   int subplan_index);
+extern void scyllaBeginDirectModify(ForeignScanState *node, int eflags);
+extern TupleTableSlot *scyllaIterateDirectModify(ForeignScanState *node);
+extern void scyllaEndDirectModify(ForeignScanState *node);
+extern int scyllaGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo);
+extern TupleTableSlot **scyllaExecForeignBatchInsert(EState *estate,
+                                                     ResultRelInfo *resultRelInfo,
+                                                     TupleTableSlot **slots,
+                                                     TupleTableSlot **planSlots,
+                                                     int *numSlots);
 extern void scyllaGetForeignJoinPaths(PlannerInfo *root,
                                       RelOptInfo *joinrel,
                                       RelOptInfo *outerrel,
                                       RelOptInfo *innerrel,
                                       JoinType jointype,
                                       JoinPathExtraData *extra);
-#if PG_VERSION_NUM < 180000
 extern void scyllaExplainForeignScan(ForeignScanState *node, ExplainState *es);
 extern void scyllaExplainForeignModify(ModifyTableState *mtstate,
                                        ResultRelInfo *rinfo,
                                        List *fdw_private,
                                        int subplan_index,
                                        ExplainState *es);
-#endif
+extern void scyllaExplainDirectModify(ForeignScanState *node,
+                                      ExplainState *es);
 extern bool scyllaAnalyzeForeignTable(Relation relation,
                                       AcquireSampleRowsFunc *func,
                                       BlockNumber *totalpages);
@@ -13,7 +13,12 @@
 #include "scylla_fdw.h"
 
 #include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "catalog/pg_am.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
 #include "optimizer/cost.h"
 #include "optimizer/optimizer.h"
 #include "utils/lsyscache.h"
@@ -30,18 +35,37 @@
 #endif
 
 /*
- * Default cost estimates for foreign table scans
+ * Cost of reading a row on the server without shipping it, as a fraction
+ * of fdw_tuple_cost.  ALLOW FILTERING scans pay it for every row of the
+ * table, on every node.
  */
-#define DEFAULT_FDW_STARTUP_COST    100.0
-#define DEFAULT_FDW_TUPLE_COST      0.01
-#define DEFAULT_FDW_SORT_MULTIPLIER 1.2
+#define SCYLLA_FILTER_COST_FRACTION 0.5
+
+static double count_pinned_partitions(RelOptInfo *baserel, List *conds,
+                                      List *pk_attrs);
+static bool is_partition_key_clause(RelOptInfo *baserel, Expr *clause,
+                                    List *pk_attrs);
 
 /*
  * estimate_path_cost_size
  *        Estimate the cost and result size of a foreign scan
  *
- * This is a simplified cost model. A more sophisticated implementation
- * would query ScyllaDB for actual statistics.
+ * join_conds are the join clauses a parameterized scan sends along with
+ * the relation's own remote conditions.  The cost follows the access
+ * pattern those conditions allow:
+ *
+ * - When they pin every partition key column, the scan reads each pinned
+ *   partition from a single replica, costed as one random page per
+ *   partition plus the rows fetched.  With clustering column conditions
+ *   this is a slice of the partition.
+ * - Otherwise, if there are remote conditions, CQL needs ALLOW FILTERING
+ *   and the whole table is read across the cluster, so every row pays a
+ *   server-side read cost whether it is returned or not.
+ * - A scan without conditions transfers the whole table.
+ *
+ * Each request pays fdw_startup_cost and each returned row fdw_tuple_cost.
+ * The table size comes from ANALYZE, or from system.size_estimates when
+ * use_remote_estimate is set, or falls back to 1000 rows.
  */
 void
 estimate_path_cost_size(PlannerInfo *root, RelOptInfo *baserel,
@@ -50,44 +74,67 @@ estimate_path_cost_size(PlannerInfo *root, RelOptInfo *baserel,
                         Cost *p_startup_cost, Cost *p_total_cost)
 {
     ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    List       *conds = list_concat_copy(fpinfo->remote_conds, join_conds);
     double      rows;
     int         width;
     Cost        startup_cost;
-    Cost        total_cost;
+    Cost        run_cost;
     Cost        cpu_per_tuple;
     double      selectivity;
     QualCost    qual_cost;
+    double      tuples;
     double      ntuples;
+    double      partitions;
 
     /*
-     * Estimate the number of rows. If we have restriction quals, apply
-     * selectivity estimates.
+     * Start from the row count ANALYZE stored in reltuples.  A remote
+     * estimate counts partitions, which is at least a lower bound on rows.
      */
-    if (fpinfo != NULL && fpinfo->remote_conds != NIL)
+    if (baserel->tuples >= 0)
+        tuples = baserel->tuples;
+    else if (fpinfo->remote_partitions >= 0)
+        tuples = fpinfo->remote_partitions;
+    else
+        tuples = 1000;
+
+    /* Rows the server returns */
+    partitions = count_pinned_partitions(baserel, conds, fpinfo->pk_attrs);
+    if (partitions > 0 && fpinfo->remote_partitions > 0)
     {
         /*
-         * Apply selectivity for remote conditions. For equality on partition
-         * key, this should be very selective. For other conditions, use
-         * default estimates.
+         * With a partition count from the server, a key lookup returns
+         * the average partition's rows, narrowed by the other conditions.
          */
-        selectivity = clauselist_selectivity(root,
-                                            fpinfo->remote_conds,
-                                            baserel->relid,
-                                            JOIN_INNER,
-                                            NULL);
-        ntuples = clamp_row_est(baserel->tuples * selectivity);
+        List       *other_conds = NIL;
+        ListCell   *lc;
+
+        foreach(lc, conds)
+        {
+            Expr       *clause = (Expr *) lfirst(lc);
+
+            if (IsA(clause, RestrictInfo))
+                clause = ((RestrictInfo *) clause)->clause;
+            if (!is_partition_key_clause(baserel, clause, fpinfo->pk_attrs))
+                other_conds = lappend(other_conds, lfirst(lc));
+        }
+
+        selectivity = clauselist_selectivity(root, other_conds,
+                                             baserel->relid, JOIN_INNER, NULL);
+        ntuples = clamp_row_est(partitions *
+                                Max(tuples / fpinfo->remote_partitions, 1.0) *
+                                selectivity);
     }
-    else
+    else if (conds != NIL)
     {
-        /*
-         * No remote conditions, so we'll scan the whole table.
-         * Use a default estimate if we don't have better info.
-         */
-        ntuples = (baserel->tuples > 0) ? baserel->tuples : 1000;
+        selectivity = clauselist_selectivity(root, conds,
+                                             baserel->relid, JOIN_INNER, NULL);
+        ntuples = clamp_row_est(tuples * selectivity);
     }
+    else
+        ntuples = clamp_row_est(tuples);
 
     /* Apply local conditions selectivity */
-    if (fpinfo != NULL && fpinfo->local_conds != NIL)
+    if (fpinfo->local_conds != NIL)
     {
         selectivity = clauselist_selectivity(root,
                                             fpinfo->local_conds,
@@ -106,31 +153,32 @@ estimate_path_cost_size(PlannerInfo *root, RelOptInfo *baserel,
     if (width <= 0)
         width = 100;  /* Default estimate */
 
-    /*
-     * Cost model:
-     * - Startup cost: Connection setup + query preparation
-     * - Per-tuple cost: Network transfer + local processing
-     */
-    startup_cost = DEFAULT_FDW_STARTUP_COST;
+    startup_cost = fpinfo->fdw_startup_cost;
+    run_cost = 0;
+
+    if (partitions > 0)
+    {
+        /* Single-replica reads of the pinned partitions */
+        run_cost += partitions * random_page_cost;
+    }
+    else if (conds != NIL)
+    {
+        /* ALLOW FILTERING: every row of the table is read somewhere */
+        run_cost += tuples * fpinfo->fdw_tuple_cost * SCYLLA_FILTER_COST_FRACTION;
+    }
 
-    /* Cost of network transfer depends on data volume */
-    cpu_per_tuple = cpu_tuple_cost + DEFAULT_FDW_TUPLE_COST;
+    /* Transfer and local processing of the returned rows */
+    cpu_per_tuple = cpu_tuple_cost + fpinfo->fdw_tuple_cost;
 
     /* Add cost of evaluating local conditions */
-    if (fpinfo != NULL && fpinfo->local_conds != NIL)
+    if (fpinfo->local_conds != NIL)
     {
         cost_qual_eval(&qual_cost, fpinfo->local_conds, root);
         cpu_per_tuple += qual_cost.per_tuple;
         startup_cost += qual_cost.startup;
     }
 
-    total_cost = startup_cost + cpu_per_tuple * ntuples;
-
-    /* Add additional cost if we need to fetch more data than we return */
-    if (ntuples > rows)
-    {
-        total_cost += (ntuples - rows) * cpu_tuple_cost * 0.5;
-    }
+    run_cost += cpu_per_tuple * ntuples;
 
     /* If sorted output is requested but we can't push down ORDER BY,
      * add an estimate for local sorting cost */
@@ -146,38 +194,345 @@ estimate_path_cost_size(PlannerInfo *root, RelOptInfo *baserel,
             sort_cost = 0.0;
         
         startup_cost += sort_cost;
-        total_cost += sort_cost;
     }
 
     *p_rows = rows;
     *p_width = width;
     *p_startup_cost = startup_cost;
-    *p_total_cost = total_cost;
+    *p_total_cost = startup_cost + run_cost;
+}
+
+/*
+ * count_pinned_partitions
+ *        Number of partitions conds restrict a scan to, or -1 if they do not
+ *        pin every partition key column
+ *
+ * A column compared with = pins one value, and one compared with IN as
+ * many values as the list has.
+ */
+static double
+count_pinned_partitions(RelOptInfo *baserel, List *conds, List *pk_attrs)
+{
+    double      partitions = 1;
+    ListCell   *lc;
+
+    if (pk_attrs == NIL)
+        return -1;
+
+    foreach(lc, pk_attrs)
+    {
+        AttrNumber  attnum = lfirst_int(lc);
+        double      values = -1;
+        ListCell   *lc2;
+
+        if (scylla_column_has_equality(baserel, conds, attnum, false))
+            continue;
+
+        foreach(lc2, conds)
+        {
+            Expr       *clause = (Expr *) lfirst(lc2);
+            ScalarArrayOpExpr *saop;
+            Expr       *arg;
+
+            if (IsA(clause, RestrictInfo))
+                clause = ((RestrictInfo *) clause)->clause;
+            if (!IsA(clause, ScalarArrayOpExpr))
+                continue;
+
+            saop = (ScalarArrayOpExpr *) clause;
+            arg = (Expr *) linitial(saop->args);
+            if (IsA(arg, RelabelType))
+                arg = ((RelabelType *) arg)->arg;
+            if (!saop->useOr || !IsA(arg, Var) ||
+                ((Var *) arg)->varattno != attnum)
+                continue;
+            if (IsA(lsecond(saop->args), Const) &&
+                !((Const *) lsecond(saop->args))->constisnull)
+            {
+                values = list_length(scylla_const_array_elements((Const *) lsecond(saop->args)));
+                break;
+            }
+            if (IsA(lsecond(saop->args), ArrayExpr))
+            {
+                values = list_length(((ArrayExpr *) lsecond(saop->args))->elements);
+                break;
+            }
+        }
+
+        if (values < 0)
+            return -1;
+        partitions *= values;
+    }
+
+    return partitions;
+}
+
+/*
+ * is_partition_key_clause
+ *        Check if a clause only pins a partition key column
+ */
+static bool
+is_partition_key_clause(RelOptInfo *baserel, Expr *clause, List *pk_attrs)
+{
+    ListCell   *lc;
+
+    foreach(lc, pk_attrs)
+    {
+        if (scylla_column_has_equality(baserel, list_make1(clause),
+                                       lfirst_int(lc), true))
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * scylla_estimate_partition_count
+ *        Estimate the number of partitions of the table from the
+ *        system.size_estimates table of the coordinator
+ *
+ * Each node only reports the token ranges it owns, so the partition counts
+ * are scaled up by the fraction of the ring those ranges cover.  Returns
+ * -1 if no estimate is available.
+ */
+double
+scylla_estimate_partition_count(void *conn, ScyllaFdwRelationInfo *fpinfo)
+{
+    void       *statement;
+    void       *result;
+    void       *iterator;
+    char       *error_msg = NULL;
+    double      partitions = 0;
+    double      covered = 0;
+
+    /* Names are bound rather than pasted, as they may contain quotes */
+    statement = scylla_create_query_statement(
+        "SELECT range_start, range_end, partitions_count "
+        "FROM system.size_estimates "
+        "WHERE keyspace_name = ? AND table_name = ?", 2);
+    scylla_bind_string(statement, 0, fpinfo->keyspace, strlen(fpinfo->keyspace));
+    scylla_bind_string(statement, 1, fpinfo->table, strlen(fpinfo->table));
+
+    result = scylla_execute_statement(conn, statement,
+                                      SCYLLA_CONSISTENCY_LOCAL_ONE,
+                                      &error_msg);
+    scylla_free_statement(statement);
+    if (result == NULL)
+    {
+        elog(DEBUG1, "scylla_fdw: could not read size estimates: %s",
+             error_msg ? error_msg : "unknown error");
+        return -1;
+    }
+
+    iterator = scylla_result_iterator(result);
+    while (iterator != NULL && scylla_iterator_next(iterator))
+    {
+        size_t      len;
+        bool        is_null;
+        const char *str;
+        int64       start;
+        int64       end;
+        int64       count;
+        uint64      width;
+
+        str = scylla_get_string(iterator, 0, &len, &is_null);
+        if (is_null)
+            continue;
+        start = strtoi64(pnstrdup(str, len), NULL, 10);
+
+        str = scylla_get_string(iterator, 1, &len, &is_null);
+        if (is_null)
+            continue;
+        end = strtoi64(pnstrdup(str, len), NULL, 10);
+
+        count = scylla_get_int64(iterator, 2, &is_null);
+        if (is_null)
+            continue;
+
+        /* Ranges are (start, end]; one with start == end is the whole ring */
+        width = (uint64) end - (uint64) start;
+        covered += (width == 0) ? 1.0 : (double) width / 18446744073709551616.0;
+        partitions += count;
+    }
+
+    if (iterator != NULL)
+        scylla_free_iterator(iterator);
+    scylla_free_result(result);
+
+    if (covered <= 0)
+        return -1;
+    return partitions / Min(covered, 1.0);
 }
 
 /*
  * scylla_get_useful_pathkeys
  *        Determine which pathkeys might be useful for ordering results
  *
- * ScyllaDB can provide sorted results on clustering columns, so we look
- * for pathkeys that match those columns.
+ * ScyllaDB returns the rows of a partition sorted by its clustering
+ * columns, and CQL's ORDER BY can reverse that order, but only for a query
+ * restricted to a single partition.  So the query's own pathkeys are worth
+ * a sorted path if the partition key is pinned with = and they map onto
+ * the clustering columns.
  */
 List *
 scylla_get_useful_pathkeys(PlannerInfo *root, RelOptInfo *baserel)
 {
     ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
-    List       *useful_pathkeys = NIL;
+    bool        reversed;
+    ListCell   *lc;
 
-    /*
-     * If we have clustering key info, we could potentially push down ORDER BY.
-     * For now, return empty list as this requires more complex implementation.
-     */
-    if (fpinfo == NULL || fpinfo->clustering_key == NULL)
+    if (fpinfo == NULL || fpinfo->pk_attrs == NIL || fpinfo->ck_attrs == NIL ||
+        root->query_pathkeys == NIL)
         return NIL;
 
-    /* Future enhancement: Parse clustering_key and create pathkeys */
+    foreach(lc, fpinfo->pk_attrs)
+    {
+        if (!scylla_column_has_equality(baserel, fpinfo->remote_conds,
+                                        lfirst_int(lc), false))
+            return NIL;
+    }
+
+    if (scylla_clustering_order(root, baserel, root->query_pathkeys,
+                                &reversed) == NIL)
+        return NIL;
 
-    return useful_pathkeys;
+    return root->query_pathkeys;
+}
+
+/*
+ * scylla_clustering_order
+ *        Map pathkeys onto a CQL ORDER BY over the clustering columns
+ *
+ * Each pathkey must sort a clustering column of baserel with its type's
+ * default btree order, in clustering_key order.  CQL can only return a
+ * partition in its stored clustering order or the exact reverse, so the
+ * pathkeys must either all match the directions declared in clustering_key
+ * or all be opposite to them.  Leading clustering columns pinned with = may
+ * be skipped by the pathkeys, but CQL wants them listed, so they are
+ * included.
+ *
+ * Returns the attribute numbers to order by and sets *reversed if the
+ * declared order is to be reversed, or returns NIL if the pathkeys can't be
+ * produced by ScyllaDB.
+ */
+List *
+scylla_clustering_order(PlannerInfo *root, RelOptInfo *baserel,
+                        List *pathkeys, bool *reversed)
+{
+    ScyllaFdwRelationInfo *fpinfo = (ScyllaFdwRelationInfo *) baserel->fdw_private;
+    List       *order_attrs = NIL;
+    int         ck = 0;
+    bool        first = true;
+    ListCell   *lc;
+
+    foreach(lc, pathkeys)
+    {
+        PathKey    *pathkey = (PathKey *) lfirst(lc);
+        EquivalenceClass *ec = pathkey->pk_eclass;
+        Var        *var = NULL;
+        bool        desc;
+        ListCell   *lc2;
+
+#if PG_VERSION_NUM >= 180000
+        if (pathkey->pk_cmptype != COMPARE_LT && pathkey->pk_cmptype != COMPARE_GT)
+            return NIL;
+        desc = (pathkey->pk_cmptype == COMPARE_GT);
+#else
+        if (pathkey->pk_strategy != BTLessStrategyNumber &&
+            pathkey->pk_strategy != BTGreaterStrategyNumber)
+            return NIL;
+        desc = (pathkey->pk_strategy == BTGreaterStrategyNumber);
+#endif
+
+        if (ec->ec_has_volatile)
+            return NIL;
+
+        /* Find the column of baserel this pathkey sorts by */
+        foreach(lc2, ec->ec_members)
+        {
+            EquivalenceMember *em = (EquivalenceMember *) lfirst(lc2);
+            Expr       *expr = em->em_expr;
+
+            if (IsA(expr, RelabelType))
+                expr = ((RelabelType *) expr)->arg;
+            if (IsA(expr, Var) && ((Var *) expr)->varno == baserel->relid &&
+                ((Var *) expr)->varlevelsup == 0)
+            {
+                var = (Var *) expr;
+                break;
+            }
+        }
+        if (var == NULL || !is_cql_sort_compatible(var->vartype, ec->ec_collation) ||
+            pathkey->pk_opfamily !=
+            get_opclass_family(GetDefaultOpClass(var->vartype, BTREE_AM_OID)))
+            return NIL;
+
+        /* Walk the clustering columns up to this one */
+        for (;;)
+        {
+            AttrNumber  attnum;
+
+            if (ck >= list_length(fpinfo->ck_attrs))
+                return NIL;
+            attnum = list_nth_int(fpinfo->ck_attrs, ck++);
+            order_attrs = lappend_int(order_attrs, attnum);
+            if (attnum == var->varattno)
+                break;
+            if (!scylla_column_has_equality(baserel, fpinfo->remote_conds,
+                                            attnum, false))
+                return NIL;
+        }
+
+        /* Check the direction against the declared one */
+        if (desc != (list_nth_int(fpinfo->ck_desc, ck - 1) != 0))
+        {
+            if (!first && !*reversed)
+                return NIL;
+            *reversed = true;
+        }
+        else
+        {
+            if (!first && *reversed)
+                return NIL;
+            *reversed = false;
+        }
+        first = false;
+    }
+
+    return order_attrs;
+}
+
+/*
+ * is_cql_sort_compatible
+ *        Check if ScyllaDB sorts values of a type the way PostgreSQL does
+ *
+ * Text is only compared bytewise by ScyllaDB, so it matches the "C"
+ * collation alone.  uuid is left out: CQL orders timeuuids by time.
+ */
+bool
+is_cql_sort_compatible(Oid type, Oid collation)
+{
+    switch (type)
+    {
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case NUMERICOID:
+        case DATEOID:
+        case TIMEOID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+            return true;
+
+        case TEXTOID:
+        case VARCHAROID:
+            return collation == C_COLLATION_OID;
+
+        default:
+            return false;
+    }
 }
 
 /*
@@ -229,6 +584,24 @@ apply_server_options(ScyllaFdwRelationInfo *fpinfo, ForeignServer *server)
             fpinfo->port = atoi(defGetString(def));
         else if (strcmp(def->defname, OPT_CONSISTENCY) == 0)
             fpinfo->consistency = defGetString(def);
+        else if (strcmp(def->defname, OPT_FETCH_SIZE) == 0)
+            fpinfo->fetch_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_PREFETCH_DEPTH) == 0)
+            fpinfo->prefetch_depth = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_LOOKUP_CONCURRENCY) == 0)
+            fpinfo->lookup_concurrency = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_RESCAN_CACHE_SIZE) == 0)
+            fpinfo->rescan_cache_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_USE_REMOTE_ESTIMATE) == 0)
+            fpinfo->use_remote_estimate = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_ASYNC_CAPABLE) == 0)
+            fpinfo->async_capable = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_DIRECT_MODIFY_IF_EXISTS) == 0)
+            fpinfo->direct_modify_if_exists = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_FDW_STARTUP_COST) == 0)
+            fpinfo->fdw_startup_cost = strtod(defGetString(def), NULL);
+        else if (strcmp(def->defname, OPT_FDW_TUPLE_COST) == 0)
+            fpinfo->fdw_tuple_cost = strtod(defGetString(def), NULL);
     }
 }
 
@@ -253,6 +626,20 @@ apply_table_options(ScyllaFdwRelationInfo *fpinfo, ForeignTable *table)
             fpinfo->primary_key = defGetString(def);
         else if (strcmp(def->defname, OPT_CLUSTERING_KEY) == 0)
             fpinfo->clustering_key = defGetString(def);
+        else if (strcmp(def->defname, OPT_FETCH_SIZE) == 0)
+            fpinfo->fetch_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_PREFETCH_DEPTH) == 0)
+            fpinfo->prefetch_depth = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_LOOKUP_CONCURRENCY) == 0)
+            fpinfo->lookup_concurrency = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_RESCAN_CACHE_SIZE) == 0)
+            fpinfo->rescan_cache_size = atoi(defGetString(def));
+        else if (strcmp(def->defname, OPT_USE_REMOTE_ESTIMATE) == 0)
+            fpinfo->use_remote_estimate = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_ASYNC_CAPABLE) == 0)
+            fpinfo->async_capable = defGetBoolean(def);
+        else if (strcmp(def->defname, OPT_DIRECT_MODIFY_IF_EXISTS) == 0)
+            fpinfo->direct_modify_if_exists = defGetBoolean(def);
     }
 }
 
@@ -270,6 +657,15 @@ merge_fdw_options(ScyllaFdwRelationInfo *fpinfo,
     fpinfo->host = DEFAULT_HOST;
     fpinfo->port = DEFAULT_PORT;
     fpinfo->consistency = DEFAULT_CONSISTENCY;
+    fpinfo->fetch_size = DEFAULT_FETCH_SIZE;
+    fpinfo->prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    fpinfo->lookup_concurrency = DEFAULT_LOOKUP_CONCURRENCY;
+    fpinfo->rescan_cache_size = DEFAULT_RESCAN_CACHE_SIZE;
+    fpinfo->use_remote_estimate = false;
+    fpinfo->async_capable = false;
+    fpinfo->direct_modify_if_exists = false;
+    fpinfo->fdw_startup_cost = DEFAULT_FDW_STARTUP_COST;
+    fpinfo->fdw_tuple_cost = DEFAULT_FDW_TUPLE_COST;
     fpinfo->keyspace = NULL;
     fpinfo->table = NULL;
     fpinfo->primary_key = NULL;
@@ -321,7 +717,26 @@ is_valid_option(const char *option, Oid context)
             strcmp(option, OPT_CONNECT_TIMEOUT) == 0 ||
             strcmp(option, OPT_REQUEST_TIMEOUT) == 0 ||
             strcmp(option, OPT_CONSISTENCY) == 0 ||
-            strcmp(option, OPT_PROTOCOL_VERSION) == 0)
+            strcmp(option, OPT_READ_CONSISTENCY) == 0 ||
+            strcmp(option, OPT_WRITE_CONSISTENCY) == 0 ||
+            strcmp(option, OPT_SERIAL_CONSISTENCY) == 0 ||
+            strcmp(option, OPT_PROTOCOL_VERSION) == 0 ||
+            strcmp(option, OPT_FETCH_SIZE) == 0 ||
+            strcmp(option, OPT_PREFETCH_DEPTH) == 0 ||
+            strcmp(option, OPT_BATCH_SIZE) == 0 ||
+            strcmp(option, OPT_MAX_INFLIGHT) == 0 ||
+            strcmp(option, OPT_LOOKUP_CONCURRENCY) == 0 ||
+            strcmp(option, OPT_RESCAN_CACHE_SIZE) == 0 ||
+            strcmp(option, OPT_USE_REMOTE_ESTIMATE) == 0 ||
+            strcmp(option, OPT_ASYNC_CAPABLE) == 0 ||
+            strcmp(option, OPT_DIRECT_MODIFY_IF_EXISTS) == 0 ||
+            strcmp(option, OPT_FDW_STARTUP_COST) == 0 ||
+            strcmp(option, OPT_FDW_TUPLE_COST) == 0 ||
+            strcmp(option, OPT_LOCAL_DC) == 0 ||
+            strcmp(option, OPT_TOKEN_AWARE) == 0 ||
+            strcmp(option, OPT_LATENCY_AWARE_ROUTING) == 0 ||
+            strcmp(option, OPT_CORE_CONNECTIONS_PER_HOST) == 0 ||
+            strcmp(option, OPT_NUM_IO_THREADS) == 0)
             return true;
     }
 
@@ -339,7 +754,21 @@ is_valid_option(const char *option, Oid context)
         if (strcmp(option, OPT_KEYSPACE) == 0 ||
             strcmp(option, OPT_TABLE) == 0 ||
             strcmp(option, OPT_PRIMARY_KEY) == 0 ||
-            strcmp(option, OPT_CLUSTERING_KEY) == 0)
+            strcmp(option, OPT_CLUSTERING_KEY) == 0 ||
+            strcmp(option, OPT_TTL) == 0 ||
+            strcmp(option, OPT_WRITE_TIMESTAMP) == 0 ||
+            strcmp(option, OPT_FETCH_SIZE) == 0 ||
+            strcmp(option, OPT_PREFETCH_DEPTH) == 0 ||
+            strcmp(option, OPT_BATCH_SIZE) == 0 ||
+            strcmp(option, OPT_MAX_INFLIGHT) == 0 ||
+            strcmp(option, OPT_LOOKUP_CONCURRENCY) == 0 ||
+            strcmp(option, OPT_RESCAN_CACHE_SIZE) == 0 ||
+            strcmp(option, OPT_USE_REMOTE_ESTIMATE) == 0 ||
+            strcmp(option, OPT_ASYNC_CAPABLE) == 0 ||
+            strcmp(option, OPT_DIRECT_MODIFY_IF_EXISTS) == 0 ||
+            strcmp(option, OPT_READ_CONSISTENCY) == 0 ||
+            strcmp(option, OPT_WRITE_CONSISTENCY) == 0 ||
+            strcmp(option, OPT_SERIAL_CONSISTENCY) == 0)
             return true;
     }
 
@@ -391,9 +820,25 @@ get_column_by_name(Relation rel, const char *colname)
 /*
  * parse_column_list
  *        Parse a comma-separated list of column names into attribute numbers
+ *
+ * A name may be followed by ASC or DESC, as in a clustering_key option;
+ * the direction is ignored here, see parse_clustering_key.
  */
 List *
 parse_column_list(Relation rel, const char *collist)
+{
+    return parse_clustering_key(rel, collist, NULL);
+}
+
+/*
+ * parse_clustering_key
+ *        Parse a clustering_key option into attribute numbers
+ *
+ * If descending isn't NULL, it is set to an integer list with 1 for each
+ * column declared DESC and 0 for the others.
+ */
+List *
+parse_clustering_key(Relation rel, const char *collist, List **descending)
 {
     List       *result = NIL;
     char       *str;
@@ -401,6 +846,9 @@ parse_column_list(Relation rel, const char *collist)
     char       *saveptr;
     char       *end;
 
+    if (descending != NULL)
+        *descending = NIL;
+
     if (collist == NULL || collist[0] == '\0')
         return NIL;
 
@@ -411,6 +859,8 @@ parse_column_list(Relation rel, const char *collist)
          token = strtok_r(NULL, ",", &saveptr))
     {
         AttrNumber  attnum;
+        char       *dir;
+        bool        desc = false;
 
         /* Trim whitespace */
         while (*token == ' ' || *token == '\t')
@@ -419,9 +869,27 @@ parse_column_list(Relation rel, const char *collist)
         while (end > token && (*end == ' ' || *end == '\t'))
             *end-- = '\0';
 
+        /* Strip the direction, if any */
+        dir = strrchr(token, ' ');
+        if (dir == NULL)
+            dir = strrchr(token, '\t');
+        if (dir != NULL &&
+            (pg_strcasecmp(dir + 1, "asc") == 0 ||
+             pg_strcasecmp(dir + 1, "desc") == 0))
+        {
+            desc = (pg_strcasecmp(dir + 1, "desc") == 0);
+            end = dir;
+            while (end > token && (*end == ' ' || *end == '\t'))
+                *end-- = '\0';
+        }
+
         attnum = get_column_by_name(rel, token);
         if (attnum != InvalidAttrNumber)
+        {
             result = lappend_int(result, attnum);
+            if (descending != NULL)
+                *descending = lappend_int(*descending, desc ? 1 : 0);
+        }
     }
 
     pfree(str);
@@ -433,45 +901,209 @@ parse_column_list(Relation rel, const char *collist)
  *        Check if a column is part of the partition key
  */
 bool
-is_partition_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum, Relation rel)
+is_partition_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum)
 {
-    List       *pk_cols;
-    ListCell   *lc;
+    return list_member_int(fpinfo->pk_attrs, attnum);
+}
+
+/*
+ * is_clustering_key_column
+ *        Check if a column is part of the clustering key
+ */
+bool
+is_clustering_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum)
+{
+    return list_member_int(fpinfo->ck_attrs, attnum);
+}
+
+/*
+ * scylla_stats_init
+ *        Start collecting remote activity statistics on conn
+ */
+void
+scylla_stats_init(ScyllaRemoteStats *stats, void *conn, Oid serverid,
+                  bool enabled)
+{
+    int64_t     speculative;
+    int64_t     timeouts;
 
-    if (fpinfo->primary_key == NULL)
-        return false;
+    memset(stats, 0, sizeof(ScyllaRemoteStats));
+    stats->enabled = enabled;
+    stats->shared = scylla_shared_stats_active();
+    stats->serverid = serverid;
 
-    pk_cols = parse_column_list(rel, fpinfo->primary_key);
-    
-    foreach(lc, pk_cols)
+    if (enabled)
     {
-        if (lfirst_int(lc) == attnum)
-            return true;
+        scylla_session_counters(conn, &speculative, &timeouts);
+        stats->speculative_base = speculative;
+        stats->timeouts_base = timeouts;
     }
+}
 
-    return false;
+/*
+ * scylla_stats_get_result
+ *        scylla_future_get_result, counting the request in stats
+ *
+ * sent is when the request was sent, or NULL if its time is unknown.  The
+ * time measured reaches until we take up the result, which may be later
+ * than its arrival when requests are pipelined.  The bytes received are
+ * counted by the scan as it decodes the values, see decode_page.
+ */
+void *
+scylla_stats_get_result(ScyllaRemoteStats *stats, void *conn, void *future,
+                        instr_time *sent, char **error_msg)
+{
+    void       *result;
+    bool        timed = (stats->enabled || stats->shared) && sent != NULL;
+    instr_time  elapsed;
+
+    /* Stop the clock when the response is in, before asking for more */
+    if (timed)
+    {
+        scylla_future_wait(future);
+        INSTR_TIME_SET_CURRENT(elapsed);
+        INSTR_TIME_SUBTRACT(elapsed, *sent);
+    }
+
+    /* A request of its own, sent once per scan or modification */
+    if (stats->enabled && stats->coordinator[0] == '\0')
+        scylla_future_coordinator(conn, future, stats->coordinator,
+                                  sizeof(stats->coordinator));
+
+    /* This frees the future */
+    result = scylla_future_get_result(future, error_msg);
+
+    stats->requests++;
+    if (result != NULL)
+        stats->rows += scylla_result_row_count(result);
+    else if (stats->shared)
+        scylla_shared_stats_count(stats->serverid, SCYLLA_STATS_ERROR);
+
+    if (timed)
+    {
+        double      ms = INSTR_TIME_GET_MILLISEC(elapsed);
+
+        stats->total_time += ms;
+        stats->max_time = Max(stats->max_time, ms);
+        stats->latency[scylla_latency_bucket(ms)]++;
+    }
+
+    return result;
 }
 
 /*
- * is_clustering_key_column
- *        Check if a column is part of the clustering key
+ * scylla_stats_explain
+ *        Show remote activity under EXPLAIN (ANALYZE, VERBOSE)
+ *
+ * Rows and conversion time only apply to scans.  The statistics of
+ * parallel workers are not included.
  */
-bool
-is_clustering_key_column(ScyllaFdwRelationInfo *fpinfo, AttrNumber attnum, Relation rel)
+void
+scylla_stats_explain(ScyllaRemoteStats *stats, void *conn, bool scan,
+                     ExplainState *es)
 {
-    List       *ck_cols;
-    ListCell   *lc;
+    int64_t     speculative;
+    int64_t     timeouts;
 
-    if (fpinfo->clustering_key == NULL)
-        return false;
+    if (!es->analyze || !es->verbose || !stats->enabled)
+        return;
 
-    ck_cols = parse_column_list(rel, fpinfo->clustering_key);
-    
-    foreach(lc, ck_cols)
+    ExplainPropertyInteger("Remote Requests", NULL, stats->requests, es);
+    if (scan)
     {
-        if (lfirst_int(lc) == attnum)
-            return true;
+        ExplainPropertyInteger("Remote Rows", NULL, stats->rows, es);
+        ExplainPropertyInteger("Remote Bytes", "bytes", stats->bytes, es);
     }
+    ExplainPropertyFloat("Remote Request Time", "ms", stats->total_time, 3, es);
+    ExplainPropertyFloat("Remote Max Request Time", "ms", stats->max_time, 3, es);
+    if (scan)
+        ExplainPropertyFloat("Conversion Time", "ms", stats->convert_time, 3, es);
+    if (stats->coordinator[0] != '\0')
+        ExplainPropertyText("Coordinator", stats->coordinator, es);
 
-    return false;
+    if (conn != NULL)
+    {
+        scylla_session_counters(conn, &speculative, &timeouts);
+        ExplainPropertyInteger("Speculative Executions", NULL,
+                               speculative - stats->speculative_base, es);
+        ExplainPropertyInteger("Request Timeouts", NULL,
+                               timeouts - stats->timeouts_base, es);
+    }
+}
+
+/*
+ * find_option_value
+ *        Get the value of an option from a list of DefElems, or NULL
+ */
+const char *
+find_option_value(List *options, const char *optname)
+{
+    const char *value = NULL;
+    ListCell   *lc;
+
+    foreach(lc, options)
+    {
+        DefElem    *def = (DefElem *) lfirst(lc);
+
+        if (strcmp(def->defname, optname) == 0)
+            value = defGetString(def);
+    }
+
+    return value;
+}
+
+/*
+ * resolve_consistency
+ *        Pick a consistency level from the settings that apply to a table
+ *
+ * A non-empty setting wins; then option, the table's or server's value as
+ * cached by scylla_get_table_meta.
+ */
+static int
+resolve_consistency(const char *option, const char *setting,
+                    int default_value)
+{
+    if (setting != NULL && setting[0] != '\0')
+        return scylla_string_to_consistency(setting);
+
+    return option != NULL ? scylla_string_to_consistency(option) : default_value;
+}
+
+/*
+ * scylla_get_read_consistency
+ *        Consistency level for reads from a foreign table
+ */
+int
+scylla_get_read_consistency(Oid relid)
+{
+    return resolve_consistency(scylla_get_table_meta(relid)->read_consistency,
+                               scylla_read_consistency,
+                               SCYLLA_CONSISTENCY_LOCAL_QUORUM);
+}
+
+/*
+ * scylla_get_write_consistency
+ *        Consistency level for writes to a foreign table
+ */
+int
+scylla_get_write_consistency(Oid relid)
+{
+    return resolve_consistency(scylla_get_table_meta(relid)->write_consistency,
+                               scylla_write_consistency,
+                               SCYLLA_CONSISTENCY_LOCAL_QUORUM);
+}
+
+/*
+ * scylla_get_serial_consistency
+ *        Serial consistency level for conditional writes to a foreign table
+ *
+ * It only matters to lightweight transactions, whose Paxos round runs at
+ * this level; the commit that follows uses the write consistency.
+ */
+int
+scylla_get_serial_consistency(Oid relid)
+{
+    return resolve_consistency(scylla_get_table_meta(relid)->serial_consistency,
+                               scylla_serial_consistency,
+                               SCYLLA_CONSISTENCY_SERIAL);
 }
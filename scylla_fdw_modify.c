@@ -12,14 +12,113 @@
  */
 #include "scylla_fdw.h"
 
+#include <math.h>
+
 #include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "access/table.h"
 #include "catalog/pg_type.h"
+#include "commands/trigger.h"
+#include "commands/vacuum.h"
+#include "common/hashfn.h"
 #include "executor/executor.h"
 #include "nodes/makefuncs.h"
 #include "optimizer/optimizer.h"
 #include "parser/parsetree.h"
+#include "utils/datum.h"
+#include "utils/sampling.h"
+
+/* CQL limits the number of statements in a single batch */
+#define SCYLLA_MAX_BATCH_STATEMENTS 65535
+
+/*
+ * ANALYZE splits the token ring into at most this many slices, and reads
+ * at least the smaller of the slice count and SCYLLA_ANALYZE_MIN_SLICES.
+ */
+#define SCYLLA_ANALYZE_MAX_SLICES   1024
+#define SCYLLA_ANALYZE_MIN_SLICES   32
+
+/*
+ * IMPORT FOREIGN SCHEMA ... LIMIT TO asks for at most this many tables per
+ * metadata query, ScyllaDB's default max_clustering_key_restrictions_per_query
+ */
+#define SCYLLA_IMPORT_MAX_TABLES    100
+
+/*
+ * Rows of a batched INSERT whose partition keys hash alike, see
+ * send_insert_rows
+ */
+typedef struct ScyllaPartitionGroup
+{
+    uint32      hash;           /* hash key, must be first */
+    int         first_group;    /* chained through group_next */
+} ScyllaPartitionGroup;
+
+/*
+ * A column of a table being imported
+ */
+typedef struct ScyllaImportColumn
+{
+    char       *name;
+    char       *cql_type;       /* type name from system_schema.columns */
+    int         kind;           /* 0 partition key, 1 clustering, 2 other */
+    int         position;       /* within the partition or clustering key */
+    bool        descending;     /* clustering column stored in DESC order */
+} ScyllaImportColumn;
+
+static void create_foreign_modify(ModifyTableState *mtstate,
+                                  ResultRelInfo *resultRelInfo,
+                                  CmdType operation, char *query,
+                                  List *target_attrs, bool conditional,
+                                  bool bulk);
+static void send_insert_rows(ScyllaFdwModifyState *fmstate,
+                             TupleTableSlot **slots, int nrows);
+static void flush_bulk_rows(ScyllaFdwModifyState *fmstate);
+static int get_int_modify_option(Relation rel, const char *optname,
+                                 int default_value);
+static const char *operation_name(CmdType operation);
+static int *get_pk_attrs(Relation rel, CmdType operation, int *num_pk_attrs);
+static bool submit_write(ScyllaFdwModifyState *fmstate, void *statement);
+static bool result_applied(void *result);
+static void track_inflight(ScyllaFdwModifyState *fmstate, void *future,
+                           instr_time *sent);
+static void wait_oldest_inflight(ScyllaFdwModifyState *fmstate);
+static void drain_inflight(ScyllaFdwModifyState *fmstate);
+static void discard_inflight(void *arg);
+static char *take_error_msg(char *error_msg);
+static void *create_insert_statement(ScyllaFdwModifyState *fmstate,
+                                     TupleTableSlot *slot);
+static bool same_partition_key(ScyllaFdwModifyState *fmstate,
+                               TupleTableSlot *a, TupleTableSlot *b);
+static int scylla_acquire_sample_rows(Relation relation, int elevel,
+                                      HeapTuple *rows, int targrows,
+                                      double *totalrows,
+                                      double *totaldeadrows);
+static ForeignScan *find_modifytable_subplan(PlannerInfo *root,
+                                             ModifyTable *plan,
+                                             Index rtindex,
+                                             int subplan_index);
+static bool import_table_wanted(ImportForeignSchemaStmt *stmt,
+                                const char *table);
+static int import_column_cmp(const void *a, const void *b);
+static char *import_table_command(ForeignServer *server, const char *keyspace,
+                                  const char *table,
+                                  ScyllaImportColumn *columns, int ncolumns);
+static const char *cql_type_to_pg_type(const char *cql_type);
+
+/*
+ * Indexes of FDW-private information stored in the fdw_private list of a
+ * directly modifying ForeignScan.
+ */
+enum FdwDirectModifyPrivateIndex
+{
+    /* CQL UPDATE/DELETE command (as a String node) */
+    FdwDirectModifyPrivateUpdateSql,
+    /* Whether to count the row in es_processed (as an Integer node) */
+    FdwDirectModifyPrivateSetProcessed,
+    /* Whether the command is an LWT reporting [applied] (as an Integer node) */
+    FdwDirectModifyPrivateConditional
+};
 
 /*
  * scyllaAddForeignUpdateTargets
@@ -31,86 +130,44 @@ scyllaAddForeignUpdateTargets(PlannerInfo *root,
                               RangeTblEntry *target_rte,
                               Relation target_relation)
 {
-    Oid         relid = RelationGetRelid(target_relation);
     TupleDesc   tupdesc = RelationGetDescr(target_relation);
-    ForeignTable *table;
+    ScyllaTableMeta *meta;
+    List       *pk_cols;
     ListCell   *lc;
-    char       *pk_str = NULL;
-    List       *pk_cols = NIL;
-    char       *str;
-    char       *token;
-    char       *saveptr;
-    char       *end;
-    int         i;
 
-    table = GetForeignTable(relid);
-
-    /* Get the primary_key option */
-    foreach(lc, table->options)
-    {
-        DefElem *def = (DefElem *) lfirst(lc);
-        if (strcmp(def->defname, OPT_PRIMARY_KEY) == 0)
-        {
-            pk_str = defGetString(def);
-            break;
-        }
-    }
+    meta = scylla_get_table_meta(RelationGetRelid(target_relation));
 
-    if (pk_str == NULL)
+    if (meta->options->primary_key == NULL)
     {
         ereport(ERROR,
                 (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
                  errmsg("primary_key option must be specified for UPDATE/DELETE operations")));
     }
 
-    /* Parse primary key columns (comma-separated) */
-    str = pstrdup(pk_str);
-
-    for (token = strtok_r(str, ",", &saveptr);
-         token != NULL;
-         token = strtok_r(NULL, ",", &saveptr))
-    {
-        /* Trim whitespace */
-        while (*token == ' ') token++;
-        end = token + strlen(token) - 1;
-        while (end > token && *end == ' ') *end-- = '\0';
-
-        pk_cols = lappend(pk_cols, makeString(pstrdup(token)));
-    }
+    if (!meta->pk_complete)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_COLUMN_NAME_NOT_FOUND),
+                 errmsg("primary_key option of foreign table \"%s\" names a column that does not exist",
+                        RelationGetRelationName(target_relation))));
 
     /* Add each primary key column as a junk attribute */
+    pk_cols = list_copy(meta->options->pk_attrs);
     foreach(lc, pk_cols)
     {
-        char       *colname = strVal(lfirst(lc));
-        int         attnum = 0;
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, lfirst_int(lc) - 1);
         Var        *var;
 
-        /* Find the attribute number */
-        for (i = 0; i < tupdesc->natts; i++)
-        {
-            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-            if (strcmp(NameStr(attr->attname), colname) == 0)
-            {
-                attnum = i + 1;
-                break;
-            }
-        }
-
-        if (attnum == 0)
-            ereport(ERROR,
-                    (errcode(ERRCODE_FDW_COLUMN_NAME_NOT_FOUND),
-                     errmsg("primary key column \"%s\" not found", colname)));
-
         /* Make a Var representing the column */
         var = makeVar(rtindex,
-                      attnum,
-                      TupleDescAttr(tupdesc, attnum - 1)->atttypid,
-                      TupleDescAttr(tupdesc, attnum - 1)->atttypmod,
-                      TupleDescAttr(tupdesc, attnum - 1)->attcollation,
+                      lfirst_int(lc),
+                      attr->atttypid,
+                      attr->atttypmod,
+                      attr->attcollation,
                       0);
 
         /* Add it as a resjunk entry */
-        add_row_identity_var(root, var, rtindex, pstrdup(colname));
+        add_row_identity_var(root, var, rtindex,
+                             pstrdup(NameStr(attr->attname)));
     }
 }
 
@@ -131,17 +188,11 @@ scyllaPlanForeignModify(PlannerInfo *root,
     StringInfoData sql;
     TupleDesc   tupdesc;
     int         attnum;
-    char       *pk_str = NULL;
     ListCell   *lc;
-    ForeignTable *table;
     int        *pk_attrs;
     int         num_pk_attrs;
-    char       *str;
-    char       *token;
-    char       *saveptr;
-    char       *end;
     char       *query;
-    int         idx;
+    bool        if_not_exists = false;
     int         i;
 
     elog(DEBUG1, "scylla_fdw: planning %s operation for relation %u",
@@ -152,6 +203,17 @@ scyllaPlanForeignModify(PlannerInfo *root,
 
     initStringInfo(&sql);
 
+    /*
+     * ON CONFLICT DO NOTHING becomes INSERT ... IF NOT EXISTS.  Without a
+     * unique index there is nothing to infer a DO UPDATE from, so the
+     * parser never lets that through to us.
+     */
+    if (plan->onConflictAction == ONCONFLICT_NOTHING)
+        if_not_exists = true;
+    else if (plan->onConflictAction != ONCONFLICT_NONE)
+        elog(ERROR, "unexpected ON CONFLICT specification: %d",
+             (int) plan->onConflictAction);
+
     /* Open the relation to get column info */
     rel = table_open(rte->relid, NoLock);
     tupdesc = RelationGetDescr(rel);
@@ -241,57 +303,13 @@ scyllaPlanForeignModify(PlannerInfo *root,
     switch (operation)
     {
         case CMD_INSERT:
-            query = scylla_build_insert_query(rel, targetAttrs);
+            query = scylla_build_insert_query(rel, targetAttrs, if_not_exists);
             appendStringInfoString(&sql, query);
             pfree(query);
             break;
 
         case CMD_UPDATE:
-            table = GetForeignTable(rte->relid);
-
-            /* Get primary key columns */
-            foreach(lc, table->options)
-            {
-                DefElem *def = (DefElem *) lfirst(lc);
-                if (strcmp(def->defname, OPT_PRIMARY_KEY) == 0)
-                {
-                    pk_str = defGetString(def);
-                    break;
-                }
-            }
-
-            if (pk_str == NULL)
-                ereport(ERROR,
-                        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-                         errmsg("primary_key option required for UPDATE")));
-
-            /* Parse and convert to attribute numbers */
-            num_pk_attrs = 1;
-            for (str = pk_str; *str; str++)
-                if (*str == ',') num_pk_attrs++;
-
-            pk_attrs = (int *) palloc(num_pk_attrs * sizeof(int));
-            str = pstrdup(pk_str);
-            idx = 0;
-            for (token = strtok_r(str, ",", &saveptr);
-                 token != NULL;
-                 token = strtok_r(NULL, ",", &saveptr))
-            {
-                while (*token == ' ') token++;
-                end = token + strlen(token) - 1;
-                while (end > token && *end == ' ') *end-- = '\0';
-
-                for (i = 0; i < tupdesc->natts; i++)
-                {
-                    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-                    if (strcmp(NameStr(attr->attname), token) == 0)
-                    {
-                        pk_attrs[idx++] = i + 1;
-                        break;
-                    }
-                }
-            }
-            num_pk_attrs = idx;
+            pk_attrs = get_pk_attrs(rel, operation, &num_pk_attrs);
 
             query = scylla_build_update_query(rel, targetAttrs, pk_attrs, num_pk_attrs);
             appendStringInfoString(&sql, query);
@@ -332,52 +350,7 @@ scyllaPlanForeignModify(PlannerInfo *root,
             break;
 
         case CMD_DELETE:
-            table = GetForeignTable(rte->relid);
-
-            /* Get primary key columns */
-            pk_str = NULL;
-            foreach(lc, table->options)
-            {
-                DefElem *def = (DefElem *) lfirst(lc);
-                if (strcmp(def->defname, OPT_PRIMARY_KEY) == 0)
-                {
-                    pk_str = defGetString(def);
-                    break;
-                }
-            }
-
-            if (pk_str == NULL)
-                ereport(ERROR,
-                        (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-                         errmsg("primary_key option required for DELETE")));
-
-            /* Parse and convert to attribute numbers */
-            num_pk_attrs = 1;
-            for (str = pk_str; *str; str++)
-                if (*str == ',') num_pk_attrs++;
-
-            pk_attrs = (int *) palloc(num_pk_attrs * sizeof(int));
-            str = pstrdup(pk_str);
-            idx = 0;
-            for (token = strtok_r(str, ",", &saveptr);
-                 token != NULL;
-                 token = strtok_r(NULL, ",", &saveptr))
-            {
-                while (*token == ' ') token++;
-                end = token + strlen(token) - 1;
-                while (end > token && *end == ' ') *end-- = '\0';
-
-                for (i = 0; i < tupdesc->natts; i++)
-                {
-                    Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-                    if (strcmp(NameStr(attr->attname), token) == 0)
-                    {
-                        pk_attrs[idx++] = i + 1;
-                        break;
-                    }
-                }
-            }
-            num_pk_attrs = idx;
+            pk_attrs = get_pk_attrs(rel, operation, &num_pk_attrs);
 
             query = scylla_build_delete_query(rel, pk_attrs, num_pk_attrs);
             appendStringInfoString(&sql, query);
@@ -407,8 +380,10 @@ scyllaPlanForeignModify(PlannerInfo *root,
      * Items:
      *  1) CQL command string
      *  2) Target attribute list
+     *  3) Whether the command is conditional (IF NOT EXISTS)
      */
-    return list_make2(makeString(sql.data), targetAttrs);
+    return list_make3(makeString(sql.data), targetAttrs,
+                      makeInteger(if_not_exists));
 }
 
 /*
@@ -421,6 +396,31 @@ scyllaBeginForeignModify(ModifyTableState *mtstate,
                          List *fdw_private,
                          int subplan_index,
                          int eflags)
+{
+    /* Do nothing for EXPLAIN without ANALYZE */
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+        return;
+
+    create_foreign_modify(mtstate, resultRelInfo, mtstate->operation,
+                          strVal(list_nth(fdw_private, 0)),
+                          (List *) list_nth(fdw_private, 1),
+                          intVal(list_nth(fdw_private, 2)) != 0, false);
+}
+
+/*
+ * create_foreign_modify
+ *        Set up the modify state of a result relation
+ *
+ * bulk is set for COPY, which gets larger defaults for batch_size and
+ * max_inflight and reports failed writes together at the end.
+ * conditional is set for INSERT ... IF NOT EXISTS, whose rows are sent one
+ * at a time because each one needs its own [applied] answer.
+ */
+static void
+create_foreign_modify(ModifyTableState *mtstate,
+                      ResultRelInfo *resultRelInfo,
+                      CmdType operation, char *query,
+                      List *target_attrs, bool conditional, bool bulk)
 {
     ScyllaFdwModifyState *fmstate;
     Relation    rel = resultRelInfo->ri_RelationDesc;
@@ -428,28 +428,16 @@ scyllaBeginForeignModify(ModifyTableState *mtstate,
     ForeignTable *table;
     ForeignServer *server;
     UserMapping *user;
-    char       *error_msg = NULL;
     ListCell   *lc;
-    char       *host = DEFAULT_HOST;
-    int         port = DEFAULT_PORT;
-    char       *username = NULL;
-    char       *password = NULL;
-    int         connect_timeout = DEFAULT_CONNECT_TIMEOUT;
-    bool        use_ssl = false;
-    char       *ssl_cert = NULL;
-    char       *ssl_key = NULL;
-    char       *ssl_ca = NULL;
-
-    /* Do nothing for EXPLAIN without ANALYZE */
-    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-        return;
 
     /* Allocate and initialize modify state */
     fmstate = (ScyllaFdwModifyState *) palloc0(sizeof(ScyllaFdwModifyState));
     resultRelInfo->ri_FdwState = fmstate;
     
     /* Set operation early so it can be used in log messages */
-    fmstate->operation = mtstate->operation;
+    fmstate->operation = operation;
+    fmstate->bulk = bulk;
+    fmstate->conditional = conditional;
 
     /* Get the user ID for connection */
     userid = GetUserId();
@@ -458,55 +446,19 @@ scyllaBeginForeignModify(ModifyTableState *mtstate,
     server = GetForeignServer(table->serverid);
     user = GetUserMapping(userid, server->serverid);
 
-    /* Extract connection options */
-    foreach(lc, server->options)
-    {
-        DefElem *def = (DefElem *) lfirst(lc);
-        if (strcmp(def->defname, OPT_HOST) == 0)
-            host = defGetString(def);
-        else if (strcmp(def->defname, OPT_PORT) == 0)
-            port = atoi(defGetString(def));
-        else if (strcmp(def->defname, OPT_CONNECT_TIMEOUT) == 0)
-            connect_timeout = atoi(defGetString(def));
-        else if (strcmp(def->defname, OPT_SSL) == 0)
-            use_ssl = defGetBoolean(def);
-        else if (strcmp(def->defname, OPT_SSL_CERT) == 0)
-            ssl_cert = defGetString(def);
-        else if (strcmp(def->defname, OPT_SSL_KEY) == 0)
-            ssl_key = defGetString(def);
-        else if (strcmp(def->defname, OPT_SSL_CA) == 0)
-            ssl_ca = defGetString(def);
-    }
-
-    foreach(lc, user->options)
-    {
-        DefElem *def = (DefElem *) lfirst(lc);
-        if (strcmp(def->defname, OPT_USERNAME) == 0)
-            username = defGetString(def);
-        else if (strcmp(def->defname, OPT_PASSWORD) == 0)
-            password = defGetString(def);
-    }
-
-    /* Connect to ScyllaDB */
-    elog(DEBUG1, "scylla_fdw: connecting to ScyllaDB at %s:%d for %s operation",
-         host, port,
+    /* Get a (possibly cached) session for this server and user */
+    elog(DEBUG1, "scylla_fdw: acquiring ScyllaDB connection for %s operation",
          fmstate->operation == CMD_INSERT ? "INSERT" :
          fmstate->operation == CMD_UPDATE ? "UPDATE" :
          fmstate->operation == CMD_DELETE ? "DELETE" : "UNKNOWN");
-    fmstate->conn = scylla_connect(host, port, username, password,
-                                   connect_timeout, use_ssl,
-                                   ssl_cert, ssl_key, ssl_ca,
-                                   &error_msg);
-    if (fmstate->conn == NULL)
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-                 errmsg("could not connect to ScyllaDB: %s",
-                        error_msg ? error_msg : "unknown error")));
-    elog(DEBUG1, "scylla_fdw: successfully connected to ScyllaDB");
+    fmstate->conn = scylla_get_connection(server, user, true);
+    scylla_stats_init(&fmstate->stats, fmstate->conn, server->serverid,
+                      mtstate->ps.instrument != NULL);
+    fmstate->consistency = scylla_get_write_consistency(RelationGetRelid(rel));
+    fmstate->serial_consistency = scylla_get_serial_consistency(RelationGetRelid(rel));
 
-    /* Get the CQL command from fdw_private */
-    fmstate->query = strVal(list_nth(fdw_private, 0));
-    fmstate->target_attrs = (List *) list_nth(fdw_private, 1);
+    fmstate->query = query;
+    fmstate->target_attrs = target_attrs;
 
     ereport(NOTICE,
             (errmsg("scylla_fdw: preparing remote %s statement",
@@ -515,13 +467,9 @@ scyllaBeginForeignModify(ModifyTableState *mtstate,
                     fmstate->operation == CMD_DELETE ? "DELETE" : "UNKNOWN"),
              errdetail("%s", fmstate->query)));
 
-    /* Prepare the statement */
-    fmstate->prepared = scylla_prepare_query(fmstate->conn, fmstate->query, &error_msg);
-    if (fmstate->prepared == NULL)
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("could not prepare ScyllaDB statement: %s",
-                        error_msg ? error_msg : "unknown error")));
+    /* Prepare the statement, or reuse the one cached with the session */
+    fmstate->prepared = scylla_get_prepared(fmstate->conn, RelationGetRelid(rel),
+                                            fmstate->query);
 
     /* Store additional state */
     fmstate->rel = rel;
@@ -532,585 +480,2023 @@ scyllaBeginForeignModify(ModifyTableState *mtstate,
     if (fmstate->operation == CMD_UPDATE || fmstate->operation == CMD_DELETE)
     {
         Plan       *subplan = outerPlanState(mtstate)->plan;
-        char       *pk_str = NULL;
-        char       *str;
-        char       *token;
-        char       *saveptr;
-        char       *end;
-        int         num_pk;
-        int         idx;
-        
-        /* Get primary key column names */
-        foreach(lc, table->options)
-        {
-            DefElem *def = (DefElem *) lfirst(lc);
-            if (strcmp(def->defname, OPT_PRIMARY_KEY) == 0)
-            {
-                pk_str = defGetString(def);
-                break;
-            }
-        }
-        
-        if (pk_str == NULL)
+        ScyllaTableMeta *meta = scylla_get_table_meta(RelationGetRelid(rel));
+        int         idx = 0;
+
+        if (meta->options->primary_key == NULL)
             ereport(ERROR,
                     (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
                      errmsg("primary_key option required for UPDATE/DELETE")));
-        
-        /* Count PK columns */
-        num_pk = 1;
-        for (str = pk_str; *str; str++)
-            if (*str == ',') num_pk++;
-        
+
         /* Allocate array for junk attribute numbers */
-        fmstate->junk_att_nums = (AttrNumber *) palloc(num_pk * sizeof(AttrNumber));
-        fmstate->num_pk_attrs = num_pk;
-        
+        fmstate->junk_att_nums = (AttrNumber *)
+            palloc(Max(list_length(meta->options->pk_attrs), 1) *
+                   sizeof(AttrNumber));
+
         /* Find junk attribute number for each PK column */
-        str = pstrdup(pk_str);
-        idx = 0;
-        for (token = strtok_r(str, ",", &saveptr);
-             token != NULL;
-             token = strtok_r(NULL, ",", &saveptr))
+        foreach(lc, meta->options->pk_attrs)
         {
-            AttrNumber attnum;
-            
-            /* Trim whitespace */
-            while (*token == ' ') token++;
-            end = token + strlen(token) - 1;
-            while (end > token && *end == ' ') *end-- = '\0';
-            
-            /* Find junk attribute in targetlist */
-            attnum = ExecFindJunkAttributeInTlist(subplan->targetlist, token);
+            Form_pg_attribute attr = TupleDescAttr(fmstate->tupdesc,
+                                                   lfirst_int(lc) - 1);
+            AttrNumber  attnum;
+
+            attnum = ExecFindJunkAttributeInTlist(subplan->targetlist,
+                                                  NameStr(attr->attname));
             if (!AttributeNumberIsValid(attnum))
                 ereport(ERROR,
                         (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
-                         errmsg("primary key column \"%s\" not found in junk attributes", token)));
-            
+                         errmsg("primary key column \"%s\" not found in junk attributes",
+                                NameStr(attr->attname))));
+
             fmstate->junk_att_nums[idx++] = attnum;
         }
-        pfree(str);
+        fmstate->num_pk_attrs = idx;
     }
     else
     {
+        List       *pk_cols;
+        int         idx = 0;
+
         fmstate->junk_att_nums = NULL;
         fmstate->num_pk_attrs = 0;
+
+        /*
+         * Batched inserts group rows by partition key so that each CQL batch
+         * goes to a single replica set.  Without a primary_key option all
+         * rows of a batch simply share one multi-partition batch.
+         */
+        pk_cols = scylla_get_table_meta(RelationGetRelid(rel))->options->pk_attrs;
+        if (pk_cols != NIL)
+        {
+            fmstate->pk_attrs = (AttrNumber *) palloc(list_length(pk_cols) *
+                                                      sizeof(AttrNumber));
+            foreach(lc, pk_cols)
+                fmstate->pk_attrs[idx++] = lfirst_int(lc);
+            fmstate->num_pk_attrs = idx;
+        }
     }
+
+    fmstate->batch_size = (fmstate->operation == CMD_INSERT && !conditional) ?
+        get_int_modify_option(rel, OPT_BATCH_SIZE,
+                              bulk ? DEFAULT_COPY_BATCH_SIZE : DEFAULT_BATCH_SIZE) : 1;
+
+    /* Set up the window of pipelined writes */
+    fmstate->max_inflight = conditional ? 1 :
+        get_int_modify_option(rel, OPT_MAX_INFLIGHT,
+                              bulk ? DEFAULT_COPY_MAX_INFLIGHT :
+                              DEFAULT_MAX_INFLIGHT);
+    fmstate->inflight = (void **) palloc(fmstate->max_inflight * sizeof(void *));
+    fmstate->inflight_sent = (instr_time *) palloc(fmstate->max_inflight *
+                                                   sizeof(instr_time));
+    fmstate->inflight_head = 0;
+    fmstate->num_inflight = 0;
+
+    /*
+     * An error anywhere in the query skips scyllaEndForeignModify, so the
+     * futures still in the window are freed with the executor's memory.
+     */
+    fmstate->inflight_cb.func = discard_inflight;
+    fmstate->inflight_cb.arg = fmstate;
+    MemoryContextRegisterResetCallback(GetMemoryChunkContext(fmstate),
+                                       &fmstate->inflight_cb);
 }
 
 /*
- * scyllaExecForeignInsert
- *        Insert one row into a foreign table
+ * scyllaBeginForeignInsert
+ *        Begin inserting rows routed to a foreign table, or loaded by COPY
+ *
+ * Every column is written, with the table's ttl and write_timestamp
+ * options, through one prepared INSERT.  When COPY hands rows over one at
+ * a time (before PostgreSQL 16 it always does), ExecForeignInsert
+ * buffers them and sends them batch_size at a time, grouped by partition
+ * like ExecForeignBatchInsert does.
  */
-TupleTableSlot *
-scyllaExecForeignInsert(EState *estate,
-                        ResultRelInfo *resultRelInfo,
-                        TupleTableSlot *slot,
-                        TupleTableSlot *planSlot)
+void
+scyllaBeginForeignInsert(ModifyTableState *mtstate,
+                         ResultRelInfo *resultRelInfo)
 {
-    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
-    void       *statement;
-    char       *error_msg = NULL;
-    ListCell   *lc;
-    int         pindex = 0;
-
-    elog(DEBUG1, "scylla_fdw: executing INSERT");
+    Relation    rel = resultRelInfo->ri_RelationDesc;
+    TupleDesc   tupdesc = RelationGetDescr(rel);
+    ScyllaFdwModifyState *fmstate;
+    List       *target_attrs = NIL;
+    bool        if_not_exists = false;
+    bool        bulk;
+    int         i;
 
-    /* Create a statement from the prepared query */
-    statement = scylla_create_statement(fmstate->prepared);
-    if (statement == NULL)
+    /*
+     * The tuple routing of an UPDATE can target a foreign partition that
+     * is itself being updated; its result relation then already has an
+     * UPDATE state, which we can't replace.
+     */
+    if (resultRelInfo->ri_FdwState != NULL)
         ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("could not create ScyllaDB statement")));
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("cannot route tuples into foreign table to be updated \"%s\"",
+                        RelationGetRelationName(rel))));
 
-    /* Bind parameters from the slot */
-    foreach(lc, fmstate->target_attrs)
+    for (i = 0; i < tupdesc->natts; i++)
     {
-        int         attnum = lfirst_int(lc);
-        Datum       value;
-        bool        isnull;
+        if (!TupleDescAttr(tupdesc, i)->attisdropped)
+            target_attrs = lappend_int(target_attrs, i + 1);
+    }
 
-        value = slot_getattr(slot, attnum, &isnull);
-        scylla_convert_from_pg(value, TupleDescAttr(fmstate->tupdesc, attnum - 1)->atttypid,
-                               statement, pindex, isnull);
-        pindex++;
+    /* COPY runs a ModifyTableState without a plan */
+    bulk = (mtstate->ps.plan == NULL);
+
+    /* A routed INSERT ... ON CONFLICT DO NOTHING, see PlanForeignModify */
+    if (!bulk)
+    {
+        ModifyTable *plan = castNode(ModifyTable, mtstate->ps.plan);
+
+        if (plan->onConflictAction == ONCONFLICT_NOTHING)
+            if_not_exists = true;
+        else if (plan->onConflictAction != ONCONFLICT_NONE)
+            elog(ERROR, "unexpected ON CONFLICT specification: %d",
+                 (int) plan->onConflictAction);
     }
 
-    /* Execute the statement */
-    if (scylla_execute_prepared(fmstate->conn, fmstate->prepared, 
-                                &statement, 1,
-                                SCYLLA_CONSISTENCY_LOCAL_QUORUM, &error_msg) == NULL)
+    create_foreign_modify(mtstate, resultRelInfo, CMD_INSERT,
+                          scylla_build_insert_query(rel, target_attrs,
+                                                    if_not_exists),
+                          target_attrs, if_not_exists, bulk);
+    fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+
+    if (bulk)
     {
-        scylla_free_statement(statement);
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("ScyllaDB INSERT failed: %s",
-                        error_msg ? error_msg : "unknown error")));
+        fmstate->bulk_capacity = scyllaGetForeignModifyBatchSize(resultRelInfo);
+        if (fmstate->bulk_capacity > 1)
+        {
+            fmstate->bulk_slots = (TupleTableSlot **)
+                palloc(fmstate->bulk_capacity * sizeof(TupleTableSlot *));
+            for (i = 0; i < fmstate->bulk_capacity; i++)
+                fmstate->bulk_slots[i] =
+                    MakeSingleTupleTableSlot(tupdesc, &TTSOpsMinimalTuple);
+        }
     }
+}
 
-    scylla_free_statement(statement);
+/*
+ * scyllaEndForeignInsert
+ *        Finish inserting rows started by scyllaBeginForeignInsert
+ */
+void
+scyllaEndForeignInsert(EState *estate, ResultRelInfo *resultRelInfo)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+    int         i;
 
-    return slot;
+    if (fmstate == NULL)
+        return;
+
+    scyllaEndForeignModify(estate, resultRelInfo);
+
+    for (i = 0; fmstate->bulk_slots != NULL && i < fmstate->bulk_capacity; i++)
+        ExecDropSingleTupleTableSlot(fmstate->bulk_slots[i]);
 }
 
 /*
- * scyllaExecForeignUpdate
- *        Update one row in a foreign table
+ * scyllaExecForeignInsert
+ *        Insert one row into a foreign table
  */
 TupleTableSlot *
-scyllaExecForeignUpdate(EState *estate,
+scyllaExecForeignInsert(EState *estate,
                         ResultRelInfo *resultRelInfo,
                         TupleTableSlot *slot,
                         TupleTableSlot *planSlot)
 {
     ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
     void       *statement;
-    char       *error_msg = NULL;
-    TupleDesc   tupdesc = fmstate->tupdesc;
-    int         num_non_pk;
-    int         i;
-    int         pindex = 0;
-
-    elog(DEBUG1, "scylla_fdw: executing UPDATE");
-
-    /* Create a statement from the prepared query */
-    statement = scylla_create_statement(fmstate->prepared);
-    if (statement == NULL)
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("could not create ScyllaDB statement")));
 
-    /* 
-     * Bind parameters: non-PK columns from slot (new values),
-     * then PK columns from planSlot (junk attributes for WHERE clause)
-     */
-    num_non_pk = list_length(fmstate->target_attrs) - fmstate->num_pk_attrs;
-    
-    /* Bind non-PK columns (SET clause) from slot */
-    for (i = 0; i < num_non_pk; i++)
-    {
-        int attnum = list_nth_int(fmstate->target_attrs, i);
-        Datum value;
-        bool isnull;
-        
-        value = slot_getattr(slot, attnum, &isnull);
-        scylla_convert_from_pg(value, TupleDescAttr(tupdesc, attnum - 1)->atttypid,
-                               statement, pindex, isnull);
-        pindex++;
-    }
-    
-    /* Bind PK columns (WHERE clause) from planSlot junk attributes */
-    for (i = 0; i < fmstate->num_pk_attrs; i++)
+    /* COPY: collect the row, and send a batch once we have enough */
+    if (fmstate->bulk_slots != NULL)
     {
-        Datum value;
-        bool isnull;
-        int attnum;
-        
-        /* Get value from junk attribute in planSlot */
-        value = ExecGetJunkAttribute(planSlot, fmstate->junk_att_nums[i], &isnull);
-        
-        /* Get the actual attribute number to determine the type */
-        attnum = list_nth_int(fmstate->target_attrs, num_non_pk + i);
-        
-        scylla_convert_from_pg(value, TupleDescAttr(tupdesc, attnum - 1)->atttypid,
-                               statement, pindex, isnull);
-        pindex++;
+        ExecCopySlot(fmstate->bulk_slots[fmstate->num_bulk_slots++], slot);
+        if (fmstate->num_bulk_slots == fmstate->bulk_capacity)
+            flush_bulk_rows(fmstate);
+        return slot;
     }
 
-    /* Execute the statement */
-    if (scylla_execute_prepared(fmstate->conn, fmstate->prepared,
-                                &statement, 1,
-                                SCYLLA_CONSISTENCY_LOCAL_QUORUM, &error_msg) == NULL)
-    {
-        scylla_free_statement(statement);
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("ScyllaDB UPDATE failed: %s",
-                        error_msg ? error_msg : "unknown error")));
-    }
+    /* Create a statement from the prepared query and bind the row */
+    statement = create_insert_statement(fmstate, slot);
 
-    scylla_free_statement(statement);
+    /*
+     * Send the statement; wait for it unless writes are pipelined.  A row
+     * that IF NOT EXISTS did not write is not counted as inserted.
+     */
+    if (!submit_write(fmstate, statement))
+        return NULL;
 
     return slot;
 }
 
 /*
- * scyllaExecForeignDelete
- *        Delete one row from a foreign table
+ * scyllaGetForeignModifyBatchSize
+ *        Report the maximum number of rows to pass to ExecForeignBatchInsert
  */
-TupleTableSlot *
-scyllaExecForeignDelete(EState *estate,
-                        ResultRelInfo *resultRelInfo,
-                        TupleTableSlot *slot,
-                        TupleTableSlot *planSlot)
+int
+scyllaGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
 {
     ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
-    void       *statement;
-    char       *error_msg = NULL;
-    TupleDesc   tupdesc = fmstate->tupdesc;
+    int         batch_size;
+
+    /* During EXPLAIN there is no modify state, so consult the options */
+    if (fmstate)
+        batch_size = fmstate->batch_size;
+    else
+        batch_size = get_int_modify_option(resultRelInfo->ri_RelationDesc,
+                                           OPT_BATCH_SIZE, DEFAULT_BATCH_SIZE);
+
+    /*
+     * Disable batching when rows must be processed one at a time: with
+     * RETURNING, row-level INSERT triggers, WITH CHECK OPTION constraints
+     * from parent views, or ON CONFLICT DO NOTHING.
+     */
+    if ((fmstate && fmstate->conditional) ||
+        resultRelInfo->ri_projectReturning != NULL ||
+        resultRelInfo->ri_WithCheckOptions != NIL ||
+        (resultRelInfo->ri_TrigDesc &&
+         (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
+          resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
+        return 1;
+
+    return Min(batch_size, SCYLLA_MAX_BATCH_STATEMENTS);
+}
+
+/*
+ * scyllaExecForeignBatchInsert
+ *        Insert multiple rows into a foreign table
+ *
+ * Rows are grouped by partition key, and each group is sent as one
+ * UNLOGGED batch so that the coordinator forwards it to a single replica
+ * set instead of fanning out.  A group with a single row is sent as a
+ * plain statement.  All groups are in flight concurrently, and we only
+ * wait once every request has been sent.
+ */
+TupleTableSlot **
+scyllaExecForeignBatchInsert(EState *estate,
+                             ResultRelInfo *resultRelInfo,
+                             TupleTableSlot **slots,
+                             TupleTableSlot **planSlots,
+                             int *numSlots)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+
+    send_insert_rows(fmstate, slots, *numSlots);
+
+    return slots;
+}
+
+/*
+ * send_insert_rows
+ *        Send rows to ScyllaDB grouped by partition, see
+ *        scyllaExecForeignBatchInsert
+ */
+static void
+send_insert_rows(ScyllaFdwModifyState *fmstate, TupleTableSlot **slots,
+                 int nrows)
+{
+    int        *row_group;      /* group of each row */
+    int        *group_first;    /* first row of each group */
+    int        *group_rows;     /* number of rows in each group */
+    int        *group_next;     /* next group with the same key hash, or -1 */
+    HTAB       *groups;
+    HASHCTL     ctl;
+    void      **statements;
+    void      **batches;
+    void      **futures;
+    int         ngroups = 0;
+    char       *failure = NULL;
+    instr_time  sent;
+    int         i;
+    int         g;
+
+    elog(DEBUG2, "scylla_fdw: executing batch INSERT of %d rows", nrows);
+
+    row_group = (int *) palloc(nrows * sizeof(int));
+    group_first = (int *) palloc(nrows * sizeof(int));
+    group_rows = (int *) palloc(nrows * sizeof(int));
+    group_next = (int *) palloc(nrows * sizeof(int));
+
+    /* Maps the hash of a partition key to its chain of groups */
+    ctl.keysize = sizeof(uint32);
+    ctl.entrysize = sizeof(ScyllaPartitionGroup);
+    ctl.hcxt = CurrentMemoryContext;
+    groups = hash_create("scylla_fdw batch partitions", nrows, &ctl,
+                         HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+    /* Assign each row to the group of its partition */
+    for (i = 0; i < nrows; i++)
+    {
+        ScyllaPartitionGroup *entry;
+        uint32      hash = 0;
+        bool        found;
+        int         k;
+
+        for (k = 0; k < fmstate->num_pk_attrs; k++)
+        {
+            AttrNumber  attnum = fmstate->pk_attrs[k];
+            Form_pg_attribute attr = TupleDescAttr(fmstate->tupdesc, attnum - 1);
+            Datum       value;
+            bool        isnull;
+
+            value = slot_getattr(slots[i], attnum, &isnull);
+            hash = hash_combine(hash, isnull ? 0 :
+                                datum_image_hash(value, attr->attbyval,
+                                                 attr->attlen));
+        }
+
+        entry = (ScyllaPartitionGroup *) hash_search(groups, &hash,
+                                                     HASH_ENTER, &found);
+        g = -1;
+        if (found)
+        {
+            /* Distinct keys may share a hash */
+            for (g = entry->first_group; g >= 0; g = group_next[g])
+            {
+                if (same_partition_key(fmstate, slots[group_first[g]], slots[i]))
+                    break;
+            }
+        }
+
+        if (g < 0)
+        {
+            g = ngroups++;
+            group_first[g] = i;
+            group_rows[g] = 0;
+            group_next[g] = found ? entry->first_group : -1;
+            entry->first_group = g;
+        }
+
+        row_group[i] = g;
+        group_rows[g]++;
+    }
+
+    hash_destroy(groups);
+
+    elog(DEBUG2, "scylla_fdw: batch INSERT spans %d partition(s)", ngroups);
+
+    statements = (void **) palloc0(ngroups * sizeof(void *));
+    batches = (void **) palloc0(ngroups * sizeof(void *));
+    futures = (void **) palloc0(ngroups * sizeof(void *));
+
+    /*
+     * Bind every row and add it to the batch of its partition.  Nothing is
+     * sent until all rows are bound, so an error here leaves no request
+     * behind.
+     */
+    for (i = 0; i < nrows; i++)
+    {
+        void       *statement = create_insert_statement(fmstate, slots[i]);
+
+        g = row_group[i];
+        if (group_rows[g] == 1)
+        {
+            statements[g] = statement;
+            continue;
+        }
+
+        if (batches[g] == NULL)
+        {
+            batches[g] = scylla_create_batch(false);
+            scylla_batch_set_idempotent(batches[g], true);
+            scylla_batch_set_serial_consistency(batches[g],
+                                                fmstate->serial_consistency);
+        }
+        if (!scylla_batch_add_statement(batches[g], statement))
+        {
+            scylla_free_statement(statement);
+            for (g = 0; g < ngroups; g++)
+            {
+                scylla_free_statement(statements[g]);
+                scylla_free_batch(batches[g]);
+            }
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("could not add statement to ScyllaDB batch")));
+        }
+        scylla_free_statement(statement);
+    }
+
+    /* Send the single rows and the multi-row batches */
+    INSTR_TIME_SET_CURRENT(sent);
+    for (g = 0; g < ngroups; g++)
+    {
+        if (statements[g] != NULL)
+        {
+            futures[g] = scylla_execute_statement_async(fmstate->conn,
+                                                        statements[g],
+                                                        fmstate->consistency);
+            scylla_free_statement(statements[g]);
+        }
+        else
+        {
+            futures[g] = scylla_execute_batch_async(fmstate->conn, batches[g],
+                                                    fmstate->consistency);
+            scylla_free_batch(batches[g]);
+        }
+    }
+
+    /*
+     * With pipelining, leave the requests in the in-flight window; they are
+     * reaped as the window fills up or at the end of the statement.  Making
+     * room can raise the error of an earlier write, and then the requests
+     * not yet in the window are freed here.
+     */
+    if (fmstate->max_inflight > 1)
+    {
+        volatile int ntracked = 0;
+
+        PG_TRY();
+        {
+            for (; ntracked < ngroups; ntracked++)
+                track_inflight(fmstate, futures[ntracked], &sent);
+        }
+        PG_CATCH();
+        {
+            for (g = ntracked; g < ngroups; g++)
+                scylla_free_future(futures[g]);
+            PG_RE_THROW();
+        }
+        PG_END_TRY();
+        ngroups = 0;
+    }
+
+    /* Otherwise wait for all of them, then report the first failure */
+    for (g = 0; g < ngroups; g++)
+    {
+        char       *error_msg = NULL;
+        void       *result = scylla_stats_get_result(&fmstate->stats,
+                                                     fmstate->conn, futures[g],
+                                                     &sent, &error_msg);
+
+        if (result == NULL)
+        {
+            if (failure == NULL)
+                failure = take_error_msg(error_msg);
+            else
+                free(error_msg);
+        }
+        else
+            scylla_free_result(result);
+    }
+
+    if (failure != NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("ScyllaDB batch INSERT failed: %s", failure)));
+
+    pfree(row_group);
+    pfree(group_first);
+    pfree(group_rows);
+    pfree(group_next);
+    pfree(statements);
+    pfree(batches);
+    pfree(futures);
+}
+
+/*
+ * flush_bulk_rows
+ *        Send the rows COPY has buffered
+ */
+static void
+flush_bulk_rows(ScyllaFdwModifyState *fmstate)
+{
+    int         i;
+
+    if (fmstate->num_bulk_slots == 0)
+        return;
+
+    send_insert_rows(fmstate, fmstate->bulk_slots, fmstate->num_bulk_slots);
+
+    for (i = 0; i < fmstate->num_bulk_slots; i++)
+        ExecClearTuple(fmstate->bulk_slots[i]);
+    fmstate->num_bulk_slots = 0;
+}
+
+/*
+ * scyllaExecForeignUpdate
+ *        Update one row in a foreign table
+ */
+TupleTableSlot *
+scyllaExecForeignUpdate(EState *estate,
+                        ResultRelInfo *resultRelInfo,
+                        TupleTableSlot *slot,
+                        TupleTableSlot *planSlot)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+    void       *statement;
+    TupleDesc   tupdesc = fmstate->tupdesc;
+    int         num_non_pk;
+    int         i;
+    int         pindex = 0;
+
+    elog(DEBUG1, "scylla_fdw: executing UPDATE");
+
+    /* Create a statement from the prepared query */
+    statement = scylla_create_statement(fmstate->prepared);
+    if (statement == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not create ScyllaDB statement")));
+    scylla_statement_set_idempotent(statement, true);
+    scylla_statement_set_serial_consistency(statement, fmstate->serial_consistency);
+
+    /* 
+     * Bind parameters: non-PK columns from slot (new values),
+     * then PK columns from planSlot (junk attributes for WHERE clause)
+     */
+    num_non_pk = list_length(fmstate->target_attrs) - fmstate->num_pk_attrs;
+    
+    /* Bind non-PK columns (SET clause) from slot */
+    for (i = 0; i < num_non_pk; i++)
+    {
+        int attnum = list_nth_int(fmstate->target_attrs, i);
+        Datum value;
+        bool isnull;
+        
+        value = slot_getattr(slot, attnum, &isnull);
+        scylla_convert_from_pg(value, TupleDescAttr(tupdesc, attnum - 1)->atttypid,
+                               statement, pindex, isnull);
+        pindex++;
+    }
+    
+    /* Bind PK columns (WHERE clause) from planSlot junk attributes */
+    for (i = 0; i < fmstate->num_pk_attrs; i++)
+    {
+        Datum value;
+        bool isnull;
+        int attnum;
+        
+        /* Get value from junk attribute in planSlot */
+        value = ExecGetJunkAttribute(planSlot, fmstate->junk_att_nums[i], &isnull);
+        
+        /* Get the actual attribute number to determine the type */
+        attnum = list_nth_int(fmstate->target_attrs, num_non_pk + i);
+        
+        scylla_convert_from_pg(value, TupleDescAttr(tupdesc, attnum - 1)->atttypid,
+                               statement, pindex, isnull);
+        pindex++;
+    }
+
+    /* Send the statement; wait for it unless writes are pipelined */
+    submit_write(fmstate, statement);
+
+    return slot;
+}
+
+/*
+ * scyllaExecForeignDelete
+ *        Delete one row from a foreign table
+ */
+TupleTableSlot *
+scyllaExecForeignDelete(EState *estate,
+                        ResultRelInfo *resultRelInfo,
+                        TupleTableSlot *slot,
+                        TupleTableSlot *planSlot)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+    void       *statement;
+    TupleDesc   tupdesc = fmstate->tupdesc;
+    int         i;
+    int         pindex = 0;
+
+    elog(DEBUG1, "scylla_fdw: executing DELETE");
+
+    /* Create a statement from the prepared query */
+    statement = scylla_create_statement(fmstate->prepared);
+    if (statement == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not create ScyllaDB statement")));
+    scylla_statement_set_idempotent(statement, true);
+    scylla_statement_set_serial_consistency(statement, fmstate->serial_consistency);
+
+    /* Bind primary key values from planSlot junk attributes */
+    for (i = 0; i < fmstate->num_pk_attrs; i++)
+    {
+        Datum value;
+        bool isnull;
+        int attnum;
+        
+        /* Get value from junk attribute in planSlot */
+        value = ExecGetJunkAttribute(planSlot, fmstate->junk_att_nums[i], &isnull);
+        
+        /* Get the actual attribute number to determine the type */
+        attnum = list_nth_int(fmstate->target_attrs, i);
+        
+        scylla_convert_from_pg(value, TupleDescAttr(tupdesc, attnum - 1)->atttypid,
+                               statement, pindex, isnull);
+        pindex++;
+    }
+
+    /* Send the statement; wait for it unless writes are pipelined */
+    submit_write(fmstate, statement);
+
+    return slot;
+}
+
+/*
+ * scyllaEndForeignModify
+ *        End a foreign modification operation
+ */
+void
+scyllaEndForeignModify(EState *estate,
+                       ResultRelInfo *resultRelInfo)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+
+    if (fmstate == NULL)
+        return;
+
+    elog(DEBUG1, "scylla_fdw: ending foreign modify operation");
+
+    /* Send what COPY buffered, then wait for it and surface errors */
+    flush_bulk_rows(fmstate);
+    drain_inflight(fmstate);
+    scylla_shared_stats_report(&fmstate->stats);
+
+    /* Return the session, and with it the prepared statement, to the cache */
+    if (fmstate->conn != NULL)
+        scylla_release_connection(fmstate->conn);
+}
+
+/*
+ * scyllaPlanDirectModify
+ *        Consider sending an UPDATE/DELETE to ScyllaDB as a single command
+ *
+ * This is possible when the conditions pin every partition and clustering
+ * key column with =, so the statement touches exactly one CQL row and
+ * needs no read first.  Any other conditions must compare regular columns
+ * with constants; they become the IF clause of a lightweight transaction,
+ * which checks them and writes in one Paxos round.  Without such
+ * conditions the command is a plain UPDATE or DELETE, unless
+ * direct_modify_if_exists asks for IF EXISTS (see deparse_lwt_conds).
+ * For UPDATE, every new value must be a constant and no key
+ * column may be assigned, because CQL can neither compute values from
+ * columns nor change a row's key.
+ */
+bool
+scyllaPlanDirectModify(PlannerInfo *root,
+                       ModifyTable *plan,
+                       Index resultRelation,
+                       int subplan_index)
+{
+    CmdType     operation = plan->operation;
+    RelOptInfo *foreignrel;
+    ScyllaFdwRelationInfo *fpinfo;
+    ForeignScan *fscan;
+    List       *remote_exprs;
+    List       *key_exprs;
+    List       *if_exprs;
+    List       *processed_tlist = NIL;
+    List       *targetAttrs = NIL;
+    char       *sql;
+    bool        ok = true;
+
+    /* The table modification must be an UPDATE or DELETE */
+    if (operation != CMD_UPDATE && operation != CMD_DELETE)
+        return false;
+
+    /* Try to locate the ForeignScan subplan that's scanning resultRelation */
+    fscan = find_modifytable_subplan(root, plan, resultRelation, subplan_index);
+    if (!fscan)
+        return false;
+
+    /* Quals that must be evaluated locally rule out a direct modification */
+    if (fscan->scan.plan.qual != NIL)
+        return false;
+
+    /* CQL UPDATE/DELETE cannot return rows */
+    if (plan->returningLists != NIL)
+        return false;
+
+    foreignrel = root->simple_rel_array[resultRelation];
+    fpinfo = (ScyllaFdwRelationInfo *) foreignrel->fdw_private;
+
+    remote_exprs = extract_actual_clauses(fpinfo->remote_conds, false);
+
+    if (!scylla_split_lwt_conds(foreignrel, fpinfo, remote_exprs,
+                                &key_exprs, &if_exprs) ||
+        !scylla_conds_pin_primary_key(root, foreignrel, fpinfo, key_exprs))
+        ok = false;
+
+    if (ok && operation == CMD_UPDATE)
+    {
+        ListCell   *lc,
+                   *lc2;
+
+        get_translated_update_targetlist(root, resultRelation,
+                                         &processed_tlist, &targetAttrs);
+        forboth(lc, processed_tlist, lc2, targetAttrs)
+        {
+            TargetEntry *tle = lfirst_node(TargetEntry, lc);
+            AttrNumber  attno = lfirst_int(lc2);
+            Expr       *expr = tle->expr;
+
+            /* update's new-value expressions shouldn't be resjunk */
+            Assert(!tle->resjunk);
+
+            if (attno <= InvalidAttrNumber) /* shouldn't happen */
+                elog(ERROR, "system-column update is not supported");
+
+            if (is_partition_key_column(fpinfo, attno) ||
+                is_clustering_key_column(fpinfo, attno))
+            {
+                ok = false;
+                break;
+            }
+
+            while (IsA(expr, RelabelType))
+                expr = ((RelabelType *) expr)->arg;
+            if (!IsA(expr, Const) ||
+                !scylla_is_foreign_expr(root, foreignrel, tle->expr))
+            {
+                ok = false;
+                break;
+            }
+        }
+
+        if (targetAttrs == NIL)
+            ok = false;
+    }
+
+    if (!ok)
+        return false;
+
+    if (operation == CMD_UPDATE)
+        sql = scylla_build_direct_update_query(root, foreignrel, fpinfo,
+                                               targetAttrs, processed_tlist,
+                                               key_exprs, if_exprs);
+    else
+        sql = scylla_build_direct_delete_query(root, foreignrel, fpinfo,
+                                               key_exprs, if_exprs);
+
+    elog(DEBUG1, "scylla_fdw: direct %s: %s",
+         operation_name(operation), sql);
+
+    /* Update the operation and target relation info */
+    fscan->operation = operation;
+    fscan->resultRelation = resultRelation;
+
+    /*
+     * Update the fdw_private list that will be available to the executor.
+     * Items in the list must match enum FdwDirectModifyPrivateIndex, above.
+     */
+    fscan->fdw_private = list_make3(makeString(sql),
+                                    makeInteger(plan->canSetTag),
+                                    makeInteger(if_exprs != NIL ||
+                                                fpinfo->direct_modify_if_exists));
+
+    /* Direct modifications are never run asynchronously */
+    fscan->scan.plan.async_capable = false;
+
+    return true;
+}
+
+/*
+ * scyllaBeginDirectModify
+ *        Prepare to execute a direct modification
+ */
+void
+scyllaBeginDirectModify(ForeignScanState *node, int eflags)
+{
+    ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+    ScyllaFdwDirectModifyState *dmstate;
+    Relation    rel;
+    ForeignTable *table;
+    ForeignServer *server;
+    UserMapping *user;
+
+    /* Do nothing for EXPLAIN without ANALYZE */
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+        return;
+
+    dmstate = (ScyllaFdwDirectModifyState *) palloc0(sizeof(ScyllaFdwDirectModifyState));
+    node->fdw_state = (void *) dmstate;
+
+    rel = node->resultRelInfo->ri_RelationDesc;
+    table = GetForeignTable(RelationGetRelid(rel));
+    server = GetForeignServer(table->serverid);
+    user = GetUserMapping(GetUserId(), server->serverid);
+
+    /* Get a (possibly cached) session for this server and user */
+    dmstate->conn = scylla_get_connection(server, user, false);
+    dmstate->consistency = scylla_get_write_consistency(RelationGetRelid(rel));
+    dmstate->serial_consistency = scylla_get_serial_consistency(RelationGetRelid(rel));
+
+    dmstate->query = strVal(list_nth(fsplan->fdw_private,
+                                     FdwDirectModifyPrivateUpdateSql));
+    dmstate->set_processed = intVal(list_nth(fsplan->fdw_private,
+                                             FdwDirectModifyPrivateSetProcessed)) != 0;
+    dmstate->conditional = intVal(list_nth(fsplan->fdw_private,
+                                           FdwDirectModifyPrivateConditional)) != 0;
+    dmstate->executed = false;
+
+    elog(DEBUG1, "scylla_fdw: executing remote %s directly: %s",
+         operation_name(fsplan->operation), dmstate->query);
+}
+
+/*
+ * scyllaIterateDirectModify
+ *        Execute a direct modification
+ *
+ * A lightweight transaction reports whether its IF clause held, and the
+ * row it addresses is counted only if it did.  A plain UPDATE or DELETE
+ * can't tell, so the row is counted as modified.
+ */
+TupleTableSlot *
+scyllaIterateDirectModify(ForeignScanState *node)
+{
+    ScyllaFdwDirectModifyState *dmstate = (ScyllaFdwDirectModifyState *) node->fdw_state;
+    EState     *estate = node->ss.ps.state;
+    TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+    Instrumentation *instr = node->ss.ps.instrument;
+    char       *error_msg = NULL;
+    void       *statement;
+    void       *result;
+    int         processed;
+
+    if (dmstate->executed)
+        return ExecClearTuple(slot);
+
+    /*
+     * Retrying an LWT could report its own write as a failed condition; a
+     * plain write of constants can be sent again safely.
+     */
+    statement = scylla_create_query_statement(dmstate->query, 0);
+    scylla_statement_set_idempotent(statement, !dmstate->conditional);
+    scylla_statement_set_serial_consistency(statement,
+                                            dmstate->serial_consistency);
+    result = scylla_execute_statement(dmstate->conn, statement,
+                                      dmstate->consistency, &error_msg);
+    scylla_free_statement(statement);
+    if (result == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("ScyllaDB direct modification failed: %s",
+                        error_msg ? error_msg : "unknown error"),
+                 errdetail("%s", dmstate->query)));
+
+    processed = (!dmstate->conditional || result_applied(result)) ? 1 : 0;
+    scylla_free_result(result);
+
+    dmstate->executed = true;
+
+    /* Increment the command es_processed count if necessary */
+    if (dmstate->set_processed)
+        estate->es_processed += processed;
+
+    /* Increment the tuple count for EXPLAIN ANALYZE if necessary */
+    if (instr)
+        instr->tuplecount += processed;
+
+    return ExecClearTuple(slot);
+}
+
+/*
+ * scyllaEndDirectModify
+ *        Finish a direct modification
+ */
+void
+scyllaEndDirectModify(ForeignScanState *node)
+{
+    ScyllaFdwDirectModifyState *dmstate = (ScyllaFdwDirectModifyState *) node->fdw_state;
+
+    /* if dmstate is NULL, we are in EXPLAIN; nothing to do */
+    if (dmstate == NULL)
+        return;
+
+    /* Return the session to the connection cache */
+    if (dmstate->conn != NULL)
+        scylla_release_connection(dmstate->conn);
+}
+
+/*
+ * scyllaGetForeignJoinPaths
+ *        Create paths for joining foreign tables on the same server
+ *
+ * Note: ScyllaDB doesn't support JOINs in CQL, so we don't add any paths.
+ */
+void
+scyllaGetForeignJoinPaths(PlannerInfo *root,
+                          RelOptInfo *joinrel,
+                          RelOptInfo *outerrel,
+                          RelOptInfo *innerrel,
+                          JoinType jointype,
+                          JoinPathExtraData *extra)
+{
+    /*
+     * ScyllaDB doesn't support JOINs at the CQL level, so we can't push down
+     * the join operation. Just return without adding any join paths.
+     */
+}
+
+/*
+ * scyllaExplainForeignScan
+ *        Produce extra output for EXPLAIN
+ */
+void
+scyllaExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+    ForeignScan *plan = castNode(ForeignScan, node->ss.ps.plan);
+    List       *fdw_private = plan->fdw_private;
+    ScyllaFdwScanState *fsstate = (ScyllaFdwScanState *) node->fdw_state;
+    char       *sql;
+
+    if (fdw_private != NIL)
+    {
+        sql = strVal(list_nth(fdw_private, 0));
+        ExplainPropertyText("ScyllaDB Query", sql, es);
+    }
+
+    if (fsstate != NULL)
+        scylla_stats_explain(&fsstate->stats, fsstate->conn, true, es);
+
+    if (fsstate != NULL && fsstate->rescan_cache != NULL && es->analyze)
+    {
+        ExplainPropertyInteger("Rescan Cache Hits", NULL,
+                               fsstate->rescan_cache->hits, es);
+        ExplainPropertyInteger("Rescan Cache Misses", NULL,
+                               fsstate->rescan_cache->misses, es);
+        ExplainPropertyInteger("Rescan Cache Evictions", NULL,
+                               fsstate->rescan_cache->evictions, es);
+    }
+}
+
+/*
+ * scyllaExplainForeignModify
+ *        Produce extra output for EXPLAIN of modification operations
+ */
+void
+scyllaExplainForeignModify(ModifyTableState *mtstate,
+                           ResultRelInfo *rinfo,
+                           List *fdw_private,
+                           int subplan_index,
+                           ExplainState *es)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) rinfo->ri_FdwState;
+    char       *sql;
+
+    if (fdw_private != NIL)
+    {
+        sql = strVal(list_nth(fdw_private, 0));
+        ExplainPropertyText("ScyllaDB Query", sql, es);
+    }
+
+    if (fmstate != NULL)
+        scylla_stats_explain(&fmstate->stats, fmstate->conn, false, es);
+}
+
+/*
+ * scyllaExplainDirectModify
+ *        Produce extra output for EXPLAIN of a direct modification
+ */
+void
+scyllaExplainDirectModify(ForeignScanState *node, ExplainState *es)
+{
+    List       *fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+    char       *sql;
+
+    sql = strVal(list_nth(fdw_private, FdwDirectModifyPrivateUpdateSql));
+    ExplainPropertyText("ScyllaDB Query", sql, es);
+}
+
+/*
+ * scyllaAnalyzeForeignTable
+ *        Test whether analyzing this table is supported
+ *
+ * Sampling reads token ranges, so the table needs its partition key.
+ */
+bool
+scyllaAnalyzeForeignTable(Relation relation,
+                          AcquireSampleRowsFunc *func,
+                          BlockNumber *totalpages)
+{
+    if (scylla_get_table_meta(RelationGetRelid(relation))->options->pk_attrs == NIL)
+        return false;
+
+    *func = scylla_acquire_sample_rows;
+
+    /* There are no local pages; report one so the table is not skipped */
+    *totalpages = 1;
+
+    return true;
+}
+
+/*
+ * scylla_acquire_sample_rows
+ *        Acquire a random sample of rows for ANALYZE
+ *
+ * The token ring is split into slices, and the scan visits slices in
+ * random order, reading a single page of each, until it has seen at least
+ * targrows rows spread over a reasonable number of slices.  Rows are drawn
+ * from what was read with reservoir sampling.
+ *
+ * If every visited slice was read to its end, the row count extrapolates
+ * from the slices read.  Otherwise it comes from the size_estimates
+ * partition count times the rows per partition seen in the sample, using
+ * the partition key token fetched with each row to find partition edges.
+ */
+static int
+scylla_acquire_sample_rows(Relation relation, int elevel,
+                           HeapTuple *rows, int targrows,
+                           double *totalrows, double *totaldeadrows)
+{
+    ScyllaFdwRelationInfo *fpinfo;
+    ForeignTable *table;
+    ForeignServer *server;
+    UserMapping *user;
+    TupleDesc   tupdesc = RelationGetDescr(relation);
+    List       *retrieved_attrs;
+    ListCell   *lc;
+    void       *conn;
+    void       *prepared;
+    char       *query;
+    ScyllaColumnDecoder *decoders;
+    int         num_decoders = 0;
+    int         token_col;
+    bool        decoders_checked = false;
+    Datum      *values;
+    bool       *nulls;
+    MemoryContext rowcontext;
+    ReservoirStateData rstate;
+    double      rowstoskip = -1;
+    double      samplerows = 0;
+    double      partitions_seen = 0;
+    double      est_partitions;
+    int         num_slices;
+    int        *slices;
+    int         slices_read = 0;
+    bool        all_complete = true;
+    int         numrows = 0;
+    int         i;
+
+    fpinfo = (ScyllaFdwRelationInfo *) palloc0(sizeof(ScyllaFdwRelationInfo));
+    scylla_init_rel_info(RelationGetRelid(relation), fpinfo);
+
+    table = GetForeignTable(RelationGetRelid(relation));
+    server = GetForeignServer(table->serverid);
+    user = GetUserMapping(GetUserId(), server->serverid);
+    conn = scylla_get_connection(server, user, false);
+
+    query = scylla_build_analyze_query(relation, fpinfo, &retrieved_attrs);
+    prepared = scylla_get_prepared(conn, RelationGetRelid(relation), query);
+
+    /* Decode plan for every column, as in a scan; the token comes last */
+    decoders = (ScyllaColumnDecoder *)
+        palloc0(Max(list_length(retrieved_attrs), 1) *
+                sizeof(ScyllaColumnDecoder));
+    foreach(lc, retrieved_attrs)
+    {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, lfirst_int(lc) - 1);
+        ScyllaColumnDecoder *d = &decoders[num_decoders];
+
+        d->attidx = lfirst_int(lc) - 1;
+        d->col = num_decoders++;
+        d->pg_type = attr->atttypid;
+        d->typmod = attr->atttypmod;
+    }
+    token_col = num_decoders;
+
+    values = (Datum *) palloc0(tupdesc->natts * sizeof(Datum));
+    nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+    rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                       "scylla_fdw analyze row",
+                                       ALLOCSET_SMALL_SIZES);
+
+    /*
+     * Use no more slices than there are pages' worth of partitions, so a
+     * small table is read whole in a few requests.
+     */
+    est_partitions = scylla_estimate_partition_count(conn, fpinfo);
+    if (est_partitions >= 0)
+        num_slices = (int) Max(Min(ceil(est_partitions / fpinfo->fetch_size),
+                                   SCYLLA_ANALYZE_MAX_SLICES), 1);
+    else
+        num_slices = SCYLLA_ANALYZE_MAX_SLICES;
+
+    /* Visit the slices in random order */
+    reservoir_init_selection_state(&rstate, targrows);
+    slices = (int *) palloc(num_slices * sizeof(int));
+    for (i = 0; i < num_slices; i++)
+        slices[i] = i;
+    for (i = num_slices - 1; i > 0; i--)
+    {
+        int         j = (int) ((i + 1) * sampler_random_fract(&rstate.randstate));
+        int         tmp = slices[i];
+
+        slices[i] = slices[j];
+        slices[j] = tmp;
+    }
+
+    for (i = 0; i < num_slices; i++)
+    {
+        uint64      step = PG_UINT64_MAX / (uint64) num_slices;
+        int64       lower;
+        int64       upper;
+        void       *statement;
+        void       *result;
+        void       *iterator;
+        char       *error_msg = NULL;
+        int64_t     prev_token = 0;
+        bool        have_prev = false;
+
+        if (samplerows >= targrows &&
+            slices_read >= Min(num_slices, SCYLLA_ANALYZE_MIN_SLICES))
+            break;
+
+#if PG_VERSION_NUM >= 180000
+        vacuum_delay_point(true);
+#else
+        vacuum_delay_point();
+#endif
+
+        /* Same split of the ring as a parallel scan */
+        lower = (int64) ((uint64) PG_INT64_MIN + slices[i] * step);
+        if (slices[i] == num_slices - 1)
+            upper = PG_INT64_MAX;
+        else
+            upper = (int64) ((uint64) PG_INT64_MIN + (slices[i] + 1) * step);
+
+        statement = scylla_create_statement(prepared);
+        scylla_statement_set_idempotent(statement, true);
+        scylla_bind_int64(statement, 0, lower);
+        scylla_bind_int64(statement, 1, upper);
+        scylla_statement_set_paging_size(statement, fpinfo->fetch_size);
+
+        result = scylla_execute_statement(conn, statement,
+                                          SCYLLA_CONSISTENCY_LOCAL_ONE,
+                                          &error_msg);
+        scylla_free_statement(statement);
+        if (result == NULL)
+        {
+            scylla_release_connection(conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("could not sample ScyllaDB table \"%s\": %s",
+                            RelationGetRelationName(relation),
+                            error_msg ? error_msg : "unknown error")));
+        }
+
+        if (!decoders_checked)
+        {
+            int         j;
+
+            for (j = 0; j < num_decoders; j++)
+            {
+                ScyllaColumnDecoder *d = &decoders[j];
+                int         cql_type = scylla_get_column_type(result, d->col);
+
+                d->decode = scylla_get_decoder(d->pg_type, cql_type);
+                if (d->decode == NULL)
+                {
+                    scylla_free_result(result);
+                    scylla_release_connection(conn);
+                    ereport(ERROR,
+                            (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+                             errmsg("column \"%s\" of foreign table \"%s\" has type %s, which cannot hold CQL type %s",
+                                    NameStr(TupleDescAttr(tupdesc, d->attidx)->attname),
+                                    RelationGetRelationName(relation),
+                                    format_type_be(d->pg_type),
+                                    scylla_cql_type_name(cql_type))));
+                }
+            }
+            decoders_checked = true;
+        }
+
+        iterator = scylla_result_iterator(result);
+        while (iterator != NULL && scylla_iterator_next(iterator))
+        {
+            void       *row = scylla_iterator_get_row(iterator);
+            int64_t     token = 0;
+            int         pos = -1;
+
+            /* Rows of a partition are adjacent and share its token */
+            if (!scylla_value_get_int64(scylla_row_get_column(row, token_col),
+                                        &token) ||
+                !have_prev || token != prev_token)
+                partitions_seen++;
+            prev_token = token;
+            have_prev = true;
+
+            /* Reservoir sampling; rows that are skipped are never decoded */
+            if (numrows < targrows)
+                pos = numrows++;
+            else
+            {
+                if (rowstoskip < 0)
+                    rowstoskip = reservoir_get_next_S(&rstate, samplerows, targrows);
+                if (rowstoskip <= 0)
+                {
+                    pos = (int) (targrows * sampler_random_fract(&rstate.randstate));
+                    heap_freetuple(rows[pos]);
+                }
+                rowstoskip -= 1;
+            }
+            samplerows += 1;
+
+            if (pos >= 0)
+            {
+                MemoryContext oldcontext;
+                int         j;
+
+                MemoryContextReset(rowcontext);
+                oldcontext = MemoryContextSwitchTo(rowcontext);
+                memset(nulls, true, tupdesc->natts * sizeof(bool));
+                for (j = 0; j < num_decoders; j++)
+                {
+                    ScyllaColumnDecoder *d = &decoders[j];
+
+                    if (d->decode(scylla_row_get_column(row, d->col), d->typmod,
+                                  &values[d->attidx]))
+                        nulls[d->attidx] = false;
+                }
+                MemoryContextSwitchTo(oldcontext);
+
+                rows[pos] = heap_form_tuple(tupdesc, values, nulls);
+            }
+        }
+
+        if (scylla_result_has_more_pages(result))
+            all_complete = false;
+
+        if (iterator != NULL)
+            scylla_free_iterator(iterator);
+        scylla_free_result(result);
+        slices_read++;
+    }
+
+    scylla_release_connection(conn);
+    MemoryContextDelete(rowcontext);
+
+    if (slices_read == 0 || (!all_complete && est_partitions >= 0))
+        *totalrows = Max(est_partitions, 0) *
+            (partitions_seen > 0 ? samplerows / partitions_seen : 1.0);
+    else
+        *totalrows = samplerows * num_slices / slices_read;
+    *totaldeadrows = 0;
+
+    ereport(elevel,
+            (errmsg("\"%s\": read %d of %d token range slices, containing %.0f rows; %d rows in sample, %.0f estimated total rows",
+                    RelationGetRelationName(relation),
+                    slices_read, num_slices, samplerows, numrows,
+                    *totalrows)));
+
+    return numrows;
+}
+
+/*
+ * scyllaImportForeignSchema
+ *        Import foreign schema
+ *
+ * The column metadata of the keyspace is read from system_schema.columns,
+ * one page at a time.  With LIMIT TO, only the listed tables are asked
+ * for; EXCEPT can't be expressed in CQL, so those tables are skipped
+ * here.  The rows of a table arrive together, ordered by column name.
+ */
+List *
+scyllaImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid)
+{
+    ForeignServer *server;
+    UserMapping *user;
+    List       *commands = NIL;
+    List       *tables = NIL;
+    void       *conn = NULL;
+    ListCell   *next_table;
+
+    server = GetForeignServer(serverOid);
+    user = GetUserMapping(GetUserId(), serverOid);
+
+    /* Get a (possibly cached) session for this server and user */
+    conn = scylla_get_connection(server, user, false);
+
+    if (stmt->list_type == FDW_IMPORT_SCHEMA_LIMIT_TO)
+    {
+        ListCell   *lc;
+
+        foreach(lc, stmt->table_list)
+            tables = lappend(tables, ((RangeVar *) lfirst(lc))->relname);
+    }
+
+    /*
+     * Query the listed tables SCYLLA_IMPORT_MAX_TABLES at a time, which
+     * keeps each IN list within ScyllaDB's limit on clustering key
+     * restrictions; without LIMIT TO, a single query covers the keyspace.
+     */
+    next_table = list_head(tables);
+    do
+    {
+        StringInfoData sql;
+        void       *statement;
+        List       *batch = NIL;
+        ListCell   *lc;
+        char       *current_table = NULL;
+        ScyllaImportColumn *columns = NULL;
+        int         ncolumns = 0;
+        int         maxcolumns = 0;
+        bool        more = true;
+        int         i;
+
+        while (next_table != NULL && list_length(batch) < SCYLLA_IMPORT_MAX_TABLES)
+        {
+            batch = lappend(batch, lfirst(next_table));
+            next_table = lnext(tables, next_table);
+        }
+
+        initStringInfo(&sql);
+        appendStringInfoString(&sql,
+                               "SELECT table_name, column_name, kind, position, "
+                               "clustering_order, type "
+                               "FROM system_schema.columns "
+                               "WHERE keyspace_name = ?");
+        if (batch != NIL)
+        {
+            appendStringInfoString(&sql, " AND table_name IN (");
+            for (i = 0; i < list_length(batch); i++)
+                appendStringInfoString(&sql, i == 0 ? "?" : ", ?");
+            appendStringInfoChar(&sql, ')');
+        }
+
+        statement = scylla_create_query_statement(sql.data,
+                                                  1 + list_length(batch));
+        scylla_bind_string(statement, 0, stmt->remote_schema,
+                           strlen(stmt->remote_schema));
+        i = 1;
+        foreach(lc, batch)
+        {
+            char       *table = (char *) lfirst(lc);
+
+            scylla_bind_string(statement, i++, table, strlen(table));
+        }
+        scylla_statement_set_paging_size(statement, DEFAULT_FETCH_SIZE);
+
+        while (more)
+        {
+            char       *error_msg = NULL;
+            void       *result;
+            void       *iterator;
+
+            result = scylla_execute_statement(conn, statement,
+                                              SCYLLA_CONSISTENCY_LOCAL_ONE,
+                                              &error_msg);
+            if (result == NULL)
+            {
+                scylla_free_statement(statement);
+                scylla_release_connection(conn);
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_ERROR),
+                         errmsg("could not query ScyllaDB schema: %s",
+                                error_msg ? error_msg : "unknown error")));
+            }
+
+            iterator = scylla_result_iterator(result);
+            while (scylla_iterator_next(iterator))
+            {
+                ScyllaImportColumn *col;
+                size_t      len;
+                bool        is_null;
+                const char *table_name;
+                const char *str;
+
+                table_name = scylla_get_string(iterator, 0, &len, &is_null);
+                if (is_null)
+                    continue;
+
+                /* Moved on to a new table: finish the previous one */
+                if (current_table == NULL ||
+                    strlen(current_table) != len ||
+                    strncmp(current_table, table_name, len) != 0)
+                {
+                    if (current_table != NULL &&
+                        import_table_wanted(stmt, current_table))
+                        commands = lappend(commands,
+                                           import_table_command(server,
+                                                                stmt->remote_schema,
+                                                                current_table,
+                                                                columns,
+                                                                ncolumns));
+                    current_table = pnstrdup(table_name, len);
+                    ncolumns = 0;
+                }
+
+                if (ncolumns == maxcolumns)
+                {
+                    maxcolumns = Max(maxcolumns * 2, 16);
+                    columns = (ScyllaImportColumn *)
+                        (columns == NULL ?
+                         palloc(maxcolumns * sizeof(ScyllaImportColumn)) :
+                         repalloc(columns,
+                                  maxcolumns * sizeof(ScyllaImportColumn)));
+                }
+                col = &columns[ncolumns];
+
+                str = scylla_get_string(iterator, 1, &len, &is_null);
+                if (is_null)
+                    continue;
+                col->name = pnstrdup(str, len);
+
+                str = scylla_get_string(iterator, 2, &len, &is_null);
+                if (!is_null && len == 13 && strncmp(str, "partition_key", len) == 0)
+                    col->kind = 0;
+                else if (!is_null && len == 10 && strncmp(str, "clustering", len) == 0)
+                    col->kind = 1;
+                else
+                    col->kind = 2;
+
+                col->position = scylla_get_int32(iterator, 3, &is_null);
+                if (is_null)
+                    col->position = -1;
+
+                str = scylla_get_string(iterator, 4, &len, &is_null);
+                col->descending = (!is_null && len == 4 &&
+                                   pg_strncasecmp(str, "desc", len) == 0);
+
+                str = scylla_get_string(iterator, 5, &len, &is_null);
+                if (is_null)
+                    continue;
+                col->cql_type = pnstrdup(str, len);
+
+                ncolumns++;
+            }
+            scylla_free_iterator(iterator);
+
+            more = scylla_result_has_more_pages(result) &&
+                scylla_statement_set_paging_state(statement, result);
+            scylla_free_result(result);
+        }
+        scylla_free_statement(statement);
+
+        /* Finish the last table */
+        if (current_table != NULL && import_table_wanted(stmt, current_table))
+            commands = lappend(commands,
+                               import_table_command(server, stmt->remote_schema,
+                                                    current_table, columns,
+                                                    ncolumns));
+
+        list_free(batch);
+        pfree(sql.data);
+    } while (next_table != NULL);
+
+    scylla_release_connection(conn);
+
+    return commands;
+}
+
+/*
+ * import_table_wanted
+ *        Check a remote table against the EXCEPT list of an import
+ *
+ * LIMIT TO is applied by the metadata query itself.
+ */
+static bool
+import_table_wanted(ImportForeignSchemaStmt *stmt, const char *table)
+{
+    ListCell   *lc;
+
+    if (stmt->list_type != FDW_IMPORT_SCHEMA_EXCEPT)
+        return true;
+
+    foreach(lc, stmt->table_list)
+    {
+        if (strcmp(((RangeVar *) lfirst(lc))->relname, table) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * import_column_cmp
+ *        qsort comparator putting imported columns in CQL table order
+ *
+ * Partition key columns come first and clustering columns next, each in
+ * key order, followed by the other columns by name, as cqlsh lists them.
+ */
+static int
+import_column_cmp(const void *a, const void *b)
+{
+    const ScyllaImportColumn *ca = (const ScyllaImportColumn *) a;
+    const ScyllaImportColumn *cb = (const ScyllaImportColumn *) b;
+
+    if (ca->kind != cb->kind)
+        return ca->kind - cb->kind;
+    if (ca->kind < 2 && ca->position != cb->position)
+        return ca->position - cb->position;
+    return strcmp(ca->name, cb->name);
+}
+
+/*
+ * import_table_command
+ *        Build the CREATE FOREIGN TABLE command of an imported table
+ *
+ * The primary_key and clustering_key options are filled in from the key
+ * columns, with DESC on clustering columns stored in descending order.
+ */
+static char *
+import_table_command(ForeignServer *server, const char *keyspace,
+                     const char *table, ScyllaImportColumn *columns,
+                     int ncolumns)
+{
+    StringInfoData cmd;
+    StringInfoData pk_cols;
+    StringInfoData ck_cols;
     int         i;
-    int         pindex = 0;
 
-    elog(DEBUG1, "scylla_fdw: executing DELETE");
+    qsort(columns, ncolumns, sizeof(ScyllaImportColumn), import_column_cmp);
 
-    /* Create a statement from the prepared query */
-    statement = scylla_create_statement(fmstate->prepared);
-    if (statement == NULL)
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("could not create ScyllaDB statement")));
+    initStringInfo(&cmd);
+    initStringInfo(&pk_cols);
+    initStringInfo(&ck_cols);
 
-    /* Bind primary key values from planSlot junk attributes */
-    for (i = 0; i < fmstate->num_pk_attrs; i++)
+    appendStringInfo(&cmd, "CREATE FOREIGN TABLE %s (\n",
+                     quote_identifier(table));
+
+    for (i = 0; i < ncolumns; i++)
     {
-        Datum value;
-        bool isnull;
-        int attnum;
-        
-        /* Get value from junk attribute in planSlot */
-        value = ExecGetJunkAttribute(planSlot, fmstate->junk_att_nums[i], &isnull);
-        
-        /* Get the actual attribute number to determine the type */
-        attnum = list_nth_int(fmstate->target_attrs, i);
-        
-        scylla_convert_from_pg(value, TupleDescAttr(tupdesc, attnum - 1)->atttypid,
-                               statement, pindex, isnull);
-        pindex++;
+        ScyllaImportColumn *col = &columns[i];
+
+        appendStringInfo(&cmd, "    %s %s%s\n",
+                         quote_identifier(col->name),
+                         cql_type_to_pg_type(col->cql_type),
+                         i < ncolumns - 1 ? "," : "");
+
+        if (col->kind == 0)
+            appendStringInfo(&pk_cols, "%s%s", pk_cols.len > 0 ? ", " : "",
+                             col->name);
+        else if (col->kind == 1)
+            appendStringInfo(&ck_cols, "%s%s%s", ck_cols.len > 0 ? ", " : "",
+                             col->name, col->descending ? " DESC" : "");
     }
 
-    /* Execute the statement */
-    if (scylla_execute_prepared(fmstate->conn, fmstate->prepared,
-                                &statement, 1,
-                                SCYLLA_CONSISTENCY_LOCAL_QUORUM, &error_msg) == NULL)
+    appendStringInfo(&cmd,
+                     ") SERVER %s\n"
+                     "OPTIONS (keyspace %s, \"table\" %s",
+                     quote_identifier(server->servername),
+                     quote_literal_cstr(keyspace),
+                     quote_literal_cstr(table));
+    if (pk_cols.len > 0)
+        appendStringInfo(&cmd, ", primary_key %s",
+                         quote_literal_cstr(pk_cols.data));
+    if (ck_cols.len > 0)
+        appendStringInfo(&cmd, ", clustering_key %s",
+                         quote_literal_cstr(ck_cols.data));
+    appendStringInfoString(&cmd, ");");
+
+    pfree(pk_cols.data);
+    pfree(ck_cols.data);
+
+    return cmd.data;
+}
+
+/*
+ * cql_type_to_pg_type
+ *        PostgreSQL type of an imported column, from its CQL type name
+ *
+ * Collections, tuples, user-defined and other types a scan has no
+ * conversion for are imported as bytea, which holds the value in CQL's
+ * serialized form.
+ */
+static const char *
+cql_type_to_pg_type(const char *cql_type)
+{
+    static const struct
+    {
+        const char *cql;
+        const char *pg;
+    }           types[] =
+    {
+        {"ascii", "text"},
+        {"bigint", "bigint"},
+        {"blob", "bytea"},
+        {"boolean", "boolean"},
+        {"counter", "bigint"},
+        {"date", "date"},
+        {"decimal", "numeric"},
+        {"double", "double precision"},
+        {"float", "real"},
+        {"inet", "inet"},
+        {"int", "integer"},
+        {"smallint", "smallint"},
+        {"text", "text"},
+        {"time", "time"},
+        {"timestamp", "timestamp with time zone"},
+        {"timeuuid", "uuid"},
+        {"tinyint", "smallint"},
+        {"uuid", "uuid"},
+        {"varchar", "text"},
+        {"varint", "numeric"},
+    };
+    int         i;
+
+    for (i = 0; i < lengthof(types); i++)
     {
-        scylla_free_statement(statement);
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("ScyllaDB DELETE failed: %s",
-                        error_msg ? error_msg : "unknown error")));
+        if (strcmp(cql_type, types[i].cql) == 0)
+            return types[i].pg;
     }
 
-    scylla_free_statement(statement);
-
-    return slot;
+    return "bytea";
 }
 
 /*
- * scyllaEndForeignModify
- *        End a foreign modification operation
+ * get_int_modify_option
+ *        Get an integer option, with the table setting taking precedence
  */
-void
-scyllaEndForeignModify(EState *estate,
-                       ResultRelInfo *resultRelInfo)
+static int
+get_int_modify_option(Relation rel, const char *optname, int default_value)
 {
-    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) resultRelInfo->ri_FdwState;
+    ForeignTable *table = GetForeignTable(RelationGetRelid(rel));
+    ForeignServer *server = GetForeignServer(table->serverid);
+    List       *options = NIL;
+    ListCell   *lc;
+    int         value = default_value;
 
-    if (fmstate == NULL)
-        return;
+    /* Table options come last, so they override server options */
+    options = list_concat(options, server->options);
+    options = list_concat(options, table->options);
 
-    elog(DEBUG1, "scylla_fdw: ending foreign modify operation");
+    foreach(lc, options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
 
-    /* Release prepared statement */
-    if (fmstate->prepared != NULL)
-        scylla_free_prepared(fmstate->prepared);
+        if (strcmp(def->defname, optname) == 0)
+            value = atoi(defGetString(def));
+    }
 
-    /* Disconnect from ScyllaDB */
-    if (fmstate->conn != NULL)
-        scylla_disconnect(fmstate->conn, fmstate->cluster);
+    return value;
 }
 
 /*
- * scyllaGetForeignJoinPaths
- *        Create paths for joining foreign tables on the same server
- *
- * Note: ScyllaDB doesn't support JOINs in CQL, so we don't add any paths.
+ * operation_name
+ *        Name of a modify operation, for messages
  */
-void
-scyllaGetForeignJoinPaths(PlannerInfo *root,
-                          RelOptInfo *joinrel,
-                          RelOptInfo *outerrel,
-                          RelOptInfo *innerrel,
-                          JoinType jointype,
-                          JoinPathExtraData *extra)
+static const char *
+operation_name(CmdType operation)
 {
-    /*
-     * ScyllaDB doesn't support JOINs at the CQL level, so we can't push down
-     * the join operation. Just return without adding any join paths.
-     */
+    return operation == CMD_INSERT ? "INSERT" :
+           operation == CMD_UPDATE ? "UPDATE" :
+           operation == CMD_DELETE ? "DELETE" : "UNKNOWN";
 }
 
-#if PG_VERSION_NUM < 180000
 /*
- * scyllaExplainForeignScan
- *        Produce extra output for EXPLAIN
+ * get_pk_attrs
+ *        Get the attribute numbers of the primary_key columns of rel, which
+ *        an UPDATE or DELETE needs
  */
-void
-scyllaExplainForeignScan(ForeignScanState *node, ExplainState *es)
+static int *
+get_pk_attrs(Relation rel, CmdType operation, int *num_pk_attrs)
 {
-    ForeignScan *plan = castNode(ForeignScan, node->ss.ps.plan);
-    List       *fdw_private = plan->fdw_private;
-    char       *sql;
+    ScyllaTableMeta *meta = scylla_get_table_meta(RelationGetRelid(rel));
+    int        *pk_attrs;
+    ListCell   *lc;
+    int         i = 0;
 
-    if (fdw_private != NIL)
-    {
-        sql = strVal(list_nth(fdw_private, 0));
-        ExplainPropertyText("ScyllaDB Query", sql, es);
-    }
+    if (meta->options->primary_key == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_UNABLE_TO_CREATE_EXECUTION),
+                 errmsg("primary_key option required for %s",
+                        operation_name(operation))));
+
+    pk_attrs = (int *) palloc(Max(list_length(meta->options->pk_attrs), 1) *
+                              sizeof(int));
+    foreach(lc, meta->options->pk_attrs)
+        pk_attrs[i++] = lfirst_int(lc);
+    *num_pk_attrs = i;
+
+    return pk_attrs;
 }
 
 /*
- * scyllaExplainForeignModify
- *        Produce extra output for EXPLAIN of modification operations
+ * submit_write
+ *        Send a bound write statement and free it
+ *
+ * With max_inflight = 1 this waits for the write, so errors are reported
+ * on the row that caused them.  Otherwise the write is pipelined: we only
+ * block once max_inflight writes are outstanding, and errors surface when
+ * the failed write is reaped, at the latest in scyllaEndForeignModify.
+ *
+ * Returns false if a conditional write was not applied.
  */
-void
-scyllaExplainForeignModify(ModifyTableState *mtstate,
-                           ResultRelInfo *rinfo,
-                           List *fdw_private,
-                           int subplan_index,
-                           ExplainState *es)
+static bool
+submit_write(ScyllaFdwModifyState *fmstate, void *statement)
 {
-    char       *sql;
+    char       *error_msg = NULL;
+    instr_time  sent;
+    void       *future;
+    void       *result;
+    bool        applied = true;
+
+    INSTR_TIME_SET_CURRENT(sent);
+    future = scylla_execute_statement_async(fmstate->conn, statement,
+                                            fmstate->consistency);
+    scylla_free_statement(statement);
 
-    if (fdw_private != NIL)
+    if (fmstate->max_inflight > 1)
     {
-        sql = strVal(list_nth(fdw_private, 0));
-        ExplainPropertyText("ScyllaDB Query", sql, es);
+        track_inflight(fmstate, future, &sent);
+        return true;
     }
+
+    result = scylla_stats_get_result(&fmstate->stats, fmstate->conn, future,
+                                     &sent, &error_msg);
+
+    if (result == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("ScyllaDB %s failed: %s",
+                        operation_name(fmstate->operation),
+                        take_error_msg(error_msg))));
+
+    if (fmstate->conditional)
+        applied = result_applied(result);
+    scylla_free_result(result);
+
+    return applied;
 }
-#endif
 
 /*
- * scyllaAnalyzeForeignTable
- *        Test whether analyzing this table is supported
+ * result_applied
+ *        Check the [applied] column of the result of a lightweight
+ *        transaction
+ *
+ * It is always the first column; when the condition failed, the current
+ * values of the row follow it.
  */
-bool
-scyllaAnalyzeForeignTable(Relation relation,
-                          AcquireSampleRowsFunc *func,
-                          BlockNumber *totalpages)
+static bool
+result_applied(void *result)
 {
-    /*
-     * ScyllaDB doesn't provide easy access to table statistics,
-     * so we don't support ANALYZE for now.
-     */
-    return false;
+    void       *iterator = scylla_result_iterator(result);
+    bool        applied = false;
+    bool        is_null;
+
+    if (iterator != NULL && scylla_iterator_next(iterator))
+        applied = scylla_get_bool(iterator, 0, &is_null) && !is_null;
+    if (iterator != NULL)
+        scylla_free_iterator(iterator);
+
+    return applied;
 }
 
 /*
- * scyllaImportForeignSchema
- *        Import foreign schema
+ * track_inflight
+ *        Add a write future to the in-flight window, making room if needed
  */
-List *
-scyllaImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid)
+static void
+track_inflight(ScyllaFdwModifyState *fmstate, void *future, instr_time *sent)
 {
-    ForeignServer *server;
-    UserMapping *user;
-    List       *commands = NIL;
-    void       *conn = NULL;
-    void       *result = NULL;
-    void       *iterator = NULL;
+    int         tail;
+
+    if (fmstate->num_inflight == fmstate->max_inflight)
+        wait_oldest_inflight(fmstate);
+
+    tail = (fmstate->inflight_head + fmstate->num_inflight) % fmstate->max_inflight;
+    fmstate->inflight[tail] = future;
+    fmstate->inflight_sent[tail] = *sent;
+    fmstate->num_inflight++;
+}
+
+/*
+ * wait_oldest_inflight
+ *        Wait for the oldest in-flight write and report its failure, if any
+ */
+static void
+wait_oldest_inflight(ScyllaFdwModifyState *fmstate)
+{
+    void       *future;
+    void       *result;
     char       *error_msg = NULL;
-    StringInfoData sql;
-    StringInfoData cmd;
-    char       *host = DEFAULT_HOST;
-    int         port = DEFAULT_PORT;
-    char       *username = NULL;
-    char       *password = NULL;
-    ListCell   *lc;
-    char       *current_table = NULL;
-    char       *pk_cols = NULL;
-    bool        in_table = false;
+    instr_time  sent;
 
-    server = GetForeignServer(serverOid);
-    user = GetUserMapping(GetUserId(), serverOid);
+    Assert(fmstate->num_inflight > 0);
 
-    /* Extract connection options */
-    foreach(lc, server->options)
-    {
-        DefElem *def = (DefElem *) lfirst(lc);
-        if (strcmp(def->defname, OPT_HOST) == 0)
-            host = defGetString(def);
-        else if (strcmp(def->defname, OPT_PORT) == 0)
-            port = atoi(defGetString(def));
-    }
+    future = fmstate->inflight[fmstate->inflight_head];
+    sent = fmstate->inflight_sent[fmstate->inflight_head];
+    fmstate->inflight_head = (fmstate->inflight_head + 1) % fmstate->max_inflight;
+    fmstate->num_inflight--;
 
-    foreach(lc, user->options)
+    /* This frees the future */
+    result = scylla_stats_get_result(&fmstate->stats, fmstate->conn, future,
+                                     &sent, &error_msg);
+
+    /* COPY keeps loading, and reports all failures at the end */
+    if (result == NULL && fmstate->bulk)
     {
-        DefElem *def = (DefElem *) lfirst(lc);
-        if (strcmp(def->defname, OPT_USERNAME) == 0)
-            username = defGetString(def);
-        else if (strcmp(def->defname, OPT_PASSWORD) == 0)
-            password = defGetString(def);
+        MemoryContext oldcxt;
+
+        oldcxt = MemoryContextSwitchTo(GetMemoryChunkContext(fmstate));
+        if (fmstate->first_failure == NULL)
+            fmstate->first_failure = take_error_msg(error_msg);
+        else
+            free(error_msg);
+        MemoryContextSwitchTo(oldcxt);
+        fmstate->num_failed++;
+        return;
     }
 
-    /* Connect to ScyllaDB */
-    conn = scylla_connect(host, port, username, password,
-                          DEFAULT_CONNECT_TIMEOUT, false,
-                          NULL, NULL, NULL, &error_msg);
-    if (conn == NULL)
-        ereport(ERROR,
-                (errcode(ERRCODE_FDW_UNABLE_TO_ESTABLISH_CONNECTION),
-                 errmsg("could not connect to ScyllaDB: %s",
-                        error_msg ? error_msg : "unknown error")));
-
-    /* Query system_schema.columns for the keyspace */
-    initStringInfo(&sql);
-    appendStringInfo(&sql,
-                     "SELECT table_name, column_name, type, kind "
-                     "FROM system_schema.columns "
-                     "WHERE keyspace_name = '%s' "
-                     "ORDER BY table_name, position",
-                     stmt->remote_schema);
-
-    result = scylla_execute_query(conn, sql.data,
-                                  SCYLLA_CONSISTENCY_LOCAL_ONE, &error_msg);
+    /* The rest of the window is freed by discard_inflight */
     if (result == NULL)
-    {
-        scylla_disconnect(conn, NULL);
         ereport(ERROR,
                 (errcode(ERRCODE_FDW_ERROR),
-                 errmsg("could not query ScyllaDB schema: %s",
-                        error_msg ? error_msg : "unknown error")));
-    }
+                 errmsg("ScyllaDB %s failed: %s",
+                        operation_name(fmstate->operation),
+                        take_error_msg(error_msg))));
 
-    iterator = scylla_result_iterator(result);
-    if (iterator != NULL)
+    scylla_free_result(result);
+}
+
+/*
+ * drain_inflight
+ *        Wait for every in-flight write, then report the first failure
+ */
+static void
+drain_inflight(ScyllaFdwModifyState *fmstate)
+{
+    char       *failure = fmstate->first_failure;
+    int         failed = fmstate->num_failed;
+
+    while (fmstate->num_inflight > 0)
     {
-        initStringInfo(&cmd);
+        void       *future = fmstate->inflight[fmstate->inflight_head];
+        instr_time  sent = fmstate->inflight_sent[fmstate->inflight_head];
+        void       *result;
+        char       *error_msg = NULL;
 
-        while (scylla_iterator_next(iterator))
+        fmstate->inflight_head = (fmstate->inflight_head + 1) % fmstate->max_inflight;
+        fmstate->num_inflight--;
+
+        result = scylla_stats_get_result(&fmstate->stats, fmstate->conn,
+                                         future, &sent, &error_msg);
+        if (result == NULL)
         {
-            size_t      len;
-            bool        is_null;
-            const char *table_name;
-            const char *column_name;
-            const char *cql_type;
-            const char *kind;
-            char       *pg_type;
+            if (failure == NULL)
+                failure = take_error_msg(error_msg);
+            else
+                free(error_msg);
+            failed++;
+        }
+        else
+            scylla_free_result(result);
+    }
 
-            table_name = scylla_get_string(iterator, 0, &len, &is_null);
-            if (is_null) continue;
+    if (failure != NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("ScyllaDB %s failed: %s",
+                        operation_name(fmstate->operation), failure),
+                 failed > 1 ? errdetail("%d pipelined writes failed.", failed) : 0));
+}
 
-            column_name = scylla_get_string(iterator, 1, &len, &is_null);
-            if (is_null) continue;
+/*
+ * discard_inflight
+ *        Free the futures of the writes still in flight, without waiting
+ *
+ * Called when the memory of the modify state is reset, that is at the end
+ * of the query; after a successful drain_inflight there is nothing left.
+ * The writes themselves go on, only their results are dropped.
+ */
+static void
+discard_inflight(void *arg)
+{
+    ScyllaFdwModifyState *fmstate = (ScyllaFdwModifyState *) arg;
 
-            cql_type = scylla_get_string(iterator, 2, &len, &is_null);
-            if (is_null) continue;
+    while (fmstate->num_inflight > 0)
+    {
+        scylla_free_future(fmstate->inflight[fmstate->inflight_head]);
+        fmstate->inflight_head = (fmstate->inflight_head + 1) % fmstate->max_inflight;
+        fmstate->num_inflight--;
+    }
+}
 
-            kind = scylla_get_string(iterator, 3, &len, &is_null);
+/*
+ * take_error_msg
+ *        Copy an error message of the driver into the current memory
+ *        context, and free the driver's copy
+ */
+static char *
+take_error_msg(char *error_msg)
+{
+    char       *msg;
 
-            /* Check if we've moved to a new table */
-            if (current_table == NULL || strcmp(current_table, table_name) != 0)
-            {
-                /* Finish previous table if any */
-                if (in_table)
-                {
-                    /* Remove trailing comma and newline */
-                    cmd.len -= 2;
-                    cmd.data[cmd.len] = '\0';
+    if (error_msg == NULL)
+        return pstrdup("unknown error");
 
-                    appendStringInfo(&cmd,
-                                     "\n) SERVER %s\n"
-                                     "OPTIONS (keyspace '%s', \"table\" '%s'",
-                                     quote_identifier(server->servername),
-                                     stmt->remote_schema,
-                                     current_table);
+    msg = pstrdup(error_msg);
+    free(error_msg);
+    return msg;
+}
 
-                    if (pk_cols != NULL)
-                        appendStringInfo(&cmd, ", primary_key '%s'", pk_cols);
+/*
+ * create_insert_statement
+ *        Bind the values of one row to a new INSERT statement
+ *
+ * Like the UPDATEs and DELETEs, it only writes bound values, so sending it
+ * twice has the same effect as sending it once: it is marked idempotent.
+ * That does not hold for IF NOT EXISTS, whose retry would find the row the
+ * first attempt wrote and report it as not applied.
+ */
+static void *
+create_insert_statement(ScyllaFdwModifyState *fmstate, TupleTableSlot *slot)
+{
+    void       *statement;
+    ListCell   *lc;
+    int         pindex = 0;
 
-                    appendStringInfoString(&cmd, ");");
+    statement = scylla_create_statement(fmstate->prepared);
+    if (statement == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not create ScyllaDB statement")));
+    scylla_statement_set_idempotent(statement, !fmstate->conditional);
+    scylla_statement_set_serial_consistency(statement, fmstate->serial_consistency);
 
-                    commands = lappend(commands, pstrdup(cmd.data));
-                }
+    /* Bind parameters from the slot */
+    foreach(lc, fmstate->target_attrs)
+    {
+        int         attnum = lfirst_int(lc);
+        Datum       value;
+        bool        isnull;
 
-                /* Start new table */
-                current_table = pstrdup(table_name);
-                pk_cols = NULL;
-                resetStringInfo(&cmd);
+        value = slot_getattr(slot, attnum, &isnull);
+        scylla_convert_from_pg(value, TupleDescAttr(fmstate->tupdesc, attnum - 1)->atttypid,
+                               statement, pindex, isnull);
+        pindex++;
+    }
 
-                appendStringInfo(&cmd,
-                                 "CREATE FOREIGN TABLE %s (\n",
-                                 quote_identifier(table_name));
-                in_table = true;
-            }
+    return statement;
+}
 
-            /* Map CQL type to PostgreSQL type */
-            if (strcmp(cql_type, "uuid") == 0 || strcmp(cql_type, "timeuuid") == 0)
-                pg_type = "uuid";
-            else if (strcmp(cql_type, "text") == 0 || strcmp(cql_type, "ascii") == 0 ||
-                     strcmp(cql_type, "varchar") == 0)
-                pg_type = "text";
-            else if (strcmp(cql_type, "int") == 0)
-                pg_type = "integer";
-            else if (strcmp(cql_type, "bigint") == 0 || strcmp(cql_type, "counter") == 0)
-                pg_type = "bigint";
-            else if (strcmp(cql_type, "smallint") == 0)
-                pg_type = "smallint";
-            else if (strcmp(cql_type, "tinyint") == 0)
-                pg_type = "smallint";
-            else if (strcmp(cql_type, "float") == 0)
-                pg_type = "real";
-            else if (strcmp(cql_type, "double") == 0)
-                pg_type = "double precision";
-            else if (strcmp(cql_type, "boolean") == 0)
-                pg_type = "boolean";
-            else if (strcmp(cql_type, "timestamp") == 0)
-                pg_type = "timestamp with time zone";
-            else if (strcmp(cql_type, "date") == 0)
-                pg_type = "date";
-            else if (strcmp(cql_type, "time") == 0)
-                pg_type = "time";
-            else if (strcmp(cql_type, "blob") == 0)
-                pg_type = "bytea";
-            else if (strcmp(cql_type, "inet") == 0)
-                pg_type = "inet";
-            else if (strcmp(cql_type, "decimal") == 0 || strcmp(cql_type, "varint") == 0)
-                pg_type = "numeric";
-            else
-                pg_type = "text";  /* Default fallback */
+/*
+ * same_partition_key
+ *        Check whether two rows belong to the same ScyllaDB partition
+ */
+static bool
+same_partition_key(ScyllaFdwModifyState *fmstate,
+                   TupleTableSlot *a, TupleTableSlot *b)
+{
+    int         k;
 
-            appendStringInfo(&cmd, "    %s %s,\n",
-                             quote_identifier(column_name), pg_type);
+    for (k = 0; k < fmstate->num_pk_attrs; k++)
+    {
+        AttrNumber  attnum = fmstate->pk_attrs[k];
+        Form_pg_attribute attr = TupleDescAttr(fmstate->tupdesc, attnum - 1);
+        Datum       va,
+                    vb;
+        bool        na,
+                    nb;
+
+        va = slot_getattr(a, attnum, &na);
+        vb = slot_getattr(b, attnum, &nb);
+
+        if (na != nb)
+            return false;
+        if (!na && !datum_image_eq(va, vb, attr->attbyval, attr->attlen))
+            return false;
+    }
 
-            /* Track partition key columns */
-            if (kind != NULL && strcmp(kind, "partition_key") == 0)
-            {
-                if (pk_cols == NULL)
-                    pk_cols = pstrdup(column_name);
-                else
-                {
-                    char *new_pk = psprintf("%s, %s", pk_cols, column_name);
-                    pfree(pk_cols);
-                    pk_cols = new_pk;
-                }
-            }
-        }
+    return true;
+}
 
-        /* Finish last table */
-        if (in_table)
-        {
-            cmd.len -= 2;
-            cmd.data[cmd.len] = '\0';
+/*
+ * find_modifytable_subplan
+ *        Find the ForeignScan that scans rtindex below a ModifyTable
+ *
+ * We only look at the immediate child of the ModifyTable and, for
+ * inherited/partitioned targets, the subplan_index'th child of an Append
+ * directly beneath it (possibly under a Result computing the targetlist).
+ * Anything deeper would involve local joins, so no direct modification.
+ */
+static ForeignScan *
+find_modifytable_subplan(PlannerInfo *root,
+                         ModifyTable *plan,
+                         Index rtindex,
+                         int subplan_index)
+{
+    Plan       *subplan = outerPlan(plan);
 
-            appendStringInfo(&cmd,
-                             "\n) SERVER %s\n"
-                             "OPTIONS (keyspace '%s', \"table\" '%s'",
-                             quote_identifier(server->servername),
-                             stmt->remote_schema,
-                             current_table);
+    if (IsA(subplan, Append))
+    {
+        Append     *appendplan = (Append *) subplan;
 
-            if (pk_cols != NULL)
-                appendStringInfo(&cmd, ", primary_key '%s'", pk_cols);
+        if (subplan_index < list_length(appendplan->appendplans))
+            subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
+    }
+    else if (IsA(subplan, Result) &&
+             outerPlan(subplan) != NULL &&
+             IsA(outerPlan(subplan), Append))
+    {
+        Append     *appendplan = (Append *) outerPlan(subplan);
 
-            appendStringInfoString(&cmd, ");");
+        if (subplan_index < list_length(appendplan->appendplans))
+            subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
+    }
 
-            commands = lappend(commands, pstrdup(cmd.data));
-        }
+    /* Now, have we got a plain ForeignScan of the desired rel? */
+    if (IsA(subplan, ForeignScan))
+    {
+        ForeignScan *fscan = (ForeignScan *) subplan;
 
-        scylla_free_iterator(iterator);
+        if (fscan->scan.scanrelid == rtindex)
+            return fscan;
     }
 
-    scylla_free_result(result);
-    scylla_disconnect(conn, NULL);
-
-    return commands;
+    return NULL;
 }
@@ -0,0 +1,288 @@
+/*-------------------------------------------------------------------------
+ *
+ * scylla_metacache.c
+ *        Per-backend cache of foreign table metadata for ScyllaDB Foreign
+ *        Data Wrapper
+ *
+ * Every plan of a foreign table needs its resolved options and the
+ * attribute numbers of its partition and clustering key columns, and so
+ * does every modification that starts.  Working them out means fetching
+ * the table, server and user mapping, walking their option lists and
+ * tokenizing the key options against the tuple descriptor, which is a
+ * noticeable share of the time needed to plan a simple key lookup.  The
+ * result is therefore kept per backend, until the table, its server or a
+ * user mapping changes.
+ *
+ * Copyright (c) 2024, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *        scylla_fdw/scylla_metacache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "scylla_fdw.h"
+
+#include "access/table.h"
+#include "utils/inval.h"
+
+/* Metadata cache (initialized on first use) */
+static HTAB *TableMetaHash = NULL;
+
+/* Number of invalidations seen, to detect those arriving during a build */
+static uint64 TableMetaInvalCount = 0;
+
+/* Local function prototypes */
+static void build_table_meta(ScyllaTableMeta *entry);
+static const char *table_or_server_option(ForeignTable *table,
+                                          ForeignServer *server,
+                                          const char *optname,
+                                          const char *fallback_opt);
+static char *copy_option(const char *value);
+static void scylla_metacache_inval_callback(Datum arg, int cacheid,
+                                            uint32 hashvalue);
+static void scylla_metacache_relcache_callback(Datum arg, Oid relid);
+
+/*
+ * scylla_get_table_meta
+ *        Get the cached metadata of a foreign table for the current user
+ *
+ * The caller must hold a lock on the table.  The result belongs to the
+ * cache and may be rebuilt by the next catalog access, so anything kept
+ * beyond that must be copied, as scylla_init_rel_info does.
+ */
+ScyllaTableMeta *
+scylla_get_table_meta(Oid relid)
+{
+    ScyllaTableMetaKey key;
+    ScyllaTableMeta *entry;
+    bool        found;
+
+    /* First time through, initialize the cache and its callbacks */
+    if (TableMetaHash == NULL)
+    {
+        HASHCTL     ctl;
+
+        ctl.keysize = sizeof(ScyllaTableMetaKey);
+        ctl.entrysize = sizeof(ScyllaTableMeta);
+        ctl.hcxt = CacheMemoryContext;
+        TableMetaHash = hash_create("scylla_fdw table metadata", 64,
+                                    &ctl,
+                                    HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+        CacheRegisterSyscacheCallback(FOREIGNTABLEREL,
+                                      scylla_metacache_inval_callback,
+                                      (Datum) 0);
+        CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+                                      scylla_metacache_inval_callback,
+                                      (Datum) 0);
+        CacheRegisterSyscacheCallback(USERMAPPINGOID,
+                                      scylla_metacache_inval_callback,
+                                      (Datum) 0);
+        CacheRegisterRelcacheCallback(scylla_metacache_relcache_callback,
+                                      (Datum) 0);
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.relid = relid;
+    key.userid = GetUserId();
+
+    entry = (ScyllaTableMeta *) hash_search(TableMetaHash, &key,
+                                            HASH_ENTER, &found);
+    if (!found)
+    {
+        entry->valid = false;
+        entry->cxt = NULL;
+        entry->options = NULL;
+    }
+
+    if (!entry->valid || entry->options == NULL)
+        build_table_meta(entry);
+
+    return entry;
+}
+
+/*
+ * scylla_init_rel_info
+ *        Fill in the options and key columns of a foreign table's fpinfo
+ *
+ * This takes the place of scylla_get_options, scylla_extract_options and
+ * the parsing of the key options.  Fields other than those are reset.
+ */
+void
+scylla_init_rel_info(Oid relid, ScyllaFdwRelationInfo *fpinfo)
+{
+    ScyllaFdwRelationInfo *cached = scylla_get_table_meta(relid)->options;
+
+    memcpy(fpinfo, cached, sizeof(ScyllaFdwRelationInfo));
+
+    /* Copy out everything that points into the cache */
+    fpinfo->keyspace = copy_option(cached->keyspace);
+    fpinfo->table = copy_option(cached->table);
+    fpinfo->primary_key = copy_option(cached->primary_key);
+    fpinfo->clustering_key = copy_option(cached->clustering_key);
+    fpinfo->host = copy_option(cached->host);
+    fpinfo->username = copy_option(cached->username);
+    fpinfo->password = copy_option(cached->password);
+    fpinfo->consistency = copy_option(cached->consistency);
+    fpinfo->pk_attrs = list_copy(cached->pk_attrs);
+    fpinfo->ck_attrs = list_copy(cached->ck_attrs);
+    fpinfo->ck_desc = list_copy(cached->ck_desc);
+}
+
+/*
+ * build_table_meta
+ *        (Re)compute the metadata of a cache entry
+ *
+ * Reading the catalogs may process invalidations.  If any arrives before
+ * we are done, the entry is left invalid, so the next lookup builds it
+ * again; it is current enough for the caller that started this one.
+ */
+static void
+build_table_meta(ScyllaTableMeta *entry)
+{
+    Oid         relid = entry->key.relid;
+    ScyllaFdwRelationInfo *fpinfo;
+    MemoryContext oldcontext;
+    ForeignTable *table;
+    ForeignServer *server;
+    List       *server_opts;
+    List       *table_opts;
+    List       *user_opts;
+    Relation    rel;
+    uint64      inval_count = TableMetaInvalCount;
+    int         num_names = 0;
+    const char *p;
+
+    if (entry->cxt == NULL)
+        entry->cxt = AllocSetContextCreate(CacheMemoryContext,
+                                           "scylla_fdw table metadata",
+                                           ALLOCSET_SMALL_SIZES);
+    else
+        MemoryContextReset(entry->cxt);
+    entry->options = NULL;
+    entry->valid = false;
+
+    entry->table_hashvalue = GetSysCacheHashValue1(FOREIGNTABLEREL,
+                                                   ObjectIdGetDatum(relid));
+
+    oldcontext = MemoryContextSwitchTo(entry->cxt);
+
+    fpinfo = (ScyllaFdwRelationInfo *) palloc0(sizeof(ScyllaFdwRelationInfo));
+    scylla_get_options(relid, &server_opts, &table_opts, &user_opts);
+    scylla_extract_options(server_opts, table_opts, user_opts, fpinfo);
+
+    rel = table_open(relid, NoLock);
+    fpinfo->pk_attrs = parse_column_list(rel, fpinfo->primary_key);
+    fpinfo->ck_attrs = parse_clustering_key(rel, fpinfo->clustering_key,
+                                            &fpinfo->ck_desc);
+    table_close(rel, NoLock);
+
+    /* parse_column_list skips names that are not columns */
+    if (fpinfo->primary_key != NULL && fpinfo->primary_key[0] != '\0')
+    {
+        num_names = 1;
+        for (p = fpinfo->primary_key; *p; p++)
+            if (*p == ',')
+                num_names++;
+    }
+    entry->pk_complete = (list_length(fpinfo->pk_attrs) == num_names);
+
+    /* Consistency options, later overridden by the settings if those are set */
+    table = GetForeignTable(relid);
+    server = GetForeignServer(table->serverid);
+    entry->read_consistency =
+        copy_option(table_or_server_option(table, server, OPT_READ_CONSISTENCY,
+                                           OPT_CONSISTENCY));
+    entry->write_consistency =
+        copy_option(table_or_server_option(table, server, OPT_WRITE_CONSISTENCY,
+                                           OPT_CONSISTENCY));
+    entry->serial_consistency =
+        copy_option(table_or_server_option(table, server, OPT_SERIAL_CONSISTENCY,
+                                           NULL));
+
+    MemoryContextSwitchTo(oldcontext);
+
+    entry->options = fpinfo;
+    entry->valid = (inval_count == TableMetaInvalCount);
+}
+
+/*
+ * table_or_server_option
+ *        Get the table's optname, else the server's optname, else the
+ *        server's fallback_opt (if any), or NULL
+ */
+static const char *
+table_or_server_option(ForeignTable *table, ForeignServer *server,
+                       const char *optname, const char *fallback_opt)
+{
+    const char *value = find_option_value(table->options, optname);
+
+    if (value == NULL)
+        value = find_option_value(server->options, optname);
+    if (value == NULL && fallback_opt != NULL)
+        value = find_option_value(server->options, fallback_opt);
+
+    return value;
+}
+
+/*
+ * copy_option
+ *        pstrdup that passes NULL through
+ */
+static char *
+copy_option(const char *value)
+{
+    return value != NULL ? pstrdup(value) : NULL;
+}
+
+/*
+ * scylla_metacache_inval_callback
+ *        Invalidate cached metadata when a table, server or user mapping
+ *        changes
+ *
+ * Server and user mapping changes are rare enough that they simply drop
+ * everything.
+ */
+static void
+scylla_metacache_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaTableMeta *entry;
+
+    TableMetaInvalCount++;
+
+    /* TableMetaHash must exist already, if we're registered */
+    hash_seq_init(&scan, TableMetaHash);
+    while ((entry = (ScyllaTableMeta *) hash_seq_search(&scan)) != NULL)
+    {
+        /* hashvalue == 0 means a cache reset, must clear all state */
+        if (hashvalue == 0 || cacheid != FOREIGNTABLEREL ||
+            entry->table_hashvalue == hashvalue)
+            entry->valid = false;
+    }
+}
+
+/*
+ * scylla_metacache_relcache_callback
+ *        Invalidate cached metadata when a foreign table's definition
+ *        changes
+ *
+ * Renaming, adding or dropping columns changes the attribute numbers the
+ * key options resolve to.
+ */
+static void
+scylla_metacache_relcache_callback(Datum arg, Oid relid)
+{
+    HASH_SEQ_STATUS scan;
+    ScyllaTableMeta *entry;
+
+    TableMetaInvalCount++;
+
+    hash_seq_init(&scan, TableMetaHash);
+    while ((entry = (ScyllaTableMeta *) hash_seq_search(&scan)) != NULL)
+    {
+        /* relid == InvalidOid means a cache reset */
+        if (!OidIsValid(relid) || entry->key.relid == relid)
+            entry->valid = false;
+    }
+}
@@ -0,0 +1,586 @@
+/*-------------------------------------------------------------------------
+ *
+ * scylla_stats.c
+ *        Cluster-wide statistics for ScyllaDB Foreign Data Wrapper
+ *
+ * When scylla_fdw is loaded through shared_preload_libraries, every
+ * backend adds what it sends to ScyllaDB to counters kept in shared
+ * memory, one entry per database and foreign server.  scylla_fdw_stats()
+ * returns them, so none of this depends on the backends still running.
+ *
+ * Scans and modifications report their requests, rows, bytes and request
+ * latencies once, when they finish; events that stop a statement, such as
+ * failed requests, and the rare session and prepare events are counted
+ * as they happen.  The driver's metrics are per session, so each session
+ * publishes how they changed since it last did whenever it is released.
+ *
+ * Latencies are kept as a histogram with power-of-two buckets in
+ * microseconds, which is what lets them be summed across backends; the
+ * percentiles derived from it are interpolated within a bucket.
+ *
+ * Copyright (c) 2024, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *        scylla_fdw/scylla_stats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "scylla_fdw.h"
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "port/pg_bitutils.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+PG_FUNCTION_INFO_V1(scylla_fdw_stats);
+
+/*
+ * Upper bound on the number of foreign servers, across all databases,
+ * that statistics are kept for.  Servers beyond it are not tracked.
+ */
+#define SCYLLA_STATS_MAX_SERVERS    256
+
+/* Number of columns returned by scylla_fdw_stats() */
+#define SCYLLA_STATS_COLS           22
+
+/*
+ * Counters of one foreign server
+ */
+typedef struct ScyllaStatsCounters
+{
+    int64       sessions;       /* sessions open now */
+    int64       connections;    /* driver connections open now */
+    int64       connects;       /* sessions opened */
+    int64       prepared_hits;  /* prepared statements reused */
+    int64       prepared_misses;    /* statements prepared */
+    int64       requests;       /* requests answered */
+    int64       errors;         /* requests that failed */
+    int64       rows;           /* rows received */
+    int64       bytes;          /* bytes of column values received */
+    double      total_time;     /* ms from sending requests to their results */
+    int64       request_timeouts;
+    int64       connection_timeouts;
+    int64       pending_request_timeouts;
+    int64       latency[SCYLLA_LATENCY_BUCKETS];
+} ScyllaStatsCounters;
+
+/*
+ * Shared statistics entry
+ *
+ * Entries are only ever added, so a pointer to one stays valid for the
+ * life of the server.  The counters are protected by the spinlock.
+ */
+typedef struct ScyllaStatsEntry
+{
+    Oid         dbid;           /* database the server is defined in */
+    Oid         serverid;       /* OID of foreign server */
+    TimestampTz since;          /* when counting started */
+    slock_t     mutex;
+    ScyllaStatsCounters counters;
+} ScyllaStatsEntry;
+
+/*
+ * Shared state; the LWLock protects the number of entries and their keys
+ */
+typedef struct ScyllaStatsShared
+{
+    LWLock     *lock;
+    int         num_entries;
+    ScyllaStatsEntry entries[SCYLLA_STATS_MAX_SERVERS];
+} ScyllaStatsShared;
+
+/*
+ * Backend-local map from server OID to its shared entry
+ */
+typedef struct ScyllaStatsLocalEntry
+{
+    Oid         serverid;       /* hash key (must be first) */
+    ScyllaStatsEntry *entry;
+} ScyllaStatsLocalEntry;
+
+/* Saved hook values */
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* Pointer to shared state, NULL unless preloaded */
+static ScyllaStatsShared *ScyllaStats = NULL;
+
+/* Entries this backend already looked up */
+static HTAB *LocalStatsHash = NULL;
+
+/* Local function prototypes */
+static void scylla_stats_shmem_request(void);
+static void scylla_stats_shmem_startup(void);
+static ScyllaStatsEntry *get_stats_entry(Oid serverid);
+static ScyllaStatsEntry *find_shared_entry(Oid serverid);
+static double latency_percentile(const int64 *latency, int64 total,
+                                 double fraction);
+
+/*
+ * scylla_shared_stats_install
+ *        Ask for shared memory, if we are being preloaded
+ *
+ * Called from _PG_init.  Loaded any other way, shared statistics are
+ * simply not kept.
+ */
+void
+scylla_shared_stats_install(void)
+{
+    if (!process_shared_preload_libraries_in_progress)
+        return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = scylla_stats_shmem_request;
+#else
+    scylla_stats_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = scylla_stats_shmem_startup;
+}
+
+/*
+ * scylla_stats_shmem_request
+ *        Request the shared memory and LWLock we need
+ */
+static void
+scylla_stats_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+    if (prev_shmem_request_hook)
+        prev_shmem_request_hook();
+#endif
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(ScyllaStatsShared)));
+    RequestNamedLWLockTranche("scylla_fdw", 1);
+}
+
+/*
+ * scylla_stats_shmem_startup
+ *        Allocate or attach to the shared statistics
+ */
+static void
+scylla_stats_shmem_startup(void)
+{
+    bool        found;
+    int         i;
+
+    if (prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    ScyllaStats = ShmemInitStruct("scylla_fdw stats",
+                                  sizeof(ScyllaStatsShared), &found);
+    if (!found)
+    {
+        ScyllaStats->lock = &(GetNamedLWLockTranche("scylla_fdw"))->lock;
+        ScyllaStats->num_entries = 0;
+        for (i = 0; i < SCYLLA_STATS_MAX_SERVERS; i++)
+            SpinLockInit(&ScyllaStats->entries[i].mutex);
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * scylla_shared_stats_active
+ *        Are shared statistics kept?
+ */
+bool
+scylla_shared_stats_active(void)
+{
+    return ScyllaStats != NULL;
+}
+
+/*
+ * scylla_latency_bucket
+ *        Histogram bucket of a request latency
+ *
+ * Bucket 0 holds latencies under 1us, bucket i those from 2^(i-1) up to
+ * 2^i us, and the last bucket everything longer.
+ */
+int
+scylla_latency_bucket(double ms)
+{
+    uint64      us = (uint64) (ms * 1000.0);
+    int         bucket;
+
+    if (us == 0)
+        return 0;
+
+    bucket = pg_leftmost_one_pos64(us) + 1;
+
+    return Min(bucket, SCYLLA_LATENCY_BUCKETS - 1);
+}
+
+/*
+ * scylla_shared_stats_report
+ *        Add what a finished scan or modification did to shared statistics
+ */
+void
+scylla_shared_stats_report(ScyllaRemoteStats *stats)
+{
+    ScyllaStatsEntry *entry;
+    ScyllaStatsCounters *c;
+    int         i;
+
+    if (!stats->shared || stats->requests == 0)
+        return;
+
+    entry = get_stats_entry(stats->serverid);
+    if (entry == NULL)
+        return;
+
+    SpinLockAcquire(&entry->mutex);
+    c = &entry->counters;
+    c->requests += stats->requests;
+    c->rows += stats->rows;
+    c->bytes += stats->bytes;
+    c->total_time += stats->total_time;
+    for (i = 0; i < SCYLLA_LATENCY_BUCKETS; i++)
+        c->latency[i] += stats->latency[i];
+    SpinLockRelease(&entry->mutex);
+}
+
+/*
+ * scylla_shared_stats_count
+ *        Count an event in shared statistics
+ */
+void
+scylla_shared_stats_count(Oid serverid, ScyllaStatsEvent event)
+{
+    ScyllaStatsEntry *entry = get_stats_entry(serverid);
+    ScyllaStatsCounters *c;
+
+    if (entry == NULL)
+        return;
+
+    SpinLockAcquire(&entry->mutex);
+    c = &entry->counters;
+    switch (event)
+    {
+        case SCYLLA_STATS_CONNECT:
+            c->connects++;
+            c->sessions++;
+            break;
+        case SCYLLA_STATS_PREPARED_HIT:
+            c->prepared_hits++;
+            break;
+        case SCYLLA_STATS_PREPARED_MISS:
+            c->prepared_misses++;
+            break;
+        case SCYLLA_STATS_ERROR:
+            c->errors++;
+            break;
+    }
+    SpinLockRelease(&entry->mutex);
+}
+
+/*
+ * scylla_shared_stats_session
+ *        Publish how the driver metrics of a session changed
+ *
+ * published holds what the session reported last time and is updated.
+ */
+void
+scylla_shared_stats_session(Oid serverid, void *conn,
+                            ScyllaSessionMetrics *published)
+{
+    ScyllaStatsEntry *entry;
+    ScyllaStatsCounters *c;
+    int64_t     connections;
+    int64_t     request_timeouts;
+    int64_t     connection_timeouts;
+    int64_t     pending_request_timeouts;
+
+    if (ScyllaStats == NULL || conn == NULL)
+        return;
+
+    entry = get_stats_entry(serverid);
+    if (entry == NULL)
+        return;
+
+    scylla_session_metrics(conn, &connections, &request_timeouts,
+                           &connection_timeouts, &pending_request_timeouts);
+
+    SpinLockAcquire(&entry->mutex);
+    c = &entry->counters;
+    c->connections += connections - published->connections;
+    c->request_timeouts += request_timeouts - published->request_timeouts;
+    c->connection_timeouts += connection_timeouts - published->connection_timeouts;
+    c->pending_request_timeouts +=
+        pending_request_timeouts - published->pending_request_timeouts;
+    SpinLockRelease(&entry->mutex);
+
+    published->connections = connections;
+    published->request_timeouts = request_timeouts;
+    published->connection_timeouts = connection_timeouts;
+    published->pending_request_timeouts = pending_request_timeouts;
+}
+
+/*
+ * scylla_shared_stats_disconnect
+ *        Publish the last metrics of a session that is about to be closed
+ *
+ * This may run at backend exit, so it must not need more than the entry's
+ * spinlock; the entry was looked up when the session was opened.
+ */
+void
+scylla_shared_stats_disconnect(Oid serverid, void *conn,
+                               ScyllaSessionMetrics *published)
+{
+    ScyllaStatsEntry *entry;
+
+    if (ScyllaStats == NULL)
+        return;
+
+    scylla_shared_stats_session(serverid, conn, published);
+
+    entry = get_stats_entry(serverid);
+    if (entry == NULL)
+        return;
+
+    SpinLockAcquire(&entry->mutex);
+    entry->counters.connections -= published->connections;
+    entry->counters.sessions--;
+    SpinLockRelease(&entry->mutex);
+
+    memset(published, 0, sizeof(ScyllaSessionMetrics));
+}
+
+/*
+ * get_stats_entry
+ *        Find or create the shared entry of a server in this database
+ *
+ * Returns NULL if shared statistics are not kept or the table is full.
+ */
+static ScyllaStatsEntry *
+get_stats_entry(Oid serverid)
+{
+    ScyllaStatsLocalEntry *local;
+    ScyllaStatsEntry *entry;
+    bool        found;
+
+    if (ScyllaStats == NULL)
+        return NULL;
+
+    if (LocalStatsHash == NULL)
+    {
+        HASHCTL     ctl;
+
+        ctl.keysize = sizeof(Oid);
+        ctl.entrysize = sizeof(ScyllaStatsLocalEntry);
+        ctl.hcxt = TopMemoryContext;
+        LocalStatsHash = hash_create("scylla_fdw stats entries", 8, &ctl,
+                                     HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
+
+    local = (ScyllaStatsLocalEntry *) hash_search(LocalStatsHash, &serverid,
+                                                  HASH_FIND, NULL);
+    if (local != NULL)
+        return local->entry;
+
+    /* LWLocks can no longer be taken once we are exiting */
+    if (proc_exit_inprogress)
+        return NULL;
+
+    LWLockAcquire(ScyllaStats->lock, LW_SHARED);
+    entry = find_shared_entry(serverid);
+    LWLockRelease(ScyllaStats->lock);
+
+    if (entry == NULL)
+    {
+        LWLockAcquire(ScyllaStats->lock, LW_EXCLUSIVE);
+        entry = find_shared_entry(serverid);
+        if (entry == NULL &&
+            ScyllaStats->num_entries < SCYLLA_STATS_MAX_SERVERS)
+        {
+            entry = &ScyllaStats->entries[ScyllaStats->num_entries];
+            entry->dbid = MyDatabaseId;
+            entry->serverid = serverid;
+            entry->since = GetCurrentTimestamp();
+            memset(&entry->counters, 0, sizeof(ScyllaStatsCounters));
+            ScyllaStats->num_entries++;
+        }
+        LWLockRelease(ScyllaStats->lock);
+    }
+
+    if (entry == NULL)
+    {
+        elog(DEBUG1, "scylla_fdw: no room for statistics of server %u",
+             serverid);
+        return NULL;
+    }
+
+    local = (ScyllaStatsLocalEntry *) hash_search(LocalStatsHash, &serverid,
+                                                  HASH_ENTER, &found);
+    local->entry = entry;
+
+    return entry;
+}
+
+/*
+ * find_shared_entry
+ *        Look up the shared entry of a server; caller holds the LWLock
+ */
+static ScyllaStatsEntry *
+find_shared_entry(Oid serverid)
+{
+    int         i;
+
+    for (i = 0; i < ScyllaStats->num_entries; i++)
+    {
+        ScyllaStatsEntry *entry = &ScyllaStats->entries[i];
+
+        if (entry->dbid == MyDatabaseId && entry->serverid == serverid)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * latency_percentile
+ *        Estimate a latency percentile, in ms, from the histogram
+ */
+static double
+latency_percentile(const int64 *latency, int64 total, double fraction)
+{
+    double      rank = fraction * total;
+    int64       seen = 0;
+    int         i;
+
+    for (i = 0; i < SCYLLA_LATENCY_BUCKETS; i++)
+    {
+        double      lower;
+        double      upper;
+
+        if (latency[i] == 0 || seen + latency[i] < rank)
+        {
+            seen += latency[i];
+            continue;
+        }
+
+        lower = (i == 0) ? 0.0 : (double) ((uint64) 1 << (i - 1));
+        upper = (double) ((uint64) 1 << i);
+
+        return (lower + (upper - lower) * (rank - seen) / latency[i]) / 1000.0;
+    }
+
+    return 0.0;
+}
+
+/*
+ * scylla_fdw_stats
+ *        Return the shared statistics, one row per database and server
+ */
+Datum
+scylla_fdw_stats(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc   tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    TimestampTz now = GetCurrentTimestamp();
+    int         i;
+
+    if (ScyllaStats == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("scylla_fdw must be loaded via \"shared_preload_libraries\" to keep statistics")));
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not allowed in this context")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    LWLockAcquire(ScyllaStats->lock, LW_SHARED);
+
+    for (i = 0; i < ScyllaStats->num_entries; i++)
+    {
+        ScyllaStatsEntry *entry = &ScyllaStats->entries[i];
+        ScyllaStatsCounters c;
+        Datum       values[SCYLLA_STATS_COLS];
+        bool        nulls[SCYLLA_STATS_COLS];
+        double      seconds;
+        int64       timed;
+        int         b;
+        int         col = 0;
+
+        SpinLockAcquire(&entry->mutex);
+        c = entry->counters;
+        SpinLockRelease(&entry->mutex);
+
+        memset(nulls, 0, sizeof(nulls));
+
+        seconds = (double) (now - entry->since) / USECS_PER_SEC;
+
+        values[col++] = ObjectIdGetDatum(entry->dbid);
+        values[col++] = ObjectIdGetDatum(entry->serverid);
+        values[col++] = TimestampTzGetDatum(entry->since);
+        values[col++] = Int64GetDatum(c.sessions);
+        values[col++] = Int64GetDatum(c.connections);
+        values[col++] = Int64GetDatum(c.connects);
+        values[col++] = Int64GetDatum(c.prepared_hits);
+        values[col++] = Int64GetDatum(c.prepared_misses);
+        values[col++] = Int64GetDatum(c.requests);
+        values[col++] = Int64GetDatum(c.errors);
+        values[col++] = Float8GetDatum(seconds > 0 ? c.requests / seconds : 0);
+
+        /* Only requests whose send time is known have a latency */
+        timed = 0;
+        for (b = 0; b < SCYLLA_LATENCY_BUCKETS; b++)
+            timed += c.latency[b];
+
+        if (timed > 0)
+        {
+            values[col++] = Float8GetDatum(c.total_time / timed);
+            values[col++] = Float8GetDatum(latency_percentile(c.latency, timed, 0.50));
+            values[col++] = Float8GetDatum(latency_percentile(c.latency, timed, 0.95));
+            values[col++] = Float8GetDatum(latency_percentile(c.latency, timed, 0.99));
+            values[col++] = Float8GetDatum(latency_percentile(c.latency, timed, 0.999));
+        }
+        else
+        {
+            for (b = 0; b < 5; b++)
+                nulls[col++] = true;
+        }
+
+        values[col++] = Int64GetDatum(c.request_timeouts);
+        values[col++] = Int64GetDatum(c.connection_timeouts);
+        values[col++] = Int64GetDatum(c.pending_request_timeouts);
+        values[col++] = Int64GetDatum(c.rows);
+        values[col++] = Int64GetDatum(c.bytes);
+        values[col++] = Float8GetDatum(c.total_time);
+
+        Assert(col == SCYLLA_STATS_COLS);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    LWLockRelease(ScyllaStats->lock);
+
+    return (Datum) 0;
+}
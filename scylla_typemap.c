@@ -64,263 +64,475 @@
 /* USECS_PER_SEC is already defined in PostgreSQL headers */
 
 /*
- * scylla_convert_to_pg
- *        Convert a ScyllaDB value to a PostgreSQL Datum
+ * Decoders used by a scan's decode plan
+ *
+ * Each one converts a single CQL value, whose type scylla_get_decoder has
+ * already matched against the column's PostgreSQL type, and returns false
+ * for NULL.
+ */
+
+#define DEFINE_SCALAR_DECODER(name, getter, ctype, todatum) \
+static bool \
+name(void *value, int32 typmod, Datum *result) \
+{ \
+    ctype       v; \
+    \
+    if (!getter(value, &v)) \
+        return false; \
+    *result = todatum(v); \
+    return true; \
+}
+
+DEFINE_SCALAR_DECODER(decode_bool, scylla_value_get_bool, bool, BoolGetDatum)
+DEFINE_SCALAR_DECODER(decode_int2_from_tinyint, scylla_value_get_int8, int8_t, Int16GetDatum)
+DEFINE_SCALAR_DECODER(decode_int2_from_smallint, scylla_value_get_int16, int16_t, Int16GetDatum)
+DEFINE_SCALAR_DECODER(decode_int4_from_tinyint, scylla_value_get_int8, int8_t, Int32GetDatum)
+DEFINE_SCALAR_DECODER(decode_int4_from_smallint, scylla_value_get_int16, int16_t, Int32GetDatum)
+DEFINE_SCALAR_DECODER(decode_int4_from_int, scylla_value_get_int32, int32_t, Int32GetDatum)
+DEFINE_SCALAR_DECODER(decode_int8_from_tinyint, scylla_value_get_int8, int8_t, Int64GetDatum)
+DEFINE_SCALAR_DECODER(decode_int8_from_smallint, scylla_value_get_int16, int16_t, Int64GetDatum)
+DEFINE_SCALAR_DECODER(decode_int8_from_int, scylla_value_get_int32, int32_t, Int64GetDatum)
+DEFINE_SCALAR_DECODER(decode_int8_from_bigint, scylla_value_get_int64, int64_t, Int64GetDatum)
+DEFINE_SCALAR_DECODER(decode_float4_from_float, scylla_value_get_float, float, Float4GetDatum)
+DEFINE_SCALAR_DECODER(decode_float8_from_float, scylla_value_get_float, float, Float8GetDatum)
+DEFINE_SCALAR_DECODER(decode_float8_from_double, scylla_value_get_double, double, Float8GetDatum)
+
+/*
+ * varint_to_numeric
+ *        Convert a big-endian two's complement varint, scaled by 10^-scale,
+ *        straight to Numeric without going through its decimal text
  */
-Datum
-scylla_convert_to_pg(void *iterator, int col, Oid pg_type,
-                     int32 typmod, bool *is_null)
+static Numeric
+varint_to_numeric(const unsigned char *varint, size_t len, int32 scale)
 {
-    Datum       result = (Datum) 0;
+    bool        negative = (len > 0 && (varint[0] & 0x80) != 0);
+    Numeric     result;
+    size_t      i;
 
-    switch (pg_type)
+    /* Common case: the unscaled value fits in an int64 */
+    if (len <= sizeof(int64))
     {
-        case BOOLOID:
+        uint64      v = negative ? ~UINT64CONST(0) : 0;
+
+        for (i = 0; i < len; i++)
+            v = (v << 8) | varint[i];
+        return int64_div_fast_to_numeric((int64) v, scale);
+    }
+
+    /*
+     * Otherwise take the magnitude and accumulate it 32 bits at a time,
+     * most significant chunk first.
+     */
+    {
+        unsigned char *mag = (unsigned char *) palloc(len);
+        Datum       radix = NumericGetDatum(int64_to_numeric(INT64CONST(1) << 32));
+        uint64      chunk = 0;
+        size_t      first = len % 4 ? len % 4 : 4;
+
+        memcpy(mag, varint, len);
+        if (negative)
+        {
+            int         carry = 1;
+
+            for (i = len; i-- > 0;)
             {
-                bool value = scylla_get_bool(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = BoolGetDatum(value);
+                int         b = (unsigned char) ~mag[i] + carry;
+
+                mag[i] = (unsigned char) b;
+                carry = b >> 8;
             }
+        }
+
+        for (i = 0; i < first; i++)
+            chunk = (chunk << 8) | mag[i];
+        result = int64_to_numeric((int64) chunk);
+
+        while (i < len)
+        {
+            chunk = ((uint64) mag[i] << 24) | ((uint64) mag[i + 1] << 16) |
+                ((uint64) mag[i + 2] << 8) | mag[i + 3];
+            i += 4;
+            result = DatumGetNumeric(DirectFunctionCall2(numeric_mul,
+                                                         NumericGetDatum(result),
+                                                         radix));
+            result = DatumGetNumeric(DirectFunctionCall2(numeric_add,
+                                                         NumericGetDatum(result),
+                                                         NumericGetDatum(int64_to_numeric((int64) chunk))));
+        }
+
+        if (negative)
+            result = DatumGetNumeric(DirectFunctionCall1(numeric_uminus,
+                                                         NumericGetDatum(result)));
+    }
+
+    /* 10^-scale is exact, so the product keeps every digit */
+    if (scale != 0)
+        result = DatumGetNumeric(DirectFunctionCall2(numeric_mul,
+                                                     NumericGetDatum(result),
+                                                     NumericGetDatum(int64_div_fast_to_numeric(1, scale))));
+    return result;
+}
+
+/* Apply the column's typmod, as numeric_in would have */
+static Datum
+numeric_with_typmod(Numeric num, int32 typmod)
+{
+    if (typmod < 0)
+        return NumericGetDatum(num);
+    return DirectFunctionCall2(numeric, NumericGetDatum(num),
+                               Int32GetDatum(typmod));
+}
+
+static bool
+decode_numeric_from_decimal(void *value, int32 typmod, Datum *result)
+{
+    const unsigned char *varint;
+    size_t      len;
+    int32_t     scale;
+
+    if (!scylla_value_get_decimal(value, &varint, &len, &scale))
+        return false;
+    *result = numeric_with_typmod(varint_to_numeric(varint, len, scale), typmod);
+    return true;
+}
+
+static bool
+decode_numeric_from_varint(void *value, int32 typmod, Datum *result)
+{
+    const unsigned char *varint;
+    size_t      len;
+
+    if (!scylla_value_get_varint(value, &varint, &len))
+        return false;
+    *result = numeric_with_typmod(varint_to_numeric(varint, len, 0), typmod);
+    return true;
+}
+
+static bool
+decode_text(void *value, int32 typmod, Datum *result)
+{
+    size_t      len;
+    const char *str = scylla_value_get_string(value, &len);
+
+    if (str == NULL)
+        return false;
+    *result = PointerGetDatum(cstring_to_text_with_len(str, len));
+    return true;
+}
+
+/*
+ * Non-string CQL types read into a text column get their serialized bytes,
+ * as they always have
+ */
+static bool
+decode_text_from_bytes(void *value, int32 typmod, Datum *result)
+{
+    size_t      len;
+    const char *data = scylla_value_get_bytes(value, &len);
+
+    if (data == NULL)
+        return false;
+    *result = PointerGetDatum(cstring_to_text_with_len(data, len));
+    return true;
+}
+
+static bool
+decode_bytea(void *value, int32 typmod, Datum *result)
+{
+    size_t      len;
+    const char *data = scylla_value_get_bytes(value, &len);
+    bytea      *bytes;
+
+    if (data == NULL)
+        return false;
+    bytes = (bytea *) palloc(VARHDRSZ + len);
+    SET_VARSIZE(bytes, VARHDRSZ + len);
+    memcpy(VARDATA(bytes), data, len);
+    *result = PointerGetDatum(bytes);
+    return true;
+}
+
+static bool
+decode_uuid(void *value, int32 typmod, Datum *result)
+{
+    pg_uuid_t  *uuid = (pg_uuid_t *) palloc(sizeof(pg_uuid_t));
+
+    if (!scylla_value_get_uuid(value, uuid->data))
+    {
+        pfree(uuid);
+        return false;
+    }
+    *result = UUIDPGetDatum(uuid);
+    return true;
+}
+
+static bool
+decode_timestamp(void *value, int32 typmod, Datum *result)
+{
+    /* ScyllaDB timestamp is milliseconds since Unix epoch */
+    int64_t     ms;
+    int64       usec;
+
+    if (!scylla_value_get_int64(value, &ms))
+        return false;
+
+    /*
+     * Convert to PostgreSQL timestamp (microseconds since 2000-01-01).
+     * ScyllaDB stores UTC, so the same value serves timestamptz.
+     */
+    usec = ms * 1000LL;
+    usec -= ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
+    *result = TimestampGetDatum(usec);
+    return true;
+}
+
+static bool
+decode_date(void *value, int32 typmod, Datum *result)
+{
+    /* ScyllaDB date is days since 1970-01-01 with center at 2^31 */
+    uint32_t    scylla_date;
+    int32       unix_days;
+
+    if (!scylla_value_get_uint32(value, &scylla_date))
+        return false;
+
+    /* Convert to PostgreSQL date (days since 2000-01-01) */
+    unix_days = (int32) scylla_date - (1 << 31);
+    *result = DateADTGetDatum(unix_days - (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE));
+    return true;
+}
+
+static bool
+decode_time(void *value, int32 typmod, Datum *result)
+{
+    /* ScyllaDB time is nanoseconds since midnight */
+    int64_t     ns;
+
+    if (!scylla_value_get_int64(value, &ns))
+        return false;
+    *result = TimeADTGetDatum(ns / 1000);
+    return true;
+}
+
+static bool
+decode_inet(void *value, int32 typmod, Datum *result)
+{
+    unsigned char addr[16];
+    int         len;
+    inet       *dst;
+
+    if (!scylla_value_get_inet(value, addr, &len))
+        return false;
+
+    dst = (inet *) palloc0(sizeof(inet));
+    ip_family(dst) = (len == 4) ? PGSQL_AF_INET : PGSQL_AF_INET6;
+    ip_bits(dst) = len * 8;
+    memcpy(ip_addr(dst), addr, len);
+    SET_INET_VARSIZE(dst);
+    *result = InetPGetDatum(dst);
+    return true;
+}
+
+/*
+ * scylla_get_decoder
+ *        Pick the decoder that reads a CQL column of cql_type into a column
+ *        of PostgreSQL type pg_type
+ *
+ * Returns NULL if the two types are incompatible.  PostgreSQL types without
+ * a dedicated conversion fall back to text, like text columns themselves.
+ */
+ScyllaDecodeFunc
+scylla_get_decoder(Oid pg_type, int cql_type)
+{
+    switch (pg_type)
+    {
+        case BOOLOID:
+            if (cql_type == CASS_VALUE_TYPE_BOOLEAN)
+                return decode_bool;
             break;
 
         case INT2OID:
-            {
-                int32 value = scylla_get_int32(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = Int16GetDatum((int16) value);
-            }
+            if (cql_type == CASS_VALUE_TYPE_SMALLINT)
+                return decode_int2_from_smallint;
+            if (cql_type == CASS_VALUE_TYPE_TINYINT)
+                return decode_int2_from_tinyint;
             break;
 
         case INT4OID:
-            {
-                int32 value = scylla_get_int32(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = Int32GetDatum(value);
-            }
+            if (cql_type == CASS_VALUE_TYPE_INT)
+                return decode_int4_from_int;
+            if (cql_type == CASS_VALUE_TYPE_SMALLINT)
+                return decode_int4_from_smallint;
+            if (cql_type == CASS_VALUE_TYPE_TINYINT)
+                return decode_int4_from_tinyint;
             break;
 
         case INT8OID:
-            {
-                int64 value = scylla_get_int64(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = Int64GetDatum(value);
-            }
+            if (cql_type == CASS_VALUE_TYPE_BIGINT ||
+                cql_type == CASS_VALUE_TYPE_COUNTER)
+                return decode_int8_from_bigint;
+            if (cql_type == CASS_VALUE_TYPE_INT)
+                return decode_int8_from_int;
+            if (cql_type == CASS_VALUE_TYPE_SMALLINT)
+                return decode_int8_from_smallint;
+            if (cql_type == CASS_VALUE_TYPE_TINYINT)
+                return decode_int8_from_tinyint;
             break;
 
         case FLOAT4OID:
-            {
-                float value = scylla_get_float(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = Float4GetDatum(value);
-            }
+            if (cql_type == CASS_VALUE_TYPE_FLOAT)
+                return decode_float4_from_float;
             break;
 
         case FLOAT8OID:
-            {
-                double value = scylla_get_double(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = Float8GetDatum(value);
-            }
+            if (cql_type == CASS_VALUE_TYPE_DOUBLE)
+                return decode_float8_from_double;
+            if (cql_type == CASS_VALUE_TYPE_FLOAT)
+                return decode_float8_from_float;
             break;
 
         case NUMERICOID:
-            {
-                /* Get decimal from ScyllaDB and convert to PostgreSQL numeric */
-                const char *decimal_str;
-                
-                decimal_str = scylla_get_decimal(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                
-                result = DirectFunctionCall3(numeric_in,
-                                            CStringGetDatum(decimal_str),
-                                            ObjectIdGetDatum(InvalidOid),
-                                            Int32GetDatum(typmod));
-            }
-            break;
-
-        case TEXTOID:
-        case VARCHAROID:
-        case BPCHAROID:
-            {
-                size_t len;
-                const char *str = scylla_get_string(iterator, col, &len, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = PointerGetDatum(cstring_to_text_with_len(str, len));
-            }
+            if (cql_type == CASS_VALUE_TYPE_DECIMAL)
+                return decode_numeric_from_decimal;
+            if (cql_type == CASS_VALUE_TYPE_VARINT)
+                return decode_numeric_from_varint;
             break;
 
         case BYTEAOID:
-            {
-                size_t len;
-                const char *data;
-                bytea *bytes;
-                
-                data = scylla_get_bytes(iterator, col, &len, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                
-                bytes = (bytea *) palloc(VARHDRSZ + len);
-                SET_VARSIZE(bytes, VARHDRSZ + len);
-                memcpy(VARDATA(bytes), data, len);
-                result = PointerGetDatum(bytes);
-            }
-            break;
+            return decode_bytea;
 
         case UUIDOID:
-            {
-                const char *uuid_str = scylla_get_uuid(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = DirectFunctionCall1(uuid_in, CStringGetDatum(uuid_str));
-            }
+            if (cql_type == CASS_VALUE_TYPE_UUID ||
+                cql_type == CASS_VALUE_TYPE_TIMEUUID)
+                return decode_uuid;
             break;
 
         case TIMESTAMPOID:
-            {
-                /* ScyllaDB timestamp is milliseconds since Unix epoch */
-                int64 ms;
-                int64 usec;
-                
-                ms = scylla_get_timestamp(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                
-                /* Convert to PostgreSQL timestamp (microseconds since 2000-01-01) */
-                usec = ms * 1000LL;
-                /* Adjust from Unix epoch to PostgreSQL epoch */
-                usec -= ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
-                result = TimestampGetDatum(usec);
-            }
-            break;
-
         case TIMESTAMPTZOID:
-            {
-                /* Same as TIMESTAMP but ScyllaDB stores in UTC */
-                int64 ms;
-                int64 usec;
-                
-                ms = scylla_get_timestamp(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                
-                usec = ms * 1000LL;
-                usec -= ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
-                result = TimestampTzGetDatum(usec);
-            }
+            if (cql_type == CASS_VALUE_TYPE_TIMESTAMP)
+                return decode_timestamp;
             break;
 
         case DATEOID:
-            {
-                /* ScyllaDB date is days since 1970-01-01 with center at 2^31 */
-                int32 scylla_date;
-                int32 unix_days;
-                int32 pg_date;
-                
-                scylla_date = scylla_get_date(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                
-                /* Convert to PostgreSQL date (days since 2000-01-01) */
-                /* ScyllaDB date: 2^31 = 1970-01-01, so actual days = value - 2^31 */
-                unix_days = scylla_date - (1 << 31);
-                pg_date = unix_days - (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
-                result = DateADTGetDatum(pg_date);
-            }
+            if (cql_type == CASS_VALUE_TYPE_DATE)
+                return decode_date;
             break;
 
         case TIMEOID:
-            {
-                /* ScyllaDB time is nanoseconds since midnight */
-                int64 ns;
-                int64 usec;
-                
-                ns = scylla_get_time(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                
-                /* Convert to PostgreSQL time (microseconds since midnight) */
-                usec = ns / 1000;
-                result = TimeADTGetDatum(usec);
-            }
+            if (cql_type == CASS_VALUE_TYPE_TIME)
+                return decode_time;
             break;
 
         case INETOID:
-            {
-                const char *inet_str = scylla_get_inet(iterator, col, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = DirectFunctionCall1(inet_in, CStringGetDatum(inet_str));
-            }
+            if (cql_type == CASS_VALUE_TYPE_INET)
+                return decode_inet;
             break;
 
         default:
-            /* Fall back to text conversion */
-            {
-                size_t len;
-                const char *str = scylla_get_string(iterator, col, &len, is_null);
-                if (*is_null)
-                    return (Datum) 0;
-                result = PointerGetDatum(cstring_to_text_with_len(str, len));
-            }
-            break;
+            if (cql_type == CASS_VALUE_TYPE_ASCII ||
+                cql_type == CASS_VALUE_TYPE_TEXT ||
+                cql_type == CASS_VALUE_TYPE_VARCHAR)
+                return decode_text;
+            return decode_text_from_bytes;
     }
 
-    return result;
+    return NULL;
+}
+
+/*
+ * scylla_cql_type_name
+ *        Name of a CassValueType, for error messages
+ */
+const char *
+scylla_cql_type_name(int cql_type)
+{
+    switch (cql_type)
+    {
+        case CASS_VALUE_TYPE_CUSTOM:    return "custom";
+        case CASS_VALUE_TYPE_ASCII:     return "ascii";
+        case CASS_VALUE_TYPE_BIGINT:    return "bigint";
+        case CASS_VALUE_TYPE_BLOB:      return "blob";
+        case CASS_VALUE_TYPE_BOOLEAN:   return "boolean";
+        case CASS_VALUE_TYPE_COUNTER:   return "counter";
+        case CASS_VALUE_TYPE_DECIMAL:   return "decimal";
+        case CASS_VALUE_TYPE_DOUBLE:    return "double";
+        case CASS_VALUE_TYPE_FLOAT:     return "float";
+        case CASS_VALUE_TYPE_INT:       return "int";
+        case CASS_VALUE_TYPE_TEXT:      return "text";
+        case CASS_VALUE_TYPE_TIMESTAMP: return "timestamp";
+        case CASS_VALUE_TYPE_UUID:      return "uuid";
+        case CASS_VALUE_TYPE_VARCHAR:   return "varchar";
+        case CASS_VALUE_TYPE_VARINT:    return "varint";
+        case CASS_VALUE_TYPE_TIMEUUID:  return "timeuuid";
+        case CASS_VALUE_TYPE_INET:      return "inet";
+        case CASS_VALUE_TYPE_DATE:      return "date";
+        case CASS_VALUE_TYPE_TIME:      return "time";
+        case CASS_VALUE_TYPE_SMALLINT:  return "smallint";
+        case CASS_VALUE_TYPE_TINYINT:   return "tinyint";
+        case CASS_VALUE_TYPE_DURATION:  return "duration";
+        case CASS_VALUE_TYPE_LIST:      return "list";
+        case CASS_VALUE_TYPE_MAP:       return "map";
+        case CASS_VALUE_TYPE_SET:       return "set";
+        case CASS_VALUE_TYPE_UDT:       return "udt";
+        case CASS_VALUE_TYPE_TUPLE:     return "tuple";
+        default:                        return "unknown";
+    }
 }
 
 /*
  * scylla_convert_from_pg
  *        Convert a PostgreSQL Datum to ScyllaDB format and bind to statement
+ *
+ * The driver checks each value against the type of its marker; one it
+ * rejects would leave the marker unset, so that is an error here.
  */
 void
 scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
                        int index, bool is_null)
 {
+    bool        ok = false;
+
     if (is_null)
     {
-        scylla_bind_null(statement, index);
+        if (!scylla_bind_null(statement, index))
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_ERROR),
+                     errmsg("could not bind NULL to ScyllaDB parameter %d",
+                            index + 1)));
         return;
     }
 
     switch (pg_type)
     {
         case BOOLOID:
-            scylla_bind_bool(statement, index, DatumGetBool(value));
+            ok = scylla_bind_bool(statement, index, DatumGetBool(value));
             break;
 
         case INT2OID:
-            scylla_bind_int32(statement, index, DatumGetInt16(value));
+            ok = scylla_bind_int16(statement, index, DatumGetInt16(value));
             break;
 
         case INT4OID:
-            scylla_bind_int32(statement, index, DatumGetInt32(value));
+            ok = scylla_bind_int32(statement, index, DatumGetInt32(value));
             break;
 
         case INT8OID:
-            scylla_bind_int64(statement, index, DatumGetInt64(value));
+            ok = scylla_bind_int64(statement, index, DatumGetInt64(value));
             break;
 
         case FLOAT4OID:
-            scylla_bind_float(statement, index, DatumGetFloat4(value));
+            ok = scylla_bind_float(statement, index, DatumGetFloat4(value));
             break;
 
         case FLOAT8OID:
-            scylla_bind_double(statement, index, DatumGetFloat8(value));
+            ok = scylla_bind_double(statement, index, DatumGetFloat8(value));
             break;
 
         case NUMERICOID:
             {
                 /* Convert numeric to string for ScyllaDB decimal type */
                 char *str = DatumGetCString(DirectFunctionCall1(numeric_out, value));
-                scylla_bind_decimal(statement, index, str);
+                ok = scylla_bind_decimal(statement, index, str);
                 pfree(str);
             }
             break;
@@ -330,7 +542,7 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
         case BPCHAROID:
             {
                 text *txt = DatumGetTextPP(value);
-                scylla_bind_string(statement, index,
+                ok = scylla_bind_string(statement, index,
                                    VARDATA_ANY(txt),
                                    VARSIZE_ANY_EXHDR(txt));
             }
@@ -339,7 +551,7 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
         case BYTEAOID:
             {
                 bytea *bytes = DatumGetByteaPP(value);
-                scylla_bind_bytes(statement, index,
+                ok = scylla_bind_bytes(statement, index,
                                   VARDATA_ANY(bytes),
                                   VARSIZE_ANY_EXHDR(bytes));
             }
@@ -348,7 +560,7 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
         case UUIDOID:
             {
                 char *uuid_str = DatumGetCString(DirectFunctionCall1(uuid_out, value));
-                scylla_bind_uuid(statement, index, uuid_str);
+                ok = scylla_bind_uuid(statement, index, uuid_str);
                 pfree(uuid_str);
             }
             break;
@@ -360,7 +572,7 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
                 /* Add PostgreSQL to Unix epoch offset */
                 int64 usec = ts + ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
                 int64 ms = usec / 1000;
-                scylla_bind_timestamp(statement, index, ms);
+                ok = scylla_bind_timestamp(statement, index, ms);
             }
             break;
 
@@ -369,7 +581,7 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
                 TimestampTz ts = DatumGetTimestampTz(value);
                 int64 usec = ts + ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
                 int64 ms = usec / 1000;
-                scylla_bind_timestamp(statement, index, ms);
+                ok = scylla_bind_timestamp(statement, index, ms);
             }
             break;
 
@@ -379,7 +591,7 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
                 /* Convert to ScyllaDB date format (uint32 with 2^31 as epoch) */
                 int32 unix_days = pg_date + (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE);
                 uint32_t scylla_date = (uint32_t)(unix_days + (1 << 31));
-                scylla_bind_uint32(statement, index, scylla_date);
+                ok = scylla_bind_uint32(statement, index, scylla_date);
             }
             break;
 
@@ -388,15 +600,21 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
                 TimeADT pg_time = DatumGetTimeADT(value);
                 /* Convert microseconds to nanoseconds */
                 int64 ns = pg_time * 1000;
-                scylla_bind_int64(statement, index, ns);
+                ok = scylla_bind_int64(statement, index, ns);
             }
             break;
 
         case INETOID:
             {
-                char *inet_str = DatumGetCString(DirectFunctionCall1(inet_out, value));
-                scylla_bind_string(statement, index, inet_str, strlen(inet_str));
-                pfree(inet_str);
+                inet       *ip = DatumGetInetPP(value);
+
+                /* CQL inet holds an address, without a netmask */
+                if (ip_bits(ip) != ip_maxbits(ip))
+                    ereport(ERROR,
+                            (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+                             errmsg("cannot send inet value with a netmask to ScyllaDB")));
+                ok = scylla_bind_inet(statement, index, ip_addr(ip),
+                                      ip_addrsize(ip));
             }
             break;
 
@@ -409,11 +627,49 @@ scylla_convert_from_pg(Datum value, Oid pg_type, void *statement,
 
                 getTypeOutputInfo(pg_type, &typoutput, &typIsVarlena);
                 str = OidOutputFunctionCall(typoutput, value);
-                scylla_bind_string(statement, index, str, strlen(str));
+                ok = scylla_bind_string(statement, index, str, strlen(str));
                 pfree(str);
             }
             break;
     }
+    if (!ok)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_ERROR),
+                 errmsg("could not bind a value of type %s to ScyllaDB parameter %d",
+                        format_type_be(pg_type), index + 1)));
+}
+
+/*
+ * scylla_is_bindable_type
+ *        Check if values of a type can be sent as bind markers
+ *
+ * These are the types scylla_convert_from_pg binds in the binary form of
+ * the CQL type they map to.  The others are inlined as CQL literals,
+ * which ScyllaDB coerces to the column's type, and so are comparisons
+ * with parameters of those types never pushed down.
+ */
+bool
+scylla_is_bindable_type(Oid pg_type)
+{
+    switch (pg_type)
+    {
+        case BOOLOID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case TEXTOID:
+        case VARCHAROID:
+        case BYTEAOID:
+        case UUIDOID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+        case DATEOID:
+        case TIMEOID:
+            return true;
+        default:
+            return false;
+    }
 }
 
 /*
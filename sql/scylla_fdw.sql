@@ -0,0 +1,88 @@
+--
+-- scylla_fdw regression tests
+--
+-- Nothing here connects to ScyllaDB: planning only does with
+-- use_remote_estimate, and EXPLAIN without ANALYZE runs no scan.
+--
+CREATE EXTENSION scylla_fdw;
+SELECT extversion FROM pg_extension WHERE extname = 'scylla_fdw';
+SELECT scylla_fdw_version();
+-- ===================================================================
+-- Option validation
+-- ===================================================================
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (port '70000');
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (fetch_size '0');
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (rescan_cache_size '-1');
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (consistency 'bogus');
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (serial_consistency 'quorum');
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (direct_modify_if_exists 'maybe');
+CREATE SERVER bad_srv FOREIGN DATA WRAPPER scylla_fdw OPTIONS (keyspace 'ks');
+CREATE SERVER scylla_srv FOREIGN DATA WRAPPER scylla_fdw
+    OPTIONS (host '127.0.0.1', port '9042', consistency 'local_quorum');
+CREATE USER MAPPING FOR CURRENT_USER SERVER scylla_srv OPTIONS (nosuch 'x');
+CREATE USER MAPPING FOR CURRENT_USER SERVER scylla_srv;
+CREATE FOREIGN TABLE ft (
+    id int,
+    ts int,
+    seq int,
+    val text,
+    score float8
+) SERVER scylla_srv
+OPTIONS (keyspace 'ks', table 'ft', primary_key 'id', clustering_key 'ts, seq');
+ALTER FOREIGN TABLE ft OPTIONS (ADD lookup_concurrency 'many');
+ALTER FOREIGN TABLE ft OPTIONS (ADD host 'localhost');
+-- scylla_token() only means something to ScyllaDB
+SELECT scylla_token(1);
+-- Keep plans free of Gather nodes
+SET max_parallel_workers_per_gather = 0;
+-- ===================================================================
+-- WHERE pushdown
+-- ===================================================================
+-- IN list on the partition key, inlined
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT id, val FROM ft WHERE id IN (1, 2, 3);
+-- ... or split into single-key lookups
+ALTER FOREIGN TABLE ft OPTIONS (ADD lookup_concurrency '4');
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT id, val FROM ft WHERE id IN (1, 2, 3);
+ALTER FOREIGN TABLE ft OPTIONS (DROP lookup_concurrency);
+-- Token range
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT id FROM ft WHERE scylla_token(id) > 0 AND scylla_token(id) <= 100;
+-- Multi-column slice on the clustering key
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT id, ts, seq FROM ft WHERE id = 1 AND (ts, seq) > (10, 20);
+-- ===================================================================
+-- ORDER BY and LIMIT
+-- ===================================================================
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT id, ts, seq FROM ft WHERE id = 1 ORDER BY ts DESC, seq DESC LIMIT 5;
+-- ===================================================================
+-- Aggregates
+-- ===================================================================
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT count(*), sum(score), max(ts) FROM ft WHERE id = 1;
+-- ===================================================================
+-- Direct modification
+-- ===================================================================
+-- Conditions on regular columns become the IF of a lightweight transaction
+EXPLAIN (VERBOSE, COSTS OFF)
+UPDATE ft SET val = 'new' WHERE id = 1 AND ts = 2 AND seq = 3 AND score > 1.5;
+-- Without any, a plain UPDATE or DELETE is sent
+EXPLAIN (VERBOSE, COSTS OFF)
+UPDATE ft SET val = 'new' WHERE id = 1 AND ts = 2 AND seq = 3;
+EXPLAIN (VERBOSE, COSTS OFF)
+DELETE FROM ft WHERE id = 1 AND ts = 2 AND seq = 3;
+-- ... unless direct_modify_if_exists asks for IF EXISTS
+ALTER FOREIGN TABLE ft OPTIONS (ADD direct_modify_if_exists 'true');
+EXPLAIN (VERBOSE, COSTS OFF)
+DELETE FROM ft WHERE id = 1 AND ts = 2 AND seq = 3;
+ALTER FOREIGN TABLE ft OPTIONS (DROP direct_modify_if_exists);
+-- ===================================================================
+-- Cleanup
+-- ===================================================================
+RESET max_parallel_workers_per_gather;
+DROP FOREIGN TABLE ft;
+DROP USER MAPPING FOR CURRENT_USER SERVER scylla_srv;
+DROP SERVER scylla_srv;
+DROP EXTENSION scylla_fdw;